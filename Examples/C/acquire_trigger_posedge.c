@@ -37,14 +37,9 @@ int main(int argc, char **argv){
 
         sleep(1);
         rp_AcqSetTriggerSrc(RP_TRIG_SRC_CHA_PE);
-        rp_acq_trig_state_t state = RP_TRIG_STATE_TRIGGERED;
 
-        while(1){
-                rp_AcqGetTriggerState(&state);
-                if(state == RP_TRIG_STATE_TRIGGERED){
-                break;
-                }
-        }
+        /* Sleeps until the trigger and the samples after it are in the buffer */
+        rp_AcqWaitBufferFilled(-1);
                 
         rp_AcqGetOldestDataV(RP_CH_1, &buff_size, buff);
         int i;
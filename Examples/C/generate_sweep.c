@@ -0,0 +1,48 @@
+/* Red Pitaya C API example Measuring a frequency response
+ * This application sweeps the output 1 from 100 Hz to 1 MHz and prints the response
+ * of a device connected between input 1 (its input) and input 2 (its output) */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "redpitaya/rp.h"
+
+#define POINTS 31
+
+int main(int argc, char **argv){
+
+	rp_gen_sweep_result_t results[POINTS];
+
+	/* Print error, if rp_Init() function failed */
+	if(rp_Init() != RP_OK){
+		fprintf(stderr, "Rp api init failed!\n");
+	}
+
+	/* Logarithmic range, 0.5 V amplitude, 1 ms for the device to settle at each step */
+	rp_GenSweepSetRange(RP_CH_1, 100.0, 1e6, POINTS, RP_GEN_SWEEP_LOG, 0.5, 1000);
+
+	/* Sweep and measure 10 periods at each step */
+	if(rp_GenSweepRun(10, results) != RP_OK){
+		fprintf(stderr, "Sweep failed!\n");
+		rp_Release();
+		return -1;
+	}
+
+	for(int i = 0; i < POINTS; i++){
+		/* Response is input 2 / input 1 */
+		float re = results[i].ch2_re * results[i].ch1_re + results[i].ch2_im * results[i].ch1_im;
+		float im = results[i].ch2_im * results[i].ch1_re - results[i].ch2_re * results[i].ch1_im;
+		float in = hypotf(results[i].ch1_re, results[i].ch1_im);
+		printf("%12.2f Hz %8.2f dB %8.2f deg\n", results[i].frequency,
+			20 * log10f(hypotf(re, im) / (in * in)), atan2f(im, re) * 180 / M_PI);
+	}
+
+	rp_GenOutDisable(RP_CH_1);
+
+	/* Releasing resources */
+	rp_Release();
+
+	return 0;
+}
@@ -105,6 +105,10 @@ extern "C" {
 #define RP_EMNC   23
 /** Command not supported */
 #define RP_NOTS   24
+/** Timeout */
+#define RP_ETIM   25
+/** Wait canceled */
+#define RP_ECAN   26
 
 #define SPECTR_OUT_SIG_LEN (2*1024)
 
@@ -254,6 +258,24 @@ typedef enum {
     RP_TRIG_STATE_WAITING,   //!< Trigger is set up and waiting (to be triggered)
 } rp_acq_trig_state_t;
 
+/**
+ * Called from a library thread when an asynchronous acquisition wait ends.
+ * @param result Result of the wait, RP_OK, RP_ETIM or RP_ECAN.
+ * @param user_data Pointer given to the wait function.
+ */
+typedef void (*rp_acq_wait_callback_t)(int result, void* user_data);
+
+/**
+ * Segment of a segmented acquisition
+ */
+typedef struct {
+    uint64_t index;         //!< Number of the segment since rp_AcqSegmentedStart(), from 0
+    int64_t  timestamp_ns;  //!< CLOCK_MONOTONIC time of the trigger, taken back from the end of the capture
+    uint32_t trigger_pos;   //!< Write pointer at the trigger
+    int32_t  trigger_index; //!< Index of the trigger sample in the segment, outside the segment with a long trigger delay
+    uint32_t lost;          //!< Segments overwritten in the ring since the previous read
+} rp_acq_segment_t;
+
 
 /**
  * Calibration parameters, stored in the EEPROM device
@@ -274,6 +296,45 @@ typedef struct {
     int32_t  fe_ch2_hi_offs; //!< Front end DC offset, channel B
 } rp_calib_params_t;
 
+/**
+ * Source of the FPGA registers
+ */
+typedef enum {
+    RP_BACKEND_FPGA,    //!< Registers of the FPGA, mapped from /dev/uio/api
+    RP_BACKEND_SIM      //!< Software model of the FPGA, for hosts without Red Pitaya hardware
+} rp_backend_t;
+
+
+/**
+ * Spacing of the frequencies of a sweep range
+ */
+typedef enum {
+    RP_GEN_SWEEP_LIN,   //!< Equal steps in Hz
+    RP_GEN_SWEEP_LOG    //!< Equal ratios of neighbouring frequencies
+} rp_gen_sweep_scale_t;
+
+/**
+ * One step of a generator sweep
+ */
+typedef struct {
+    float    frequency; //!< Sine frequency in Hz
+    float    amplitude; //!< Sine amplitude in V
+    uint32_t dwell_us;  //!< Time the step is held before the acquisition, in microseconds
+} rp_gen_sweep_step_t;
+
+/**
+ * Response of both inputs at one step of a generator sweep. A phasor has the amplitude
+ * in V as its magnitude and the phase of a cosine at the trigger sample as its angle,
+ * so the response of a device from input A to input B is ch2 / ch1.
+ */
+typedef struct {
+    float frequency;    //!< Generated frequency in Hz, the set one rounded to the generator resolution
+    float ch1_re;       //!< Phasor of channel A, real part
+    float ch1_im;       //!< Phasor of channel A, imaginary part
+    float ch2_re;       //!< Phasor of channel B, real part
+    float ch2_im;       //!< Phasor of channel B, imaginary part
+} rp_gen_sweep_result_t;
+
 
 /** @name General
  */
@@ -282,11 +343,43 @@ typedef struct {
 
 /**
  * Initializes the library. It must be called first, before any other library method.
+ * Uses the FPGA registers, or the simulated ones if the environment variable RP_BACKEND is "sim".
  * @return If the function is successful, the return value is RP_OK.
  * If the function is unsuccessful, the return value is any of RP_E* values that indicate an error.
  */
 int rp_Init();
 
+/**
+ * Initializes the library with the given register backend, instead of rp_Init().
+ * The simulated backend models the oscilloscope, generator and housekeeping blocks in software
+ * and uses ideal calibration parameters, so the library runs on any Linux host.
+ * @param backend Source of the FPGA registers.
+ * @return If the function is successful, the return value is RP_OK.
+ * If the function is unsuccessful, the return value is any of RP_E* values that indicate an error.
+ */
+int rp_InitBackend(rp_backend_t backend);
+
+/**
+ * Gives an input of the simulated backend its own waveform. By default an input is the
+ * generator output of the same channel, as if the outputs were cabled to the inputs.
+ * @param channel Channel A or B.
+ * @param type Waveform, all but RP_WAVEFORM_ARBITRARY. PWM has 50 % duty cycle.
+ * @param frequency Frequency in Hz.
+ * @param amplitude Amplitude in V, the input range is +/-1 V.
+ * @param offset DC offset in V.
+ * @return If the function is successful, the return value is RP_OK.
+ * If the function is unsuccessful, the return value is any of RP_E* values that indicate an error.
+ */
+int rp_SimSetInput(rp_channel_t channel, rp_waveform_t type, float frequency, float amplitude, float offset);
+
+/**
+ * Sets an input of the simulated backend back to the generator output of the same channel.
+ * @param channel Channel A or B.
+ * @return If the function is successful, the return value is RP_OK.
+ * If the function is unsuccessful, the return value is any of RP_E* values that indicate an error.
+ */
+int rp_SimSetInputLoopback(rp_channel_t channel);
+
 int rp_CalibInit();
 
 /**
@@ -765,6 +858,51 @@ int rp_AcqGetTriggerSrc(rp_acq_trig_src_t* source);
  */
 int rp_AcqGetTriggerState(rp_acq_trig_state_t* state);
 
+/**
+ * Waits until the trigger has happened, instead of polling rp_AcqGetTriggerState().
+ * The wait polls shortly, then sleeps in steps that grow with the decimation, and wakes
+ * up on the interrupt of the FPGA where the bitstream provides one.
+ * The trigger source has to be set before, with a disabled source the function returns at once.
+ * @param timeout_ns Longest wait in nanoseconds, negative to wait without limit.
+ * @return RP_OK after the trigger, RP_ETIM on timeout, RP_ECAN if rp_AcqWaitCancel() was called.
+ */
+int rp_AcqWaitTrigger(int64_t timeout_ns);
+
+/**
+ * Waits until the trigger has happened and the samples after it (trigger delay) are written,
+ * so the buffer can be read. Most of the time after the trigger is spent in one sleep.
+ * The trigger source has to be set before, with a disabled source the function returns at once.
+ * @param timeout_ns Longest wait in nanoseconds, negative to wait without limit.
+ * @return RP_OK when the buffer is filled, RP_ETIM on timeout, RP_ECAN if rp_AcqWaitCancel() was called.
+ */
+int rp_AcqWaitBufferFilled(int64_t timeout_ns);
+
+/**
+ * rp_AcqWaitTrigger() in a library thread. The function returns at once, callback gets the result.
+ * @param timeout_ns Longest wait in nanoseconds, negative to wait without limit.
+ * @param callback Called when the wait ends.
+ * @param user_data Passed to the callback.
+ * @return If the function is successful, the return value is RP_OK.
+ * If the function is unsuccessful, the return value is any of RP_E* values that indicate an error.
+ */
+int rp_AcqWaitTriggerAsync(int64_t timeout_ns, rp_acq_wait_callback_t callback, void* user_data);
+
+/**
+ * rp_AcqWaitBufferFilled() in a library thread. The function returns at once, callback gets the result.
+ * @param timeout_ns Longest wait in nanoseconds, negative to wait without limit.
+ * @param callback Called when the wait ends.
+ * @param user_data Passed to the callback.
+ * @return If the function is successful, the return value is RP_OK.
+ * If the function is unsuccessful, the return value is any of RP_E* values that indicate an error.
+ */
+int rp_AcqWaitBufferFilledAsync(int64_t timeout_ns, rp_acq_wait_callback_t callback, void* user_data);
+
+/**
+ * Ends all acquisition waits that are in progress with RP_ECAN.
+ * @return If the function is successful, the return value is RP_OK.
+ */
+int rp_AcqWaitCancel();
+
 /**
  * Sets the number of decimated data after trigger written into memory.
  * @param decimated_data_num Number of decimated data. It must not be higher than the ADC buffer size.
@@ -963,6 +1101,19 @@ int rp_AcqGetDataRaw(rp_channel_t channel,  uint32_t pos, uint32_t* size, int16_
  */
 int rp_AcqGetDataRawV2(uint32_t pos, uint32_t* size, uint16_t* buffer, uint16_t* buffer2);
 
+/**
+ * Returns the ADC buffer of one or both channels in raw units with the calibrated DC offset applied,
+ * from specified position and desired size. Gives the same samples as rp_AcqGetDataRaw() in one call.
+ * Output buffers must be at least 'size' long.
+ * @param pos Starting position of the ADC buffer to retrieve.
+ * @param size Length of the ADC buffer to retrieve. Returns length of filled buffer. In case of too small buffer, required size is returned.
+ * @param buffer1 The output buffer for channel 1, NULL to skip the channel.
+ * @param buffer2 The output buffer for channel 2, NULL to skip the channel.
+ * @return If the function is successful, the return value is RP_OK.
+ * If the function is unsuccessful, the return value is any of RP_E* values that indicate an error.
+ */
+int rp_AcqGetDataRawBulk(uint32_t pos, uint32_t* size, int16_t* buffer1, int16_t* buffer2);
+
 /**
  * Returns the ADC buffer in raw units from the oldest sample to the newest one.
  * Output buffer must be at least 'size' long.
@@ -1010,6 +1161,67 @@ int rp_AcqGetDataV(rp_channel_t channel, uint32_t pos, uint32_t* size, float* bu
  */
 int rp_AcqGetDataV2(uint32_t pos, uint32_t* size, float* buffer1, float* buffer2);
 
+/**
+ * Returns the ADC buffer of one or both channels in Volt units from specified position and desired size.
+ * Gives the same samples as rp_AcqGetDataV() in one call, computed in single precision.
+ * Output buffers must be at least 'size' long.
+ * @param pos Starting position of the ADC buffer to retrieve.
+ * @param size Length of the ADC buffer to retrieve. Returns length of filled buffer. In case of too small buffer, required size is returned.
+ * @param buffer1 The output buffer for channel 1, NULL to skip the channel.
+ * @param buffer2 The output buffer for channel 2, NULL to skip the channel.
+ * @return If the function is successful, the return value is RP_OK.
+ * If the function is unsuccessful, the return value is any of RP_E* values that indicate an error.
+ */
+int rp_AcqGetDataVBulk(uint32_t pos, uint32_t* size, float* buffer1, float* buffer2);
+
+/**
+ * Starts a segmented acquisition: a library thread arms the scope, waits for the trigger and keeps
+ * the capture in a ring of segments, again and again until rp_AcqSegmentedStop(). A segment is the
+ * last 'size' samples of both channels in raw units with the calibrated DC offset applied, the trigger
+ * delay decides how many of them are after the trigger. When the ring is full the oldest segment is
+ * overwritten. Decimation, trigger level and delay are set before, the acquisition must not be
+ * changed or read otherwise while the segmented acquisition runs.
+ * @param source Trigger source of every segment.
+ * @param segments Segments the ring holds.
+ * @param size Samples of a segment per channel, up to ADC_BUFFER_SIZE.
+ * @return If the function is successful, the return value is RP_OK.
+ * If the function is unsuccessful, the return value is any of RP_E* values that indicate an error.
+ */
+int rp_AcqSegmentedStart(rp_acq_trig_src_t source, uint32_t segments, uint32_t size);
+
+/**
+ * Takes the oldest segment out of the ring of the segmented acquisition, waits for one if the ring is empty.
+ * Output buffers must be at least 'size' of rp_AcqSegmentedStart() long.
+ * @param timeout_ns Longest wait in nanoseconds, negative to wait without limit.
+ * @param info Position and time of the segment, NULL to skip.
+ * @param buffer1 The output buffer for channel 1, NULL to skip the channel.
+ * @param buffer2 The output buffer for channel 2, NULL to skip the channel.
+ * @return RP_OK with a segment, RP_ETIM on timeout, RP_ECAN if the ring is empty and the acquisition stopped.
+ * If the function is unsuccessful, the return value is any of RP_E* values that indicate an error.
+ */
+int rp_AcqSegmentedRead(int64_t timeout_ns, rp_acq_segment_t* info, int16_t* buffer1, int16_t* buffer2);
+
+/**
+ * Stops the segmented acquisition and frees the ring, segments not read are dropped.
+ * @return If the function is successful, the return value is RP_OK.
+ */
+int rp_AcqSegmentedStop();
+
+/**
+ * Captures a number of triggers and returns the average of the captures of one or both channels
+ * in Volt units. Each capture is added to the sums right out of the ADC buffer. The segment of a
+ * capture is as in rp_AcqSegmentedStart(), so the trigger delay sets the position of the trigger.
+ * @param source Trigger source of every capture.
+ * @param triggers Captures to average.
+ * @param size Samples to average per channel, up to ADC_BUFFER_SIZE.
+ * @param timeout_ns Longest wait for each trigger in nanoseconds, negative to wait without limit.
+ * @param buffer1 The output buffer for channel 1, NULL to skip the channel.
+ * @param buffer2 The output buffer for channel 2, NULL to skip the channel.
+ * @return RP_OK after the last capture, RP_ETIM on timeout, RP_ECAN if rp_AcqWaitCancel() was called.
+ * If the function is unsuccessful, the return value is any of RP_E* values that indicate an error.
+ */
+int rp_AcqAverageTriggers(rp_acq_trig_src_t source, uint32_t triggers, uint32_t size, int64_t timeout_ns, float* buffer1, float* buffer2);
+
 /**
  * Returns the ADC buffer in Volt units from the oldest sample to the newest one.
  * Output buffer must be at least 'size' long.
@@ -1300,6 +1512,60 @@ int rp_GenGetTriggerSource(rp_channel_t channel, rp_trig_src_t *src);
 */
 int rp_GenTrigger(uint32_t channel);
 
+/**
+* Sets the steps of a generator sweep, the steps are copied.
+* @param channel Channel A or B that makes the sine.
+* @param steps Frequency, amplitude and dwell time of each step.
+* @param count Number of steps.
+* @return If the function is successful, the return value is RP_OK.
+* If the function is unsuccessful, the return value is any of RP_E* values that indicate an error.
+*/
+int rp_GenSweepSetSteps(rp_channel_t channel, const rp_gen_sweep_step_t* steps, uint32_t count);
+
+/**
+* Sets the steps of a generator sweep to a range of frequencies with the same amplitude and dwell time.
+* @param channel Channel A or B that makes the sine.
+* @param start_frequency Frequency of the first step in Hz.
+* @param stop_frequency Frequency of the last step in Hz.
+* @param count Number of steps, start and stop included.
+* @param scale Linear or logarithmic spacing.
+* @param amplitude Sine amplitude in V.
+* @param dwell_us Time each step is held before the acquisition, in microseconds.
+* @return If the function is successful, the return value is RP_OK.
+* If the function is unsuccessful, the return value is any of RP_E* values that indicate an error.
+*/
+int rp_GenSweepSetRange(rp_channel_t channel, float start_frequency, float stop_frequency, uint32_t count,
+                        rp_gen_sweep_scale_t scale, float amplitude, uint32_t dwell_us);
+
+/**
+* Gets the number of steps of the generator sweep.
+* @param count Number of steps, 0 if none are set.
+* @return If the function is successful, the return value is RP_OK.
+*/
+int rp_GenSweepGetCount(uint32_t* count);
+
+/**
+* Runs the generator sweep and returns after the last step. The channel is switched to a continuous
+* sine and enabled, it stays at the last step afterwards. Frequencies, decimations and sample counts
+* of all steps are computed before the first one, a step then only writes the frequency and amplitude.
+* With results each step is followed by an acquisition of both inputs, triggered by software after
+* the dwell time: the smallest decimation that holds the periods is used and the phasors of the
+* inputs at the generated frequency are measured over whole periods. The decimation and the trigger
+* delay and source of the acquisition are left as the last step set them.
+* @param periods Periods of the sine recorded at each step, fewer below 1.9 Hz where the buffer is too short.
+* @param results Array of rp_GenSweepGetCount() results, NULL to sweep the generator only.
+* @return RP_OK after the last step, RP_ECAN if rp_GenSweepCancel() was called.
+* If the function is unsuccessful, the return value is any of RP_E* values that indicate an error.
+*/
+int rp_GenSweepRun(uint32_t periods, rp_gen_sweep_result_t* results);
+
+/**
+* Ends a generator sweep in progress with RP_ECAN, from another thread. Acquisition waits in
+* progress end too, as with rp_AcqWaitCancel().
+* @return If the function is successful, the return value is RP_OK.
+*/
+int rp_GenSweepCancel();
+
 /**
 * Sets the DAC protection mode from overheating. Only works with Redpitaya 250-12 otherwise returns RP_NOTS
 * @param channel Channel A or B for witch we want to set protection.
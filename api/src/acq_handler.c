@@ -16,6 +16,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <math.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "common.h"
 #include "calib.h"
@@ -47,6 +49,15 @@ static bool triggerDelayInNs = false;
 
 rp_acq_trig_src_t last_trig_src = RP_TRIG_SRC_DISABLED;
 
+/* @brief Busy polling time of the trigger waits before they start to sleep [ns] */
+static const int64_t WAIT_SPIN_NS = 20000;
+/* @brief Range of the sleep steps of the trigger waits [ns] */
+static const int64_t WAIT_SLEEP_MIN_NS = 10000;
+static const int64_t WAIT_SLEEP_MAX_NS = 1000000;
+
+/* @brief Incremented by acq_WaitCancel(), waits started before return RP_ECAN */
+static volatile uint32_t wait_cancel = 0;
+
 /* @brief Default filter equalization coefficients */
 static const uint32_t GAIN_LO_FILT_AA = 0x7D93;
 static const uint32_t GAIN_LO_FILT_BB = 0x437C7;
@@ -358,6 +369,171 @@ int acq_GetTriggerState(rp_acq_trig_state_t* state)
     return RP_OK;
 }
 
+static int64_t getTimeNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void waitSleep(int64_t time_ns)
+{
+    // The UIO interrupt only ends the sleep early, the condition is checked by the caller
+    if (cmn_WaitInterrupt(time_ns) == RP_OK) {
+        return;
+    }
+    struct timespec ts = { .tv_sec = time_ns / 1000000000, .tv_nsec = time_ns % 1000000000 };
+    nanosleep(&ts, NULL);
+}
+
+/* The trigger source is set back to disabled when the samples after the trigger are written */
+static bool isBufferFilled()
+{
+    uint32_t source;
+    osc_GetTriggerSource(&source);
+    return source == RP_TRIG_SRC_DISABLED;
+}
+
+/* The trigger status bit is only set while the samples after the trigger are written */
+static bool isTriggered()
+{
+    bool triggered;
+    osc_GetTriggerState(&triggered);
+    return triggered || isBufferFilled();
+}
+
+/*
+ * Spins for WAIT_SPIN_NS, then sleeps in steps that double up to a quarter of
+ * the time the FPGA takes to write 1/16 of the buffer, within WAIT_SLEEP_MIN_NS
+ * and WAIT_SLEEP_MAX_NS. expected_ns of the wait are slept right away.
+ */
+static int waitFor(bool (*done)(), int64_t timeout_ns, int64_t expected_ns)
+{
+    uint32_t cancel = wait_cancel;
+    int64_t start = getTimeNs();
+    int64_t deadline = timeout_ns < 0 ? INT64_MAX : start + timeout_ns;
+
+    uint32_t decimation = 1;
+    osc_GetDecimation(&decimation);
+    int64_t max_step = (int64_t)ADC_BUFFER_SIZE / 16 * ADC_SAMPLE_PERIOD * MAX(decimation, 1) / 4;
+    max_step = MIN(MAX(max_step, WAIT_SLEEP_MIN_NS), WAIT_SLEEP_MAX_NS);
+    int64_t step = WAIT_SLEEP_MIN_NS;
+
+    if (expected_ns > WAIT_SPIN_NS && !done()) {
+        waitSleep(MIN(expected_ns - WAIT_SPIN_NS, deadline - start));
+        start = getTimeNs();
+    }
+
+    while (true) {
+        if (done()) {
+            return RP_OK;
+        }
+        if (cancel != wait_cancel) {
+            return RP_ECAN;
+        }
+        int64_t now = getTimeNs();
+        if (now >= deadline) {
+            return RP_ETIM;
+        }
+        if (now - start >= WAIT_SPIN_NS) {
+            waitSleep(MIN(step, deadline - now));
+            step = MIN(step * 2, max_step);
+        }
+    }
+}
+
+int acq_WaitTrigger(int64_t timeout_ns)
+{
+    return waitFor(isTriggered, timeout_ns, 0);
+}
+
+int acq_WaitBufferFilled(int64_t timeout_ns)
+{
+    int64_t start = getTimeNs();
+    int result = waitFor(isTriggered, timeout_ns, 0);
+    if (result != RP_OK) {
+        return result;
+    }
+
+    // Samples after the trigger, the wait sleeps through most of their time
+    uint32_t samples = 0;
+    uint32_t decimation = 1;
+    osc_GetTriggerDelay(&samples);
+    osc_GetDecimation(&decimation);
+    int64_t expected_ns = (int64_t)samples * ADC_SAMPLE_PERIOD * MAX(decimation, 1);
+
+    if (timeout_ns >= 0) {
+        timeout_ns = MAX(timeout_ns - (getTimeNs() - start), 0);
+    }
+    return waitFor(isBufferFilled, timeout_ns, expected_ns);
+}
+
+int acq_WaitCancel()
+{
+    __sync_fetch_and_add(&wait_cancel, 1);
+    return RP_OK;
+}
+
+/* Taken before a wait of its own, the wait is cancelled once the value changes */
+uint32_t acq_GetWaitCancel()
+{
+    return wait_cancel;
+}
+
+typedef struct {
+    int (*wait)(int64_t);
+    int64_t timeout_ns;
+    rp_acq_wait_callback_t callback;
+    void* user_data;
+} wait_task_t;
+
+static void* waitTask(void* arg)
+{
+    wait_task_t task = *(wait_task_t*)arg;
+    free(arg);
+    task.callback(task.wait(task.timeout_ns), task.user_data);
+    return NULL;
+}
+
+static int waitAsync(int (*wait)(int64_t), int64_t timeout_ns, rp_acq_wait_callback_t callback, void* user_data)
+{
+    if (callback == NULL) {
+        return RP_EIPV;
+    }
+
+    // Without memory or a thread the wait is reported as unsupported
+    wait_task_t* task = malloc(sizeof(wait_task_t));
+    if (task == NULL) {
+        return RP_EUF;
+    }
+    task->wait = wait;
+    task->timeout_ns = timeout_ns;
+    task->callback = callback;
+    task->user_data = user_data;
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int result = pthread_create(&thread, &attr, waitTask, task);
+    pthread_attr_destroy(&attr);
+    if (result != 0) {
+        free(task);
+        return RP_EUF;
+    }
+    return RP_OK;
+}
+
+int acq_WaitTriggerAsync(int64_t timeout_ns, rp_acq_wait_callback_t callback, void* user_data)
+{
+    return waitAsync(acq_WaitTrigger, timeout_ns, callback, user_data);
+}
+
+int acq_WaitBufferFilledAsync(int64_t timeout_ns, rp_acq_wait_callback_t callback, void* user_data)
+{
+    return waitAsync(acq_WaitBufferFilled, timeout_ns, callback, user_data);
+}
+
 int acq_SetTriggerDelay(int32_t decimated_data_num, bool updateMaxValue)
 {
     int32_t trig_dly;
@@ -586,30 +762,116 @@ uint32_t acq_GetNormalizedDataPos(uint32_t pos)
     return (pos % ADC_BUFFER_SIZE);
 }
 
-int acq_GetDataRaw(rp_channel_t channel, uint32_t pos, uint32_t* size, int16_t* buffer)
+static void getChannelCalib(rp_channel_t channel, int32_t* dc_offs, float* scale)
+{
+    float gainV;
+    rp_pinState_t gain;
+    acq_GetGainV(channel, &gainV);
+    acq_GetGain(channel, &gain);
+
+    rp_calib_params_t calib = calib_GetParams();
+    *dc_offs = GET_OFFSET(channel, gain, calib);
+    if (scale) {
+        *scale = cmn_CnvCntToVScale(ADC_BITS, gainV, calib_GetFrontEndScale(channel, gain));
+    }
+}
+
+/**
+ * The circular buffer is read in at most two contiguous parts per channel,
+ * without an index modulo per sample.
+ */
+int acq_GetDataRawBulk(uint32_t pos, uint32_t* size, int16_t* buffer1, int16_t* buffer2)
 {
+    if (buffer1 == NULL && buffer2 == NULL) {
+        return RP_EIPV;
+    }
 
     *size = MIN(*size, ADC_BUFFER_SIZE);
+    pos = acq_GetNormalizedDataPos(pos);
+    uint32_t first = MIN(*size, ADC_BUFFER_SIZE - pos);
 
-    uint32_t cnts;
+    int32_t dc_offs;
+    if (buffer1) {
+        const volatile uint32_t* raw_buffer = getRawBuffer(RP_CH_1);
+        getChannelCalib(RP_CH_1, &dc_offs, NULL);
+        cmn_CalibCntsBuffer(ADC_BITS, raw_buffer + pos, first, dc_offs, buffer1);
+        cmn_CalibCntsBuffer(ADC_BITS, raw_buffer, *size - first, dc_offs, buffer1 + first);
+    }
+    if (buffer2) {
+        const volatile uint32_t* raw_buffer = getRawBuffer(RP_CH_2);
+        getChannelCalib(RP_CH_2, &dc_offs, NULL);
+        cmn_CalibCntsBuffer(ADC_BITS, raw_buffer + pos, first, dc_offs, buffer2);
+        cmn_CalibCntsBuffer(ADC_BITS, raw_buffer, *size - first, dc_offs, buffer2 + first);
+    }
 
-    const volatile uint32_t* raw_buffer = getRawBuffer(channel);
+    return RP_OK;
+}
 
-    rp_pinState_t gain;
-    acq_GetGain(channel, &gain);
+int acq_GetDataVBulk(uint32_t pos, uint32_t* size, float* buffer1, float* buffer2)
+{
+    if (buffer1 == NULL && buffer2 == NULL) {
+        return RP_EIPV;
+    }
 
-    rp_calib_params_t calib = calib_GetParams();
-    int32_t dc_offs = GET_OFFSET(channel, gain, calib);
+    *size = MIN(*size, ADC_BUFFER_SIZE);
+    pos = acq_GetNormalizedDataPos(pos);
+    uint32_t first = MIN(*size, ADC_BUFFER_SIZE - pos);
 
-    for (uint32_t i = 0; i < (*size); ++i) {
-        cnts = (raw_buffer[(pos + i) % ADC_BUFFER_SIZE]) & ADC_BITS_MASK;
+    int32_t dc_offs;
+    float scale;
+    if (buffer1) {
+        const volatile uint32_t* raw_buffer = getRawBuffer(RP_CH_1);
+        getChannelCalib(RP_CH_1, &dc_offs, &scale);
+        cmn_CnvCntToVBuffer(ADC_BITS, raw_buffer + pos, first, dc_offs, scale, buffer1);
+        cmn_CnvCntToVBuffer(ADC_BITS, raw_buffer, *size - first, dc_offs, scale, buffer1 + first);
+    }
+    if (buffer2) {
+        const volatile uint32_t* raw_buffer = getRawBuffer(RP_CH_2);
+        getChannelCalib(RP_CH_2, &dc_offs, &scale);
+        cmn_CnvCntToVBuffer(ADC_BITS, raw_buffer + pos, first, dc_offs, scale, buffer2);
+        cmn_CnvCntToVBuffer(ADC_BITS, raw_buffer, *size - first, dc_offs, scale, buffer2 + first);
+    }
 
-        buffer[i] = cmn_CalibCnts(ADC_BITS, cnts, dc_offs);
+    return RP_OK;
+}
+
+int acq_AddDataVBulk(uint32_t pos, uint32_t size, float* acc1, float* acc2)
+{
+    if (acc1 == NULL && acc2 == NULL) {
+        return RP_EIPV;
+    }
+
+    size = MIN(size, ADC_BUFFER_SIZE);
+    pos = acq_GetNormalizedDataPos(pos);
+    uint32_t first = MIN(size, ADC_BUFFER_SIZE - pos);
+
+    int32_t dc_offs;
+    float scale;
+    if (acc1) {
+        const volatile uint32_t* raw_buffer = getRawBuffer(RP_CH_1);
+        getChannelCalib(RP_CH_1, &dc_offs, &scale);
+        cmn_AddCntToVBuffer(ADC_BITS, raw_buffer + pos, first, dc_offs, scale, acc1);
+        cmn_AddCntToVBuffer(ADC_BITS, raw_buffer, size - first, dc_offs, scale, acc1 + first);
+    }
+    if (acc2) {
+        const volatile uint32_t* raw_buffer = getRawBuffer(RP_CH_2);
+        getChannelCalib(RP_CH_2, &dc_offs, &scale);
+        cmn_AddCntToVBuffer(ADC_BITS, raw_buffer + pos, first, dc_offs, scale, acc2);
+        cmn_AddCntToVBuffer(ADC_BITS, raw_buffer, size - first, dc_offs, scale, acc2 + first);
     }
 
     return RP_OK;
 }
 
+int acq_GetDataRaw(rp_channel_t channel, uint32_t pos, uint32_t* size, int16_t* buffer)
+{
+    if (channel == RP_CH_1) {
+        return acq_GetDataRawBulk(pos, size, buffer, NULL);
+    }
+    else {
+        return acq_GetDataRawBulk(pos, size, NULL, buffer);
+    }
+}
 
 int acq_GetDataRawV2(uint32_t pos, uint32_t* size, uint16_t* buffer, uint16_t* buffer2)
 {
@@ -670,69 +932,17 @@ int acq_GetLatestDataRaw(rp_channel_t channel, uint32_t* size, int16_t* buffer)
 
 int acq_GetDataV(rp_channel_t channel,  uint32_t pos, uint32_t* size, float* buffer)
 {
-    *size = MIN(*size, ADC_BUFFER_SIZE);
-
-    float gainV;
-    rp_pinState_t gain;
-    acq_GetGainV(channel, &gainV);
-    acq_GetGain(channel, &gain);
-
-    rp_calib_params_t calib = calib_GetParams();
-    int32_t dc_offs = GET_OFFSET(channel, gain, calib);
-    uint32_t calibScale = calib_GetFrontEndScale(channel, gain);
-
-    const volatile uint32_t* raw_buffer = getRawBuffer(channel);
-
-    uint32_t cnts;
-    for (uint32_t i = 0; i < (*size); ++i) {
-        cnts = raw_buffer[(pos + i) % ADC_BUFFER_SIZE];
-        buffer[i] = cmn_CnvCntToV(ADC_BITS, cnts & ADC_BITS_MASK, gainV, calibScale, dc_offs, 0.0);
+    if (channel == RP_CH_1) {
+        return acq_GetDataVBulk(pos, size, buffer, NULL);
+    }
+    else {
+        return acq_GetDataVBulk(pos, size, NULL, buffer);
     }
-
-    return RP_OK;
 }
 
 int acq_GetDataV2(uint32_t pos, uint32_t* size, float* buffer1, float* buffer2)
 {
-    *size = MIN(*size, ADC_BUFFER_SIZE);
-
-    float gainV1, gainV2;
-    rp_pinState_t gain1, gain2;
-    acq_GetGainV(RP_CH_1, &gainV1);
-    acq_GetGain(RP_CH_1, &gain1);
-    acq_GetGainV(RP_CH_2, &gainV2);
-    acq_GetGain(RP_CH_2, &gain2);
-
-    rp_calib_params_t calib = calib_GetParams();
-    int32_t dc_offs1 = gain1 == RP_HIGH ? calib.fe_ch1_hi_offs : calib.fe_ch1_lo_offs;
-    uint32_t calibScale1 = calib_GetFrontEndScale(RP_CH_1, gain1);
-
-    int32_t dc_offs2 = gain2 == RP_HIGH ? calib.fe_ch2_hi_offs : calib.fe_ch2_lo_offs;
-    uint32_t calibScale2 = calib_GetFrontEndScale(RP_CH_2, gain2);
-
-    const volatile uint32_t* raw_buffer1 = getRawBuffer(RP_CH_1);
-    const volatile uint32_t* raw_buffer2 = getRawBuffer(RP_CH_2);
-
-    uint32_t cnts1[*size];
-    uint32_t cnts2[*size];
-    uint32_t* ptr1 = cnts1;
-    uint32_t* ptr2 = cnts2;
-
-    for (uint32_t i = 0; i < (*size); ++i) {
-        *ptr1++ = raw_buffer1[pos];
-        *ptr2++ = raw_buffer2[pos];
-        pos = (pos + 1) % ADC_BUFFER_SIZE;
-    }
-
-    ptr1 = cnts1;
-    ptr2 = cnts2;
-
-    for (uint32_t i = 0; i < (*size); ++i) {
-        *buffer1++ = cmn_CnvCntToV(ADC_BITS, *ptr1++ & ADC_BITS_MASK, gainV1, calibScale1, dc_offs1, 0.0);
-        *buffer2++ = cmn_CnvCntToV(ADC_BITS, *ptr2++ & ADC_BITS_MASK, gainV2, calibScale2, dc_offs2, 0.0);
-    }
-
-    return RP_OK;
+    return acq_GetDataVBulk(pos, size, buffer1, buffer2);
 }
 
 int acq_GetDataPosV(rp_channel_t channel,  uint32_t start_pos, uint32_t end_pos, float* buffer, uint32_t *buffer_size)
@@ -48,6 +48,12 @@ int acq_GetAveraging(bool* enable);
 int acq_SetTriggerSrc(rp_acq_trig_src_t source);
 int acq_GetTriggerSrc(rp_acq_trig_src_t* source);
 int acq_GetTriggerState(rp_acq_trig_state_t* state);
+int acq_WaitTrigger(int64_t timeout_ns);
+int acq_WaitBufferFilled(int64_t timeout_ns);
+int acq_WaitTriggerAsync(int64_t timeout_ns, rp_acq_wait_callback_t callback, void* user_data);
+int acq_WaitBufferFilledAsync(int64_t timeout_ns, rp_acq_wait_callback_t callback, void* user_data);
+int acq_WaitCancel();
+uint32_t acq_GetWaitCancel();
 int acq_SetTriggerDelay(int32_t decimated_data_num, bool updateMaxValue);
 int acq_GetTriggerDelay(int32_t* decimated_data_num);
 int acq_SetTriggerDelayNs(int64_t time_ns, bool updateMaxValue);
@@ -71,11 +77,14 @@ uint32_t acq_GetNormalizedDataPos(uint32_t pos);
 int acq_GetDataPosRaw(rp_channel_t channel, uint32_t start_pos, uint32_t end_pos, int16_t* buffer, uint32_t *buffer_size);
 int acq_GetDataPosV(rp_channel_t channel, uint32_t start_pos, uint32_t end_pos, float* buffer, uint32_t *buffer_size);
 int acq_GetDataRaw(rp_channel_t channel, uint32_t pos, uint32_t* size, int16_t* buffer);
+int acq_GetDataRawBulk(uint32_t pos, uint32_t* size, int16_t* buffer1, int16_t* buffer2);
 int acq_GetDataRawV2(uint32_t pos, uint32_t* size, uint16_t* buffer, uint16_t* buffer2);
 int acq_GetOldestDataRaw(rp_channel_t channel, uint32_t* size, int16_t* buffer);
 int acq_GetLatestDataRaw(rp_channel_t channel, uint32_t* size, int16_t* buffer);
 int acq_GetDataV(rp_channel_t channel, uint32_t pos, uint32_t* size, float* buffer);
 int acq_GetDataV2(uint32_t pos, uint32_t* size, float* buffer1, float* buffer2);
+int acq_GetDataVBulk(uint32_t pos, uint32_t* size, float* buffer1, float* buffer2);
+int acq_AddDataVBulk(uint32_t pos, uint32_t size, float* acc1, float* acc2);
 int acq_GetOldestDataV(rp_channel_t channel, uint32_t* size, float* buffer);
 int acq_GetLatestDataV(rp_channel_t channel, uint32_t* size, float* buffer);
 
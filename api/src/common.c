@@ -12,18 +12,40 @@
  * for more details on the language used herein.
  */
 
+#define _GNU_SOURCE
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <stdio.h>
 #include <math.h>
 
 #include "common.h"
+#include "sim.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CMN_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define CMN_SSE2
+#endif
 
 static int fd = 0;
+static rp_backend_t backend = RP_BACKEND_FPGA;
+
+// Interrupt of the UIO device: 0 - not known yet, 1 - available, -1 - the bitstream has none
+static int irq_state = 0;
 
-int cmn_Init()
+int cmn_Init(rp_backend_t _backend)
 {
+    backend = _backend;
+    if (backend == RP_BACKEND_SIM) {
+        return sim_Init();
+    }
+
     if (!fd) {
         if((fd = open("/dev/uio/api", O_RDWR | O_SYNC)) == -1) {
             return RP_EOMD;
@@ -34,8 +56,14 @@ int cmn_Init()
 
 int cmn_Release()
 {
-    if (fd) {
-        if(close(fd) < 0) {
+    if (backend == RP_BACKEND_SIM) {
+        return sim_Release();
+    }
+
+    if (fd > 0) {
+        int result = close(fd);
+        fd = 0;
+        if(result < 0) {
             return RP_ECMD;
         }
     }
@@ -43,8 +71,47 @@ int cmn_Release()
     return RP_OK;
 }
 
+/**
+ * @brief Waits for an interrupt of the UIO device
+ *
+ * The interrupt is enabled again before every wait. When several threads wait,
+ * only one of them gets the interrupt, so the callers use it as an early wake up
+ * and check their condition themselves.
+ *
+ * @param[in] timeout_ns Longest wait [ns]
+ * @retval RP_OK after an interrupt or the timeout, RP_EUF if the device has no interrupt
+ */
+int cmn_WaitInterrupt(int64_t timeout_ns)
+{
+    if (fd <= 0 || irq_state < 0) {
+        return RP_EUF;
+    }
+
+    uint32_t enable = 1;
+    if (write(fd, &enable, sizeof(enable)) != sizeof(enable) && errno != ENOSYS) {
+        // UIO answers EIO for a device without interrupt, ENOSYS if it can't be masked
+        irq_state = -1;
+        return RP_EUF;
+    }
+    irq_state = 1;
+
+    struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+    struct timespec ts = { .tv_sec = timeout_ns / 1000000000, .tv_nsec = timeout_ns % 1000000000 };
+    if (ppoll(&pfd, 1, &ts, NULL) > 0 && (pfd.revents & POLLIN)) {
+        // Only clears the pending state, the interrupt count is not used
+        uint32_t count;
+        ssize_t size = read(fd, &count, sizeof(count));
+        (void)size;
+    }
+    return RP_OK;
+}
+
 int cmn_Map(size_t size, size_t offset, void** mapped)
 {
+    if (backend == RP_BACKEND_SIM) {
+        return sim_Map(size, offset, mapped);
+    }
+
     if(fd == -1) {
         return RP_EMMD;
     }
@@ -62,6 +129,10 @@ int cmn_Map(size_t size, size_t offset, void** mapped)
 
 int cmn_Unmap(size_t size, void** mapped)
 {
+    if (backend == RP_BACKEND_SIM) {
+        return sim_Unmap(size, mapped);
+    }
+
     if(fd == -1) {
         return RP_EUMD;
     }
@@ -275,6 +346,207 @@ float cmn_CnvCntToV(uint32_t field_len, uint32_t cnts, float adc_max_v, uint32_t
 float rp_cmn_CnvCntToV(uint32_t field_len, uint32_t cnts, float adc_max_v, uint32_t calibScale, int calib_dc_off, float user_dc_off) {
 	return cmn_CnvCntToV(field_len, cnts, adc_max_v, calibScale, calib_dc_off, user_dc_off);
 }
+
+/**
+ * @brief Voltage of one calibrated ADC count
+ *
+ * cmn_CnvCalibCntToV() without user DC offset is a multiplication by this factor.
+ *
+ * @param[in] field_len Number of field (ADC/DAC/Buffer) bits
+ * @param[in] adc_max_v Maximal ADC/DAC voltage, specified in [V]
+ * @param[in] calibScale Calibration scale factor, specified in [full scale] - EPROM calibration parameter storage format
+ * @retval float Volts per count
+ */
+
+float cmn_CnvCntToVScale(uint32_t field_len, float adc_max_v, uint32_t calibScale)
+{
+    double scale = (double)adc_max_v / (double)(1 << (field_len - 1));
+    return scale * (double)cmn_CalibFullScaleToVoltage(calibScale) / ((double)FULL_SCALE_NORM/(double)adc_max_v);
+}
+
+/* cmn_CalibCnts() on masked counts, the sign extension done with two shifts */
+static inline int32_t calibCnts(uint32_t shift, uint32_t cnts, int32_t calib_dc_off, int32_t lo, int32_t hi)
+{
+    int32_t m = ((int32_t)((cnts & ADC_BITS_MASK) << shift) >> shift) - calib_dc_off;
+    return m < lo ? lo : (m > hi ? hi : m);
+}
+
+/* calibCnts() on four counts at a time, the constants are set up once per buffer */
+#if defined(CMN_NEON)
+typedef struct {
+    uint32x4_t mask;
+    int32x4_t left;
+    int32x4_t right;
+    int32x4_t offs;
+    int32x4_t lo;
+    int32x4_t hi;
+} calib_cnts4_t;
+
+static inline calib_cnts4_t calibCnts4Init(uint32_t shift, int32_t calib_dc_off, int32_t lo, int32_t hi)
+{
+    calib_cnts4_t c;
+    c.mask = vdupq_n_u32(ADC_BITS_MASK);
+    c.left = vdupq_n_s32(shift);
+    c.right = vdupq_n_s32(-(int32_t)shift);
+    c.offs = vdupq_n_s32(calib_dc_off);
+    c.lo = vdupq_n_s32(lo);
+    c.hi = vdupq_n_s32(hi);
+    return c;
+}
+
+static inline int32x4_t calibCnts4(const calib_cnts4_t *c, const uint32_t *src)
+{
+    int32x4_t a = vreinterpretq_s32_u32(vshlq_u32(vandq_u32(vld1q_u32(src), c->mask), c->left));
+    return vminq_s32(vmaxq_s32(vsubq_s32(vshlq_s32(a, c->right), c->offs), c->lo), c->hi);
+}
+#elif defined(CMN_SSE2)
+typedef struct {
+    __m128i mask;
+    __m128i count;
+    __m128i offs;
+    __m128i lo;
+    __m128i hi;
+} calib_cnts4_t;
+
+static inline calib_cnts4_t calibCnts4Init(uint32_t shift, int32_t calib_dc_off, int32_t lo, int32_t hi)
+{
+    calib_cnts4_t c;
+    c.mask = _mm_set1_epi32(ADC_BITS_MASK);
+    c.count = _mm_cvtsi32_si128(shift);
+    c.offs = _mm_set1_epi32(calib_dc_off);
+    c.lo = _mm_set1_epi32(lo);
+    c.hi = _mm_set1_epi32(hi);
+    return c;
+}
+
+static inline __m128i calibCnts4(const calib_cnts4_t *c, const uint32_t *src)
+{
+    __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i *)src), c->mask);
+    a = _mm_sub_epi32(_mm_sra_epi32(_mm_sll_epi32(a, c->count), c->count), c->offs);
+    /* No 32 bit min/max before SSE4.1 */
+    __m128i lt = _mm_cmplt_epi32(a, c->lo);
+    a = _mm_or_si128(_mm_and_si128(lt, c->lo), _mm_andnot_si128(lt, a));
+    __m128i gt = _mm_cmpgt_epi32(a, c->hi);
+    return _mm_or_si128(_mm_and_si128(gt, c->hi), _mm_andnot_si128(gt, a));
+}
+#endif
+
+/**
+ * @brief Calibrates a buffer of ADC counts
+ *
+ * Same result as cmn_CalibCnts() on every (cnts[i] & ADC_BITS_MASK), except that
+ * the output saturates at the int16_t range.
+ * The counts are read in order, so a buffer in FPGA memory is read in bursts.
+ *
+ * @param[in] field_len Number of field (ADC/DAC/Buffer) bits
+ * @param[in] cnts Captured Signal Values, expressed in ADC/DAC counts
+ * @param[in] size Number of values
+ * @param[in] calib_dc_off Calibrated DC offset, specified in ADC/DAC counts
+ * @param[out] out Calibrated counts
+ */
+
+void cmn_CalibCntsBuffer(uint32_t field_len, const volatile uint32_t* cnts, uint32_t size, int calib_dc_off, int16_t* out)
+{
+    const uint32_t shift = 32 - field_len;
+    const int32_t lo = MAX(-(1 << (field_len - 1)), INT16_MIN);
+    const int32_t hi = MIN(1 << (field_len - 1), INT16_MAX);
+    uint32_t i = 0;
+
+#if defined(CMN_NEON)
+    const uint32_t *src = (const uint32_t *)cnts;
+    const calib_cnts4_t c = calibCnts4Init(shift, calib_dc_off, lo, hi);
+    for (; i + 8 <= size; i += 8) {
+        int32x4_t a = calibCnts4(&c, src + i);
+        int32x4_t b = calibCnts4(&c, src + i + 4);
+        vst1q_s16(out + i, vcombine_s16(vmovn_s32(a), vmovn_s32(b)));
+    }
+#elif defined(CMN_SSE2)
+    const uint32_t *src = (const uint32_t *)cnts;
+    const calib_cnts4_t c = calibCnts4Init(shift, calib_dc_off, lo, hi);
+    for (; i + 8 <= size; i += 8) {
+        __m128i a = calibCnts4(&c, src + i);
+        __m128i b = calibCnts4(&c, src + i + 4);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(a, b));
+    }
+#endif
+
+    for (; i < size; ++i) {
+        out[i] = calibCnts(shift, cnts[i], calib_dc_off, lo, hi);
+    }
+}
+
+/* Body of cmn_CnvCntToVBuffer() and cmn_AddCntToVBuffer(), accumulate is a constant at both call sites */
+static inline void cnvCntToVBuffer(uint32_t field_len, const volatile uint32_t* cnts, uint32_t size, int calib_dc_off, float scale, float* out, bool accumulate)
+{
+    const uint32_t shift = 32 - field_len;
+    const int32_t lo = -(1 << (field_len - 1));
+    const int32_t hi = 1 << (field_len - 1);
+    uint32_t i = 0;
+
+#if defined(CMN_NEON)
+    const uint32_t *src = (const uint32_t *)cnts;
+    const calib_cnts4_t c = calibCnts4Init(shift, calib_dc_off, lo, hi);
+    for (; i + 4 <= size; i += 4) {
+        float32x4_t v = vmulq_n_f32(vcvtq_f32_s32(calibCnts4(&c, src + i)), scale);
+        if (accumulate)
+            v = vaddq_f32(vld1q_f32(out + i), v);
+        vst1q_f32(out + i, v);
+    }
+#elif defined(CMN_SSE2)
+    const uint32_t *src = (const uint32_t *)cnts;
+    const calib_cnts4_t c = calibCnts4Init(shift, calib_dc_off, lo, hi);
+    const __m128 vscale = _mm_set1_ps(scale);
+    for (; i + 4 <= size; i += 4) {
+        __m128 v = _mm_mul_ps(_mm_cvtepi32_ps(calibCnts4(&c, src + i)), vscale);
+        if (accumulate)
+            v = _mm_add_ps(_mm_loadu_ps(out + i), v);
+        _mm_storeu_ps(out + i, v);
+    }
+#endif
+
+    for (; i < size; ++i) {
+        float v = (float)calibCnts(shift, cnts[i], calib_dc_off, lo, hi) * scale;
+        out[i] = accumulate ? out[i] + v : v;
+    }
+}
+
+/**
+ * @brief Converts a buffer of ADC counts to voltage [V]
+ *
+ * Same as cmn_CnvCntToV() on every (cnts[i] & ADC_BITS_MASK) without user DC offset,
+ * computed in single precision.
+ *
+ * @param[in] field_len Number of field (ADC/DAC/Buffer) bits
+ * @param[in] cnts Captured Signal Values, expressed in ADC/DAC counts
+ * @param[in] size Number of values
+ * @param[in] calib_dc_off Calibrated DC offset, specified in ADC/DAC counts
+ * @param[in] scale Volts per count from cmn_CnvCntToVScale()
+ * @param[out] out Signal Values, expressed in user units [V]
+ */
+
+void cmn_CnvCntToVBuffer(uint32_t field_len, const volatile uint32_t* cnts, uint32_t size, int calib_dc_off, float scale, float* out)
+{
+    cnvCntToVBuffer(field_len, cnts, size, calib_dc_off, scale, out, false);
+}
+
+/**
+ * @brief Adds a buffer of ADC counts, converted to voltage [V], to an accumulator
+ *
+ * Same as cmn_CnvCntToVBuffer() followed by acc[i] += out[i], without the
+ * intermediate buffer. Used to average the captures of repeated triggers.
+ *
+ * @param[in] field_len Number of field (ADC/DAC/Buffer) bits
+ * @param[in] cnts Captured Signal Values, expressed in ADC/DAC counts
+ * @param[in] size Number of values
+ * @param[in] calib_dc_off Calibrated DC offset, specified in ADC/DAC counts
+ * @param[in] scale Volts per count from cmn_CnvCntToVScale()
+ * @param[in,out] acc Sums of Signal Values, expressed in user units [V]
+ */
+
+void cmn_AddCntToVBuffer(uint32_t field_len, const volatile uint32_t* cnts, uint32_t size, int calib_dc_off, float scale, float* acc)
+{
+    cnvCntToVBuffer(field_len, cnts, size, calib_dc_off, scale, acc, true);
+}
 /**
  * @brief Converts voltage in [V] to ADC/DAC/Buffer counts
  *
@@ -336,3 +608,65 @@ uint32_t cmn_CnvVToCnt(uint32_t field_len, float voltage, float adc_max_v, bool
 uint32_t rp_cmn_CnvVToCnt(uint32_t field_len, float voltage, float adc_max_v, bool calibFS_LO, uint32_t calib_scale, int calib_dc_off, float user_dc_off) {
 	return cmn_CnvVToCnt(field_len, voltage, adc_max_v, calibFS_LO, calib_scale, calib_dc_off, user_dc_off);
 }
+
+/**
+ * @brief Converts voltages in [V] to DAC counts
+ *
+ * Same as cmn_CnvVToCnt() on every value without calibration and DC offsets, exactly
+ * when adc_max_v is a power of two. Otherwise the scaling by one multiplication instead
+ * of a division may give one count more or less at the rounding boundaries.
+ * Counts are clamped before rounding, which gives the same result as clamping after.
+ * The counts are written with 16 byte stores, so out can be the FPGA buffer.
+ *
+ * @param[in] field_len Number of field (ADC/DAC/Buffer) bits
+ * @param[in] voltage Voltages, specified in [V]
+ * @param[in] size Number of values
+ * @param[in] adc_max_v Maximal ADC/DAC voltage, specified in [V]
+ * @param[out] out Counts, field_len bits two's complement
+ */
+void cmn_CnvVToCntBuffer(uint32_t field_len, const float* voltage, uint32_t size, float adc_max_v, volatile uint32_t* out)
+{
+    const float scale = (float)(1 << field_len) / (2 * adc_max_v);
+    const float lo = (float)-(1 << (field_len - 1));
+    const float hi = (float)((1 << (field_len - 1)) - 1);
+    const uint32_t mask = (1u << field_len) - 1;
+    uint32_t i = 0;
+
+    // Rounding half away from zero: the fraction after truncation is exact in float
+#if defined(CMN_NEON)
+    uint32_t *dst = (uint32_t *)out;
+    const float32x4_t vlo = vdupq_n_f32(lo);
+    const float32x4_t vhi = vdupq_n_f32(hi);
+    const float32x4_t half = vdupq_n_f32(0.5f);
+    const float32x4_t nhalf = vdupq_n_f32(-0.5f);
+    const uint32x4_t vmask = vdupq_n_u32(mask);
+    for (; i + 4 <= size; i += 4) {
+        float32x4_t x = vminq_f32(vmaxq_f32(vmulq_n_f32(vld1q_f32(voltage + i), scale), vlo), vhi);
+        int32x4_t t = vcvtq_s32_f32(x);
+        float32x4_t frac = vsubq_f32(x, vcvtq_f32_s32(t));
+        t = vsubq_s32(t, vreinterpretq_s32_u32(vcgeq_f32(frac, half)));
+        t = vaddq_s32(t, vreinterpretq_s32_u32(vcleq_f32(frac, nhalf)));
+        vst1q_u32(dst + i, vandq_u32(vreinterpretq_u32_s32(t), vmask));
+    }
+#elif defined(CMN_SSE2)
+    uint32_t *dst = (uint32_t *)out;
+    const __m128 vscale = _mm_set1_ps(scale);
+    const __m128 vlo = _mm_set1_ps(lo);
+    const __m128 vhi = _mm_set1_ps(hi);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 nhalf = _mm_set1_ps(-0.5f);
+    const __m128i vmask = _mm_set1_epi32(mask);
+    for (; i + 4 <= size; i += 4) {
+        __m128 x = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(voltage + i), vscale), vlo), vhi);
+        __m128i t = _mm_cvttps_epi32(x);
+        __m128 frac = _mm_sub_ps(x, _mm_cvtepi32_ps(t));
+        t = _mm_sub_epi32(t, _mm_castps_si128(_mm_cmpge_ps(frac, half)));
+        t = _mm_add_epi32(t, _mm_castps_si128(_mm_cmple_ps(frac, nhalf)));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_and_si128(t, vmask));
+    }
+#endif
+
+    for (; i < size; ++i) {
+        out[i] = (uint32_t)(int32_t)roundf(MIN(MAX(voltage[i] * scale, lo), hi)) & mask;
+    }
+}
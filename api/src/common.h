@@ -60,9 +60,10 @@ else { \
 
 #define FULL_SCALE_NORM     20.0    // V
 
-int cmn_Init();
+int cmn_Init(rp_backend_t backend);
 int cmn_Release();
 
+int cmn_WaitInterrupt(int64_t timeout_ns);
 int cmn_Map(size_t size, size_t offset, void** mapped);
 int cmn_Unmap(size_t size, void** mapped);
 
@@ -84,7 +85,12 @@ uint32_t cmn_CalibFullScaleFromVoltage(float voltageScale);
 int32_t cmn_CalibCnts(uint32_t field_len, uint32_t cnts, int calib_dc_off);
 float cmn_CnvCalibCntToV(uint32_t field_len, int32_t calib_cnts, float adc_max_v, float calibScale, float user_dc_off);
 float cmn_CnvCntToV(uint32_t field_len, uint32_t cnts, float adc_max_v, uint32_t calibScale, int calib_dc_off, float user_dc_off);
+float cmn_CnvCntToVScale(uint32_t field_len, float adc_max_v, uint32_t calibScale);
+void cmn_CalibCntsBuffer(uint32_t field_len, const volatile uint32_t* cnts, uint32_t size, int calib_dc_off, int16_t* out);
+void cmn_CnvCntToVBuffer(uint32_t field_len, const volatile uint32_t* cnts, uint32_t size, int calib_dc_off, float scale, float* out);
+void cmn_AddCntToVBuffer(uint32_t field_len, const volatile uint32_t* cnts, uint32_t size, int calib_dc_off, float scale, float* acc);
 uint32_t cmn_CnvVToCnt(uint32_t field_len, float voltage, float adc_max_v, bool calibFS_LO, uint32_t calib_scale, int calib_dc_off, float user_dc_off);
+void cmn_CnvVToCntBuffer(uint32_t field_len, const float* voltage, uint32_t size, float adc_max_v, volatile uint32_t* out);
 
 float rp_cmn_CalibFullScaleToVoltage(uint32_t fullScaleGain);
 uint32_t rp_cmn_CalibFullScaleFromVoltage(float voltageScale);
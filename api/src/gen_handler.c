@@ -38,7 +38,32 @@ bool          chA_LatchTempAlarm       = 0, chB_LatchTempAlarm       = 0;
 float chA_arbitraryData[BUFFER_LENGTH];
 float chB_arbitraryData[BUFFER_LENGTH];
 
+/* Normalized waveforms, built on first use. key is the shape parameter the table
+ * was built for: transition samples of square, high samples of PWM, 0 for the others */
+typedef struct {
+    bool  valid;
+    int   key;
+    float data[BUFFER_LENGTH];
+} waveform_table_t;
+
+static waveform_table_t waveform_tables[RP_WAVEFORM_PWM + 1];
+
+/* What the DAC buffer of a channel holds, so changes that keep it (frequency
+ * of most waveforms) skip writing the buffer */
+typedef struct {
+    bool          valid;
+    rp_waveform_t waveform;
+    int           key;
+    uint32_t      phase;
+    uint32_t      size;
+} dac_buffer_t;
+
+static dac_buffer_t dac_buffers[2];
+
 int gen_SetDefaultValues() {
+    // The buffers may have been written by someone else
+    dac_buffers[RP_CH_1].valid = false;
+    dac_buffers[RP_CH_2].valid = false;
     gen_Disable(RP_CH_1);
     gen_Disable(RP_CH_2);
     gen_setFrequency(RP_CH_1, 1000);
@@ -143,6 +168,18 @@ int gen_setFrequency(rp_channel_t channel, float frequency) {
     return gen_Synchronise();
 }
 
+/* Frequency of a sine step of a sweep, the table and the burst registers stay as they are */
+int gen_setStepFrequency(rp_channel_t channel, float frequency) {
+    if (frequency < FREQUENCY_MIN || frequency > FREQUENCY_MAX) {
+        return RP_EOOR;
+    }
+    CHANNEL_ACTION(channel,
+            chA_frequency = frequency,
+            chB_frequency = frequency)
+
+    return generate_setFrequency(channel, frequency);
+}
+
 int gen_getFrequency(rp_channel_t channel, float *frequency) {
     return generate_getFrequency(channel, frequency);
 }
@@ -219,6 +256,10 @@ int gen_setArbWaveform(rp_channel_t channel, float *data, uint32_t length) {
         pointer[i] = 0;
     }
 
+    CHANNEL_ACTION(channel,
+            dac_buffers[RP_CH_1].valid = false,
+            dac_buffers[RP_CH_2].valid = false)
+
     if (channel == RP_CH_1) {
         chA_arb_size = length;
         if(chA_waveform==RP_WAVEFORM_ARBITRARY){
@@ -449,11 +490,54 @@ int gen_Synchronise() {
     return generate_Synchronise();
 }
 
+static int squareTransition(float frequency) {
+    // Various locally used constants - HW specific parameters
+    const int trans0 = 30;
+    const int trans1 = 300;
+
+    int trans = (int) (frequency / 1e6 * trans1); // 300 samples at 1 MHz
+
+    if (trans <= 10)  trans = trans0;
+    return trans;
+}
+
+static int pwmHighSamples(float ratio) {
+    // calculate number of samples that need to be high
+    return (int) (BUFFER_LENGTH/2 * ratio);
+}
+
+static const float *waveformTable(rp_waveform_t waveform, float frequency, float dutyCycle, int *key) {
+    waveform_table_t *table = &waveform_tables[waveform];
+    switch (waveform) {
+        case RP_WAVEFORM_SQUARE: *key = squareTransition(frequency); break;
+        case RP_WAVEFORM_PWM   : *key = pwmHighSamples(dutyCycle);   break;
+        default:                 *key = 0;                           break;
+    }
+    if (table->valid && table->key == *key) {
+        return table->data;
+    }
+
+    switch (waveform) {
+        case RP_WAVEFORM_SINE     : synthesis_sin      (table->data);            break;
+        case RP_WAVEFORM_TRIANGLE : synthesis_triangle (table->data);            break;
+        case RP_WAVEFORM_SQUARE   : synthesis_square   (frequency, table->data); break;
+        case RP_WAVEFORM_RAMP_UP  : synthesis_rampUp   (table->data);            break;
+        case RP_WAVEFORM_RAMP_DOWN: synthesis_rampDown (table->data);            break;
+        case RP_WAVEFORM_DC       : synthesis_DC       (table->data);            break;
+        case RP_WAVEFORM_PWM      : synthesis_PWM      (dutyCycle, table->data); break;
+        default:                    return NULL;
+    }
+    table->valid = true;
+    table->key = *key;
+    return table->data;
+}
+
 int synthesize_signal(rp_channel_t channel) {
-    float data[BUFFER_LENGTH];
+    const float *data;
     rp_waveform_t waveform;
     float dutyCycle, frequency;
     uint32_t size, phase;
+    int key = 0;
 
     if (channel == RP_CH_1) {
         waveform = chA_waveform;
@@ -473,17 +557,26 @@ int synthesize_signal(rp_channel_t channel) {
         return RP_EPN;
     }
 
-    switch (waveform) {
-        case RP_WAVEFORM_SINE     : synthesis_sin      (data);                 break;
-        case RP_WAVEFORM_TRIANGLE : synthesis_triangle (data);                 break;
-        case RP_WAVEFORM_SQUARE   : synthesis_square   (frequency, data);      break;
-        case RP_WAVEFORM_RAMP_UP  : synthesis_rampUp   (data);                 break;
-        case RP_WAVEFORM_RAMP_DOWN: synthesis_rampDown (data);                 break;
-        case RP_WAVEFORM_DC       : synthesis_DC       (data);                 break;
-        case RP_WAVEFORM_PWM      : synthesis_PWM      (dutyCycle, data);      break;
-        case RP_WAVEFORM_ARBITRARY: synthesis_arbitrary(channel, data, &size); break;
-        default:                    return RP_EIPV;
+    if (waveform == RP_WAVEFORM_ARBITRARY) {
+        data = channel == RP_CH_1 ? chA_arbitraryData : chB_arbitraryData;
+        size = channel == RP_CH_1 ? chA_arb_size : chB_arb_size;
+    }
+    else if (waveform >= RP_WAVEFORM_SINE && waveform <= RP_WAVEFORM_PWM) {
+        data = waveformTable(waveform, frequency, dutyCycle, &key);
     }
+    else {
+        return RP_EIPV;
+    }
+
+    dac_buffer_t *buffer = &dac_buffers[channel];
+    if (buffer->valid && buffer->waveform == waveform && buffer->key == key && buffer->phase == phase && buffer->size == size) {
+        return generate_setWrapCounter(channel, size);
+    }
+    buffer->valid = true;
+    buffer->waveform = waveform;
+    buffer->key = key;
+    buffer->phase = phase;
+    buffer->size = size;
     return generate_writeData(channel, data, phase, size);
 }
 
@@ -524,8 +617,7 @@ int synthesis_DC(float *data_out) {
 }
 
 int synthesis_PWM(float ratio, float *data_out) {
-    // calculate number of samples that need to be high
-    int h = (int) (BUFFER_LENGTH/2 * ratio);
+    int h = pwmHighSamples(ratio);
 
     for(int unsigned i = 0; i < BUFFER_LENGTH; i++) {
         if (i < h || i >= BUFFER_LENGTH - h) {
@@ -553,13 +645,7 @@ int synthesis_arbitrary(rp_channel_t channel, float *data_out, uint32_t * size)
 }
 
 int synthesis_square(float frequency, float *data_out) {
-    // Various locally used constants - HW specific parameters
-    const int trans0 = 30;
-    const int trans1 = 300;
-
-    int trans = (int) (frequency / 1e6 * trans1); // 300 samples at 1 MHz
-
-    if (trans <= 10)  trans = trans0;
+    int trans = squareTransition(frequency);
 
     for(int unsigned i = 0; i < BUFFER_LENGTH; i++) {
         if      ((0 <= i                      ) && (i <  BUFFER_LENGTH/2 - trans))  data_out[i] =  1.0f;
@@ -27,6 +27,7 @@ int gen_getAmplitude(rp_channel_t channel, float *amplitude);
 int gen_setOffset(rp_channel_t channel, float offset) ;
 int gen_getOffset(rp_channel_t channel, float *offset) ;
 int gen_setFrequency(rp_channel_t channel, float frequency);
+int gen_setStepFrequency(rp_channel_t channel, float frequency);
 int gen_getFrequency(rp_channel_t channel, float *frequency);
 int gen_setPhase(rp_channel_t channel, float phase);
 int gen_getPhase(rp_channel_t channel, float *phase);
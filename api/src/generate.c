@@ -298,22 +298,17 @@ int generate_Synchronise() {
     return RP_OK;
 }
 
-int generate_writeData(rp_channel_t channel, float *data, uint32_t start, uint32_t length) {
+int generate_writeData(rp_channel_t channel, const float *data, uint32_t start, uint32_t length) {
     volatile int32_t *dataOut;
     CHANNEL_ACTION(channel,
             dataOut = data_chA,
             dataOut = data_chB)
 
-    volatile ch_properties_t *properties;
-    getChannelPropertiesAddress(&properties, channel);
     generate_setWrapCounter(channel, length);
 
-    //rp_calib_params_t calib = calib_GetParams();
-    int dc_offs = 0;//channel == RP_CH_1 ? calib.be_ch1_dc_offs: calib.be_ch2_dc_offs;
-    uint32_t amp_max = 0; //channel == RP_CH_1 ? calib.be_ch1_fs: calib.be_ch2_fs;
-
-    for(int i = start; i < start+BUFFER_LENGTH; i++) {
-        dataOut[i % BUFFER_LENGTH] = cmn_CnvVToCnt(DATA_BIT_LENGTH, data[i-start], AMPLITUDE_MAX, false, amp_max, dc_offs, 0.0);
-    }
+    // Without calibration, data[0] goes to dataOut[start] and the rest wraps around
+    start %= BUFFER_LENGTH;
+    cmn_CnvVToCntBuffer(DATA_BIT_LENGTH, data, BUFFER_LENGTH - start, AMPLITUDE_MAX, (volatile uint32_t *) dataOut + start);
+    cmn_CnvVToCntBuffer(DATA_BIT_LENGTH, data + BUFFER_LENGTH - start, start, AMPLITUDE_MAX, (volatile uint32_t *) dataOut);
     return RP_OK;
 }
@@ -131,6 +131,6 @@ int generate_getRuntimeTempAlarm(rp_channel_t channel, bool *state);
 int generate_simultaneousTrigger();
 int generate_Synchronise();
 
-int generate_writeData(rp_channel_t channel, float *data, uint32_t start, uint32_t length);
+int generate_writeData(rp_channel_t channel, const float *data, uint32_t start, uint32_t length);
 
 #endif //__GENERATE_H
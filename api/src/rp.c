@@ -14,6 +14,8 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "redpitaya/version.h"
 #include "common.h"
@@ -24,6 +26,9 @@
 #include "calib.h"
 #include "generate.h"
 #include "gen_handler.h"
+#include "sim.h"
+#include "sweep.h"
+#include "segment.h"
 
 static char version[50];
 
@@ -33,9 +38,19 @@ static char version[50];
 
 int rp_Init()
 {
-    cmn_Init();
+    const char* name = getenv("RP_BACKEND");
+    return rp_InitBackend(name != NULL && strcmp(name, "sim") == 0 ? RP_BACKEND_SIM : RP_BACKEND_FPGA);
+}
+
+int rp_InitBackend(rp_backend_t backend)
+{
+    ECHECK(cmn_Init(backend));
 
     calib_Init();
+    if (backend == RP_BACKEND_SIM) {
+        // There is no EEPROM
+        calib_SetToZero();
+    }
     hk_Init();
     ams_Init();
     generate_Init();
@@ -48,6 +63,16 @@ int rp_Init()
     return RP_OK;
 }
 
+int rp_SimSetInput(rp_channel_t channel, rp_waveform_t type, float frequency, float amplitude, float offset)
+{
+    return sim_SetInput(channel, type, frequency, amplitude, offset);
+}
+
+int rp_SimSetInputLoopback(rp_channel_t channel)
+{
+    return sim_SetInputLoopback(channel);
+}
+
 int rp_CalibInit()
 {
     calib_Init();
@@ -57,6 +82,8 @@ int rp_CalibInit()
 
 int rp_Release()
 {
+    sweep_Release();
+    segment_Stop();
     osc_Release();
     generate_Release();
     ams_Release();
@@ -108,6 +135,8 @@ const char* rp_GetError(int errorCode) {
         case RP_EABA:  return "Failed to acquire bus access";
         case RP_EFRB:  return "Failed to read from the bus";
         case RP_EFWB:  return "Failed to write to the bus";
+        case RP_ETIM:  return "Timeout";
+        case RP_ECAN:  return "Wait canceled";
         default:       return "Unknown error";
     }
 }
@@ -538,6 +567,31 @@ int rp_AcqGetTriggerState(rp_acq_trig_state_t* state)
     return acq_GetTriggerState(state);
 }
 
+int rp_AcqWaitTrigger(int64_t timeout_ns)
+{
+    return acq_WaitTrigger(timeout_ns);
+}
+
+int rp_AcqWaitBufferFilled(int64_t timeout_ns)
+{
+    return acq_WaitBufferFilled(timeout_ns);
+}
+
+int rp_AcqWaitTriggerAsync(int64_t timeout_ns, rp_acq_wait_callback_t callback, void* user_data)
+{
+    return acq_WaitTriggerAsync(timeout_ns, callback, user_data);
+}
+
+int rp_AcqWaitBufferFilledAsync(int64_t timeout_ns, rp_acq_wait_callback_t callback, void* user_data)
+{
+    return acq_WaitBufferFilledAsync(timeout_ns, callback, user_data);
+}
+
+int rp_AcqWaitCancel()
+{
+    return acq_WaitCancel();
+}
+
 int rp_AcqSetTriggerDelay(int32_t decimated_data_num)
 {
     return acq_SetTriggerDelay(decimated_data_num, false);
@@ -646,6 +700,11 @@ int rp_AcqGetDataRawV2(uint32_t pos, uint32_t* size, uint16_t* buffer, uint16_t*
     return acq_GetDataRawV2(pos, size, buffer, buffer2);
 }
 
+int rp_AcqGetDataRawBulk(uint32_t pos, uint32_t* size, int16_t* buffer1, int16_t* buffer2)
+{
+    return acq_GetDataRawBulk(pos, size, buffer1, buffer2);
+}
+
 int rp_AcqGetOldestDataRaw(rp_channel_t channel, uint32_t* size, int16_t* buffer)
 {
     return acq_GetOldestDataRaw(channel, size, buffer);
@@ -666,6 +725,31 @@ int rp_AcqGetDataV2(uint32_t pos, uint32_t* size, float* buffer1, float* buffer2
     return acq_GetDataV2(pos, size, buffer1, buffer2);
 }
 
+int rp_AcqGetDataVBulk(uint32_t pos, uint32_t* size, float* buffer1, float* buffer2)
+{
+    return acq_GetDataVBulk(pos, size, buffer1, buffer2);
+}
+
+int rp_AcqSegmentedStart(rp_acq_trig_src_t source, uint32_t segments, uint32_t size)
+{
+    return segment_Start(source, segments, size);
+}
+
+int rp_AcqSegmentedRead(int64_t timeout_ns, rp_acq_segment_t* info, int16_t* buffer1, int16_t* buffer2)
+{
+    return segment_Read(timeout_ns, info, buffer1, buffer2);
+}
+
+int rp_AcqSegmentedStop()
+{
+    return segment_Stop();
+}
+
+int rp_AcqAverageTriggers(rp_acq_trig_src_t source, uint32_t triggers, uint32_t size, int64_t timeout_ns, float* buffer1, float* buffer2)
+{
+    return segment_Average(source, triggers, size, timeout_ns, buffer1, buffer2);
+}
+
 int rp_AcqGetOldestDataV(rp_channel_t channel, uint32_t* size, float* buffer)
 {
     return acq_GetOldestDataV(channel, size, buffer);
@@ -800,6 +884,27 @@ int rp_GenTrigger(uint32_t channel) {
     return gen_Trigger(channel);
 }
 
+int rp_GenSweepSetSteps(rp_channel_t channel, const rp_gen_sweep_step_t* steps, uint32_t count) {
+    return sweep_SetSteps(channel, steps, count);
+}
+
+int rp_GenSweepSetRange(rp_channel_t channel, float start_frequency, float stop_frequency, uint32_t count,
+                        rp_gen_sweep_scale_t scale, float amplitude, uint32_t dwell_us) {
+    return sweep_SetRange(channel, start_frequency, stop_frequency, count, scale, amplitude, dwell_us);
+}
+
+int rp_GenSweepGetCount(uint32_t* count) {
+    return sweep_GetCount(count);
+}
+
+int rp_GenSweepRun(uint32_t periods, rp_gen_sweep_result_t* results) {
+    return sweep_Run(periods, results);
+}
+
+int rp_GenSweepCancel() {
+    return sweep_Cancel();
+}
+
 float rp_CmnCnvCntToV(uint32_t field_len, uint32_t cnts, float adc_max_v, uint32_t calibScale, int calib_dc_off, float user_dc_off)
 {
 	return cmn_CnvCntToV(field_len, cnts, adc_max_v, calibScale, calib_dc_off, user_dc_off);
@@ -0,0 +1,321 @@
+/**
+ * $Id: $
+ *
+ * @brief Red Pitaya library segmented acquisition implementation
+ *
+ * @Author Red Pitaya
+ *
+ * (c) Red Pitaya  http://www.redpitaya.com
+ *
+ * This part of code is written in C programming language.
+ * Please visit http://en.wikipedia.org/wiki/C_(programming_language)
+ * for more details on the language used herein.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "oscilloscope.h"
+#include "acq_handler.h"
+#include "segment.h"
+
+/*
+ * The FPGA has one 16k buffer per channel, so every trigger is still a start,
+ * wait and readout of the buffer. What is saved is the round trip through the
+ * application: a library thread re-arms the scope as soon as a capture is read
+ * and keeps the segments in a ring until they are read, and the averaging adds
+ * each capture to the sums right out of the buffer.
+ *
+ * A segment is the last size samples written after a trigger, the trigger delay
+ * decides how many of them are after the trigger sample. The trigger source is
+ * only set when the samples before it are written since the start (pre-trigger
+ * counter), else they would be left over from the previous capture.
+ */
+
+typedef struct {
+    uint32_t start;         // buffer position of the first sample of the segment
+    uint32_t trigger_pos;
+    int32_t  trigger_index;
+    int64_t  timestamp_ns;
+} capture_t;
+
+static pthread_mutex_t ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_cond;
+static pthread_t ring_thread;
+static bool ring_started = false;
+static volatile bool ring_stop = false;
+
+static rp_acq_trig_src_t ring_source;
+static uint32_t ring_segments = 0;
+static uint32_t ring_size = 0;
+static int16_t *ring_data = NULL;        // ring_segments x 2 channels x ring_size samples
+static rp_acq_segment_t *ring_info = NULL;
+static uint64_t ring_written = 0;
+static uint64_t ring_read = 0;
+static uint32_t ring_lost = 0;           // overwritten since the last read
+static int ring_error = RP_OK;           // the thread ended with it
+
+static int64_t getTimeNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleepNs(int64_t time_ns)
+{
+    struct timespec ts = { .tv_sec = time_ns / 1000000000, .tv_nsec = time_ns % 1000000000 };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+/*
+ * Waits for the buffer in SEGMENT_POLL_NS steps, so that a stop or an rp_AcqWaitCancel() after
+ * cancel was taken is seen between them. stop may be NULL, a negative timeout_ns waits without limit.
+ */
+static int waitFilled(int64_t timeout_ns, volatile bool* stop, uint32_t cancel)
+{
+    int64_t deadline = timeout_ns < 0 ? INT64_MAX : getTimeNs() + timeout_ns;
+    while (!(stop && *stop) && cancel == acq_GetWaitCancel()) {
+        int64_t left = deadline - getTimeNs();
+        if (left <= 0) {
+            return RP_ETIM;
+        }
+        int ret = acq_WaitBufferFilled(MIN(left, SEGMENT_POLL_NS));
+        if (ret != RP_ETIM) {
+            return ret;
+        }
+    }
+    return RP_ECAN;
+}
+
+static int capture(rp_acq_trig_src_t source, uint32_t size, int64_t timeout_ns, volatile bool* stop, capture_t* c)
+{
+    int32_t delay;
+    uint32_t decimation;
+    ECHECK(acq_GetTriggerDelay(&delay));
+    ECHECK(acq_GetDecimationFactor(&decimation));
+    int64_t post = MAX((int64_t)delay + ADC_BUFFER_SIZE / 2, 0);
+    int64_t sample_ns = ADC_SAMPLE_PERIOD_DEF * (int64_t)decimation;
+    c->trigger_index = (int32_t)((int64_t)size - post);
+
+    uint32_t cancel = acq_GetWaitCancel();
+    ECHECK(acq_Start());
+    uint32_t written = 0;
+    while ((int64_t)written < c->trigger_index) {
+        if ((stop && *stop) || cancel != acq_GetWaitCancel()) {
+            // The trigger is not armed yet, only the writing is stopped
+            osc_ResetWriteStateMachine();
+            return RP_ECAN;
+        }
+        sleepNs(MIN(MAX((c->trigger_index - (int64_t)written) * sample_ns, SEGMENT_SLEEP_MIN_NS), SEGMENT_POLL_NS));
+        ECHECK(acq_GetPreTriggerCounter(&written));
+    }
+    ECHECK(acq_SetTriggerSrc(source));
+    int ret = waitFilled(timeout_ns, stop, cancel);
+    if (ret != RP_OK) {
+        // A trigger may have come in the meantime, its samples after the trigger must not end the next capture
+        acq_SetTriggerSrc(RP_TRIG_SRC_DISABLED);
+        osc_ResetWriteStateMachine();
+        return ret;
+    }
+
+    // The FPGA has no time stamps, the time of the trigger is taken back from the end of the capture
+    c->timestamp_ns = getTimeNs() - post * sample_ns;
+    ECHECK(acq_GetWritePointerAtTrig(&c->trigger_pos));
+    c->start = acq_GetNormalizedDataPos(c->trigger_pos - c->trigger_index);
+    return RP_OK;
+}
+
+static void* ringTask(void* arg)
+{
+    capture_t c;
+    int ret = RP_OK;
+    while (ret == RP_OK) {
+        ret = capture(ring_source, ring_size, -1, &ring_stop, &c);
+        if (ret != RP_OK) {
+            break;
+        }
+
+        pthread_mutex_lock(&ring_mutex);
+        if (ring_written - ring_read == ring_segments) {
+            ring_read++;
+            ring_lost++;
+        }
+        uint32_t slot = ring_written % ring_segments;
+        uint32_t size = ring_size;
+        int16_t *data = ring_data + (size_t)slot * 2 * ring_size;
+        ret = acq_GetDataRawBulk(c.start, &size, data, data + ring_size);
+
+        rp_acq_segment_t *info = &ring_info[slot];
+        info->index = ring_written;
+        info->timestamp_ns = c.timestamp_ns;
+        info->trigger_pos = c.trigger_pos;
+        info->trigger_index = c.trigger_index;
+        info->lost = 0;
+        ring_written++;
+        pthread_cond_broadcast(&ring_cond);
+        pthread_mutex_unlock(&ring_mutex);
+    }
+
+    // A stop is not an error, the segments left can still be read
+    pthread_mutex_lock(&ring_mutex);
+    ring_error = ret == RP_ECAN ? RP_OK : ret;
+    ring_stop = true;
+    pthread_cond_broadcast(&ring_cond);
+    pthread_mutex_unlock(&ring_mutex);
+    return NULL;
+}
+
+int segment_Start(rp_acq_trig_src_t source, uint32_t segments, uint32_t size)
+{
+    if (ring_started) {
+        return RP_EIPV;
+    }
+    if (segments == 0 || size == 0 || size > ADC_BUFFER_SIZE) {
+        return RP_EOOR;
+    }
+    if (source == RP_TRIG_SRC_DISABLED || source > RP_TRIG_SRC_AWG_NE) {
+        return RP_EIPV;
+    }
+
+    ring_data = malloc((size_t)segments * 2 * size * sizeof(int16_t));
+    ring_info = malloc(segments * sizeof(rp_acq_segment_t));
+    if (ring_data == NULL || ring_info == NULL) {
+        free(ring_data);
+        free(ring_info);
+        ring_data = NULL;
+        ring_info = NULL;
+        return RP_EUF;
+    }
+
+    ring_source = source;
+    ring_segments = segments;
+    ring_size = size;
+    ring_written = 0;
+    ring_read = 0;
+    ring_lost = 0;
+    ring_error = RP_OK;
+    ring_stop = false;
+
+    // Read timeouts are on the monotonic clock, as all library waits
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ring_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&ring_thread, NULL, ringTask, NULL) != 0) {
+        pthread_cond_destroy(&ring_cond);
+        free(ring_data);
+        free(ring_info);
+        ring_data = NULL;
+        ring_info = NULL;
+        return RP_EUF;
+    }
+    ring_started = true;
+    return RP_OK;
+}
+
+int segment_Read(int64_t timeout_ns, rp_acq_segment_t* info, int16_t* buffer1, int16_t* buffer2)
+{
+    if (!ring_started) {
+        return RP_EIPV;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    if (timeout_ns >= 0) {
+        int64_t ns = deadline.tv_nsec + timeout_ns;
+        deadline.tv_sec += ns / 1000000000;
+        deadline.tv_nsec = ns % 1000000000;
+    }
+
+    pthread_mutex_lock(&ring_mutex);
+    while (ring_written == ring_read && !ring_stop) {
+        if (timeout_ns < 0) {
+            pthread_cond_wait(&ring_cond, &ring_mutex);
+        }
+        else if (pthread_cond_timedwait(&ring_cond, &ring_mutex, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    int ret = RP_OK;
+    if (ring_written == ring_read) {
+        ret = ring_stop ? (ring_error != RP_OK ? ring_error : RP_ECAN) : RP_ETIM;
+    }
+    else {
+        uint32_t slot = ring_read % ring_segments;
+        const int16_t *data = ring_data + (size_t)slot * 2 * ring_size;
+        if (buffer1) {
+            memcpy(buffer1, data, ring_size * sizeof(int16_t));
+        }
+        if (buffer2) {
+            memcpy(buffer2, data + ring_size, ring_size * sizeof(int16_t));
+        }
+        if (info) {
+            *info = ring_info[slot];
+            info->lost = ring_lost;
+        }
+        ring_lost = 0;
+        ring_read++;
+    }
+    pthread_mutex_unlock(&ring_mutex);
+    return ret;
+}
+
+int segment_Stop()
+{
+    if (!ring_started) {
+        return RP_OK;
+    }
+    ring_stop = true;
+    pthread_join(ring_thread, NULL);
+    pthread_cond_destroy(&ring_cond);
+    free(ring_data);
+    free(ring_info);
+    ring_data = NULL;
+    ring_info = NULL;
+    ring_started = false;
+    return RP_OK;
+}
+
+int segment_Average(rp_acq_trig_src_t source, uint32_t triggers, uint32_t size, int64_t timeout_ns, float* buffer1, float* buffer2)
+{
+    if (ring_started) {
+        return RP_EIPV;
+    }
+    if (triggers == 0 || size == 0 || size > ADC_BUFFER_SIZE) {
+        return RP_EOOR;
+    }
+    if (source == RP_TRIG_SRC_DISABLED || source > RP_TRIG_SRC_AWG_NE || (buffer1 == NULL && buffer2 == NULL)) {
+        return RP_EIPV;
+    }
+
+    if (buffer1) {
+        memset(buffer1, 0, size * sizeof(float));
+    }
+    if (buffer2) {
+        memset(buffer2, 0, size * sizeof(float));
+    }
+    for (uint32_t i = 0; i < triggers; i++) {
+        capture_t c;
+        int ret = capture(source, size, timeout_ns, NULL, &c);
+        if (ret != RP_OK) {
+            return ret;
+        }
+        ECHECK(acq_AddDataVBulk(c.start, size, buffer1, buffer2));
+    }
+
+    const float scale = 1.f / triggers;
+    for (uint32_t i = 0; i < size; i++) {
+        if (buffer1) buffer1[i] *= scale;
+        if (buffer2) buffer2[i] *= scale;
+    }
+    return RP_OK;
+}
@@ -0,0 +1,32 @@
+/**
+ * $Id: $
+ *
+ * @brief Red Pitaya library segmented acquisition interface
+ *
+ * @Author Red Pitaya
+ *
+ * (c) Red Pitaya  http://www.redpitaya.com
+ *
+ * This part of code is written in C programming language.
+ * Please visit http://en.wikipedia.org/wiki/C_(programming_language)
+ * for more details on the language used herein.
+ */
+
+#ifndef SRC_SEGMENT_H_
+#define SRC_SEGMENT_H_
+
+#include <stdint.h>
+#include "redpitaya/rp.h"
+
+/* Longest time a capture waits or sleeps before it looks for a stop or a cancel [ns] */
+#define SEGMENT_POLL_NS 100000000
+
+/* Shortest sleep while the samples before the trigger are written [ns] */
+#define SEGMENT_SLEEP_MIN_NS 20000
+
+int segment_Start(rp_acq_trig_src_t source, uint32_t segments, uint32_t size);
+int segment_Read(int64_t timeout_ns, rp_acq_segment_t* info, int16_t* buffer1, int16_t* buffer2);
+int segment_Stop();
+int segment_Average(rp_acq_trig_src_t source, uint32_t triggers, uint32_t size, int64_t timeout_ns, float* buffer1, float* buffer2);
+
+#endif /* SRC_SEGMENT_H_ */
@@ -0,0 +1,479 @@
+/**
+ * $Id: $
+ *
+ * @brief Red Pitaya library simulated FPGA module implementation
+ *
+ * @Author Red Pitaya
+ *
+ * (c) Red Pitaya  http://www.redpitaya.com
+ *
+ * This part of code is written in C programming language.
+ * Please visit http://en.wikipedia.org/wiki/C_(programming_language)
+ * for more details on the language used herein.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "oscilloscope.h"
+#include "generate.h"
+#include "gen_handler.h"
+#include "sim.h"
+
+/*
+ * The register blocks are plain memory, the handlers use them as if they were
+ * mapped from the FPGA. A thread runs the models of the blocks with state:
+ *
+ * Oscilloscope - samples are written at the decimated rate into the 16k buffers
+ * while armed (conf bit 0), the edge and software triggers work as in the FPGA
+ * and the trigger source is set back to disabled when the samples after the
+ * trigger are written. Resetting the write state machine (conf bit 1) is taken
+ * at the next tick. External and generator triggers never fire, averaging at
+ * decimation is not modelled.
+ *
+ * Generator - the buffer, amplitude, offset and frequency registers give the
+ * output of each channel, a channel runs with the internal trigger only. The
+ * output is the input of the oscilloscope channel unless sim_SetInput() gave
+ * the channel its own waveform.
+ *
+ * Housekeeping and analog mixed signals are memory only, values read back.
+ *
+ * The inputs are modelled with the LV jumper setting (+/-1 V full scale).
+ */
+
+// Full scale of the modelled inputs [V]
+#define SIM_INPUT_FULL_SCALE 1.0f
+
+typedef struct {
+    size_t offset;
+    size_t size;
+    void*  mapped;
+} sim_block_t;
+
+typedef struct {
+    bool   loopback;                // the generator output of the same channel
+    float  table[BUFFER_LENGTH];    // one period of the waveform, -1 to 1
+    float  amplitude;
+    float  offset;
+    double step;                    // periods per ADC clock
+    double phase;                   // [0, 1)
+} sim_input_t;
+
+typedef struct {
+    bool               running;
+    int32_t            scale;
+    int32_t            offset;
+    uint64_t           step;        // counter steps per ADC clock
+    uint64_t           range;       // counter wraps at this value
+    volatile int32_t*  data;
+} sim_gen_t;
+
+typedef struct {
+    bool     we;                    // armed, samples are written
+    bool     dly_do;                // samples after the trigger are written
+    uint32_t dly_cnt;
+    uint32_t we_cnt;                // samples written before the trigger
+    uint32_t wp;
+    uint32_t wp_cur;
+    uint32_t wp_trig;
+    bool     sch[4];                // ChA rising, ChA falling, ChB rising, ChB falling
+    bool     sch_valid;             // sch holds the state of the last sample
+    uint64_t clock_rest;            // ADC clocks of the next decimated sample
+} sim_osc_t;
+
+static sim_block_t blocks[SIM_MAX_BLOCKS];
+static sim_input_t inputs[2];
+static sim_osc_t sosc;
+static uint64_t gen_counter[2];
+
+static pthread_t thread;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile bool running = false;
+
+
+static void* findBlock(size_t offset)
+{
+    for (int i = 0; i < SIM_MAX_BLOCKS; i++) {
+        if (blocks[i].mapped != NULL && blocks[i].offset == offset) {
+            return blocks[i].mapped;
+        }
+    }
+    return NULL;
+}
+
+static inline int32_t signExtend(uint32_t value, uint32_t bits)
+{
+    uint32_t sign = 1u << (bits - 1);
+    value &= (sign << 1) - 1;
+    return (int32_t)(value ^ sign) - (int32_t)sign;
+}
+
+static void genState(volatile generate_control_t* gen, int ch, sim_gen_t* state)
+{
+    memset(state, 0, sizeof(sim_gen_t));
+    state->range = 1;
+    if (gen == NULL) {
+        return;
+    }
+
+    volatile ch_properties_t* properties = ch == 0 ? &gen->properties_chA : &gen->properties_chB;
+    if (ch == 0) {
+        state->running = gen->AtriggerSelector == 1 && !gen->ASM_reset && !gen->AsetOutputTo0;
+    }
+    else {
+        state->running = gen->BtriggerSelector == 1 && !gen->BSM_reset && !gen->BsetOutputTo0;
+    }
+    state->scale = properties->amplitudeScale;
+    state->offset = signExtend(properties->amplitudeOffset, DATA_BIT_LENGTH);
+    state->step = properties->counterStep;
+    state->range = MAX((uint64_t)properties->counterWrap + 1, 65536);
+    state->data = (volatile int32_t*)((char*)gen + (ch == 0 ? CHA_DATA_OFFSET : CHB_DATA_OFFSET));
+}
+
+// DAC counts of the generator output
+static int32_t genOutput(const sim_gen_t* gen, int ch)
+{
+    if (!gen->running) {
+        return gen->offset;
+    }
+    uint32_t ptr = (uint32_t)(gen_counter[ch] >> 16) % BUFFER_LENGTH;
+    int32_t value = ((signExtend(gen->data[ptr], DATA_BIT_LENGTH) * gen->scale) >> (DATA_BIT_LENGTH - 1)) + gen->offset;
+    const int32_t max = (1 << (DATA_BIT_LENGTH - 1)) - 1;
+    return MIN(MAX(value, -max - 1), max);
+}
+
+static float inputVoltage(const sim_gen_t* gen, int ch)
+{
+    const sim_input_t* input = &inputs[ch];
+    if (input->loopback) {
+        return (float)genOutput(gen, ch) / (1 << (DATA_BIT_LENGTH - 1)) * AMPLITUDE_MAX;
+    }
+    return input->offset + input->amplitude * input->table[(uint32_t)(input->phase * BUFFER_LENGTH) % BUFFER_LENGTH];
+}
+
+static void advance(const sim_gen_t* gen, int ch, uint64_t clocks)
+{
+    if (gen->running) {
+        gen_counter[ch] = (gen_counter[ch] + gen->step * clocks) % gen->range;
+    }
+    sim_input_t* input = &inputs[ch];
+    input->phase += input->step * clocks;
+    input->phase -= floor(input->phase);
+}
+
+static int32_t adcCounts(float voltage)
+{
+    const int32_t max = (1 << (ADC_BITS - 1)) - 1;
+    int32_t cnts = (int32_t)lrintf(voltage / SIM_INPUT_FULL_SCALE * (max + 1));
+    return MIN(MAX(cnts, -max - 1), max);
+}
+
+// Schmitt triggers of the FPGA, true on the rising edge of the one selected by source
+static bool detectTrigger(uint32_t source, int32_t a, int32_t b, const int32_t thr[2], const int32_t hyst[2])
+{
+    const int32_t x[2] = { a, b };
+    bool edge[4];
+    for (int ch = 0; ch < 2; ch++) {
+        bool* sch = &sosc.sch[ch * 2];
+        bool rising = sch[0];
+        bool falling = sch[1];
+        if (x[ch] >= thr[ch]) {
+            sch[0] = true;
+        }
+        else if (x[ch] < thr[ch] - hyst[ch]) {
+            sch[0] = false;
+        }
+        if (x[ch] <= thr[ch]) {
+            sch[1] = true;
+        }
+        else if (x[ch] > thr[ch] + hyst[ch]) {
+            sch[1] = false;
+        }
+        edge[ch * 2] = sch[0] && !rising && sosc.sch_valid;
+        edge[ch * 2 + 1] = sch[1] && !falling && sosc.sch_valid;
+    }
+    // The first sample after arming only sets the state, the FPGA had it from the samples before
+    sosc.sch_valid = true;
+
+    switch (source) {
+        case RP_TRIG_SRC_NOW:     return true;
+        case RP_TRIG_SRC_CHA_PE:  return edge[0];
+        case RP_TRIG_SRC_CHA_NE:  return edge[1];
+        case RP_TRIG_SRC_CHB_PE:  return edge[2];
+        case RP_TRIG_SRC_CHB_NE:  return edge[3];
+        default:                  return false;
+    }
+}
+
+static void oscReset(volatile osc_control_t* osc)
+{
+    uint64_t clock_rest = sosc.clock_rest;
+    memset(&sosc, 0, sizeof(sosc));
+    sosc.clock_rest = clock_rest;
+    // The trigger source is not cleared, it may have been set after the reset
+    osc->wr_ptr_cur = 0;
+    osc->wr_ptr_trigger = 0;
+    osc->pre_trigger_counter = 0;
+    // A write with the arm bit set arms again, as in the FPGA
+    __sync_fetch_and_and(&osc->conf, ~(RST_WR_ST_MCH_MASK | TRIG_ST_MCH_MASK));
+}
+
+static void step(uint64_t clocks)
+{
+    volatile osc_control_t* osc = findBlock(OSC_BASE_ADDR);
+    volatile generate_control_t* gen = findBlock(GENERATE_BASE_ADDR);
+
+    sim_gen_t gens[2];
+    genState(gen, 0, &gens[0]);
+    genState(gen, 1, &gens[1]);
+
+    if (osc == NULL) {
+        advance(&gens[0], 0, clocks);
+        advance(&gens[1], 1, clocks);
+        return;
+    }
+
+    uint32_t conf = osc->conf;
+    if (conf & RST_WR_ST_MCH_MASK) {
+        oscReset(osc);
+        conf = osc->conf;
+    }
+    if ((conf & START_DATA_WRITE_MASK) && !sosc.we) {
+        sosc.we = true;
+        sosc.we_cnt = 0;
+        sosc.dly_do = false;
+        sosc.sch_valid = false;
+    }
+    else if (!(conf & START_DATA_WRITE_MASK) && sosc.we) {
+        sosc.we = false;
+        sosc.dly_do = false;
+        __sync_fetch_and_and(&osc->conf, ~TRIG_ST_MCH_MASK);
+    }
+
+    uint64_t dec = MAX(osc->data_dec & DATA_DEC_MASK, 1);
+    uint64_t samples = (sosc.clock_rest + clocks) / dec;
+    sosc.clock_rest = (sosc.clock_rest + clocks) % dec;
+
+    if (!sosc.we) {
+        advance(&gens[0], 0, clocks);
+        advance(&gens[1], 1, clocks);
+        return;
+    }
+
+    const uint32_t source = osc->trig_source & TRIG_SRC_MASK;
+    const uint32_t delay = osc->trigger_delay;
+    const bool keep = (conf & 0x8) != 0;
+    const int32_t thr[2] = { signExtend(osc->cha_thr, ADC_BITS), signExtend(osc->chb_thr, ADC_BITS) };
+    const int32_t hyst[2] = { osc->cha_hystersis & HYSTERESIS_MASK, osc->chb_hystersis & HYSTERESIS_MASK };
+    volatile uint32_t* buf_a = (volatile uint32_t*)((char*)osc + OSC_CHA_OFFSET);
+    volatile uint32_t* buf_b = (volatile uint32_t*)((char*)osc + OSC_CHB_OFFSET);
+
+    // Lower decimations than the model keeps up with run slower than the FPGA
+    samples = MIN(samples, SIM_MAX_SAMPLES);
+    for (uint64_t i = 0; i < samples && sosc.we; i++) {
+        int32_t a = adcCounts(inputVoltage(&gens[0], 0));
+        int32_t b = adcCounts(inputVoltage(&gens[1], 1));
+        advance(&gens[0], 0, dec);
+        advance(&gens[1], 1, dec);
+
+        buf_a[sosc.wp] = (uint32_t)a & ADC_BITS_MASK;
+        buf_b[sosc.wp] = (uint32_t)b & ADC_BITS_MASK;
+        sosc.wp_cur = sosc.wp;
+        sosc.wp = (sosc.wp + 1) % ADC_BUFFER_SIZE;
+        if (sosc.dly_do) {
+            sosc.dly_cnt--;
+        }
+        else if (sosc.we_cnt != UINT32_MAX) {
+            sosc.we_cnt++;
+        }
+
+        if (detectTrigger(source, a, b, thr, hyst) && !sosc.dly_do) {
+            sosc.wp_trig = sosc.wp_cur;
+            sosc.dly_do = true;
+            sosc.dly_cnt = delay;
+            __sync_fetch_and_or(&osc->conf, TRIG_ST_MCH_MASK);
+        }
+
+        if (sosc.dly_do && sosc.dly_cnt == 0) {
+            sosc.dly_do = false;
+            osc->trig_source = RP_TRIG_SRC_DISABLED;
+            if (keep) {
+                __sync_fetch_and_and(&osc->conf, ~TRIG_ST_MCH_MASK);
+            }
+            else {
+                // The counter reads 0 from here, so a start is not taken for samples written before the model sees it
+                sosc.we = false;
+                sosc.we_cnt = 0;
+                __sync_fetch_and_and(&osc->conf, ~(START_DATA_WRITE_MASK | TRIG_ST_MCH_MASK));
+                advance(&gens[0], 0, (samples - i - 1) * dec);
+                advance(&gens[1], 1, (samples - i - 1) * dec);
+            }
+        }
+    }
+
+    osc->wr_ptr_cur = sosc.wp_cur;
+    osc->wr_ptr_trigger = sosc.wp_trig;
+    osc->pre_trigger_counter = sosc.we_cnt;
+    if (gen != NULL) {
+        gen->properties_chA.buffReadPointer = (gen_counter[0] >> 16) % BUFFER_LENGTH;
+        gen->properties_chB.buffReadPointer = (gen_counter[1] >> 16) % BUFFER_LENGTH;
+    }
+}
+
+static int64_t getTimeNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void* simThread(void* arg)
+{
+    const int64_t start = getTimeNs();
+    int64_t next = start;
+    uint64_t clocks_done = 0;
+
+    while (running) {
+        // A late tick is not made up for, the next one is a full period later
+        next = MAX(next + SIM_TICK_NS, getTimeNs());
+        struct timespec ts = { .tv_sec = next / 1000000000, .tv_nsec = next % 1000000000 };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        uint64_t clocks = (uint64_t)((double)(getTimeNs() - start) * (ADC_SAMPLE_RATE / 1e9)) - clocks_done;
+        clocks_done += clocks;
+
+        pthread_mutex_lock(&mutex);
+        step(clocks);
+        pthread_mutex_unlock(&mutex);
+    }
+    return NULL;
+}
+
+int sim_Init()
+{
+    if (running) {
+        return RP_OK;
+    }
+
+    memset(&sosc, 0, sizeof(sosc));
+    gen_counter[0] = gen_counter[1] = 0;
+    sim_SetInputLoopback(RP_CH_1);
+    sim_SetInputLoopback(RP_CH_2);
+
+    running = true;
+    if (pthread_create(&thread, NULL, simThread, NULL) != 0) {
+        running = false;
+        return RP_EOMD;
+    }
+    return RP_OK;
+}
+
+int sim_Release()
+{
+    if (!running) {
+        return RP_OK;
+    }
+    running = false;
+    pthread_join(thread, NULL);
+
+    for (int i = 0; i < SIM_MAX_BLOCKS; i++) {
+        free(blocks[i].mapped);
+        blocks[i].mapped = NULL;
+    }
+    return RP_OK;
+}
+
+int sim_Map(size_t size, size_t offset, void** mapped)
+{
+    pthread_mutex_lock(&mutex);
+    int result = RP_EMMD;
+    for (int i = 0; i < SIM_MAX_BLOCKS; i++) {
+        if (blocks[i].mapped == NULL) {
+            if (posix_memalign(&blocks[i].mapped, sysconf(_SC_PAGESIZE), size) != 0) {
+                blocks[i].mapped = NULL;
+                break;
+            }
+            memset(blocks[i].mapped, 0, size);
+            blocks[i].offset = offset;
+            blocks[i].size = size;
+            *mapped = blocks[i].mapped;
+            result = RP_OK;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    return result;
+}
+
+int sim_Unmap(size_t size, void** mapped)
+{
+    if ((mapped == NULL) || (*mapped == NULL)) {
+        return RP_EUMD;
+    }
+
+    pthread_mutex_lock(&mutex);
+    int result = RP_EUMD;
+    for (int i = 0; i < SIM_MAX_BLOCKS; i++) {
+        if (blocks[i].mapped == *mapped && blocks[i].size == size) {
+            free(blocks[i].mapped);
+            blocks[i].mapped = NULL;
+            *mapped = NULL;
+            result = RP_OK;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    return result;
+}
+
+int sim_SetInput(rp_channel_t channel, rp_waveform_t type, float frequency, float amplitude, float offset)
+{
+    if (channel != RP_CH_1 && channel != RP_CH_2) {
+        return RP_EPN;
+    }
+    if (frequency < 0 || frequency > ADC_SAMPLE_RATE / 2) {
+        return RP_EOOR;
+    }
+
+    float table[BUFFER_LENGTH];
+    switch (type) {
+        case RP_WAVEFORM_SINE     : synthesis_sin      (table);            break;
+        case RP_WAVEFORM_TRIANGLE : synthesis_triangle (table);            break;
+        case RP_WAVEFORM_SQUARE   : synthesis_square   (frequency, table); break;
+        case RP_WAVEFORM_RAMP_UP  : synthesis_rampUp   (table);            break;
+        case RP_WAVEFORM_RAMP_DOWN: synthesis_rampDown (table);            break;
+        case RP_WAVEFORM_DC       : synthesis_DC       (table);            break;
+        case RP_WAVEFORM_PWM      : synthesis_PWM      (0.5f, table);      break;
+        default:                    return RP_EIPV;
+    }
+
+    pthread_mutex_lock(&mutex);
+    sim_input_t* input = &inputs[channel];
+    memcpy(input->table, table, sizeof(table));
+    input->loopback = false;
+    input->amplitude = amplitude;
+    input->offset = offset;
+    input->step = frequency / ADC_SAMPLE_RATE;
+    input->phase = 0;
+    pthread_mutex_unlock(&mutex);
+    return RP_OK;
+}
+
+int sim_SetInputLoopback(rp_channel_t channel)
+{
+    if (channel != RP_CH_1 && channel != RP_CH_2) {
+        return RP_EPN;
+    }
+
+    pthread_mutex_lock(&mutex);
+    inputs[channel].loopback = true;
+    inputs[channel].step = 0;
+    inputs[channel].phase = 0;
+    pthread_mutex_unlock(&mutex);
+    return RP_OK;
+}
@@ -0,0 +1,39 @@
+/**
+ * $Id: $
+ *
+ * @brief Red Pitaya library simulated FPGA module interface
+ *
+ * @Author Red Pitaya
+ *
+ * (c) Red Pitaya  http://www.redpitaya.com
+ *
+ * This part of code is written in C programming language.
+ * Please visit http://en.wikipedia.org/wiki/C_(programming_language)
+ * for more details on the language used herein.
+ */
+
+#ifndef SRC_SIM_H_
+#define SRC_SIM_H_
+
+#include <stddef.h>
+#include "redpitaya/rp.h"
+
+/* Period of the model thread [ns] */
+#define SIM_TICK_NS     1000000
+
+/* Decimated samples the model writes in one tick at most, the rest of the time is dropped */
+#define SIM_MAX_SAMPLES ADC_BUFFER_SIZE
+
+/* Register blocks that can be mapped at the same time */
+#define SIM_MAX_BLOCKS  8
+
+int sim_Init();
+int sim_Release();
+
+int sim_Map(size_t size, size_t offset, void** mapped);
+int sim_Unmap(size_t size, void** mapped);
+
+int sim_SetInput(rp_channel_t channel, rp_waveform_t type, float frequency, float amplitude, float offset);
+int sim_SetInputLoopback(rp_channel_t channel);
+
+#endif /* SRC_SIM_H_ */
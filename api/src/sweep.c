@@ -0,0 +1,308 @@
+/**
+ * $Id: $
+ *
+ * @brief Red Pitaya library generator frequency sweep implementation
+ *
+ * @Author Red Pitaya
+ *
+ * (c) Red Pitaya  http://www.redpitaya.com
+ *
+ * This part of code is written in C programming language.
+ * Please visit http://en.wikipedia.org/wiki/C_(programming_language)
+ * for more details on the language used herein.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "common.h"
+#include "generate.h"
+#include "gen_handler.h"
+#include "acq_handler.h"
+#include "sweep.h"
+
+/*
+ * The generator has no sequencer, so the steps are taken from here. All steps
+ * of a sweep play the same sine table, the frequency is the step of the buffer
+ * pointer (counterStep) alone. The table is written once when the sweep starts
+ * and a step is then two register writes, all the rest (frequencies the
+ * generator can make, decimations, sample counts, demodulation phase steps)
+ * is worked out before the first step.
+ *
+ * With an acquisition the scope is triggered by software after the dwell time
+ * and records whole periods after the trigger sample only. The phasors of both
+ * inputs come from a lock-in (I/Q) demodulation at the generated frequency,
+ * their ratio is the response of a device between the output and the inputs.
+ */
+
+typedef struct {
+    float    frequency;     // what the generator makes of the set frequency
+    float    amplitude;
+    uint32_t dwell_us;
+    rp_acq_decimation_t decimation;
+    uint32_t samples;       // after the trigger sample, whole periods where they fit
+    int64_t  duration_ns;   // recording time of the samples
+    double   phase_step;    // of the reference, per sample
+} sweep_plan_t;
+
+static const struct {
+    rp_acq_decimation_t decimation;
+    uint32_t factor;
+} decimations[] = {
+    {RP_DEC_1,     1},
+    {RP_DEC_8,     8},
+    {RP_DEC_64,    64},
+    {RP_DEC_1024,  1024},
+    {RP_DEC_8192,  8192},
+    {RP_DEC_65536, 65536}
+};
+
+#define DECIMATIONS (sizeof(decimations) / sizeof(decimations[0]))
+
+static rp_channel_t sweep_channel = RP_CH_1;
+static rp_gen_sweep_step_t *sweep_steps = NULL;
+static uint32_t sweep_count = 0;
+
+/* @brief Incremented by sweep_Cancel(), a sweep started before returns RP_ECAN */
+static volatile uint32_t sweep_cancel = 0;
+
+static int checkStep(const rp_gen_sweep_step_t* step)
+{
+    if (step->frequency <= FREQUENCY_MIN || step->frequency > FREQUENCY_MAX) {
+        return RP_EOOR;
+    }
+    if (step->amplitude < 0 || step->amplitude > AMPLITUDE_MAX) {
+        return RP_EOOR;
+    }
+    return RP_OK;
+}
+
+static int setSteps(rp_channel_t channel, rp_gen_sweep_step_t* steps, uint32_t count)
+{
+    free(sweep_steps);
+    sweep_channel = channel;
+    sweep_steps = steps;
+    sweep_count = count;
+    return RP_OK;
+}
+
+int sweep_SetSteps(rp_channel_t channel, const rp_gen_sweep_step_t* steps, uint32_t count)
+{
+    if (channel != RP_CH_1 && channel != RP_CH_2) {
+        return RP_EPN;
+    }
+    if (steps == NULL || count == 0) {
+        return RP_EIPV;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        int ret = checkStep(&steps[i]);
+        if (ret != RP_OK) {
+            return ret;
+        }
+    }
+
+    rp_gen_sweep_step_t *copy = malloc(count * sizeof(rp_gen_sweep_step_t));
+    if (copy == NULL) {
+        return RP_EUF;
+    }
+    memcpy(copy, steps, count * sizeof(rp_gen_sweep_step_t));
+    return setSteps(channel, copy, count);
+}
+
+int sweep_SetRange(rp_channel_t channel, float start_frequency, float stop_frequency, uint32_t count,
+                   rp_gen_sweep_scale_t scale, float amplitude, uint32_t dwell_us)
+{
+    if (channel != RP_CH_1 && channel != RP_CH_2) {
+        return RP_EPN;
+    }
+    if (count == 0 || (scale != RP_GEN_SWEEP_LIN && scale != RP_GEN_SWEEP_LOG)) {
+        return RP_EIPV;
+    }
+
+    rp_gen_sweep_step_t *steps = malloc(count * sizeof(rp_gen_sweep_step_t));
+    if (steps == NULL) {
+        return RP_EUF;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        double x = count > 1 ? (double) i / (count - 1) : 0;
+        steps[i].frequency = scale == RP_GEN_SWEEP_LOG
+                ? start_frequency * pow((double) stop_frequency / start_frequency, x)
+                : start_frequency + (stop_frequency - start_frequency) * x;
+        steps[i].amplitude = amplitude;
+        steps[i].dwell_us = dwell_us;
+        int ret = checkStep(&steps[i]);
+        if (ret != RP_OK) {
+            free(steps);
+            return ret;
+        }
+    }
+    return setSteps(channel, steps, count);
+}
+
+int sweep_GetCount(uint32_t* count)
+{
+    *count = sweep_count;
+    return RP_OK;
+}
+
+int sweep_Cancel()
+{
+    __sync_fetch_and_add(&sweep_cancel, 1);
+    return acq_WaitCancel();
+}
+
+int sweep_Release()
+{
+    return setSteps(RP_CH_1, NULL, 0);
+}
+
+/*
+ * The smallest decimation that holds the periods, so the recording is short
+ * and there are as many samples per period as possible. Below that the whole
+ * periods the buffer holds at the largest decimation are taken, or the whole
+ * buffer if it is shorter than one period.
+ */
+static void planAcquisition(sweep_plan_t* plan, uint32_t periods)
+{
+    double period = 0;
+    uint32_t whole = 0;
+    uint32_t d;
+    for (d = 0; d < DECIMATIONS; d++) {
+        period = ADC_SAMPLE_RATE / (plan->frequency * (double) decimations[d].factor);
+        whole = (uint32_t) MIN(periods, floor(ADC_BUFFER_SIZE / period));
+        if (whole == periods) {
+            break;
+        }
+    }
+    d = MIN(d, DECIMATIONS - 1);
+
+    plan->decimation = decimations[d].decimation;
+    plan->samples = whole > 0 ? (uint32_t) MIN(round(whole * period), ADC_BUFFER_SIZE) : ADC_BUFFER_SIZE;
+    plan->duration_ns = (int64_t) (plan->samples * (double) decimations[d].factor / ADC_SAMPLE_RATE * 1e9);
+    plan->phase_step = 2 * M_PI / period;
+}
+
+/*
+ * Phasor of the component at the reference frequency, |z| is the amplitude in V
+ * and arg z the phase of a cosine at the first sample. The mean is taken off,
+ * so an offset does not leak in where the samples are not whole periods. The
+ * reference is rotated from sample to sample instead of calling sin and cos.
+ */
+static void demodulate(const float* x, uint32_t size, double phase_step, float* re, float* im)
+{
+    const double cs = cos(phase_step);
+    const double sn = sin(phase_step);
+    double c = 1, s = 0;
+    double sum = 0, sum_c = 0, sum_s = 0, sum_xc = 0, sum_xs = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        sum += x[i];
+        sum_c += c;
+        sum_s += s;
+        sum_xc += x[i] * c;
+        sum_xs += x[i] * s;
+        double next = c * cs - s * sn;
+        s = s * cs + c * sn;
+        c = next;
+    }
+    double mean = sum / size;
+    *re = (float) (2 * (sum_xc - mean * sum_c) / size);
+    *im = (float) (-2 * (sum_xs - mean * sum_s) / size);
+}
+
+static void sleepUs(uint32_t us)
+{
+    struct timespec ts = {us / 1000000, (long) (us % 1000000) * 1000};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+static int acquire(const sweep_plan_t* plan, rp_acq_decimation_t* decimation, float* ch1, float* ch2, rp_gen_sweep_result_t* result)
+{
+    if (*decimation != plan->decimation) {
+        ECHECK(acq_SetDecimation(plan->decimation));
+        *decimation = plan->decimation;
+    }
+    ECHECK(acq_SetTriggerDelay((int32_t) plan->samples - ADC_BUFFER_SIZE / 2, false));
+    ECHECK(acq_Start());
+    ECHECK(acq_SetTriggerSrc(RP_TRIG_SRC_NOW));
+    // Generous, a lost trigger should end the sweep and not hang it
+    int ret = acq_WaitBufferFilled(4 * plan->duration_ns + 1000000000LL);
+    if (ret != RP_OK) {
+        return ret;
+    }
+
+    uint32_t pos;
+    uint32_t size = plan->samples;
+    ECHECK(acq_GetWritePointerAtTrig(&pos));
+    ECHECK(acq_GetDataVBulk(pos, &size, ch1, ch2));
+
+    demodulate(ch1, size, plan->phase_step, &result->ch1_re, &result->ch1_im);
+    demodulate(ch2, size, plan->phase_step, &result->ch2_re, &result->ch2_im);
+    return RP_OK;
+}
+
+static int runSteps(const sweep_plan_t* plan, uint32_t count, uint32_t cancel, float* ch1, float* ch2, rp_gen_sweep_result_t* results)
+{
+    rp_acq_decimation_t decimation;
+    ECHECK(acq_GetDecimation(&decimation));
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (cancel != sweep_cancel) {
+            return RP_ECAN;
+        }
+        ECHECK(gen_setStepFrequency(sweep_channel, plan[i].frequency));
+        ECHECK(gen_setAmplitude(sweep_channel, plan[i].amplitude));
+        sleepUs(plan[i].dwell_us);
+
+        if (results) {
+            results[i].frequency = plan[i].frequency;
+            ECHECK(acquire(&plan[i], &decimation, ch1, ch2, &results[i]));
+        }
+    }
+    return RP_OK;
+}
+
+int sweep_Run(uint32_t periods, rp_gen_sweep_result_t* results)
+{
+    uint32_t cancel = sweep_cancel;
+    if (sweep_count == 0) {
+        return RP_EIPV;
+    }
+    if (results && periods == 0) {
+        return RP_EOOR;
+    }
+
+    sweep_plan_t *plan = malloc(sweep_count * sizeof(sweep_plan_t));
+    float *ch1 = results ? malloc(2 * ADC_BUFFER_SIZE * sizeof(float)) : NULL;
+    if (plan == NULL || (results && ch1 == NULL)) {
+        free(plan);
+        free(ch1);
+        return RP_EUF;
+    }
+    float *ch2 = results ? ch1 + ADC_BUFFER_SIZE : NULL;
+
+    // Frequencies are rounded to the step of the buffer pointer, the demodulation uses the rounded ones
+    for (uint32_t i = 0; i < sweep_count; i++) {
+        double step = round(65536 * (double) sweep_steps[i].frequency / DAC_FREQUENCY * BUFFER_LENGTH);
+        plan[i].frequency = (float) (MAX(step, 1) * DAC_FREQUENCY / (65536.0 * BUFFER_LENGTH));
+        plan[i].amplitude = sweep_steps[i].amplitude;
+        plan[i].dwell_us = sweep_steps[i].dwell_us;
+        if (results) {
+            planAcquisition(&plan[i], periods);
+        }
+    }
+
+    int ret = gen_setWaveform(sweep_channel, RP_WAVEFORM_SINE);
+    if (ret == RP_OK) ret = gen_setTriggerSource(sweep_channel, RP_GEN_TRIG_SRC_INTERNAL);
+    if (ret == RP_OK) ret = gen_setAmplitude(sweep_channel, plan[0].amplitude);
+    if (ret == RP_OK) ret = gen_setFrequency(sweep_channel, plan[0].frequency);
+    if (ret == RP_OK) ret = gen_Enable(sweep_channel);
+    if (ret == RP_OK) ret = runSteps(plan, sweep_count, cancel, ch1, ch2, results);
+
+    free(plan);
+    free(ch1);
+    return ret;
+}
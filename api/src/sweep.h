@@ -0,0 +1,29 @@
+/**
+ * $Id: $
+ *
+ * @brief Red Pitaya library generator frequency sweep interface
+ *
+ * @Author Red Pitaya
+ *
+ * (c) Red Pitaya  http://www.redpitaya.com
+ *
+ * This part of code is written in C programming language.
+ * Please visit http://en.wikipedia.org/wiki/C_(programming_language)
+ * for more details on the language used herein.
+ */
+
+#ifndef SRC_SWEEP_H_
+#define SRC_SWEEP_H_
+
+#include <stdint.h>
+#include "redpitaya/rp.h"
+
+int sweep_SetSteps(rp_channel_t channel, const rp_gen_sweep_step_t* steps, uint32_t count);
+int sweep_SetRange(rp_channel_t channel, float start_frequency, float stop_frequency, uint32_t count,
+                   rp_gen_sweep_scale_t scale, float amplitude, uint32_t dwell_us);
+int sweep_GetCount(uint32_t* count);
+int sweep_Run(uint32_t periods, rp_gen_sweep_result_t* results);
+int sweep_Cancel();
+int sweep_Release();
+
+#endif /* SRC_SWEEP_H_ */
@@ -53,6 +53,12 @@ static pthread_mutex_t mutex;
 
 #define SS_8BIT		1
 #define SS_16BIT	2
+
+// Acquisition thread runs with SCHED_FIFO on the second core, the web server stays on the first one
+#define SS_OSC_THREAD_PRIORITY	50
+#define SS_OSC_THREAD_CPU		1
+// Plain text metrics report on every connection, also published to /dev/shm/rpsa_metrics
+#define SS_METRICS_PORT			8902
 //#define DEBUG_MODE
 
 
@@ -68,8 +74,29 @@ CIntParameter		ss_protocol(  		"SS_PROTOCOL", 			CBaseParameter::RW, 1 ,0,	1,2);
 CIntParameter		ss_channels(  		"SS_CHANNEL", 			CBaseParameter::RW, 1 ,0,	1,3);
 CIntParameter		ss_resolution(  	"SS_RESOLUTION", 		CBaseParameter::RW, 1 ,0,	1,2);
 CIntParameter		ss_rate(  			"SS_RATE", 				CBaseParameter::RW, 1 ,0,	1,65536);
-CIntParameter		ss_format( 			"SS_FORMAT", 			CBaseParameter::RW, 0 ,0,	0,1);
+// Local file: 0 - WAV, 1 - TDMS, 2 - v2 packs (.bin), the only one that keeps SS_COMPRESSION
+CIntParameter		ss_format( 			"SS_FORMAT", 			CBaseParameter::RW, 0 ,0,	0,2);
 CIntParameter		ss_status( 			"SS_STATUS", 			CBaseParameter::RWSA, 1 ,0,	0,100);
+CIntParameter		ss_udp_mtu(			"SS_UDP_MTU", 			CBaseParameter::RW, UDP_MTU_DEFAULT ,0,	UDP_MTU_MIN, UDP_MTU_JUMBO);
+// Lossless compression of the sample blocks: 0 - off, 1 - predictor + Rice codes
+CIntParameter		ss_compression(		"SS_COMPRESSION", 		CBaseParameter::RW, 0 ,0,	0,1);
+// Software decimation after SS_RATE: 0 - off, 1 - averaging, 2 - CIC, 3 - FIR with SS_SW_TAPS taps
+CIntParameter		ss_sw_filter(		"SS_SW_FILTER", 		CBaseParameter::RW, 0 ,0,	0,3);
+CIntParameter		ss_sw_decimation(	"SS_SW_DECIMATION", 	CBaseParameter::RW, 1 ,0,	1,DECIMATION_MAX_FACTOR);
+CIntParameter		ss_sw_taps(			"SS_SW_TAPS", 			CBaseParameter::RW, DECIMATION_FIR_DEFAULT_TAPS ,0,	2,DECIMATION_FIR_MAX_TAPS);
+// Triggered segment capture: 0 - continuous, 1 - trigger on channel 1, 2 - on channel 2.
+// Level and hysteresis in 16 bit sample units after the software decimation, edge 0 - rising, 1 - falling.
+CIntParameter		ss_trigger(			"SS_TRIGGER", 			CBaseParameter::RW, 0 ,0,	0,2);
+CIntParameter		ss_trigger_edge(	"SS_TRIGGER_EDGE", 		CBaseParameter::RW, 0 ,0,	0,1);
+CIntParameter		ss_trigger_level(	"SS_TRIGGER_LEVEL", 	CBaseParameter::RW, 0 ,0,	INT16_MIN,INT16_MAX);
+CIntParameter		ss_trigger_hyst(	"SS_TRIGGER_HYST", 		CBaseParameter::RW, 64 ,0,	0,INT16_MAX);
+CIntParameter		ss_trigger_pre(		"SS_TRIGGER_PRE", 		CBaseParameter::RW, 1024 ,0,	0,TRIGGER_MAX_PRE_SAMPLES);
+CIntParameter		ss_trigger_post(	"SS_TRIGGER_POST", 		CBaseParameter::RW, 3072 ,0,	1,INT32_MAX);
+// Local file split into segment files of SS_FILE_SEGMENT_MB megabytes or SS_FILE_SEGMENT_SEC seconds, 0 - off.
+// SS_FILE_SEGMENT_KEEP > 0 keeps only that many newest files and the recording doesn't stop on the disk limit.
+CIntParameter		ss_file_segment_mb(	"SS_FILE_SEGMENT_MB", 	CBaseParameter::RW, 0 ,0,	0,1024*1024);
+CIntParameter		ss_file_segment_sec("SS_FILE_SEGMENT_SEC", 	CBaseParameter::RW, 0 ,0,	0,INT32_MAX);
+CIntParameter		ss_file_segment_keep("SS_FILE_SEGMENT_KEEP", CBaseParameter::RW, 0 ,0,	0,65535);
 CIntParameter		ss_acd_max(			"SS_ACD_MAX", 			CBaseParameter::RW, MAX_FREQ ,0,	0, MAX_FREQ);
 CStringParameter 	redpitaya_model(	"RP_MODEL_STR", 		CBaseParameter::ROSA, RP_MODEL, 10);
 
@@ -194,6 +221,76 @@ void UpdateParams(void)
 		ss_format.Update();
 	}
 
+	if (ss_udp_mtu.IsNewValue())
+	{
+		ss_udp_mtu.Update();
+	}
+
+	if (ss_compression.IsNewValue())
+	{
+		ss_compression.Update();
+	}
+
+	if (ss_sw_filter.IsNewValue())
+	{
+		ss_sw_filter.Update();
+	}
+
+	if (ss_sw_decimation.IsNewValue())
+	{
+		ss_sw_decimation.Update();
+	}
+
+	if (ss_sw_taps.IsNewValue())
+	{
+		ss_sw_taps.Update();
+	}
+
+	if (ss_trigger.IsNewValue())
+	{
+		ss_trigger.Update();
+	}
+
+	if (ss_trigger_edge.IsNewValue())
+	{
+		ss_trigger_edge.Update();
+	}
+
+	if (ss_trigger_level.IsNewValue())
+	{
+		ss_trigger_level.Update();
+	}
+
+	if (ss_trigger_hyst.IsNewValue())
+	{
+		ss_trigger_hyst.Update();
+	}
+
+	if (ss_trigger_pre.IsNewValue())
+	{
+		ss_trigger_pre.Update();
+	}
+
+	if (ss_trigger_post.IsNewValue())
+	{
+		ss_trigger_post.Update();
+	}
+
+	if (ss_file_segment_mb.IsNewValue())
+	{
+		ss_file_segment_mb.Update();
+	}
+
+	if (ss_file_segment_sec.IsNewValue())
+	{
+		ss_file_segment_sec.Update();
+	}
+
+	if (ss_file_segment_keep.IsNewValue())
+	{
+		ss_file_segment_keep.Update();
+	}
+
 	if (ss_start.IsNewValue())
 	{
 		PrintLogInFile("command");
@@ -244,6 +341,22 @@ void StartServer(){
 	auto channel = ss_channels.Value();
 	auto rate = ss_rate.Value();
 	auto ip_addr_host = ss_ip_addr.Value();
+	auto udp_mtu = ss_udp_mtu.Value();
+	auto sw_filter = ss_sw_filter.Value();
+	auto sw_decimation = ss_sw_decimation.Value();
+	auto sw_taps = ss_sw_taps.Value();
+	auto compression = ss_compression.Value();
+	TriggerSettings trigger;
+	trigger.source = static_cast<TriggerSource>(ss_trigger.Value());
+	trigger.edge = ss_trigger_edge.Value() == 1 ? TriggerEdge::FALLING : TriggerEdge::RISING;
+	trigger.level = ss_trigger_level.Value();
+	trigger.hysteresis = ss_trigger_hyst.Value();
+	trigger.preSamples = ss_trigger_pre.Value();
+	trigger.postSamples = ss_trigger_post.Value();
+	FileRotation rotation;
+	rotation.segmentBytes = (uint64_t)ss_file_segment_mb.Value() * 1024 * 1024;
+	rotation.segmentSeconds = ss_file_segment_sec.Value();
+	rotation.keepFiles = ss_file_segment_keep.Value();
 
 	std::vector<UioT> uioList = GetUioList();
 
@@ -276,13 +389,17 @@ void StartServer(){
 				ip_addr_host,
 				std::to_string(sock_port).c_str(),
 				protocol == 1 ? asionet::Protocol::TCP : asionet::Protocol::UDP);
+		s_manger->setUdpMtu(udp_mtu);
 	}else{
-		s_manger = CStreamingManager::Create((format == 0 ? Stream_FileType::WAV_TYPE: Stream_FileType::TDMS_TYPE) , FILE_PATH);
+		Stream_FileType file_type = format == 0 ? Stream_FileType::WAV_TYPE : (format == 1 ? Stream_FileType::TDMS_TYPE : Stream_FileType::BIN_TYPE);
+		s_manger = CStreamingManager::Create(file_type, FILE_PATH);
+		s_manger->setFileRotation(rotation);
 		s_manger->notifyStop = [](int status)
 							{
 								StopNonBlocking(2);
 							};
 	}
+	s_manger->setCompression(compression == 1 ? StreamCompression::RICE : StreamCompression::NONE);
 
 
 	if (s_app!= nullptr){
@@ -291,6 +408,14 @@ void StartServer(){
 	}
 	int resolution_val = (resolution == 1 ? 8 : 16);
 	s_app = new CStreamingApplication(s_manger, osc, resolution_val, rate, channel);
+	s_app->setOscThreadOptions(SS_OSC_THREAD_PRIORITY, SS_OSC_THREAD_CPU);
+	s_app->setMetricsPort(SS_METRICS_PORT);
+	if (!s_app->setDecimation(static_cast<DecimationFilter>(sw_filter), sw_decimation, sw_taps)){
+		fprintf(stderr, "Error: software decimation %d by %d is not supported, streaming without it\n", sw_filter, sw_decimation);
+	}
+	if (!s_app->setTrigger(trigger)){
+		fprintf(stderr, "Error: trigger settings are not supported or the channel is off, streaming continuously\n");
+	}
 	ss_status.SendValue(1);
 	PrintLogInFile("ss_status.SendValue(1)");
     s_app->runNonBlock();
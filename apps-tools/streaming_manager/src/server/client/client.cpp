@@ -21,6 +21,10 @@ long long int                         g_timeBegin;
 uint64_t                              g_lostRate;
 uint64_t                              g_packCounter_ch1;
 uint64_t                              g_packCounter_ch2;
+uint64_t                              g_badPacks;
+uint64_t                              g_lostPacks;
+uint64_t                              g_lastId;
+bool                                  g_hasLastId;
 
 char* getCmdOption(char ** begin, char ** end, const std::string & option)
 {
@@ -95,6 +99,7 @@ void UsingArgs(char const* progName){
     std::cout << "\t-p Protocol (TCP or UDP required value)\n";
     std::cout << "\t-f Path to the directory where to save files\n";
     std::cout << "\t-t Type of file (tdms or wav required value)\n";
+    std::cout << "\t-c Ask the server to add CRC32C to every pack\n";
 
 
 }
@@ -126,28 +131,29 @@ std::string time_point_to_string(std::chrono::system_clock::time_point &tp)
 void reciveData(std::error_code error,uint8_t *buff,size_t _size){
      //std::cout << "Get data: " <<  _size << "\n";
      g_BytesCount += _size;
-     uint8_t *ch1 = nullptr;
-     uint8_t *ch2 = nullptr;
-     size_t   size_ch1 = 0;
-     size_t   size_ch2 = 0;
-     uint64_t id = 0;
-     uint64_t lostRate = 0;
-     uint32_t oscRate = 0;
-     uint32_t resolution = 0;
-     asionet::CAsioNet::ExtractPack(buff,_size, id, lostRate,oscRate, resolution, ch1, size_ch1, ch2 , size_ch2);
+     asionet::PackView pack;
+     // The channel data is passed straight from the receive buffer
+     if (asionet::CAsioNet::ExtractPack(buff,_size, pack) != asionet::PACK_OK){
+         g_badPacks++;
+         return;
+     }
 
-     g_packCounter_ch1 += size_ch1 / (resolution == 16 ? 2 : 1);
-     g_packCounter_ch2 += size_ch2 / (resolution == 16 ? 2 : 1);
-     g_lostRate += lostRate;
+     if (pack.version >= PACK_VERSION_2){
+         if (g_hasLastId && pack.id > g_lastId + 1)
+             g_lostPacks += pack.id - g_lastId - 1;
+         g_lastId = pack.id;
+         g_hasLastId = true;
+     }
 
+     g_packCounter_ch1 += pack.size_ch1 / (pack.resolution == 16 ? 2 : 1);
+     g_packCounter_ch2 += pack.size_ch2 / (pack.resolution == 16 ? 2 : 1);
+     g_lostRate += pack.lostRate;
 
-     g_manger->passBuffers(lostRate, oscRate, ch1 , size_ch1 ,  ch2 , size_ch2 , resolution, id);
 
+     g_manger->passBuffers(pack.lostRate, pack.oscRate, pack.ch1 , pack.size_ch1 ,  pack.ch2 , pack.size_ch2 , pack.resolution, pack.id, pack.info);
 
-//     std::cout << id << " ; " <<  _size  <<  " ; " << resolution << " ; " << size_ch1 << " ; " << size_ch2 << "\n";
 
-     delete [] ch1;
-     delete [] ch2;
+//     std::cout << pack.id << " ; " <<  _size  <<  " ; " << pack.resolution << " ; " << pack.size_ch1 << " ; " << pack.size_ch2 << "\n";
 
      std::chrono::system_clock::time_point timeNow = std::chrono::system_clock::now();
      auto curTime = std::chrono::time_point_cast<std::chrono::milliseconds >(timeNow);
@@ -157,9 +163,12 @@ void reciveData(std::error_code error,uint8_t *buff,size_t _size){
      if ((value.count() - g_timeBegin) >= 5000) {
 
          std::cout << time_point_to_string(timeNow) << " bandwidth: " << g_BytesCount / (1024 * 1024 * 5) << " MiB/s;\nData count ch1:\t" << g_packCounter_ch1
-                 << " ch2:\t" << g_packCounter_ch2 <<  " Lost: \t"<< g_lostRate << "\n\n";
+                 << " ch2:\t" << g_packCounter_ch2 <<  " Lost: \t"<< g_lostRate
+                 << "\nLost packs:\t" << g_lostPacks << " Bad packs:\t" << g_badPacks << "\n\n";
          g_BytesCount = 0;
          g_lostRate = 0;
+         g_lostPacks = 0;
+         g_badPacks = 0;
          g_timeBegin = value.count();
      }
 
@@ -189,6 +198,10 @@ int main(int argc, char* argv[])
         g_packCounter_ch2 = 0;
         g_lostRate = 0;
         g_BytesCount = 0;
+        g_badPacks = 0;
+        g_lostPacks = 0;
+        g_lastId = 0;
+        g_hasLastId = false;
         g_terminate = false;
         signal(SIGINT, sigHandler);
       //  signal(SIGKILL, sigHandler);
@@ -242,6 +255,8 @@ int main(int argc, char* argv[])
                                            sigHandler(0);
                                        });
         g_asionet->addCallReceived(reciveData);
+        g_asionet->addCallReceivedError([](std::error_code error) { g_badPacks++; });
+        g_asionet->SetRequestVersion(PACK_VERSION_2, cmdOptionExists(argv, argv + argc, "-c") ? PACK_FLAG_CRC : 0);
         g_asionet->Start();
         while(g_manger->isFileThreadWork() &&  !g_terminate){
 #ifdef _WIN32
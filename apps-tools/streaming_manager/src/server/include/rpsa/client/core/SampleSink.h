@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rpsa/server/core/BlockInfo.h"
+#include "rpsa/server/core/StreamingManager.h"
+
+// One decoded pack as handed to the sinks. Channel pointers are only valid during write(),
+// a channel that was not sent has size 0.
+struct SampleBlock
+{
+    uint64_t  id;
+    uint64_t  timestamp;    // server time of the block in us since epoch, 0 for v1 packs
+    uint64_t  receiveTime;  // local time the pack was received, us since epoch
+    uint64_t  lostRate;
+    uint32_t  oscRate;
+    uint32_t  resolution;   // 8 or 16 bits per sample
+    BlockInfo info;
+    const uint8_t *ch1;
+    size_t    size_ch1;
+    const uint8_t *ch2;
+    size_t    size_ch2;
+};
+
+// Consumer of the received blocks. All calls come from the client's sink thread.
+class CSampleSink
+{
+public:
+    using Ptr = std::shared_ptr<CSampleSink>;
+
+    virtual ~CSampleSink() {}
+
+    virtual bool open() { return true; }
+    virtual void write(const SampleBlock &_block) = 0;
+    virtual void close() {}
+};
+
+// Channel data as it comes, two channels are interleaved sample by sample.
+class CRawFileSink: public CSampleSink
+{
+public:
+    using Ptr = std::shared_ptr<CRawFileSink>;
+
+    static Ptr Create(std::string _filePath);
+    CRawFileSink(std::string _filePath);
+    ~CRawFileSink();
+
+    bool open() override;
+    void write(const SampleBlock &_block) override;
+    void close() override;
+
+    uint64_t samples() { return m_samples; }
+    // Blocks that were skipped because the layout changed mid stream
+    uint64_t skipped() { return m_skipped; }
+
+protected:
+    // Called once before the first sample and again from close() with the final count
+    virtual bool writeHeader() { return true; }
+
+    std::string m_filePath;
+    FILE       *m_file;
+    uint32_t    m_resolution;
+    uint32_t    m_channels;
+    uint64_t    m_samples;
+
+private:
+    uint64_t    m_skipped;
+    std::vector<uint8_t> m_interleaved;
+};
+
+// numpy .npy file with shape (samples,) or (samples, 2), readable with numpy.load()
+class CNpySink: public CRawFileSink
+{
+public:
+    using Ptr = std::shared_ptr<CNpySink>;
+
+    static Ptr Create(std::string _filePath);
+    CNpySink(std::string _filePath);
+    // The header with the final count is written here, in ~CRawFileSink() writeHeader() is no longer this one
+    ~CNpySink();
+
+protected:
+    bool writeHeader() override;
+};
+
+// WAV or TDMS through the same file writer the server uses in local mode.
+// A new file is created in _dirPath on every open().
+class CStreamFileSink: public CSampleSink
+{
+public:
+    using Ptr = std::shared_ptr<CStreamFileSink>;
+
+    static Ptr Create(Stream_FileType _fileType, std::string _dirPath);
+    CStreamFileSink(Stream_FileType _fileType, std::string _dirPath);
+
+    bool open() override;
+    void write(const SampleBlock &_block) override;
+    void close() override;
+
+private:
+    Stream_FileType         m_fileType;
+    std::string             m_dirPath;
+    CStreamingManager::Ptr  m_manager;
+};
+
+class CCallbackSink: public CSampleSink
+{
+public:
+    using Ptr = std::shared_ptr<CCallbackSink>;
+    typedef std::function<void(const SampleBlock &)> Callback;
+
+    static Ptr Create(Callback _callback);
+    CCallbackSink(Callback _callback);
+
+    void write(const SampleBlock &_block) override;
+
+private:
+    Callback m_callback;
+};
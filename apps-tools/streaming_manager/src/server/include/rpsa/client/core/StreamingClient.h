@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rpsa/server/core/AsioNet.h"
+#include "rpsa/common/core/block_ring.h"
+#include "SampleSink.h"
+
+#define CLIENT_QUEUE_BLOCKS 256
+
+struct ClientCounters
+{
+    uint64_t packs;         // packs passed to the sinks
+    uint64_t bytes;         // channel data of these packs
+    uint64_t wireBytes;     // the same as received, smaller than bytes for encoded packs
+    uint64_t lostPacks;     // gaps in the pack ids, lost on the network or dropped by the server
+    uint64_t lostSamples;   // samples the server reported as dropped before sending
+    uint64_t badPacks;      // broken headers, sizes, CRC or encoded data
+    uint64_t queueDrops;    // packs dropped because the sinks did not keep up
+    uint64_t queueMax;      // queue high water mark, in packs
+    uint64_t segments;      // triggered segments the packs were cut from
+};
+
+// Receives packs from a streaming server and hands them to the sinks.
+// The network thread only validates a pack and copies it into a lock-free queue,
+// decoding into SampleBlock and all the sink work happen on a separate thread.
+// Encoded packs (PACK_FLAG_RICE) stay encoded in the queue and are decoded on that thread.
+class CStreamingClient
+{
+public:
+    using Ptr = std::shared_ptr<CStreamingClient>;
+
+    static Ptr Create(std::string _host, std::string _port, asionet::Protocol _protocol, size_t _queueBlocks = CLIENT_QUEUE_BLOCKS);
+    CStreamingClient(std::string _host, std::string _port, asionet::Protocol _protocol, size_t _queueBlocks);
+    ~CStreamingClient();
+
+    // Sinks and the requested protocol version must be set before start()
+    void addSink(CSampleSink::Ptr _sink);
+    void setRequestVersion(uint16_t _version, uint32_t _flags);
+
+    bool start();
+    // Disconnects, passes the packs still queued to the sinks and closes them
+    void stop();
+
+    bool isConnected();
+    ClientCounters getCounters();
+
+    // Passes the packs of a BIN_TYPE recording to the sinks on the calling thread, the sinks are
+    // opened and closed around it. Not while started. Returns the number of packs, -1 if the file can't be read.
+    int64_t replay(const std::string &_filePath);
+
+    std::function<void(std::error_code)> notifyError;
+
+private:
+    CStreamingClient(const CStreamingClient &) = delete;
+    CStreamingClient(CStreamingClient &&) = delete;
+
+    void received(std::error_code _error, uint8_t *_buffer, size_t _size);
+    void sinkTask();
+    bool passQueued();
+    void passBlock(SampleBlock &_sample, size_t _rawSize);
+    bool openSinks();
+    void closeSinks();
+
+    std::string       m_host;
+    std::string       m_port;
+    asionet::Protocol m_protocol;
+    uint16_t          m_version;
+    uint32_t          m_flags;
+    asionet::CAsioNet::Ptr m_asionet;
+    std::vector<CSampleSink::Ptr> m_sinks;
+    std::vector<uint8_t> m_decoded;
+
+    CBlockRing        m_ring;
+    std::thread      *m_sinkThread;
+    std::atomic_bool  m_sinkRun;
+    std::atomic_bool  m_sinkWaiting;
+    std::mutex        m_sinkMutex;
+    std::condition_variable m_sinkCond;
+
+    bool              m_hasId;
+    uint64_t          m_nextId;
+    std::atomic<uint64_t> m_packs;
+    std::atomic<uint64_t> m_bytes;
+    std::atomic<uint64_t> m_wireBytes;
+    std::atomic<uint64_t> m_lostPacks;
+    std::atomic<uint64_t> m_lostSamples;
+    std::atomic<uint64_t> m_badPacks;
+    std::atomic<uint64_t> m_queueDrops;
+    std::atomic<uint64_t> m_segments;
+    uint64_t          m_lastSegment;
+};
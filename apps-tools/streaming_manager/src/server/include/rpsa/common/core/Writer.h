@@ -31,16 +31,33 @@ namespace TDMS
 
     };
 
+    struct RawBlock {
+        uint32_t    type;
+        uint64_t    count;
+        const void *data;
+    };
+
     class Writer {
         iostream *m_fileStream;
         BinaryStream m_bstream;
         bool m_is_append;
         vector<std::ios::pos_type> m_stek_pos_g;
         vector<std::ios::pos_type> m_stek_pos_p;
+        bool m_incremental;
+        int32_t m_layoutVersion;
+        vector<pair<uint32_t,uint64_t>> m_layout;
     public:
         Writer(iostream &fileStream, bool append);
+        void SetStream(iostream &fileStream);
         void Write(WriterSegment &segment);
         uint64_t GetFileSize();
+
+        // Incremental mode. Write() remembers the raw data layout of the segment and
+        // WriteRaw() emits blocks with the same layout as lead-in + raw data only,
+        // reusing the object list of the previous segment.
+        void SetIncremental(bool enable);
+        void ResetLayout();
+        bool WriteRaw(const RawBlock *blocks, size_t count);
     private:
         void WriteSegment(long offset, shared_ptr<Metadata> leadin);
         int64_t  WriteRawHeader(shared_ptr<Metadata> metadata);
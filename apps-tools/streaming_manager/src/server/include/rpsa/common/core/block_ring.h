@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <streambuf>
+
+#define BLOCK_RING_ALIGN 64
+#define BLOCK_FLAG_NEW_FILE 0x1 // the consumer starts the next file before writing the block
+
+// One slot of the ring. Data buffers are allocated by CBlockRing::allocate() before the
+// producer starts and never grow, a block that doesn't fit fails. Slots are padded to a cache line.
+struct CBlock
+{
+    uint8_t *data;
+    size_t   capacity;
+    size_t   size;
+    uint32_t flags;     // BLOCK_FLAG_*, cleared by acquireWrite()
+    uint8_t  pad[BLOCK_RING_ALIGN - sizeof(uint8_t*) - 2 * sizeof(size_t) - sizeof(uint32_t)];
+};
+
+// Fixed-capacity single-producer/single-consumer ring of blocks.
+// The producer calls acquireWrite()/commitWrite(), the consumer peekRead()/releaseRead().
+class CBlockRing
+{
+public:
+    CBlockRing(size_t _count);
+    ~CBlockRing();
+
+    CBlock* acquireWrite();
+    void    commitWrite();
+    CBlock* peekRead();
+    void    releaseRead();
+
+    // Drop all queued blocks. Only call when the consumer is stopped.
+    void    reset();
+    // Resize the ring to _count slots of _blockSize bytes each, the memory is touched so that
+    // the producer doesn't page fault on it. Drops the queued blocks, only call when both sides
+    // are stopped. Slots already as large are kept. On failure the ring has no usable slots.
+    bool    allocate(size_t _count, size_t _blockSize);
+
+    size_t  count();
+    size_t  usedBytes();
+    size_t  highWaterMark();
+    size_t  capacity() { return m_count; }
+
+    // Never allocates, true if the slot can hold _size bytes
+    static bool fits(const CBlock *_block, size_t _size);
+
+private:
+    CBlockRing(const CBlockRing &) = delete;
+    CBlockRing& operator=(const CBlockRing &) = delete;
+    void freeBlocks();
+
+    // Padding instead of alignas: the ring is a member of heap allocated objects,
+    // and C++14 operator new doesn't honour extended alignment
+    CBlock *m_blocks;
+    size_t  m_count;
+    uint8_t m_pad0[BLOCK_RING_ALIGN];
+    std::atomic<size_t> m_head; // written by producer
+    uint8_t m_pad1[BLOCK_RING_ALIGN - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_tail; // written by consumer
+    uint8_t m_pad2[BLOCK_RING_ALIGN - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_usedBytes;
+    std::atomic<size_t> m_highWaterMark;
+};
+
+// Stream buffer writing into a ring block. Supports seeking inside the written area,
+// which the TDMS writer needs to patch segment offsets. Writing past the block capacity fails.
+class CBlockStreamBuf: public std::streambuf
+{
+public:
+    CBlockStreamBuf();
+    void attach(CBlock *_block);
+    void detach();
+    char* reserve(size_t _size);
+
+protected:
+    int_type        overflow(int_type _ch) override;
+    std::streamsize xsputn(const char *_s, std::streamsize _n) override;
+    pos_type        seekoff(off_type _off, std::ios_base::seekdir _dir, std::ios_base::openmode _which) override;
+    pos_type        seekpos(pos_type _pos, std::ios_base::openmode _which) override;
+
+private:
+    void commitSize();
+
+    CBlock *m_block;
+};
+
+class CBlockStream: public std::iostream
+{
+public:
+    CBlockStream();
+    void attach(CBlock *_block);
+    void detach();
+    // Take _size bytes at the put position to be filled in place.
+    // Returns nullptr and sets badbit if the block is full.
+    uint8_t* reserve(size_t _size);
+
+private:
+    CBlockStreamBuf m_buf;
+};
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32C (Castagnoli). Start with _crc = 0, pass the previous result to continue over
+// several buffers: crc32c(crc32c(0, a, n), b, m) == crc32c(0, ab, n + m)
+uint32_t crc32c(uint32_t _crc, const void *_data, size_t _size);
+
+// Table (slicing-by-8) kernel used when the CPU has no CRC instruction, exposed for testing
+uint32_t crc32c_table(uint32_t _crc, const void *_data, size_t _size);
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#define DECIMATION_MAX_FACTOR       65536
+#define DECIMATION_FIR_DEFAULT_TAPS 32
+#define DECIMATION_FIR_MAX_TAPS     256
+#define DECIMATION_CIC_DEFAULT_ORDER 3
+#define DECIMATION_CIC_MAX_ORDER    5
+
+// Software decimation after the FPGA decimation, on 16 bit samples
+enum class DecimationFilter {
+    NONE,
+    AVERAGE,    // mean of every _factor samples
+    CIC,        // cascaded integrator-comb, _order stages, unity DC gain
+    FIR         // windowed sinc low pass with _taps coefficients, cut off at 0.45 of the output rate
+};
+
+// Decimates one channel. The filter state is kept between blocks, so a block may end in the
+// middle of an output period. Output sample m is computed from the input up to sample (m + 1) * factor - 1.
+class CDecimator
+{
+public:
+    using Ptr = std::shared_ptr<CDecimator>;
+
+    // Returns nullptr for a factor out of 1..DECIMATION_MAX_FACTOR, a taps count out of
+    // 2..DECIMATION_FIR_MAX_TAPS or an order out of 1..DECIMATION_CIC_MAX_ORDER.
+    // A CIC factor is limited so the integrators can't overflow.
+    static Ptr Create(DecimationFilter _filter, uint32_t _factor,
+                      uint32_t _taps = DECIMATION_FIR_DEFAULT_TAPS,
+                      uint32_t _order = DECIMATION_CIC_DEFAULT_ORDER);
+    CDecimator(DecimationFilter _filter, uint32_t _factor, uint32_t _taps, uint32_t _order);
+
+    // Filters _count samples into _out and returns the number of output samples,
+    // at most _count / factor + 1. _out must not overlap _in.
+    size_t process(const int16_t *_in, size_t _count, int16_t *_out);
+    // Drops the filter history and the partial output period, used after lost samples
+    void reset();
+
+    DecimationFilter getFilter() const { return m_filter; }
+    uint32_t getFactor() const { return m_factor; }
+    const std::vector<int16_t>& getCoefficients() const { return m_coefs; }
+
+    // High byte of each sample, as memcpy_stride_8bit_neon gives for the undecimated data.
+    // _dst may be the same buffer as _src.
+    static void narrow8(int8_t *_dst, const int16_t *_src, size_t _count);
+
+private:
+    size_t processAverage(const int16_t *_in, size_t _count, int16_t *_out);
+    size_t processCic(const int16_t *_in, size_t _count, int16_t *_out);
+    size_t processFir(const int16_t *_in, size_t _count, int16_t *_out);
+
+    DecimationFilter m_filter;
+    uint32_t         m_factor;
+    uint32_t         m_order;
+    // Input samples still missing to the next output
+    uint32_t         m_remain;
+
+    // AVERAGE: sum of the current period, 1/factor in Q32
+    int64_t          m_sum;
+    int64_t          m_scale;
+
+    // CIC: integrator and comb delay registers, modular arithmetic
+    uint64_t         m_integrators[DECIMATION_CIC_MAX_ORDER];
+    uint64_t         m_combs[DECIMATION_CIC_MAX_ORDER];
+    double           m_cicGain;    // 1 / factor^order
+
+    // FIR: Q15 coefficients and the last taps - 1 input samples
+    std::vector<int16_t> m_coefs;
+    std::vector<int16_t> m_history;
+    std::vector<int16_t> m_stitch;
+};
+
+// Kernels used by CDecimator, exposed for benchmarking.
+// Sum of _count samples.
+int64_t decimator_sum_scalar(const int16_t *_in, size_t _count);
+// Q15 dot product of _count coefficients and samples, rounded and saturated to 16 bit
+int16_t decimator_dot_scalar(const int16_t *_coefs, const int16_t *_in, size_t _count);
+
+#ifdef ARCH_ARM
+int64_t decimator_sum_neon(const int16_t *_in, size_t _count);
+int16_t decimator_dot_neon(const int16_t *_coefs, const int16_t *_in, size_t _count);
+#endif
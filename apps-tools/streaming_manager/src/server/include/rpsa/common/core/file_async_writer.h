@@ -1,42 +1,50 @@
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <mutex>
 #include <thread>
 #include <vector>
-#include <list>
 #include <asio.hpp>
 #include <fstream>
 #include <iostream>
 #include "thread_cout.h"
 #include "types.h"
+#include "block_ring.h"
+#include "writer_backend.h"
 
 
 #define USING_FREE_SPACE 1024 * 1024 * 30 // Left free on disk 30 Mb
+#define FILE_QUEUE_BLOCKS 256 // Blocks between acquisition and writer thread
+#define FILE_BLOCK_SIZE_DEFAULT (2 * 65536) // Channel data of a block, both channels of a default DMA buffer
+#define FILE_BLOCK_HEADER_SIZE 4096 // Room for the WAV header, TDMS metadata or pack header in front of the data
+#define FILE_CHECKPOINT_SIZE 1024 * 1024 * 16 // Header update and flush interval
 
 
+namespace TDMS{
+    class Writer;
+}
+
+// Splitting of a recording into files, each with its own WAV header or TDMS metadata.
+// A new file starts with the first block after segmentBytes or segmentSeconds, 0 turns
+// the limit off, both 0 - one file. With segmentBytes every file is preallocated to that
+// size. keepFiles > 0 makes a ring: the oldest files are deleted so that at most keepFiles
+// stay, and the disk limit deletes old files instead of stopping the recording.
+struct FileRotation{
+    uint64_t segmentBytes;
+    uint32_t segmentSeconds;
+    uint32_t keepFiles;
+};
+
 enum Stream_FileType{
     TDMS_TYPE,
     WAV_TYPE,
+    BIN_TYPE,   // protocol v2 packs back to back, the only format that keeps encoded blocks
 };
 
-class Queue
-{
-public:
-    long queueSize();
-protected:
-    Queue();
-    ~Queue();
-    void pushQueue(std::iostream* buffer);
-    std::iostream* popQueue();
-    long long int  m_useMemory;    
-private:
-    std::list<std::iostream*> m_queue;
-    std::mutex mutex_;    
-};
-
-
-class FileQueueManager:public Queue{
-    std::fstream fs;
+class FileQueueManager{
+    CWriterBackend::Ptr  m_writer;
+    CWriterBackend::Type m_writerType;
     std::thread *th;
     std::atomic_flag m_ThreadRun = ATOMIC_FLAG_INIT;
     bool m_threadWork;
@@ -49,18 +57,65 @@ class FileQueueManager:public Queue{
    ulong m_freeSize;
    ulong m_hasWriteSize;   
 unsigned long long m_aviablePhyMemory; 
+    uint64_t m_lastCheckpoint;
+    uint64_t m_writeBytes;
+    std::chrono::duration<double> m_writeTime;
+    size_t           m_queueBlocks;
+    size_t           m_blockSize;
+    CBlockRing       m_ring;
+    CBlockStream     m_blockStream;
+    CBlock          *m_writeBlock;
+    TDMS::Writer    *m_tdmsWriter;
+
+    FileRotation     m_rotation;
+    bool             m_rotationActive;
+    // Producer side of the rotation
+    uint64_t         m_segmentProduced;
+    std::chrono::steady_clock::time_point m_segmentStart;
+    bool             m_rotatePending;
+    // Writer thread side
+    std::string      m_baseName;
+    std::string      m_dirName;
+    uint32_t         m_segmentNumber;
+    std::deque<std::string> m_segmentFiles;
+    bool             m_preallocateWarned;
+
+    bool OpenWriter(std::string _fileName, bool _append);
+    void CloseWriter();
+    void OpenSegment();
+    bool DeleteOldestSegment();
+    bool SegmentDue();
 public:
-    FileQueueManager();
+    FileQueueManager(size_t _queueBlocks = FILE_QUEUE_BLOCKS);
     ~FileQueueManager();
     static ulong GetFreeSpaceDisk(std::string _filePath);
     void StartWrite(Stream_FileType _fileType);
     void StopWrite(bool waitAllWrite);
     bool IsWork() { return  m_threadWork && !m_hasErrorWrite;};
     int  WriteToFile();
-    bool AddBufferToWrite(std::iostream *buffer);
+    // Producer side. BeginBlock returns a stream bound to a free block or nullptr if the queue is full.
+    // _newFile is set if the block starts the next segment file, the caller then puts the file header in.
+    CBlockStream* BeginBlock(bool *_newFile = nullptr);
+    bool CommitBlock();
+    long   queueSize();
+    size_t queueHighWaterMark();
+    size_t queueUsedMemory();
+    void SetWriterType(CWriterBackend::Type _type) { m_writerType = _type; }
+    // Largest channel data of one block. StartWrite() preallocates the queue for it,
+    // larger blocks are dropped.
+    void SetBlockSize(size_t _size) { m_blockSize = _size; }
+    // Takes effect with the next OpenFile(), not used for appending
+    void SetRotation(const FileRotation &_rotation) { m_rotation = _rotation; }
+    // With rotation FileName is the base name, the files get a segment number before the extension
     void OpenFile(std::string FileName,bool append);
     void CloseFile();
+    void Checkpoint();
+    static std::string SegmentFileName(std::string _baseName, uint32_t _segment);
+    // Disk throughput of the last file in bytes per second
+    double GetWriteSpeed();
 static int  AvailableSpace(std::string dst, ulong* availableSize);
-    std::iostream *BuildTDMSStream(uint8_t* buffer_ch1,size_t size_ch1,uint8_t* buffer_ch2,size_t size_ch2,unsigned short resolution);
-    void updateWavFile(int _size);
+    // Metadata is written with the first block of a file, next blocks with the same layout get a raw data segment only.
+    // sampleRate > 0 adds wf_increment to the channel properties.
+    void BuildTDMSStream(std::iostream *memory,const uint8_t* buffer_ch1,size_t size_ch1,const uint8_t* buffer_ch2,size_t size_ch2,unsigned short resolution,double sampleRate = 0);
+    void updateWavFile();
 };
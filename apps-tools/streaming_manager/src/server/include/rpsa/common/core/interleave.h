@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Interleave two channels sample by sample: dst = a0 b0 a1 b1 ...
+// dst must hold 2 * count samples. Buffers don't need any alignment.
+void interleave8(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t count);
+void interleave16(uint16_t *dst, const uint16_t *a, const uint16_t *b, size_t count);
+
+// Kernels used by the dispatch above, exposed for benchmarking
+void interleave8_scalar(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t count);
+void interleave16_scalar(uint16_t *dst, const uint16_t *a, const uint16_t *b, size_t count);
+
+#ifdef ARCH_ARM
+void interleave8_neon(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t count);
+void interleave16_neon(uint16_t *dst, const uint16_t *a, const uint16_t *b, size_t count);
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define INTERLEAVE_X86
+void interleave8_sse2(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t count);
+void interleave16_sse2(uint16_t *dst, const uint16_t *a, const uint16_t *b, size_t count);
+void interleave8_avx2(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t count);
+void interleave16_avx2(uint16_t *dst, const uint16_t *a, const uint16_t *b, size_t count);
+bool interleave_has_avx2();
+#endif
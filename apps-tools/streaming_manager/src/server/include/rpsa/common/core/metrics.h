@@ -0,0 +1,162 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define METRICS_NAME_SIZE   48
+#define METRICS_PAGE_SIZE   4096
+#define METRICS_PAGE_NAME   "/rpsa_metrics"     // shm_open() name, /dev/shm/rpsa_metrics on Linux
+#define METRICS_PAGE_MAGIC  0x3154454D41535052ull // "RPSAMET1"
+#define METRICS_PAGE_VERSION 1
+
+// Histogram buckets: values below 16 exactly, above that 16 linear sub-buckets per power of two,
+// so a percentile is off by at most 1/16 of its value
+#define METRICS_SUB_BUCKET_BITS 4
+#define METRICS_BUCKETS ((64 - METRICS_SUB_BUCKET_BITS + 1) << METRICS_SUB_BUCKET_BITS)
+
+enum MetricType : uint32_t {
+    METRIC_COUNTER,     // monotonic total, reported with its rate
+    METRIC_GAUGE,       // current level, reported with the maximum seen in the last period
+    METRIC_HISTOGRAM    // latencies in ns, reported as percentiles over the last period
+};
+
+// All record methods are lock-free and may be called from any thread
+class CMetricCounter
+{
+public:
+    CMetricCounter(): m_value(0) {}
+    void add(uint64_t _value) { m_value.fetch_add(_value, std::memory_order_relaxed); }
+    uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> m_value;
+};
+
+class CMetricGauge
+{
+public:
+    CMetricGauge(): m_value(0), m_max(0) {}
+    void set(uint64_t _value);
+    uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+    // Maximum since the last call
+    uint64_t takeMax();
+
+private:
+    std::atomic<uint64_t> m_value;
+    std::atomic<uint64_t> m_max;
+};
+
+class CMetricHistogram
+{
+public:
+    CMetricHistogram();
+    void record(uint64_t _value);
+    void recordSince(std::chrono::steady_clock::time_point _start);
+    // Adds the bucket counts to _buckets, which must hold METRICS_BUCKETS entries
+    void collect(uint64_t *_buckets) const;
+    // Maximum since the last call
+    uint64_t takeMax();
+
+    static size_t   bucketOf(uint64_t _value);
+    static uint64_t bucketUpperBound(size_t _bucket);
+
+private:
+    std::atomic<uint64_t> m_buckets[METRICS_BUCKETS];
+    std::atomic<uint64_t> m_max;
+};
+
+// Records the time from construction to destruction
+class CMetricTimer
+{
+public:
+    CMetricTimer(CMetricHistogram *_histogram): m_histogram(_histogram), m_start(std::chrono::steady_clock::now()) {}
+    ~CMetricTimer() { m_histogram->recordSince(m_start); }
+
+private:
+    CMetricHistogram *m_histogram;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+// One metric as published by refresh(). Also the entry layout of the shared page.
+struct MetricSnapshot
+{
+    char     name[METRICS_NAME_SIZE];
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t value;     // counter total, gauge level, histogram count since start
+    double   rate;      // counter and histogram per second over the last period
+    uint64_t max;       // gauge and histogram maximum over the last period
+    uint64_t count;     // histogram records in the last period
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+};
+
+// Shared page: this header followed by count MetricSnapshot entries.
+// sequence is odd while the page is written, readers retry until they see the same even value twice.
+struct MetricsPageHeader
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t count;
+    std::atomic<uint32_t> sequence;
+    uint32_t entrySize;
+    uint64_t timestamp;     // us since epoch of the last refresh
+    uint64_t period;        // us covered by the rates and percentiles
+};
+
+// Process wide set of named metrics. Metrics are never removed, so the pointers
+// returned here stay valid and the hot paths look them up only once.
+class CMetricsRegistry
+{
+public:
+    static CMetricsRegistry& instance();
+
+    CMetricCounter*   counter(const std::string &_name);
+    CMetricGauge*     gauge(const std::string &_name);
+    CMetricHistogram* histogram(const std::string &_name);
+
+    // Computes rates and percentiles since the previous refresh and publishes them to the page
+    void refresh();
+    std::vector<MetricSnapshot> snapshot();
+    // Text table of the last refresh, one metric per line
+    std::string report();
+
+    bool openSharedPage(const std::string &_name = METRICS_PAGE_NAME);
+    void closeSharedPage();
+
+private:
+    struct Entry
+    {
+        std::string name;
+        MetricType  type;
+        std::unique_ptr<CMetricCounter>   counter;
+        std::unique_ptr<CMetricGauge>     gauge;
+        std::unique_ptr<CMetricHistogram> histogram;
+        uint64_t    lastValue;
+        std::vector<uint64_t> lastBuckets;
+        MetricSnapshot snapshot;
+    };
+
+    CMetricsRegistry();
+    ~CMetricsRegistry();
+    CMetricsRegistry(const CMetricsRegistry &) = delete;
+    CMetricsRegistry& operator=(const CMetricsRegistry &) = delete;
+
+    Entry& find(const std::string &_name, MetricType _type);
+    void   publish();
+
+    std::mutex        m_mutex;
+    std::deque<Entry> m_entries;
+    std::vector<uint64_t> m_buckets;
+    std::chrono::steady_clock::time_point m_lastRefresh;
+    uint64_t          m_period;
+    MetricsPageHeader *m_page;
+    std::string       m_pageName;
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Lossless coding of one channel of 8 or 16 bit samples: a fixed polynomial predictor
+// (order 0, 1 or 2, chosen per partition) and Rice codes of the zigzagged residuals.
+//
+// Bit stream, MSB first. Every partition of RICE_PARTITION_SAMPLES samples (the last one
+// may be shorter) starts with 2 bits of predictor order. Order 3 means the partition is
+// stored verbatim, _bits per sample. Otherwise 5 bits of Rice parameter k follow, then one
+// code per sample: q = u >> k as q zero bits and a one, then the low k bits of u.
+// A quotient of RICE_ESCAPE_ZEROS or more is sent as that many zero bits and u in _bits + 2 bits.
+// The predictor history starts at zero, so every encoded buffer decodes on its own.
+#define RICE_PARTITION_SAMPLES 256
+#define RICE_ESCAPE_ZEROS      16
+
+// Returns the encoded size or 0 if the data doesn't fit into _capacity bytes,
+// which the caller takes as "send it raw". _bits is 8 or 16.
+size_t rice_encode(uint8_t *_dst, size_t _capacity, const void *_src, size_t _samples, unsigned _bits);
+// Decodes exactly _samples samples, false if _src is not a valid stream of that length
+bool rice_decode(void *_dst, size_t _samples, const uint8_t *_src, size_t _size, unsigned _bits);
+
+// Kernels used by the encoder, exposed for benchmarking. _x[-1] and _x[-2] are the
+// previous samples, _count is at most RICE_PARTITION_SAMPLES.
+// Sums of the zigzagged residuals of the predictor orders 0, 1 and 2.
+void rice_analyze_scalar(const int16_t *_x, size_t _count, uint64_t _sums[3]);
+// Zigzagged residuals of one predictor order
+void rice_residuals_scalar(uint32_t *_u, const int16_t *_x, size_t _count, unsigned _order);
+
+#ifdef ARCH_ARM
+void rice_analyze_neon(const int16_t *_x, size_t _count, uint64_t _sums[3]);
+void rice_residuals_neon(uint32_t *_u, const int16_t *_x, size_t _count, unsigned _order);
+#endif
@@ -9,6 +9,7 @@
 #include <asio.hpp>
 #include <fstream>
 #include <iostream>
+#include "block_ring.h"
 
 class CWaveWriter
 {
@@ -22,6 +23,7 @@ enum class Endianness
     int  m_numChannels;
     int  m_bitDepth;
     int  m_samplesPerChannel;
+    uint32_t m_sampleRate;
     CWaveWriter::Endianness m_endianness;
 
     
@@ -29,11 +31,12 @@ public:
 
     CWaveWriter();
     void resetHeaderInit();
-    std::iostream *BuildWAVStream(uint8_t* buffer_ch1,size_t size_ch1,uint8_t* buffer_ch2,size_t size_ch2,unsigned short resolution);
+    // sampleRate goes to the header of a new file, 0 - unknown
+    void BuildWAVStream(CBlockStream *memory,const uint8_t* buffer_ch1,size_t size_ch1,const uint8_t* buffer_ch2,size_t size_ch2,unsigned short resolution,double sampleRate = 0);
 private:
-    void BuildHeader(std::stringstream *memory);
-    void addInt32ToFileData (std::stringstream *memory, int32_t i);
-    void addInt16ToFileData (std::stringstream *memory, int16_t i);
-    void addStringToFileData (std::stringstream *memory, std::string s);
+    void BuildHeader(std::iostream *memory);
+    void addInt32ToFileData (std::iostream *memory, int32_t i);
+    void addInt16ToFileData (std::iostream *memory, int16_t i);
+    void addStringToFileData (std::iostream *memory, std::string s);
     
 };
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#define DIRECT_IO_ALIGN 4096
+#define DIRECT_IO_BATCH (1024 * 1024) // Size of one aligned write
+
+// Sink used by FileQueueManager to put queued blocks on disk.
+// write() may keep data in memory, checkpoint() pushes header updates and
+// buffered data out, close() finalizes the file.
+class CWriterBackend
+{
+public:
+    enum class Type{
+        FSTREAM,
+        DIRECT
+    };
+
+    using Ptr = std::shared_ptr<CWriterBackend>;
+    static Ptr Create(Type _type);
+
+    virtual ~CWriterBackend() {}
+
+    virtual bool open(std::string _fileName, bool _append) = 0;
+    // Reserve disk space for a file of _size bytes right after open(). close() cuts
+    // the file back to the written size. Best effort, false if the filesystem can't.
+    virtual bool preallocate(uint64_t _size) = 0;
+    virtual bool write(const uint8_t *_data, size_t _size) = 0;
+    // Overwrite bytes already passed to write(). Used for header fields.
+    virtual bool patch(uint64_t _offset, const void *_data, size_t _size) = 0;
+    virtual bool checkpoint() = 0;
+    virtual void close() = 0;
+    virtual bool good() = 0;
+    virtual bool isOpen() = 0;
+};
+
+class CStreamWriterBackend: public CWriterBackend
+{
+public:
+    CStreamWriterBackend();
+
+    bool open(std::string _fileName, bool _append) override;
+    bool preallocate(uint64_t _size) override;
+    bool write(const uint8_t *_data, size_t _size) override;
+    bool patch(uint64_t _offset, const void *_data, size_t _size) override;
+    bool checkpoint() override;
+    void close() override;
+    bool good() override;
+    bool isOpen() override;
+
+private:
+    std::fstream m_fs;
+    std::string  m_fileName;
+    bool         m_preallocated;
+};
+
+#ifndef _WIN32
+// Collects blocks into DIRECT_IO_BATCH sized aligned writes. The file is opened
+// with O_DIRECT where the filesystem allows it. The first page is kept in memory,
+// so header patches are written with one page write at checkpoint. Checkpoint also
+// writes the whole pages of a partial batch, less than a page stays buffered.
+class CDirectWriterBackend: public CWriterBackend
+{
+public:
+    CDirectWriterBackend();
+    ~CDirectWriterBackend();
+
+    bool open(std::string _fileName, bool _append) override;
+    bool preallocate(uint64_t _size) override;
+    bool write(const uint8_t *_data, size_t _size) override;
+    bool patch(uint64_t _offset, const void *_data, size_t _size) override;
+    bool checkpoint() override;
+    void close() override;
+    bool good() override;
+    bool isOpen() override;
+
+private:
+    bool writeBatch(size_t _size);
+    bool writeAt(const uint8_t *_data, size_t _size, uint64_t _offset);
+
+    int      m_fd;
+    uint8_t *m_batch;
+    size_t   m_fill;
+    uint64_t m_flushed;
+    uint8_t *m_headerPage;
+    bool     m_hasHeaderPage;
+    bool     m_headerDirty;
+    bool     m_good;
+};
+#endif
@@ -7,16 +7,45 @@
 #include <system_error>
 #include <cstdint>
 #include <memory>
-#include <deque>
+#include <vector>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
 
-#include "neon_asm.h"
 #include "asio.hpp"
 #include "EventHandlers.h"
+#include "BlockInfo.h"
 //#include "rpsa/common/messaging/message_factory.h"
 //#include "rpsa/common/io/basic_buffer.h"
 
 #define  SOCKET_BUFFER_SIZE 65536
 #define  FIFO_BUFFER_SIZE  SOCKET_BUFFER_SIZE * 3
+#define  UDP_CLIENT_RECEIVE_BUFFER (4 * 1024 * 1024) // a whole DMA buffer arrives as one burst of datagrams, capped by net.core.rmem_max
+#define  PACK_HEADER_SIZE  52
+
+// Protocol v2. Versions are negotiated with a hello from the client, a client that
+// sends no hello gets the v1 pack with the ASCII id.
+#define  PACK_VERSION_1       1
+#define  PACK_VERSION_2       2
+#define  PACK_V2_HEADER_SIZE  96
+#define  PACK_V2_MAGIC        0x32535052 // "RPS2"
+#define  PACK_HELLO_MAGIC     0x48535052 // "RPSH"
+#define  PACK_FLAG_CRC        0x00000001 // CRC32C of header (crc field zeroed) and payload
+#define  PACK_FLAG_RICE       0x00000002 // channel data is rice_encode()d, see rice_codec.h
+#define  PACK_FLAG_SEGMENT    0x00000004 // the pack is cut from a triggered segment, set by the server per pack
+
+#define  PACK_SAMPLE_INT8     1
+#define  PACK_SAMPLE_INT16    2
+#define  PACK_MAX_DATA_SIZE   (FIFO_BUFFER_SIZE) // channel data of a pack, also after decoding. A larger pack can't be received.
+
+#define  ASIO_MAX_CLIENTS         8
+#define  ASIO_CLIENT_QUEUE_DEPTH  64 // packs waiting per TCP client before the oldest is dropped
 
 using  namespace std;
 using  namespace asio;
@@ -33,6 +62,239 @@ namespace  asionet {
         NONE
     };
 
+#pragma pack(push, 1)
+    struct PackHeaderV2 {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t header_size;
+        uint32_t pack_size;     // header + channel data
+        uint32_t flags;
+        uint64_t sequence;
+        uint64_t timestamp;     // microseconds since epoch, taken when the pack is sent
+        uint64_t lost;          // samples dropped before this pack (BlockInfo::lostSamples)
+        uint64_t dma_sequence;  // BlockInfo::dmaSequence of the DMA buffer the pack was cut from
+        uint64_t sample_index;  // timeline index of the first sample in the pack
+        uint32_t osc_rate;
+        uint32_t size_ch1;
+        uint32_t size_ch2;
+        uint8_t  sample_format; // PACK_SAMPLE_*
+        uint8_t  channel_mask;  // bit 0 - channel 1, bit 1 - channel 2
+        uint16_t reserved0;
+        uint32_t crc;
+        uint32_t raw_size;      // PACK_FLAG_RICE: bytes per channel after decoding, size_ch* are the encoded sizes
+        uint64_t segment;       // PACK_FLAG_SEGMENT: number of the segment (BlockInfo::segment)
+        uint64_t trigger_index; // PACK_FLAG_SEGMENT: timeline index of the trigger sample of the segment
+    };
+
+    // Sent by the client instead of the single connect byte. The first byte stays the
+    // connect flag, so an old server still reads it as a connect request.
+    struct PackHello {
+        uint8_t  connect;
+        uint8_t  reserved;
+        uint16_t version;
+        uint32_t magic;
+        uint32_t flags;
+    };
+#pragma pack(pop)
+
+    static_assert(sizeof(PackHeaderV2) == PACK_V2_HEADER_SIZE, "Wrong size of v2 pack header");
+
+    // Result of ExtractPack. Channel pointers point into the received buffer and are
+    // only valid until the receive callback returns.
+    struct PackView {
+        uint16_t version;
+        uint32_t flags;
+        uint64_t id;
+        uint64_t timestamp;
+        uint64_t lostRate;      // v1 - as sent, v2 - 1 if samples were dropped before this pack
+        uint32_t oscRate;
+        uint32_t resolution;
+        BlockInfo info;         // dmaSequence is 0 for v1 packs, segment is 0 without PACK_FLAG_SEGMENT
+        const uint8_t *ch1;
+        size_t   size_ch1;
+        const uint8_t *ch2;
+        size_t   size_ch2;
+        size_t   raw_size;      // PACK_FLAG_RICE: bytes per channel after rice_decode()
+    };
+
+    enum ExtractResult {
+        PACK_OK,
+        PACK_BAD_HEADER,
+        PACK_BAD_SIZE,
+        PACK_BAD_CRC
+    };
+
+    enum PackFormat {
+        PACK_FORMAT_V1,
+        PACK_FORMAT_V2,
+        PACK_FORMAT_V2_CRC,
+        PACK_FORMAT_V2_RICE,
+        PACK_FORMAT_V2_RICE_CRC,
+        PACK_FORMAT_COUNT
+    };
+
+    // Everything needed to build a pack for any peer version
+    struct PackSource {
+        uint64_t id;
+        uint64_t lostRate;
+        uint32_t oscRate;
+        uint32_t resolution;
+        uint64_t timestamp;
+        BlockInfo info;
+        const void *ch1;
+        size_t   size_ch1;
+        const void *ch2;
+        size_t   size_ch2;
+        // Encoded channel data, nullptr if the pack is sent raw. Only peers that asked
+        // for PACK_FLAG_RICE get it, the others get ch1 and ch2.
+        const void *packed_ch1;
+        size_t   packed_size_ch1;
+        const void *packed_ch2;
+        size_t   packed_size_ch2;
+    };
+
+    // One pack sent to all clients. Headers are built once per wire format in use and
+    // the channel data is only copied if some client has to queue the pack.
+    class CSharedPack {
+    public:
+        using Ptr = shared_ptr<CSharedPack>;
+
+        static Ptr Create(const PackSource &_source);
+        CSharedPack(const PackSource &_source);
+
+        // Header for the peer's version and flags, built on first use
+        const uint8_t *Header(uint16_t _version, uint32_t _flags, size_t &_size);
+        // Copies the channel data into the pack, the caller's buffers can be reused afterwards.
+        // The copy is made once and shared by all clients that queue the pack.
+        void Detach();
+        std::array<asio::const_buffer, 3> Buffers(uint16_t _version, uint32_t _flags, const uint8_t *_header, size_t _header_size);
+
+    private:
+        CSharedPack(const CSharedPack &) = delete;
+        CSharedPack(CSharedPack &&) = delete;
+
+        PackSource m_source;
+        std::vector<uint8_t> m_data;
+        uint8_t m_header[PACK_FORMAT_COUNT][PACK_V2_HEADER_SIZE];
+        size_t  m_header_size[PACK_FORMAT_COUNT];
+    };
+
+    // Datagrams of one block for all UDP clients. The headers are built once per wire format
+    // into an arena that is reused from block to block. Channel data is never copied, on Linux
+    // all datagrams for one client go out with a single sendmmsg().
+    class CUdpBatch {
+    public:
+        CUdpBatch();
+
+        // The packs must stay valid until the next Reset()
+        void Reset(const PackSource *_packs, size_t _count);
+        size_t Count() { return m_count; }
+        // Returns the number of datagrams sent, _bytes is their total size
+        size_t Send(asio::ip::udp::udp::socket &_socket, const asio::ip::udp::udp::endpoint &_endpoint,
+                    uint16_t _version, uint32_t _flags, size_t &_bytes, asio::error_code &_error);
+
+    private:
+        CUdpBatch(const CUdpBatch &) = delete;
+        CUdpBatch(CUdpBatch &&) = delete;
+
+        void BuildHeaders(PackFormat _format);
+
+        const PackSource *m_packs;
+        size_t m_count;
+        std::vector<uint8_t> m_headers[PACK_FORMAT_COUNT];
+        size_t m_header_size[PACK_FORMAT_COUNT];
+        bool   m_built[PACK_FORMAT_COUNT];
+#ifdef __linux__
+        std::vector<struct mmsghdr> m_msgs;
+        std::vector<struct iovec> m_iov;
+#endif
+    };
+
+    struct ClientStats {
+        string   host;
+        uint16_t version;
+        uint64_t packs;     // packs written to the socket
+        uint64_t bytes;
+        uint64_t dropped;   // packs lost on a full queue or a failed send
+        size_t   queued;
+        size_t   queueMax;  // high water mark of the queue
+    };
+
+    // Client connected to the server. Every TCP client has a bounded queue served by the io
+    // thread, when it is full the oldest waiting pack is dropped so one slow client doesn't
+    // hold back the others. UDP packs are sent at once, the kernel drops what doesn't fit.
+    class CAsioClient: public std::enable_shared_from_this<CAsioClient> {
+    public:
+        using Ptr = shared_ptr<CAsioClient>;
+        typedef std::function<void(Ptr)> CloseHandler;
+        typedef std::function<void(error_code,size_t)> SendHandler;
+
+        static Ptr Create(asio::io_service &io, shared_ptr<asio::ip::tcp::socket> _socket, size_t _queueDepth);
+        static Ptr Create(asio::io_service &io, shared_ptr<asio::ip::udp::udp::socket> _socket, const asio::ip::udp::udp::endpoint &_endpoint);
+        CAsioClient(asio::io_service &io, Protocol _protocol, shared_ptr<asio::ip::tcp::socket> _tcp_socket,
+                    shared_ptr<asio::ip::udp::udp::socket> _udp_socket, const asio::ip::udp::udp::endpoint &_endpoint, size_t _queueDepth);
+
+        void Start(CloseHandler _onClose, SendHandler _onSend);
+        void Close();
+        // A client with nothing queued is served from the caller's buffers: _direct blocks until
+        // the socket took the pack, else only what it takes at once is sent and the rest is queued
+        bool Send(const CSharedPack::Ptr &_pack, bool _direct);
+        // UDP only
+        bool Send(CUdpBatch &_batch);
+        void ParseHello(const uint8_t *_buffer, size_t _size);
+        bool IsEndpoint(const asio::ip::udp::udp::endpoint &_endpoint);
+        string GetHost() { return m_host; }
+        uint16_t GetVersion() { return m_version; }
+        uint32_t GetFlags() { return m_flags; }
+        ClientStats GetStats();
+
+    private:
+        CAsioClient(const CAsioClient &) = delete;
+        CAsioClient(CAsioClient &&) = delete;
+
+        struct QueueItem {
+            CSharedPack::Ptr pack;
+            const uint8_t *header;
+            size_t header_size;
+            size_t offset;      // bytes already sent from the caller's buffers
+            std::chrono::steady_clock::time_point queued;
+        };
+
+        void HandlerReceiveHello(const asio::error_code &_error, size_t _bytesTransferred);
+        void HandlerReceive(const asio::error_code &_error, size_t _bytesTransferred);
+        size_t TrySend(const std::array<asio::const_buffer, 3> &_buffers, asio::error_code &_error);
+        void WriteNext();
+        void HandlerWrite(const asio::error_code &_error, size_t _bytesTransferred);
+        void Sent(const asio::error_code &_error, size_t _bytesTransferred);
+
+        io_service &m_io_service;
+        Protocol m_protocol;
+        shared_ptr<asio::ip::tcp::socket> m_tcp_socket;
+        shared_ptr<asio::ip::udp::udp::socket> m_udp_socket;
+        asio::ip::udp::udp::endpoint m_udp_endpoint;
+        string m_host;
+        uint8_t m_read_buffer[sizeof(PackHello)];
+        std::atomic<uint16_t> m_version;
+        std::atomic<uint32_t> m_flags;
+
+        std::mutex m_mutex;
+        std::vector<QueueItem> m_queue; // ring of m_queue_depth packs, full drops at the head
+        size_t m_queue_head;
+        size_t m_queue_count;
+        size_t m_queue_depth;
+        size_t m_queue_max;
+        QueueItem m_current; // taken from the ring by the io thread
+        bool m_sending;   // io thread owns the write side
+        bool m_in_flight; // m_current is being written
+        bool m_closed;
+        CloseHandler m_onClose;
+        SendHandler m_onSend;
+
+        std::atomic<uint64_t> m_packs;
+        std::atomic<uint64_t> m_bytes;
+        std::atomic<uint64_t> m_dropped;
+    };
+
     class CAsioSocket {
     public:
         typedef uint8_t* send_buffer;
@@ -44,7 +306,8 @@ namespace  asionet {
             ERROR_SERVER,
             ERROR_CLIENT,
             SEND_DATA,
-            RECIVED_DATA_FROM_SERVER};
+            RECIVED_DATA_FROM_SERVER,
+            RECIVED_BROKEN_DATA};
 
         using Ptr = shared_ptr<CAsioSocket>;
 
@@ -58,11 +321,20 @@ namespace  asionet {
         bool IsConnected();
         void SendBuffer(const void *_buffer, size_t _size);
         bool SendBuffer(bool async,send_buffer _buffer, size_t _size);
+        // Server: sends the pack to every client, false if there is none
+        bool SendPack(const PackSource &_pack);
+        bool SendPacks(const PackSource *_packs, size_t _count);
         void addHandler(Events _event, std::function<void(string host)> _func);
         void addHandler(Events _event, std::function<void(error_code error)> _func);
         void addHandler(Events _event, std::function<void(error_code error,size_t)> _func);
         void addHandler(Events _event, std::function<void(error_code error,uint8_t*,size_t)> _func);
 
+        void SetRequestVersion(uint16_t _version, uint32_t _flags);
+        void SetMaxClients(size_t _count);
+        void SetClientQueueDepth(size_t _depth);
+        std::vector<ClientStats> GetClientStats();
+        uint32_t GetClientFlags();
+
     private:
 
         CAsioSocket(const CAsioSocket &) = delete;
@@ -70,12 +342,19 @@ namespace  asionet {
 
 
         void WaitClient();
-        void HandlerReceiveFromClient(const asio::error_code &error);
+        void HandlerReceiveFromClient(const asio::error_code &error, size_t bytes_transferred);
         void HandlerAcceptFromClient(const asio::error_code &_error);
+        void AcceptClient();
+        void AddClient(CAsioClient::Ptr _client);
+        void RemoveClient(CAsioClient::Ptr _client);
+        void BuildHello(PackHello &_hello);
         void HandlerConnectToServer(const asio::error_code &_error, asio::ip::tcp::resolver::iterator endpoint_iterator);
         void HandlerSend(const asio::error_code &_error, size_t _bytesTransferred);
         void HandlerSend2(const asio::error_code &_error, size_t _bytesTransferred, uint8_t *buffer);
         void HandlerReceiveFromServer(const asio::error_code &ErrorCode, size_t bytes_transferred);
+        void ReceiveFromServer();
+        void ParseStream();
+        void Resync(size_t _from);
 
         Mode m_mode;
         Protocol m_protocol;
@@ -90,12 +369,23 @@ namespace  asionet {
         asio::ip::tcp::endpoint m_tcp_endpoint;
 
         uint8_t *m_SocketReadBuffer;
-        char m_udp_recv_server_buffer[1];
+        uint8_t m_udp_recv_server_buffer[sizeof(PackHello)];
         bool m_is_udp_connected;
         bool m_is_tcp_connected;
+        // TCP client: received stream, packs are parsed in place between begin and end
         uint8_t  *m_tcp_fifo_buffer;
-        uint32_t  m_pos_last_in_fifo;
+        size_t    m_fifo_begin;
+        size_t    m_fifo_end;
         uint64_t  m_last_pack_id;
+        uint16_t  m_request_version;
+        uint32_t  m_request_flags;
+
+        // Server: connected clients
+        std::vector<CAsioClient::Ptr> m_clients;
+        std::mutex m_clients_mutex;
+        size_t    m_max_clients;
+        size_t    m_client_queue_depth;
+        CUdpBatch m_udp_batch;
 
 
         EventList<std::string> m_callback_Str;
@@ -126,11 +416,28 @@ namespace  asionet {
 
         void addCallSend(function<void(error_code error,size_t)> _func);
         void addCallReceived(function<void(error_code error,uint8_t*,size_t)> _func);
+        // Client: the TCP stream had to be resynchronised, message_size - a pack didn't fit
+        // the receive buffer, invalid_argument - bytes without a pack header were skipped
+        void addCallReceivedError(function<void(error_code error)> _func);
 
         bool SendData(bool async,CAsioSocket::send_buffer _buffer,size_t _size);
+        // Server: sends the pack to all clients in the format each of them asked for.
+        // The channel data can be released when the call returns.
+        bool SendPack(const PackSource &_pack);
+        // Server: all packs cut from one block. UDP clients get them in one batch.
+        bool SendPacks(const PackSource *_packs, size_t _count);
     Protocol GetProtocol() { return  m_protocol;};
         bool IsConnected();
 
+        // Client: protocol version and PACK_FLAG_* asked from the server, must be set before Start()
+        void SetRequestVersion(uint16_t _version, uint32_t _flags);
+        // Server: must be set before Start()
+        void SetMaxClients(size_t _count);
+        void SetClientQueueDepth(size_t _depth);
+        std::vector<ClientStats> GetClientStats();
+        // Server: PACK_FLAG_* asked for by any of the connected clients
+        uint32_t GetClientFlags();
+
         static uint8_t *BuildPack(
                 uint64_t _id ,
                 uint64_t _lostRate ,
@@ -154,6 +461,44 @@ namespace  asionet {
                 size_t _size_ch2 ,
                 size_t &_buffer_size);
 
+        static size_t BuildPackHeader(
+                uint8_t *_header ,
+                uint64_t _id ,
+                uint64_t _lostRate ,
+                uint32_t _oscRate  ,
+                uint32_t _resolution ,
+                size_t _size_ch1 ,
+                size_t _size_ch2);
+
+        static PackFormat GetPackFormat(uint16_t _version, uint32_t _flags);
+        // Header of the pack in the given format, returns its size
+        static size_t BuildPackHeader(uint8_t *_header, PackFormat _format, const PackSource &_pack);
+
+        // Fills a v2 header for the payload. With PACK_FLAG_CRC the channel data is read to compute the CRC.
+        // With PACK_FLAG_RICE the channels hold encoded data of _raw_size bytes each.
+        static size_t BuildPackHeaderV2(
+                uint8_t *_header ,
+                uint64_t _id ,
+                uint32_t _oscRate  ,
+                uint32_t _resolution ,
+                uint64_t _timestamp ,
+                uint32_t _flags ,
+                const BlockInfo &_info ,
+                const void *_ch1 ,
+                size_t _size_ch1 ,
+                const void *_ch2 ,
+                size_t _size_ch2 ,
+                size_t _raw_size = 0);
+
+        // Parses a v1 or v2 pack without copying the channel data
+        static ExtractResult ExtractPack(
+                const uint8_t *_buffer ,
+                size_t _size ,
+                PackView &_view);
+
+        // Full size of the v1 or v2 pack starting at _buffer, 0 if there is no pack header there
+        static size_t PackSize(const uint8_t *_buffer, size_t _size);
+
         static bool     ExtractPack(
                 CAsioSocket::send_buffer _buffer ,
                 size_t _size ,
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+// Position of a data block in the acquisition timeline.
+// Sample values count samples per channel since COscilloscope::prepare(), lost samples included,
+// so sampleIndex of the next block is always sampleIndex + lostSamples of gaps + block samples.
+// In triggered segment capture only the segments are passed on, the samples between them
+// are skipped on purpose and are not counted in lostSamples.
+struct BlockInfo
+{
+    uint64_t dmaSequence;   // number of the DMA buffer, starts from 1. 0 - the source gave no timeline (v1 packs)
+    uint64_t sampleIndex;   // index of the first sample of the block
+    uint64_t lostSamples;   // samples dropped right before this block
+    uint64_t segment;       // 0 - continuous data, else number of the triggered segment the block is cut from, starts from 1
+    uint64_t triggerIndex;  // segment blocks: timeline index of the trigger sample
+};
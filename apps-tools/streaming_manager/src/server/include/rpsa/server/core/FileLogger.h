@@ -1,6 +1,11 @@
 #pragma once
 #include <iostream>
 #include <memory>
+#include <vector>
+#include "BlockInfo.h"
+
+#define LOG_MAX_GAP_MARKERS 65536
+#define LOG_MAX_TRIGGER_MARKERS 65536
 
 class CFileLogger{
 public:
@@ -11,7 +16,12 @@ public:
         FILESYSTEM_RATE,
         RECIVE_DATE,
         RECIVE_DATA_CH1,
-        RECIVE_DATA_CH2
+        RECIVE_DATA_CH2,
+        FILESYSTEM_QUEUE_MAX,
+        FILESYSTEM_WRITE_SPEED,
+        COMPRESSION_RAW_BYTES,      // channel data given to the encoder
+        COMPRESSION_PACKED_BYTES,   // what was written for it, encoded or raw
+        COMPRESSION_FALLBACK        // blocks written raw because the encoder fell behind
     };
 
     using Ptr = std::shared_ptr<CFileLogger>;
@@ -23,6 +33,9 @@ public:
     void ResetCounters();
     void AddMetric(CFileLogger::Metric _metric, uint64_t _value);
     void AddMetricId(uint64_t _id);
+    // Tracks the sample timeline, _samples is the number of samples per channel in the block.
+    // The jump to the start of a new triggered segment is not a gap, the trigger is listed instead.
+    void AddBlockInfo(const BlockInfo &_info, uint64_t _samples);
 
     void DumpToFile();
 
@@ -36,8 +49,39 @@ private:
     uint64_t    m_oscLostRate;
     uint64_t    m_udpLostRate;
     uint64_t    m_fileSystemLostRate;
+    uint64_t    m_fileSystemQueueMax;
+    uint64_t    m_fileSystemWriteSpeed;
     uint64_t    m_reciveData;
     uint64_t    m_reciveData_ch1;
     uint64_t    m_reciveData_ch2;
+    uint64_t    m_compressionRaw;
+    uint64_t    m_compressionPacked;
+    uint64_t    m_compressionFallback;
     uint64_t    m_old_id;
+
+    struct GapMarker{
+        uint64_t sampleIndex;   // first sample after the gap
+        uint64_t dmaSequence;
+        uint64_t lostSamples;
+    };
+
+    bool        m_hasTimeline;
+    uint64_t    m_firstDmaSequence;
+    uint64_t    m_lastDmaSequence;
+    uint64_t    m_firstSampleIndex;
+    uint64_t    m_nextSampleIndex;
+    uint64_t    m_adcLostSamples;
+    uint64_t    m_timelineLostSamples;
+    uint64_t    m_gapCount;
+    std::vector<GapMarker> m_gaps;
+
+    struct TriggerMarker{
+        uint64_t segment;
+        uint64_t triggerIndex;
+        uint64_t sampleIndex;   // first sample of the segment
+    };
+
+    uint64_t    m_lastSegment;
+    uint64_t    m_segmentCount;
+    std::vector<TriggerMarker> m_triggers;
 };
\ No newline at end of file
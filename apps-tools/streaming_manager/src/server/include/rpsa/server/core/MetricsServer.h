@@ -0,0 +1,27 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <asio.hpp>
+
+// Query endpoint for the metrics registry: every TCP connection gets the text report
+// of the last refresh and is closed, e.g. "nc <board> 8902".
+class CMetricsServer: public std::enable_shared_from_this<CMetricsServer>
+{
+public:
+    using Ptr = std::shared_ptr<CMetricsServer>;
+
+    // Returns nullptr if the port can't be opened
+    static Ptr Create(asio::io_service &_io, unsigned short _port);
+    CMetricsServer(asio::io_service &_io);
+
+    void close();
+
+private:
+    bool listen(unsigned short _port);
+    void accept();
+    void handlerAccept(std::shared_ptr<asio::ip::tcp::socket> _socket, const asio::error_code &_error);
+
+    asio::io_service        &m_io;
+    asio::ip::tcp::acceptor  m_acceptor;
+};
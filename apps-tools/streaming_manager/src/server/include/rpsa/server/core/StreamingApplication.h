@@ -9,9 +9,26 @@
 
 #include <Oscilloscope.h>
 #include <StreamingManager.h>
+#include <MetricsServer.h>
+#include "rpsa/common/core/metrics.h"
+#include "rpsa/common/core/decimator.h"
+#include "TriggerSegmenter.h"
+
+#define METRICS_REFRESH_PERIOD_MS 1000
 
 //#define DISABLE_OSC
 
+// Acquisition counters. Only the acquisition thread writes them, any thread may read.
+struct OscWorkerStats
+{
+    std::atomic<uint64_t> blocks;       // blocks passed to the streaming manager
+    std::atomic<uint64_t> overflows;    // blocks with the DMA overflow flag set
+    std::atomic<uint64_t> lostSamples;  // samples per channel dropped by the DMA
+    std::atomic<uint64_t> bytes;        // channel data passed to the streaming manager
+    std::atomic<uint64_t> errors;       // failed waits for the DMA interrupt
+    std::atomic<uint64_t> segments;     // triggered segments started
+};
+
 class CStreamingApplication
 {
 public:
@@ -20,8 +37,26 @@ public:
     void run();
     void runNonBlock();
     bool stop();
+
+    // Options of the acquisition thread, set before run().
+    // _priority > 0 runs it with SCHED_FIFO at this priority, _cpu >= 0 pins it to this CPU.
+    void setOscThreadOptions(int _priority, int _cpu);
+    // TCP port of the metrics query endpoint, 0 disables it. Set before run().
+    void setMetricsPort(unsigned short _port);
+    // Software decimation of both channels after the FPGA decimation, set before run().
+    // The decimation reported to the clients and files becomes _oscRate * _factor.
+    // Returns false for settings CDecimator doesn't accept; NONE turns the stage off.
+    bool setDecimation(DecimationFilter _filter, uint32_t _factor,
+                       uint32_t _taps = DECIMATION_FIR_DEFAULT_TAPS, uint32_t _order = DECIMATION_CIC_DEFAULT_ORDER);
+    // Triggered segment capture, set before run(). Only the segments around the trigger events
+    // are passed on, see CTriggerSegmenter. The level applies to the 16 bit samples after the
+    // software decimation. Returns false for settings CTriggerSegmenter doesn't accept or a source
+    // channel that is not captured; source NONE goes back to continuous capture.
+    bool setTrigger(const TriggerSettings &_settings);
+    const OscWorkerStats& getStats() const { return m_Stats; }
+
 private:
-    int m_PerformanceCounterPeriod = 10;
+    int m_PerformanceCounterPeriod = 5;
 
     COscilloscope::Ptr m_Osc_ch;
     CStreamingManager::Ptr m_StreamingManager;
@@ -39,19 +74,60 @@ private:
 
     void *m_WriteBuffer_ch1;
     void *m_WriteBuffer_ch2;
+    // Buffers handed to the streaming manager: the copies above or, in zero-copy mode, the DMA buffers
+    const void *m_PassBuffer_ch1;
+    const void *m_PassBuffer_ch2;
+    bool m_ZeroCopy;
+    bool m_DmaBufferHeld;
     size_t m_size_ch1;
     size_t m_size_ch2;
 
+    BlockInfo        m_BlockInfo;
+    // m_BlockInfo in output samples, as handed to the streaming manager
+    BlockInfo        m_PassInfo;
     uint64_t         m_lostRate;
     int              m_oscRate;
     int              m_channels;
 
     asio::steady_timer m_Timer;
-    uintmax_t m_BytesCount;
+
+    int              m_OscThreadPriority;
+    int              m_OscThreadCpu;
+    OscWorkerStats   m_Stats;
+    uint64_t         m_LastStatBlocks;
+    uint64_t         m_LastStatOverflows;
+    uint64_t         m_LastStatBytes;
+
+    // Refreshed on m_Ios: the shared page and the query endpoint
+    asio::steady_timer m_MetricsTimer;
+    unsigned short   m_MetricsPort;
+    CMetricsServer::Ptr m_MetricsServer;
+    CMetricHistogram *m_MetricDmaWait;
+    CMetricHistogram *m_MetricCopy;
+    CMetricHistogram *m_MetricPass;
+    CMetricCounter   *m_MetricBytes;
+    CMetricCounter   *m_MetricLostSamples;
+
+    CDecimator::Ptr  m_Decimator_ch1;
+    CDecimator::Ptr  m_Decimator_ch2;
+    uint32_t         m_DecimationFactor;
+    uint64_t         m_DecimatedIndex;  // output index of the next decimated sample
+
+    CTriggerSegmenter::Ptr m_Segmenter;
+    // 8 bit output of the segments, one block of samples per channel
+    std::vector<int8_t> m_SegmentBuffer;
+    CMetricCounter   *m_MetricSegments;
 
     void oscWorker();
-    bool passCh(size_t &_size1,size_t &_size2);
-    int  oscNotify(uint64_t _lostRate, uint32_t _oscRate,const void *_buffer_ch1, size_t _size_ch1,const void *_buffer_ch2, size_t _size_ch2);
+    void resetStats();
+    bool passCh(size_t &_size1,size_t &_size2,bool &_overFlow);
+    size_t decimateCh(CDecimator &_decimator, const uint8_t *_buffer, size_t _size, void *_dst);
+    size_t passSegments(size_t _size1, size_t _size2);
+    void updateZeroCopy();
+    void releaseBuffers();
+    int  oscNotify(uint64_t _lostRate, uint32_t _oscRate,const void *_buffer_ch1, size_t _size_ch1,const void *_buffer_ch2, size_t _size_ch2, const BlockInfo &_info);
     void performanceCounterHandler(const asio::error_code &_error);
+    void startMetrics();
+    void metricsHandler(const asio::error_code &_error);
     void signalHandler(const asio::error_code &_error, int _signalNumber);
 };
@@ -11,7 +11,6 @@
 #include <wavWriter.h>
 #include "AsioNet.h"
 #include "FileLogger.h"
-#include "neon_asm.h"
 #include "shared_buffer.h"
 
 
@@ -21,10 +20,23 @@
 //#define FILE_PATH "/opt/redpitaya/www/apps/streaming_manager/upload"
 #define FILE_PATH "/tmp/stream_files"
 
-#define UDP_BUFFER_LIMIT 512
+#define UDP_MTU_DEFAULT 1500
+#define UDP_MTU_JUMBO 9000
+#define UDP_MTU_MIN 576u
+#define UDP_MTU_MAX 65535u
+#define UDP_IP_HEADERS_SIZE 28 // IPv4 and UDP headers
 #define TCP_BUFFER_LIMIT 65536/2
 #define MIN(X,Y) ((X < Y) ? X: Y)
 #define MAX(X,Y) ((X > Y) ? X: Y)
+#define COMPRESSION_TIME_BUDGET 0.5     // share of the block duration the encoder may take
+#define COMPRESSION_BACKOFF_BLOCKS 64   // blocks left raw after the encoder went over the budget
+
+// Lossless coding of the channel data, see rice_codec.h. Network clients get encoded packs only
+// if they asked for PACK_FLAG_RICE, in local mode only BIN_TYPE files hold them.
+enum class StreamCompression {
+    NONE,
+    RICE
+};
 
 class CStreamingManager
 {
@@ -50,9 +62,20 @@ public:
     
 
     void run();
-    void stop();
+    // Local mode: _flush writes the blocks still queued before the file is closed, else they are dropped
+    void stop(bool _flush = false);
     bool isFileThreadWork();
-    int passBuffers(uint64_t _lostRate, uint32_t _oscRate,const void *_buffer_ch1, uint32_t _size_ch1,const void *_buffer_ch2, uint32_t _size_ch2, unsigned short _resolution ,uint64_t _id);
+    bool isLocalFile();
+    // Network mode: size of the IP packets for UDP, the datagrams are cut to fit (UDP_MTU_JUMBO for jumbo frames)
+    void setUdpMtu(uint32_t _mtu);
+    void setCompression(StreamCompression _mode);
+    // Local mode: split the recording into segment files, see FileRotation. Call before run().
+    void setFileRotation(const FileRotation &_rotation);
+    // Local mode: largest _size_ch1 + _size_ch2 of passBuffers(), the file queue is allocated for it. Call before run().
+    void setBlockSize(size_t _size);
+    // Network mode: one entry per connected client
+    std::vector<asionet::ClientStats> getClientStats();
+    int passBuffers(uint64_t _lostRate, uint32_t _oscRate,const void *_buffer_ch1, uint32_t _size_ch1,const void *_buffer_ch2, uint32_t _size_ch2, unsigned short _resolution ,uint64_t _id, const BlockInfo &_info);
     CStreamingManager::Callback notifyPassData;
     CStreamingManager::Callback notifyStop;
     CStreamingManager::CallbackVoid notifyPassDataReset;
@@ -69,12 +92,18 @@ private:
     asionet::Protocol m_protocol;
     asionet::CAsioNet *m_asionet;
     uint64_t          m_index_of_message;
+    uint32_t          m_udp_mtu;
+    std::vector<asionet::PackSource> m_packs; // packs of the current block, reused
+    StreamCompression m_compression;
+    std::vector<uint8_t> m_packed;   // encoded channel data of the current block, reused
+    uint32_t          m_compressionBackoff;
     std::string       m_file_out;
 
     bool m_use_local_file;
     Stream_FileType m_fileType;
     void startServer();
     void stopServer();
+    void compressPacks(asionet::PackSource *_packs, size_t _count, unsigned short _resolution, uint32_t _oscRate, size_t _samples);
 
     
 };
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <Oscilloscope.h>
+
+enum class SyntheticWaveform
+{
+    SINE,       // second channel is shifted by 90 degrees
+    RAMP,       // sawtooth over the full int16 range, second channel shifted by half a period
+    COUNTER     // sample index truncated to 16 bits, second channel is its bitwise inverse
+};
+
+// Software oscilloscope for running the streaming pipeline without the FPGA.
+// A generator thread stands in for the DMA: it fills one buffer per buffer period of the
+// sample rate and hands it over like the interrupt thread of CUioOscilloscope does. When the
+// consumer holds all buffers, the period is dropped and reported as an overflow on the next
+// block, with the same BlockInfo accounting as the hardware.
+class CSyntheticOscilloscope: public COscilloscope
+{
+public:
+    using Ptr = std::shared_ptr<CSyntheticOscilloscope>;
+
+    // _sampleRate = 0 runs as fast as the consumer takes the buffers, without overflows
+    static Ptr Create(bool _channel1Enable, bool _channel2Enable, double _sampleRate, SyntheticWaveform _waveform,
+                      uint32_t _dmaBufferSize = osc_buf_size, uint32_t _dmaBufferCount = osc_buf_min_count);
+
+    CSyntheticOscilloscope(bool _channel1Enable, bool _channel2Enable, double _sampleRate, SyntheticWaveform _waveform,
+                           uint32_t _dmaBufferSize, uint32_t _dmaBufferCount);
+    CSyntheticOscilloscope(const CSyntheticOscilloscope &) = delete;
+    CSyntheticOscilloscope(CSyntheticOscilloscope &&) = delete;
+    ~CSyntheticOscilloscope();
+
+    // Sine and ramp frequency in Hz and amplitude in ADC codes, set before prepare()
+    void setSignal(double _frequency, int16_t _amplitude);
+    // Drops every _period-th buffer as if the consumer was late, 0 disables
+    void setOverflowPeriod(uint32_t _period);
+
+    void prepare() override;
+    bool next(uint8_t *&_buffer1,uint8_t *&_buffer2, size_t &_size,bool &_overFlow1 , bool &_overFlow2, BlockInfo &_info) override;
+    bool changeBuffers() override;
+    void stop() override;
+    void interrupt() override;
+    void clearInterrupt() override;
+    bool isInterrupted() override;
+
+    void setIrqThreadOptions(int _priority, int _cpu) override;
+    uint32_t getBufferSize() const override { return m_DmaBufferSize; }
+    uint32_t getBufferCount() const override { return m_DmaBufferCount; }
+
+private:
+    struct DmaSlot
+    {
+        unsigned  index;
+        bool      overFlow;
+        BlockInfo info;
+    };
+
+    void generatorWorker();
+    void fill(unsigned _index, uint64_t _sampleIndex);
+    bool waitPeriod(std::chrono::steady_clock::time_point _time);
+
+    bool m_Channel1;
+    bool m_Channel2;
+    double m_SampleRate;
+    SyntheticWaveform m_Waveform;
+    double m_Frequency;
+    int16_t m_Amplitude;
+    uint32_t m_OverflowPeriod;
+    uint32_t m_DmaBufferSize;
+    uint32_t m_DmaBufferCount;
+    std::vector<int16_t> m_Buffer1;
+    std::vector<int16_t> m_Buffer2;
+    std::vector<int16_t> m_SineTable;
+    uint64_t m_DmaSequence;
+
+    std::atomic<bool> m_Interrupted;
+    std::atomic<bool> m_GeneratorRun;
+    std::thread m_GeneratorThread;
+    int m_IrqThreadPriority;
+    int m_IrqThreadCpu;
+
+    std::mutex m_RingMutex;
+    std::condition_variable m_RingCond;
+    std::deque<DmaSlot> m_Ready;
+    std::vector<unsigned> m_Free;
+    DmaSlot m_Current;
+    bool m_HasCurrent;
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <BlockInfo.h>
+
+#define TRIGGER_MAX_PRE_SAMPLES  (1 << 20)
+#define TRIGGER_MAX_POST_SAMPLES (1u << 31)
+
+enum class TriggerSource {
+    NONE,   // continuous capture
+    CHANNEL1,
+    CHANNEL2
+};
+
+enum class TriggerEdge {
+    RISING,
+    FALLING
+};
+
+// Level and edge trigger on 16 bit samples. A rising edge fires on the first sample >= level
+// after the signal was below level - hysteresis, a falling edge on the first sample <= level
+// after it was above level + hysteresis.
+struct TriggerSettings {
+    TriggerSource source;
+    TriggerEdge   edge;
+    int16_t       level;
+    uint16_t      hysteresis;
+    uint32_t      preSamples;   // samples before the trigger sample
+    uint32_t      postSamples;  // samples from the trigger sample on, at least 1
+};
+
+// Cuts segments of preSamples + postSamples around the trigger events out of a continuous
+// stream of blocks. The last preSamples of the stream are kept, so a segment may start in
+// an earlier block. Triggers are ignored while a segment is open, and the detector has to
+// re-arm after it. Segments never overlap: a trigger close after the previous segment
+// gets a shorter pre-trigger part, same after lost samples.
+class CTriggerSegmenter
+{
+public:
+    using Ptr = std::shared_ptr<CTriggerSegmenter>;
+    // One contiguous part of a segment, the pointers are valid during the call only. _info has segment
+    // and triggerIndex set, lostSamples counts samples of the segment lost right before this part.
+    using Callback = std::function<void(const int16_t *_ch1, const int16_t *_ch2, size_t _count, const BlockInfo &_info)>;
+
+    // Returns nullptr for source NONE, pre or post samples out of range or a level
+    // and hysteresis the signal can't get past to re-arm
+    static Ptr Create(const TriggerSettings &_settings);
+    CTriggerSegmenter(const TriggerSettings &_settings);
+
+    // Channels that are not captured are nullptr. Without the source channel nothing triggers.
+    void process(const int16_t *_ch1, const int16_t *_ch2, size_t _count, const BlockInfo &_info, const Callback &_callback);
+    void reset();
+
+    const TriggerSettings& getSettings() const { return m_settings; }
+    // Segments started since reset()
+    uint64_t getSegments() const { return m_segment; }
+
+private:
+    // Index of the trigger sample in _x, _count if there is none
+    size_t detect(const int16_t *_x, size_t _count);
+    void keepHistory(const int16_t *_ch1, const int16_t *_ch2, size_t _count);
+
+    TriggerSettings m_settings;
+    int16_t         m_armLevel;     // the signal has to reach this to arm the trigger
+    bool            m_armed;
+
+    // Last preSamples of the stream, without lost samples in between
+    std::vector<int16_t> m_history[2];
+    size_t          m_historyCount;
+    uint64_t        m_historyDmaSequence;
+
+    bool            m_open;
+    uint64_t        m_segment;
+    uint64_t        m_segmentStart;
+    uint64_t        m_segmentEnd;   // timeline index after the last sample of the segment
+    uint64_t        m_triggerIndex;
+    uint64_t        m_passedEnd;    // timeline index after the last sample passed on
+};
+
+// Kernels used by CTriggerSegmenter, exposed for benchmarking.
+// Index of the first sample >= _level, _count if there is none.
+size_t trigger_find_above_scalar(const int16_t *_x, size_t _count, int16_t _level);
+// Index of the first sample <= _level, _count if there is none.
+size_t trigger_find_below_scalar(const int16_t *_x, size_t _count, int16_t _level);
+
+#ifdef ARCH_ARM
+size_t trigger_find_above_neon(const int16_t *_x, size_t _count, int16_t _level);
+size_t trigger_find_below_neon(const int16_t *_x, size_t _count, int16_t _level);
+#endif
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <Oscilloscope.h>
+
+constexpr uint32_t osc0_event_id = 2;
+constexpr uint32_t osc1_event_id = 3;
+constexpr uint32_t osc0_baseaddr = 0;
+constexpr uint32_t osc1_baseaddr = 256;
+
+struct OscilloscopeMapT
+{
+    uint32_t event_sts;             // 0 - offset
+    uint32_t event_sel;             // 4 - offset
+    uint32_t trig_mask;             // 8 - offset
+    uint32_t _reserved_0;           // 12 - offset
+    uint32_t trig_pre_samp;         // 16 - offset
+    uint32_t trig_post_samp;        // 20 - offset
+    uint32_t trig_pre_cnt;          // 24 - offset
+    uint32_t trig_post_cnt;         // 28 - offset
+    uint32_t trig_low_level;        // 32 - offset
+    uint32_t trig_high_level;       // 36 - offset
+    uint32_t trig_edge;             // 40 - offset
+    uint32_t _reserved_1;           // 44 - offset
+    uint32_t dec_factor;            // 48 - offset
+    uint32_t dec_rshift;            // 52 - offset
+    uint32_t avg_en_addr;           // 56 - offset
+    uint32_t filt_bypass;           // 60 - offset
+    uint32_t filt_coeff_aa;         // 64 - offset
+    uint32_t filt_coeff_bb;         // 68 - offset
+    uint32_t filt_coeff_kk;         // 72 - offset
+    uint32_t filt_coeff_pp;         // 76 - offset
+    uint32_t dma_ctrl;              // 80 - offset
+    uint32_t dma_sts_addr;          // 84 - offset
+    uint32_t dma_dst_addr1;         // 88 - offset
+    uint32_t dma_dst_addr2;         // 92 - offset
+    uint32_t dma_buf_size;          // 96 - offset
+    uint32_t calib_offset;          // 100 - offset
+    uint32_t calib_gain;            // 104 - offset
+};
+
+// Oscilloscope of the FPGA, the DMA buffers are mapped from the rp_oscilloscope UIO node
+class CUioOscilloscope: public COscilloscope
+{
+public:
+    using Ptr = std::shared_ptr<CUioOscilloscope>;
+
+    // _dmaBufferCount = 0 takes as many buffers as fit into the reserved memory
+    static Ptr Create(const UioT &_uio, bool _channel1Enable, bool _channel2Enable, uint32_t _dec_factor,
+                      uint32_t _dmaBufferSize = osc_buf_size, uint32_t _dmaBufferCount = 0);
+
+    CUioOscilloscope(bool _channel1Enable,bool _channel2Enable, int _fd, void *_regset, size_t _regsetSize, void *_buffer, size_t _bufferSize, uintptr_t _bufferPhysAddr,uint32_t _dec_factor,
+                     uint32_t _dmaBufferSize = osc_buf_size, uint32_t _dmaBufferCount = osc_buf_min_count);
+    CUioOscilloscope(const CUioOscilloscope &) = delete;
+    CUioOscilloscope(CUioOscilloscope &&) = delete;
+    ~CUioOscilloscope();
+
+    void prepare() override;
+    bool next(uint8_t *&_buffer1,uint8_t *&_buffer2, size_t &_size,bool &_overFlow1 , bool &_overFlow2, BlockInfo &_info) override;
+    bool changeBuffers() override;
+    void stop() override;
+    void interrupt() override;
+    void clearInterrupt() override;
+    bool isInterrupted() override;
+
+    void setIrqThreadOptions(int _priority, int _cpu) override;
+    uint32_t getBufferSize() const override { return m_DmaBufferSize; }
+    uint32_t getBufferCount() const override { return m_DmaBufferCount; }
+
+private:
+    // The DMA engine only has two destination registers and ping-pongs between them.
+    // The ring is built on top: when a half is filled, its register is pointed to a free
+    // buffer and the half is released at once, the filled buffer waits in m_Ready.
+    // Only when no buffer is free the half stays held like with a plain ping-pong.
+    struct DmaSlot
+    {
+        unsigned  index;
+        int       heldHalf;     // DMA half waiting for this buffer to be released, -1 if none
+        bool      overFlow1;
+        bool      overFlow2;
+        BlockInfo info;
+    };
+
+    bool waitInterrupt();
+    bool serviceInterrupt();
+    void irqWorker();
+    void stopIrqThread();
+    void releaseHalf(unsigned _half);
+    void setHalfBuffer(unsigned _half, unsigned _index);
+    uintptr_t bufferPhysAddr(unsigned _channel, unsigned _index);
+
+    void setReg(volatile OscilloscopeMapT *_OscMap ,unsigned int _Channel);
+
+    bool m_Channel1;
+    bool m_Channel2;
+    int m_Fd;
+    void *m_Regset;
+    size_t m_RegsetSize;
+    void *m_Buffer;
+    size_t m_BufferSize;
+    uintptr_t m_BufferPhysAddr;
+    volatile OscilloscopeMapT *m_OscMap1;
+    volatile OscilloscopeMapT *m_OscMap2;
+    uint8_t *m_OscBuffer1;
+    uint8_t *m_OscBuffer2;
+    uint32_t m_dec_factor;
+    uint32_t m_DmaBufferSize;
+    uint32_t m_DmaBufferCount;
+    uint64_t m_DmaSequence;
+    uint64_t m_SampleCounter;
+    int m_StopFd;
+    std::atomic<bool> m_Interrupted;
+    std::atomic<bool> m_IrqThreadRun;
+    std::thread m_IrqThread;
+    int m_IrqThreadPriority;
+    int m_IrqThreadCpu;
+
+    std::mutex m_RingMutex;
+    std::condition_variable m_RingCond;
+    std::deque<DmaSlot> m_Ready;
+    std::vector<unsigned> m_Free;
+    unsigned m_HalfBuffer[2];
+    DmaSlot m_Current;
+    bool m_HasCurrent;
+};
@@ -0,0 +1,187 @@
+#include <cstring>
+#include <iostream>
+#include "rpsa/client/core/SampleSink.h"
+#include "rpsa/common/core/interleave.h"
+
+// Magic, version, header length and the dict padded to a multiple of 64 bytes.
+// The header is rewritten in place on close, so it has a fixed size.
+#define NPY_HEADER_SIZE 128
+
+CRawFileSink::Ptr CRawFileSink::Create(std::string _filePath){
+    return std::make_shared<CRawFileSink>(_filePath);
+}
+
+CRawFileSink::CRawFileSink(std::string _filePath):
+m_filePath(_filePath),
+m_file(nullptr),
+m_resolution(0),
+m_channels(0),
+m_samples(0),
+m_skipped(0),
+m_interleaved()
+{
+}
+
+CRawFileSink::~CRawFileSink(){
+    close();
+}
+
+bool CRawFileSink::open(){
+    close();
+    m_file = fopen(m_filePath.c_str(), "wb");
+    if (!m_file){
+        std::cerr << "Error: can't open " << m_filePath << "\n";
+        return false;
+    }
+    m_resolution = 0;
+    m_channels = 0;
+    m_samples = 0;
+    m_skipped = 0;
+    return true;
+}
+
+void CRawFileSink::write(const SampleBlock &_block){
+    if (!m_file)
+        return;
+
+    uint32_t channels = (_block.size_ch1 > 0 ? 1 : 0) + (_block.size_ch2 > 0 ? 1 : 0);
+    uint32_t bytes = _block.resolution == 8 ? 1 : 2;
+    if (channels == 0)
+        return;
+
+    if (m_channels == 0){
+        m_channels = channels;
+        m_resolution = bytes * 8;
+        if (!writeHeader()){
+            close();
+            return;
+        }
+    }
+
+    if (channels != m_channels || bytes * 8 != m_resolution){
+        m_skipped++;
+        return;
+    }
+
+    if (channels == 1){
+        const uint8_t *data = _block.size_ch1 > 0 ? _block.ch1 : _block.ch2;
+        size_t size = _block.size_ch1 > 0 ? _block.size_ch1 : _block.size_ch2;
+        size_t samples = size / bytes;
+        fwrite(data, bytes, samples, m_file);
+        m_samples += samples;
+        return;
+    }
+
+    size_t samples = MIN(_block.size_ch1, _block.size_ch2) / bytes;
+    m_interleaved.resize(samples * bytes * 2);
+    if (bytes == 1){
+        interleave8(m_interleaved.data(), _block.ch1, _block.ch2, samples);
+    }else{
+        interleave16(reinterpret_cast<uint16_t*>(m_interleaved.data()),
+                     reinterpret_cast<const uint16_t*>(_block.ch1),
+                     reinterpret_cast<const uint16_t*>(_block.ch2), samples);
+    }
+    fwrite(m_interleaved.data(), bytes * 2, samples, m_file);
+    m_samples += samples;
+}
+
+void CRawFileSink::close(){
+    if (!m_file)
+        return;
+    if (m_channels != 0 && fseek(m_file, 0, SEEK_SET) == 0){
+        writeHeader();
+    }
+    fclose(m_file);
+    m_file = nullptr;
+}
+
+
+CNpySink::Ptr CNpySink::Create(std::string _filePath){
+    return std::make_shared<CNpySink>(_filePath);
+}
+
+CNpySink::CNpySink(std::string _filePath):
+CRawFileSink(_filePath)
+{
+}
+
+CNpySink::~CNpySink(){
+    close();
+}
+
+bool CNpySink::writeHeader(){
+    char dict[NPY_HEADER_SIZE];
+    const char *descr = m_resolution == 8 ? "|i1" : "<i2";
+    int len;
+    if (m_channels == 1){
+        len = snprintf(dict, sizeof(dict), "{'descr': '%s', 'fortran_order': False, 'shape': (%llu,), }",
+                       descr, (unsigned long long)m_samples);
+    }else{
+        len = snprintf(dict, sizeof(dict), "{'descr': '%s', 'fortran_order': False, 'shape': (%llu, %u), }",
+                       descr, (unsigned long long)m_samples, m_channels);
+    }
+
+    uint8_t header[NPY_HEADER_SIZE];
+    const uint16_t dict_size = NPY_HEADER_SIZE - 10;
+    if (len < 0 || len >= dict_size)
+        return false;
+    memcpy(header, "\x93NUMPY\x01\x00", 8);
+    header[8] = dict_size & 0xFF;
+    header[9] = dict_size >> 8;
+    memcpy(header + 10, dict, len);
+    memset(header + 10 + len, ' ', dict_size - len - 1);
+    header[NPY_HEADER_SIZE - 1] = '\n';
+    return fwrite(header, 1, NPY_HEADER_SIZE, m_file) == NPY_HEADER_SIZE;
+}
+
+
+CStreamFileSink::Ptr CStreamFileSink::Create(Stream_FileType _fileType, std::string _dirPath){
+    return std::make_shared<CStreamFileSink>(_fileType, _dirPath);
+}
+
+CStreamFileSink::CStreamFileSink(Stream_FileType _fileType, std::string _dirPath):
+m_fileType(_fileType),
+m_dirPath(_dirPath),
+m_manager(nullptr)
+{
+}
+
+bool CStreamFileSink::open(){
+    close();
+    m_manager = CStreamingManager::Create(m_fileType, m_dirPath);
+    m_manager->setBlockSize(2 * PACK_MAX_DATA_SIZE);
+    m_manager->run();
+    return m_manager->isFileThreadWork();
+}
+
+void CStreamFileSink::write(const SampleBlock &_block){
+    if (!m_manager)
+        return;
+    m_manager->passBuffers(_block.lostRate, _block.oscRate,
+                           _block.ch1, _block.size_ch1,
+                           _block.ch2, _block.size_ch2,
+                           _block.resolution, _block.id, _block.info);
+}
+
+void CStreamFileSink::close(){
+    if (!m_manager)
+        return;
+    // Everything the sink was given goes to the file
+    m_manager->stop(true);
+    m_manager = nullptr;
+}
+
+
+CCallbackSink::Ptr CCallbackSink::Create(Callback _callback){
+    return std::make_shared<CCallbackSink>(_callback);
+}
+
+CCallbackSink::CCallbackSink(Callback _callback):
+m_callback(_callback)
+{
+}
+
+void CCallbackSink::write(const SampleBlock &_block){
+    if (m_callback)
+        m_callback(_block);
+}
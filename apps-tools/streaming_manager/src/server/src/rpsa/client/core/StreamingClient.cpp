@@ -0,0 +1,320 @@
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include "rpsa/client/core/StreamingClient.h"
+#include "rpsa/common/core/rice_codec.h"
+
+// A queued pack is the parsed header followed by the channel data as received
+struct QueuedBlock
+{
+    SampleBlock sample;     // sizes of the received data
+    size_t      rawSize;    // bytes per channel after decoding, 0 for a raw pack
+};
+
+#define CLIENT_BLOCK_DATA_OFFSET ((sizeof(QueuedBlock) + 15) & ~size_t(15))
+
+CStreamingClient::Ptr CStreamingClient::Create(std::string _host, std::string _port, asionet::Protocol _protocol, size_t _queueBlocks){
+    return std::make_shared<CStreamingClient>(_host, _port, _protocol, _queueBlocks);
+}
+
+CStreamingClient::CStreamingClient(std::string _host, std::string _port, asionet::Protocol _protocol, size_t _queueBlocks):
+notifyError(nullptr),
+m_host(_host),
+m_port(_port),
+m_protocol(_protocol),
+m_version(PACK_VERSION_2),
+m_flags(0),
+m_asionet(nullptr),
+m_sinks(),
+m_decoded(),
+m_ring(_queueBlocks),
+m_sinkThread(nullptr),
+m_sinkRun(false),
+m_sinkWaiting(false),
+m_hasId(false),
+m_nextId(0),
+m_packs(0),
+m_bytes(0),
+m_wireBytes(0),
+m_lostPacks(0),
+m_lostSamples(0),
+m_badPacks(0),
+m_queueDrops(0),
+m_segments(0),
+m_lastSegment(0)
+{
+}
+
+CStreamingClient::~CStreamingClient(){
+    stop();
+}
+
+void CStreamingClient::addSink(CSampleSink::Ptr _sink){
+    m_sinks.push_back(_sink);
+}
+
+void CStreamingClient::setRequestVersion(uint16_t _version, uint32_t _flags){
+    m_version = _version;
+    m_flags = _flags;
+}
+
+bool CStreamingClient::openSinks(){
+    for (auto &sink : m_sinks){
+        if (!sink->open()){
+            for (auto &opened : m_sinks){
+                if (opened == sink)
+                    break;
+                opened->close();
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+void CStreamingClient::closeSinks(){
+    for (auto &sink : m_sinks){
+        sink->close();
+    }
+}
+
+bool CStreamingClient::start(){
+    if (m_asionet)
+        return true;
+
+    // A received pack is never larger than the receive buffer
+    size_t packSize = m_protocol == asionet::Protocol::UDP ? SOCKET_BUFFER_SIZE : FIFO_BUFFER_SIZE;
+    if (!m_ring.allocate(m_ring.capacity(), CLIENT_BLOCK_DATA_OFFSET + packSize))
+        return false;
+
+    if (!openSinks())
+        return false;
+
+    m_hasId = false;
+    m_nextId = 0;
+    m_sinkRun = true;
+    m_sinkThread = new std::thread(&CStreamingClient::sinkTask, this);
+
+    m_asionet = asionet::CAsioNet::Create(asionet::Mode::CLIENT, m_protocol, m_host, m_port);
+    m_asionet->addCallReceived(std::bind(&CStreamingClient::received, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+    m_asionet->addCallReceivedError([this](std::error_code){ m_badPacks++; });
+    m_asionet->addCallClient_Error([this](std::error_code _error){
+        if (notifyError)
+            notifyError(_error);
+    });
+    m_asionet->SetRequestVersion(m_version, m_flags);
+    m_asionet->Start();
+    return true;
+}
+
+void CStreamingClient::stop(){
+    if (!m_asionet)
+        return;
+
+    // Joins the network thread, nothing is queued after this
+    m_asionet = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(m_sinkMutex);
+        m_sinkRun = false;
+    }
+    m_sinkCond.notify_one();
+    if (m_sinkThread){
+        m_sinkThread->join();
+        delete m_sinkThread;
+        m_sinkThread = nullptr;
+    }
+
+    closeSinks();
+}
+
+bool CStreamingClient::isConnected(){
+    return m_asionet && m_asionet->IsConnected();
+}
+
+ClientCounters CStreamingClient::getCounters(){
+    ClientCounters counters;
+    counters.packs = m_packs;
+    counters.bytes = m_bytes;
+    counters.wireBytes = m_wireBytes;
+    counters.lostPacks = m_lostPacks;
+    counters.lostSamples = m_lostSamples;
+    counters.badPacks = m_badPacks;
+    counters.queueDrops = m_queueDrops;
+    counters.queueMax = m_ring.highWaterMark();
+    counters.segments = m_segments;
+    return counters;
+}
+
+void CStreamingClient::received(std::error_code _error, uint8_t *_buffer, size_t _size){
+    if (_error)
+        return;
+
+    uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::system_clock::now().time_since_epoch()).count();
+
+    asionet::PackView view;
+    if (asionet::CAsioNet::ExtractPack(_buffer, _size, view) != asionet::PACK_OK){
+        m_badPacks++;
+        return;
+    }
+
+    if (m_hasId && view.id > m_nextId){
+        m_lostPacks += view.id - m_nextId;
+    }
+    // UDP may reorder, a late pack doesn't move the expected id back
+    if (!m_hasId || view.id >= m_nextId){
+        m_nextId = view.id + 1;
+        m_hasId = true;
+    }
+
+    CBlock *block = m_ring.acquireWrite();
+    if (!block || !CBlockRing::fits(block, CLIENT_BLOCK_DATA_OFFSET + view.size_ch1 + view.size_ch2)){
+        m_queueDrops++;
+        return;
+    }
+
+    QueuedBlock queued;
+    SampleBlock &sample = queued.sample;
+    sample.id = view.id;
+    sample.timestamp = view.timestamp;
+    sample.receiveTime = now;
+    sample.lostRate = view.lostRate;
+    sample.oscRate = view.oscRate;
+    sample.resolution = view.resolution;
+    sample.info = view.info;
+    sample.ch1 = nullptr;
+    sample.size_ch1 = view.size_ch1;
+    sample.ch2 = nullptr;
+    sample.size_ch2 = view.size_ch2;
+    queued.rawSize = view.raw_size;
+    memcpy(block->data, &queued, sizeof(QueuedBlock));
+    if (view.size_ch1)
+        memcpy(block->data + CLIENT_BLOCK_DATA_OFFSET, view.ch1, view.size_ch1);
+    if (view.size_ch2)
+        memcpy(block->data + CLIENT_BLOCK_DATA_OFFSET + view.size_ch1, view.ch2, view.size_ch2);
+    block->size = CLIENT_BLOCK_DATA_OFFSET + view.size_ch1 + view.size_ch2;
+    m_ring.commitWrite();
+
+    // Pairs with the store of m_sinkWaiting in sinkTask(): either the sink thread
+    // sees the new block or this thread sees that it has to wake it up
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sinkWaiting){
+        std::lock_guard<std::mutex> lock(m_sinkMutex);
+        m_sinkCond.notify_one();
+    }
+}
+
+bool CStreamingClient::passQueued(){
+    CBlock *block = m_ring.peekRead();
+    if (!block)
+        return false;
+
+    QueuedBlock queued;
+    memcpy(&queued, block->data, sizeof(QueuedBlock));
+    SampleBlock &sample = queued.sample;
+    if (sample.size_ch1)
+        sample.ch1 = block->data + CLIENT_BLOCK_DATA_OFFSET;
+    if (sample.size_ch2)
+        sample.ch2 = block->data + CLIENT_BLOCK_DATA_OFFSET + sample.size_ch1;
+
+    passBlock(sample, queued.rawSize);
+    m_ring.releaseRead();
+    return true;
+}
+
+void CStreamingClient::passBlock(SampleBlock &_sample, size_t _rawSize){
+    m_wireBytes += _sample.size_ch1 + _sample.size_ch2;
+    if (_rawSize > 0){
+        size_t sampleSize = _sample.resolution == 16 ? 2 : 1;
+        size_t samples = _rawSize / sampleSize;
+        if (m_decoded.size() < 2 * _rawSize)
+            m_decoded.resize(2 * _rawSize);
+        uint8_t *ch1 = m_decoded.data();
+        uint8_t *ch2 = m_decoded.data() + _rawSize;
+        if ((_sample.ch1 && !rice_decode(ch1, samples, _sample.ch1, _sample.size_ch1, _sample.resolution)) ||
+            (_sample.ch2 && !rice_decode(ch2, samples, _sample.ch2, _sample.size_ch2, _sample.resolution))){
+            m_badPacks++;
+            return;
+        }
+        if (_sample.ch1){
+            _sample.ch1 = ch1;
+            _sample.size_ch1 = samples * sampleSize;
+        }
+        if (_sample.ch2){
+            _sample.ch2 = ch2;
+            _sample.size_ch2 = samples * sampleSize;
+        }
+    }
+
+    for (auto &sink : m_sinks){
+        sink->write(_sample);
+    }
+
+    m_packs++;
+    m_bytes += _sample.size_ch1 + _sample.size_ch2;
+    m_lostSamples += _sample.info.lostSamples;
+    if (_sample.info.segment != 0 && _sample.info.segment != m_lastSegment)
+        m_segments++;
+    m_lastSegment = _sample.info.segment;
+}
+
+int64_t CStreamingClient::replay(const std::string &_filePath){
+    if (m_asionet)
+        return -1;
+    std::ifstream file(_filePath, std::ios::binary);
+    if (!file.is_open())
+        return -1;
+    if (!openSinks())
+        return -1;
+
+    std::vector<uint8_t> buffer(PACK_V2_HEADER_SIZE);
+    int64_t packs = 0;
+    while (file.read((char*)buffer.data(), PACK_V2_HEADER_SIZE)){
+        size_t size = asionet::CAsioNet::PackSize(buffer.data(), PACK_V2_HEADER_SIZE);
+        if (size < PACK_V2_HEADER_SIZE){
+            m_badPacks++;
+            break;
+        }
+        buffer.resize(size);
+        if (!file.read((char*)buffer.data() + PACK_V2_HEADER_SIZE, size - PACK_V2_HEADER_SIZE))
+            break;
+        asionet::PackView view;
+        if (asionet::CAsioNet::ExtractPack(buffer.data(), size, view) != asionet::PACK_OK){
+            m_badPacks++;
+            continue;
+        }
+        SampleBlock sample;
+        sample.id = view.id;
+        sample.timestamp = view.timestamp;
+        sample.receiveTime = view.timestamp;
+        sample.lostRate = view.lostRate;
+        sample.oscRate = view.oscRate;
+        sample.resolution = view.resolution;
+        sample.info = view.info;
+        sample.ch1 = view.ch1;
+        sample.size_ch1 = view.size_ch1;
+        sample.ch2 = view.ch2;
+        sample.size_ch2 = view.size_ch2;
+        passBlock(sample, view.raw_size);
+        packs++;
+    }
+    closeSinks();
+    return packs;
+}
+
+void CStreamingClient::sinkTask(){
+    while (m_sinkRun){
+        if (passQueued())
+            continue;
+
+        std::unique_lock<std::mutex> lock(m_sinkMutex);
+        m_sinkWaiting = true;
+        // The timeout only covers a missed notification, it is not a polling interval
+        m_sinkCond.wait_for(lock, std::chrono::milliseconds(100), [this]{ return !m_sinkRun || m_ring.count() > 0; });
+        m_sinkWaiting = false;
+    }
+
+    while (passQueued()) {}
+}
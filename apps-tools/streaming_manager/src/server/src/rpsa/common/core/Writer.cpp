@@ -6,6 +6,8 @@
 
 #define  OFFSET_NEXT_SEGMENT    12
 #define  OFFSET_RAW_DATA        OFFSET_NEXT_SEGMENT + 8
+#define  TOC_META_DATA          (1 << 1)
+#define  TOC_RAW_DATA           (1 << 3)
 
 namespace TDMS {
 
@@ -160,6 +162,18 @@ namespace TDMS {
 
         auto posSegmentEnd = m_fileStream->tellp();
         WriteNextSegmentAddress(posSegmentBegin,posSegmentEnd - posSegmentBegin - 28);
+
+        if (m_incremental) {
+            m_layout.clear();
+            m_layoutVersion = root->Version;
+            if (root->TableOfContents.HasRawData) {
+                for(auto &n :nodes) {
+                    if (n != root && n->RawData.Count > 0) {
+                        m_layout.push_back(make_pair(n->RawData.DataType.GetDataType(), (uint64_t)n->RawData.Count));
+                    }
+                }
+            }
+        }
     }
 
     int64_t Writer::WriteRawHeader(shared_ptr<Metadata> metadata){
@@ -204,6 +218,50 @@ namespace TDMS {
         m_is_append = append;
         m_stek_pos_g.clear();
         m_stek_pos_p.clear();
+        m_incremental = false;
+        m_layoutVersion = 0;
+    }
+
+    void Writer::SetStream(iostream &fileStream){
+        m_fileStream = &fileStream;
+        m_stek_pos_g.clear();
+        m_stek_pos_p.clear();
+    }
+
+    void Writer::SetIncremental(bool enable){
+        m_incremental = enable;
+        ResetLayout();
+    }
+
+    void Writer::ResetLayout(){
+        m_layout.clear();
+    }
+
+    bool Writer::WriteRaw(const RawBlock *blocks, size_t count){
+        if (!m_incremental || m_layout.empty() || m_layout.size() != count)
+            return false;
+        uint64_t rawSize = 0;
+        for(size_t i = 0; i < count; i++){
+            if (m_layout[i].first != blocks[i].type || m_layout[i].second != blocks[i].count)
+                return false;
+            rawSize += DataType::GetArrayLength(blocks[i].type, blocks[i].count);
+        }
+
+        // Lead-in without metadata: the reader takes the object list from the previous segment
+        m_fileStream->seekp(0,ios::end);
+        m_fileStream->write("TDSm",4);
+        int32_t tableOfContentsMask = TOC_RAW_DATA;
+        m_fileStream->write(reinterpret_cast<char*>(&tableOfContentsMask), sizeof(tableOfContentsMask));
+        m_fileStream->write(reinterpret_cast<char*>(&m_layoutVersion), sizeof(m_layoutVersion));
+        int64_t nextsegment = rawSize;
+        m_fileStream->write(reinterpret_cast<char*>(&nextsegment), sizeof(nextsegment));
+        int64_t data_offset = 0;
+        m_fileStream->write(reinterpret_cast<char*>(&data_offset), sizeof(data_offset));
+
+        for(size_t i = 0; i < count; i++){
+            m_fileStream->write((const char*)blocks[i].data, DataType::GetArrayLength(blocks[i].type, blocks[i].count));
+        }
+        return true;
     }
 
     // Full lenght 28 bytes;
@@ -0,0 +1,262 @@
+#include <cstdlib>
+#include <cstring>
+#include "rpsa/common/core/block_ring.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+static uint8_t* allocBlockData(size_t _size){
+    void *ptr = nullptr;
+#ifdef _WIN32
+    ptr = _aligned_malloc(_size, BLOCK_RING_ALIGN);
+#else
+    if (posix_memalign(&ptr, BLOCK_RING_ALIGN, _size) != 0)
+        ptr = nullptr;
+#endif
+    return static_cast<uint8_t*>(ptr);
+}
+
+static void freeBlockData(uint8_t *_ptr){
+    if (_ptr == nullptr)
+        return;
+#ifdef _WIN32
+    _aligned_free(_ptr);
+#else
+    free(_ptr);
+#endif
+}
+
+CBlockRing::CBlockRing(size_t _count):
+    m_blocks(nullptr),
+    m_count(0),
+    m_head(0),
+    m_tail(0),
+    m_usedBytes(0),
+    m_highWaterMark(0)
+{
+    allocate(_count, 0);
+}
+
+CBlockRing::~CBlockRing(){
+    freeBlocks();
+}
+
+void CBlockRing::freeBlocks(){
+    for (size_t i = 0; i < m_count; i++){
+        freeBlockData(m_blocks[i].data);
+    }
+    delete [] m_blocks;
+    m_blocks = nullptr;
+    m_count = 0;
+}
+
+bool CBlockRing::allocate(size_t _count, size_t _blockSize){
+    if (_count == 0)
+        _count = 1;
+    reset();
+    if (_count != m_count){
+        freeBlocks();
+        m_blocks = new CBlock[_count];
+        m_count = _count;
+        for (size_t i = 0; i < m_count; i++){
+            m_blocks[i].data = nullptr;
+            m_blocks[i].capacity = 0;
+            m_blocks[i].size = 0;
+            m_blocks[i].flags = 0;
+        }
+    }
+    for (size_t i = 0; i < m_count; i++){
+        auto block = &m_blocks[i];
+        block->size = 0;
+        block->flags = 0;
+        if (block->capacity >= _blockSize)
+            continue;
+        freeBlockData(block->data);
+        block->data = allocBlockData(_blockSize);
+        block->capacity = 0;
+        if (block->data == nullptr){
+            // Some slots smaller than asked would fail at random, none fit instead
+            for (size_t j = 0; j < m_count; j++){
+                freeBlockData(m_blocks[j].data);
+                m_blocks[j].data = nullptr;
+                m_blocks[j].capacity = 0;
+            }
+            return false;
+        }
+        memset(block->data, 0, _blockSize);
+        block->capacity = _blockSize;
+    }
+    return true;
+}
+
+CBlock* CBlockRing::acquireWrite(){
+    size_t head = m_head.load(std::memory_order_relaxed);
+    size_t tail = m_tail.load(std::memory_order_acquire);
+    if (head - tail >= m_count)
+        return nullptr;
+    auto block = &m_blocks[head % m_count];
+    block->size = 0;
+    block->flags = 0;
+    return block;
+}
+
+void CBlockRing::commitWrite(){
+    size_t head = m_head.load(std::memory_order_relaxed);
+    m_usedBytes.fetch_add(m_blocks[head % m_count].size, std::memory_order_relaxed);
+    m_head.store(head + 1, std::memory_order_release);
+
+    size_t used = head + 1 - m_tail.load(std::memory_order_relaxed);
+    if (used > m_highWaterMark.load(std::memory_order_relaxed))
+        m_highWaterMark.store(used, std::memory_order_relaxed);
+}
+
+CBlock* CBlockRing::peekRead(){
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    size_t head = m_head.load(std::memory_order_acquire);
+    if (tail == head)
+        return nullptr;
+    return &m_blocks[tail % m_count];
+}
+
+void CBlockRing::releaseRead(){
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    m_usedBytes.fetch_sub(m_blocks[tail % m_count].size, std::memory_order_relaxed);
+    m_tail.store(tail + 1, std::memory_order_release);
+}
+
+void CBlockRing::reset(){
+    m_tail.store(m_head.load(std::memory_order_acquire), std::memory_order_release);
+    m_usedBytes.store(0, std::memory_order_relaxed);
+    m_highWaterMark.store(0, std::memory_order_relaxed);
+}
+
+size_t CBlockRing::count(){
+    size_t tail = m_tail.load(std::memory_order_acquire);
+    size_t head = m_head.load(std::memory_order_acquire);
+    return head - tail;
+}
+
+size_t CBlockRing::usedBytes(){
+    return m_usedBytes.load(std::memory_order_relaxed);
+}
+
+size_t CBlockRing::highWaterMark(){
+    return m_highWaterMark.load(std::memory_order_relaxed);
+}
+
+bool CBlockRing::fits(const CBlock *_block, size_t _size){
+    return _block->capacity >= _size;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+CBlockStreamBuf::CBlockStreamBuf():
+    m_block(nullptr)
+{
+}
+
+void CBlockStreamBuf::attach(CBlock *_block){
+    m_block = _block;
+    m_block->size = 0;
+    char *begin = reinterpret_cast<char*>(m_block->data);
+    setp(begin, begin + m_block->capacity);
+}
+
+void CBlockStreamBuf::detach(){
+    if (m_block != nullptr){
+        commitSize();
+        m_block = nullptr;
+    }
+    setp(nullptr, nullptr);
+}
+
+void CBlockStreamBuf::commitSize(){
+    size_t pos = pptr() - pbase();
+    if (pos > m_block->size)
+        m_block->size = pos;
+}
+
+char* CBlockStreamBuf::reserve(size_t _size){
+    if (m_block == nullptr)
+        return nullptr;
+    if ((size_t)(epptr() - pptr()) < _size)
+        return nullptr;
+    char *ptr = pptr();
+    pbump(static_cast<int>(_size));
+    return ptr;
+}
+
+CBlockStreamBuf::int_type CBlockStreamBuf::overflow(int_type _ch){
+    if (m_block == nullptr)
+        return traits_type::eof();
+    if (traits_type::eq_int_type(_ch, traits_type::eof()))
+        return traits_type::not_eof(_ch);
+    if (pptr() == epptr())
+        return traits_type::eof();
+    *pptr() = traits_type::to_char_type(_ch);
+    pbump(1);
+    return _ch;
+}
+
+std::streamsize CBlockStreamBuf::xsputn(const char *_s, std::streamsize _n){
+    if (m_block == nullptr || _n <= 0)
+        return 0;
+    if (epptr() - pptr() < _n)
+        return 0;
+    memcpy(pptr(), _s, _n);
+    pbump(static_cast<int>(_n));
+    return _n;
+}
+
+CBlockStreamBuf::pos_type CBlockStreamBuf::seekoff(off_type _off, std::ios_base::seekdir _dir, std::ios_base::openmode _which){
+    if (m_block == nullptr || !(_which & std::ios_base::out))
+        return pos_type(off_type(-1));
+    commitSize();
+    off_type base = 0;
+    if (_dir == std::ios_base::cur)
+        base = pptr() - pbase();
+    else if (_dir == std::ios_base::end)
+        base = m_block->size;
+    return seekpos(pos_type(base + _off), _which);
+}
+
+CBlockStreamBuf::pos_type CBlockStreamBuf::seekpos(pos_type _pos, std::ios_base::openmode _which){
+    if (m_block == nullptr || !(_which & std::ios_base::out))
+        return pos_type(off_type(-1));
+    commitSize();
+    off_type pos = _pos;
+    if (pos < 0 || pos > static_cast<off_type>(m_block->size))
+        return pos_type(off_type(-1));
+    char *begin = reinterpret_cast<char*>(m_block->data);
+    setp(begin, begin + m_block->capacity);
+    pbump(static_cast<int>(pos));
+    return _pos;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+CBlockStream::CBlockStream():
+    std::iostream(nullptr)
+{
+    rdbuf(&m_buf);
+}
+
+void CBlockStream::attach(CBlock *_block){
+    m_buf.attach(_block);
+    clear();
+}
+
+uint8_t* CBlockStream::reserve(size_t _size){
+    auto ptr = m_buf.reserve(_size);
+    if (ptr == nullptr){
+        setstate(std::ios_base::badbit);
+        return nullptr;
+    }
+    return reinterpret_cast<uint8_t*>(ptr);
+}
+
+void CBlockStream::detach(){
+    flush();
+    m_buf.detach();
+}
@@ -0,0 +1,96 @@
+#include <cstring>
+#include "rpsa/common/core/crc32c.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CRC32C_X86
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY 0x82F63B78 // reflected 0x1EDC6F41
+
+struct Crc32cTable{
+    uint32_t t[8][256];
+
+    Crc32cTable(){
+        for (uint32_t i = 0; i < 256; i++){
+            uint32_t crc = i;
+            for (int k = 0; k < 8; k++)
+                crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+            t[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++){
+            for (int k = 1; k < 8; k++)
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+        }
+    }
+};
+
+static const Crc32cTable g_table;
+
+uint32_t crc32c_table(uint32_t _crc, const void *_data, size_t _size){
+    auto p = static_cast<const uint8_t*>(_data);
+    uint32_t crc = ~_crc;
+    while (_size >= 8){
+        // Bytes are combined explicitly, so the data doesn't need any alignment or a little endian host
+        uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = g_table.t[7][lo & 0xFF] ^ g_table.t[6][(lo >> 8) & 0xFF] ^
+              g_table.t[5][(lo >> 16) & 0xFF] ^ g_table.t[4][lo >> 24] ^
+              g_table.t[3][hi & 0xFF] ^ g_table.t[2][(hi >> 8) & 0xFF] ^
+              g_table.t[1][(hi >> 16) & 0xFF] ^ g_table.t[0][hi >> 24];
+        p += 8;
+        _size -= 8;
+    }
+    while (_size--){
+        crc = (crc >> 8) ^ g_table.t[0][(crc ^ *p++) & 0xFF];
+    }
+    return ~crc;
+}
+
+#ifdef CRC32C_X86
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t _crc, const void *_data, size_t _size){
+    auto p = static_cast<const uint8_t*>(_data);
+    uint32_t crc = ~_crc;
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (_size >= 8){
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+        p += 8;
+        _size -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (_size >= 4){
+        uint32_t v;
+        memcpy(&v, p, 4);
+        crc = _mm_crc32_u32(crc, v);
+        p += 4;
+        _size -= 4;
+    }
+    while (_size--){
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return ~crc;
+}
+
+#endif // CRC32C_X86
+
+typedef uint32_t (*Crc32cFunc)(uint32_t, const void*, size_t);
+
+static Crc32cFunc selectCrc32c(){
+#ifdef CRC32C_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        return crc32c_sse42;
+#endif
+    return crc32c_table;
+}
+
+uint32_t crc32c(uint32_t _crc, const void *_data, size_t _size){
+    static const Crc32cFunc func = selectCrc32c();
+    return func(_crc, _data, _size);
+}
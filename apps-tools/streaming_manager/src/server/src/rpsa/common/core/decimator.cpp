@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <cmath>
+#include "rpsa/common/core/decimator.h"
+
+#ifdef ARCH_ARM
+#include <arm_neon.h>
+#endif
+
+// The CIC register must hold 16 bit input + order * log2(factor) bits
+#define DECIMATION_CIC_REGISTER_BITS 63
+
+static inline int16_t saturate16(int64_t _value){
+    return static_cast<int16_t>(std::min<int64_t>(INT16_MAX, std::max<int64_t>(INT16_MIN, _value)));
+}
+
+int64_t decimator_sum_scalar(const int16_t *_in, size_t _count){
+    int64_t sum = 0;
+    for (size_t i = 0; i < _count; i++)
+        sum += _in[i];
+    return sum;
+}
+
+int16_t decimator_dot_scalar(const int16_t *_coefs, const int16_t *_in, size_t _count){
+    int64_t sum = 0;
+    for (size_t i = 0; i < _count; i++)
+        sum += (int32_t)_coefs[i] * _in[i];
+    return saturate16((sum + (1 << 14)) >> 15);
+}
+
+#ifdef ARCH_ARM
+
+// vpadalq_s16 adds two samples per 32 bit lane, so a lane is safe for 2^15 vectors
+#define DECIMATION_NEON_SUM_CHUNK (8 << 15)
+
+int64_t decimator_sum_neon(const int16_t *_in, size_t _count){
+    int64_t sum = 0;
+    size_t i = 0;
+    size_t vectors = _count & ~(size_t)7;
+    while (i < vectors){
+        size_t end = std::min(vectors, i + DECIMATION_NEON_SUM_CHUNK);
+        int32x4_t acc = vdupq_n_s32(0);
+        for (; i < end; i += 8)
+            acc = vpadalq_s16(acc, vld1q_s16(_in + i));
+        int64x2_t wide = vpaddlq_s32(acc);
+        sum += vgetq_lane_s64(wide, 0) + vgetq_lane_s64(wide, 1);
+    }
+    return sum + decimator_sum_scalar(_in + i, _count - i);
+}
+
+// The sum of |coefficients| is about 1.0 in Q15, so the 32 bit lanes can't overflow
+int16_t decimator_dot_neon(const int16_t *_coefs, const int16_t *_in, size_t _count){
+    int32x4_t acc = vdupq_n_s32(0);
+    size_t i = 0;
+    for (; i + 8 <= _count; i += 8){
+        int16x8_t c = vld1q_s16(_coefs + i);
+        int16x8_t x = vld1q_s16(_in + i);
+        acc = vmlal_s16(acc, vget_low_s16(c), vget_low_s16(x));
+        acc = vmlal_s16(acc, vget_high_s16(c), vget_high_s16(x));
+    }
+    int64x2_t wide = vpaddlq_s32(acc);
+    int64_t sum = vgetq_lane_s64(wide, 0) + vgetq_lane_s64(wide, 1);
+    for (; i < _count; i++)
+        sum += (int32_t)_coefs[i] * _in[i];
+    return saturate16((sum + (1 << 14)) >> 15);
+}
+
+#endif // ARCH_ARM
+
+static inline int64_t decimatorSum(const int16_t *_in, size_t _count){
+#ifdef ARCH_ARM
+    if (_count >= 16)
+        return decimator_sum_neon(_in, _count);
+#endif
+    return decimator_sum_scalar(_in, _count);
+}
+
+static inline int16_t decimatorDot(const int16_t *_coefs, const int16_t *_in, size_t _count){
+#ifdef ARCH_ARM
+    return decimator_dot_neon(_coefs, _in, _count);
+#else
+    return decimator_dot_scalar(_coefs, _in, _count);
+#endif
+}
+
+// Blackman windowed sinc, normalized to a DC gain of exactly 1.0 in Q15
+static std::vector<int16_t> designLowPass(uint32_t _taps, uint32_t _factor){
+    const double cutoff = 0.45 / _factor;
+    const double center = (_taps - 1) / 2.0;
+    std::vector<double> h(_taps);
+    double sum = 0;
+    for (uint32_t i = 0; i < _taps; i++){
+        double x = i - center;
+        double sinc = x == 0 ? 2 * cutoff : std::sin(2 * M_PI * cutoff * x) / (M_PI * x);
+        double window = _taps > 1 ? 0.42 - 0.5 * std::cos(2 * M_PI * i / (_taps - 1)) + 0.08 * std::cos(4 * M_PI * i / (_taps - 1)) : 1;
+        h[i] = sinc * window;
+        sum += h[i];
+    }
+    std::vector<int16_t> coefs(_taps);
+    int32_t total = 0;
+    for (uint32_t i = 0; i < _taps; i++){
+        coefs[i] = saturate16(std::lround(h[i] / sum * 32768));
+        total += coefs[i];
+    }
+    // Rounding error goes to the middle tap
+    coefs[_taps / 2] = saturate16(coefs[_taps / 2] + 32768 - total);
+    return coefs;
+}
+
+CDecimator::Ptr CDecimator::Create(DecimationFilter _filter, uint32_t _factor, uint32_t _taps, uint32_t _order){
+    if (_filter == DecimationFilter::NONE || _factor < 1 || _factor > DECIMATION_MAX_FACTOR)
+        return nullptr;
+    if (_filter == DecimationFilter::FIR && (_taps < 2 || _taps > DECIMATION_FIR_MAX_TAPS))
+        return nullptr;
+    if (_filter == DecimationFilter::CIC){
+        if (_order < 1 || _order > DECIMATION_CIC_MAX_ORDER)
+            return nullptr;
+        uint32_t bits = 0;
+        while (((uint64_t)1 << bits) < _factor)
+            bits++;
+        if (16 + _order * bits > DECIMATION_CIC_REGISTER_BITS)
+            return nullptr;
+    }
+    return std::make_shared<CDecimator>(_filter, _factor, _taps, _order);
+}
+
+CDecimator::CDecimator(DecimationFilter _filter, uint32_t _factor, uint32_t _taps, uint32_t _order):
+    m_filter(_filter),
+    m_factor(_factor),
+    m_order(_order),
+    m_remain(_factor),
+    m_sum(0),
+    m_scale(std::llround(4294967296.0 / _factor)),
+    m_cicGain(std::pow((double)_factor, -(double)_order)),
+    m_coefs(),
+    m_history(),
+    m_stitch()
+{
+    if (m_filter == DecimationFilter::FIR){
+        m_coefs = designLowPass(_taps, _factor);
+        m_history.assign(_taps - 1, 0);
+        m_stitch.assign(2 * (_taps - 1), 0);
+    }
+    reset();
+}
+
+void CDecimator::reset(){
+    m_remain = m_factor;
+    m_sum = 0;
+    std::fill(std::begin(m_integrators), std::end(m_integrators), 0);
+    std::fill(std::begin(m_combs), std::end(m_combs), 0);
+    std::fill(m_history.begin(), m_history.end(), 0);
+}
+
+size_t CDecimator::process(const int16_t *_in, size_t _count, int16_t *_out){
+    switch (m_filter){
+        case DecimationFilter::AVERAGE:
+            return processAverage(_in, _count, _out);
+        case DecimationFilter::CIC:
+            return processCic(_in, _count, _out);
+        case DecimationFilter::FIR:
+            return processFir(_in, _count, _out);
+        default:
+            return 0;
+    }
+}
+
+size_t CDecimator::processAverage(const int16_t *_in, size_t _count, int16_t *_out){
+    size_t produced = 0;
+    size_t i = 0;
+    while (i < _count){
+        size_t n = std::min<size_t>(m_remain, _count - i);
+        m_sum += decimatorSum(_in + i, n);
+        i += n;
+        m_remain -= n;
+        if (m_remain == 0){
+            _out[produced++] = saturate16((m_sum * m_scale + ((int64_t)1 << 31)) >> 32);
+            m_sum = 0;
+            m_remain = m_factor;
+        }
+    }
+    return produced;
+}
+
+// The integrators depend on the previous sample, so they run serially at the input rate;
+// the combs run at the output rate. Unsigned arithmetic wraps, the comb output is exact.
+template<uint32_t ORDER>
+static size_t cicDecimate(const int16_t *_in, size_t _count, int16_t *_out, uint64_t *_integrators, uint64_t *_combs,
+                          uint32_t &_remain, uint32_t _factor, double _gain){
+    uint64_t acc[ORDER];
+    std::copy(_integrators, _integrators + ORDER, acc);
+    size_t produced = 0;
+    uint32_t remain = _remain;
+    for (size_t i = 0; i < _count; i++){
+        acc[0] += (uint64_t)(int64_t)_in[i];
+        for (uint32_t k = 1; k < ORDER; k++)
+            acc[k] += acc[k - 1];
+        if (--remain == 0){
+            uint64_t value = acc[ORDER - 1];
+            for (uint32_t k = 0; k < ORDER; k++){
+                uint64_t diff = value - _combs[k];
+                _combs[k] = value;
+                value = diff;
+            }
+            _out[produced++] = saturate16(std::llround((int64_t)value * _gain));
+            remain = _factor;
+        }
+    }
+    std::copy(acc, acc + ORDER, _integrators);
+    _remain = remain;
+    return produced;
+}
+
+size_t CDecimator::processCic(const int16_t *_in, size_t _count, int16_t *_out){
+    switch (m_order){
+        case 1: return cicDecimate<1>(_in, _count, _out, m_integrators, m_combs, m_remain, m_factor, m_cicGain);
+        case 2: return cicDecimate<2>(_in, _count, _out, m_integrators, m_combs, m_remain, m_factor, m_cicGain);
+        case 3: return cicDecimate<3>(_in, _count, _out, m_integrators, m_combs, m_remain, m_factor, m_cicGain);
+        case 4: return cicDecimate<4>(_in, _count, _out, m_integrators, m_combs, m_remain, m_factor, m_cicGain);
+        default: return cicDecimate<5>(_in, _count, _out, m_integrators, m_combs, m_remain, m_factor, m_cicGain);
+    }
+}
+
+// Only the outputs are computed. Windows that reach back into the previous block
+// read from m_stitch: the history followed by the head of this block.
+// The coefficients are symmetric, so the window is read forward.
+size_t CDecimator::processFir(const int16_t *_in, size_t _count, int16_t *_out){
+    const size_t taps = m_coefs.size();
+    const size_t hist = taps - 1;
+    const size_t head = std::min(_count, hist);
+    std::copy(m_history.begin(), m_history.end(), m_stitch.begin());
+    std::copy(_in, _in + head, m_stitch.begin() + hist);
+
+    size_t produced = 0;
+    size_t pos = m_remain - 1;
+    for (; pos < _count; pos += m_factor){
+        const int16_t *window = pos < hist ? &m_stitch[pos] : _in + pos - hist;
+        _out[produced++] = decimatorDot(m_coefs.data(), window, taps);
+    }
+    m_remain = static_cast<uint32_t>(pos - _count + 1);
+
+    if (_count >= hist)
+        std::copy(_in + _count - hist, _in + _count, m_history.begin());
+    else
+        std::copy(m_stitch.begin() + _count, m_stitch.begin() + _count + hist, m_history.begin());
+    return produced;
+}
+
+void CDecimator::narrow8(int8_t *_dst, const int16_t *_src, size_t _count){
+    size_t i = 0;
+#ifdef ARCH_ARM
+    // The stores stay behind the loads, so this works in place
+    for (; i + 16 <= _count; i += 16){
+        int16x8_t a = vld1q_s16(_src + i);
+        int16x8_t b = vld1q_s16(_src + i + 8);
+        vst1q_s8(_dst + i, vcombine_s8(vshrn_n_s16(a, 8), vshrn_n_s16(b, 8)));
+    }
+#endif
+    for (; i < _count; i++)
+        _dst[i] = static_cast<int8_t>(_src[i] >> 8);
+}
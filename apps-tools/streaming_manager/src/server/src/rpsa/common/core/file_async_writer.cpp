@@ -8,6 +8,9 @@
 
 #include "rpsa/common/core/file_async_writer.h"
 #include "rpsa/common/core/File.h"
+#include "rpsa/common/core/metrics.h"
+#include <algorithm>
+#include <cstdio>
 #include <ctime>
 
 #ifndef _WIN32
@@ -27,7 +30,27 @@ std::string DirNameOf(const std::string& fname)
            : fname.substr(0, pos);
 }
 
-FileQueueManager::FileQueueManager():Queue(){
+FileQueueManager::FileQueueManager(size_t _queueBlocks):
+    m_writer(nullptr),
+    m_writerType(CWriterBackend::Type::DIRECT),
+    th(nullptr),
+    m_lastCheckpoint(0),
+    m_writeBytes(0),
+    m_writeTime(0),
+    m_queueBlocks(_queueBlocks),
+    m_blockSize(FILE_BLOCK_SIZE_DEFAULT),
+    m_ring(_queueBlocks),
+    m_writeBlock(nullptr),
+    m_tdmsWriter(nullptr),
+    m_rotation({0, 0, 0}),
+    m_rotationActive(false),
+    m_segmentProduced(0),
+    m_rotatePending(false),
+    m_segmentNumber(0),
+    m_preallocateWarned(false)
+{
+    m_tdmsWriter = new TDMS::Writer(m_blockStream, true);
+    m_tdmsWriter->SetIncremental(true);
     m_threadWork = false;
     m_waitAllWrite = false;    
     m_hasErrorWrite = false;
@@ -35,6 +58,8 @@ FileQueueManager::FileQueueManager():Queue(){
 
 FileQueueManager::~FileQueueManager(){
     this->StopWrite(false);
+    CloseFile();
+    delete m_tdmsWriter;
 }
 
 unsigned long long getTotalSystemMemory()
@@ -81,17 +106,67 @@ int FileQueueManager::AvailableSpace(std::string dst, ulong* availableSize) {
 #endif
 }
 
-bool FileQueueManager::AddBufferToWrite(std::iostream *buffer){
-
- //   acout() << m_useMemory  << "\n";
-    if (m_threadWork && (m_useMemory < m_aviablePhyMemory)){
-        pushQueue(buffer);
+bool FileQueueManager::SegmentDue(){
+    if (m_segmentProduced == 0)
+        return false;
+    if (m_rotation.segmentBytes > 0 && m_segmentProduced >= m_rotation.segmentBytes)
         return true;
+    return m_rotation.segmentSeconds > 0 &&
+           std::chrono::steady_clock::now() - m_segmentStart >= std::chrono::seconds(m_rotation.segmentSeconds);
+}
+
+CBlockStream* FileQueueManager::BeginBlock(bool *_newFile){
+    if (_newFile)
+        *_newFile = false;
+    if (!m_threadWork || m_ring.usedBytes() >= m_aviablePhyMemory)
+        return nullptr;
+    auto block = m_ring.acquireWrite();
+    if (block == nullptr)
+        return nullptr;
+    // Files are switched at block boundaries only. The switch stays pending until a block
+    // carrying the new header is committed, a dropped block doesn't lose it.
+    if (m_rotationActive && !m_rotatePending && SegmentDue())
+        m_rotatePending = true;
+    if (m_rotatePending){
+        block->flags |= BLOCK_FLAG_NEW_FILE;
+        m_tdmsWriter->ResetLayout();
+        if (_newFile)
+            *_newFile = true;
     }
-    else{
-        delete buffer;
+    m_writeBlock = block;
+    m_blockStream.attach(block);
+    return &m_blockStream;
+}
+
+bool FileQueueManager::CommitBlock(){
+    bool isGood = m_blockStream.good();
+    m_blockStream.detach();
+    if (!isGood){
+        // The block may hold the metadata segment the next raw segments depend on
+        m_tdmsWriter->ResetLayout();
         return false;
     }
+    if (m_rotatePending){
+        m_rotatePending = false;
+        m_segmentProduced = 0;
+    }
+    if (m_segmentProduced == 0)
+        m_segmentStart = std::chrono::steady_clock::now();
+    m_segmentProduced += m_writeBlock->size;
+    m_ring.commitWrite();
+    return true;
+}
+
+long FileQueueManager::queueSize(){
+    return m_ring.count();
+}
+
+size_t FileQueueManager::queueHighWaterMark(){
+    return m_ring.highWaterMark();
+}
+
+size_t FileQueueManager::queueUsedMemory(){
+    return m_ring.usedBytes();
 }
 
 ulong FileQueueManager::GetFreeSpaceDisk(std::string _filePath){
@@ -119,32 +194,118 @@ ulong FileQueueManager::GetFreeSpaceDisk(std::string _filePath){
     return  m_freeSize;
 }
 
-void FileQueueManager::OpenFile(std::string FileName,bool Append){
-    fs.open(FileName, std::ios::binary | std::ofstream::out| std::ofstream::in | (Append? std::ofstream::binary  : std::ofstream::trunc));
-    if (fs.fail()) {
-        fs.open(FileName, std::ios::binary | std::ofstream::out| std::ofstream::in |  std::ofstream::trunc);
-        if (fs.fail()) {
-            std::cout << "File " << FileName << " not exist" << std::endl;
-            return;
-        }
-    }
+std::string FileQueueManager::SegmentFileName(std::string _baseName, uint32_t _segment){
+    size_t dot = _baseName.find_last_of('.');
+    size_t slash = _baseName.find_last_of("\\/");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        dot = _baseName.size();
+    char number[16];
+    snprintf(number, sizeof(number), "_%04u", _segment);
+    return _baseName.substr(0, dot) + number + _baseName.substr(dot);
+}
 
-    auto dirName = DirNameOf(FileName);
-    if (dirName == "") {
-        dirName = ".";
+void FileQueueManager::OpenFile(std::string FileName,bool Append){
+    CloseFile();
+    m_dirName = DirNameOf(FileName);
+    if (m_dirName == "") {
+        m_dirName = ".";
     }
 
-    m_freeSize = GetFreeSpaceDisk(dirName);
     m_aviablePhyMemory = getTotalSystemMemory();
     std::cout << "Available physical memory: " << m_aviablePhyMemory / (1024 * 1024) << "Mb\n";
     m_aviablePhyMemory /= 2;
     std::cout << "Used physical memory: " << m_aviablePhyMemory / (1024 * 1024) << "Mb\n";
+    m_writeBytes = 0;
+    m_writeTime = std::chrono::duration<double>(0);
+
+    m_rotationActive = !Append && (m_rotation.segmentBytes > 0 || m_rotation.segmentSeconds > 0);
+    m_baseName = FileName;
+    m_segmentNumber = 0;
+    m_segmentFiles.clear();
+    m_preallocateWarned = false;
+    if (m_rotationActive)
+        OpenSegment();
+    else
+        OpenWriter(FileName, Append);
+}
+
+bool FileQueueManager::OpenWriter(std::string _fileName, bool _append){
+    m_writer = CWriterBackend::Create(_append ? CWriterBackend::Type::FSTREAM : m_writerType);
+    if (!m_writer->open(_fileName, _append)) {
+        if (_append || m_writerType == CWriterBackend::Type::FSTREAM)
+            return false;
+        m_writer = CWriterBackend::Create(CWriterBackend::Type::FSTREAM);
+        if (!m_writer->open(_fileName, _append))
+            return false;
+    }
+
+    // Free space is taken before the file reserves its own
+    m_freeSize = GetFreeSpaceDisk(m_dirName);
+    if (m_rotationActive && m_rotation.segmentBytes > 0 && !m_writer->preallocate(m_rotation.segmentBytes) && !m_preallocateWarned){
+        acout() << "Files are not preallocated, the filesystem doesn't support it\n";
+        m_preallocateWarned = true;
+    }
     m_hasWriteSize = 0;
+    m_lastCheckpoint = 0;
+    m_firstSectionWrite = false;
+    return true;
+}
+
+void FileQueueManager::CloseWriter(){
+    if (m_writer == nullptr || !m_writer->isOpen())
+        return;
+    auto start = std::chrono::steady_clock::now();
+    if (m_fileType == Stream_FileType::WAV_TYPE && m_firstSectionWrite){
+        updateWavFile();
+    }
+    m_writer->close();
+    m_writeTime += std::chrono::steady_clock::now() - start;
 }
 
 void FileQueueManager::CloseFile(){
-    if (fs.is_open())
-        fs.close();
+    if (m_writer == nullptr || !m_writer->isOpen())
+        return;
+    CloseWriter();
+    acout() << "Write speed: " << GetWriteSpeed() / (1024 * 1024) << " MB/s\n";
+}
+
+// Writer thread. In the ring the oldest files go first, so the new one always gets its space.
+void FileQueueManager::OpenSegment(){
+    static CMetricCounter *metricSegments = CMetricsRegistry::instance().counter("file.segments");
+
+    while (m_rotation.keepFiles > 0 && m_segmentFiles.size() >= m_rotation.keepFiles && DeleteOldestSegment());
+    auto fileName = SegmentFileName(m_baseName, ++m_segmentNumber);
+    if (OpenWriter(fileName, false)){
+        m_segmentFiles.push_back(fileName);
+        metricSegments->add(1);
+    }
+}
+
+bool FileQueueManager::DeleteOldestSegment(){
+    static CMetricCounter *metricDeleted = CMetricsRegistry::instance().counter("file.deleted_segments");
+
+    if (m_segmentFiles.empty())
+        return false;
+    if (std::remove(m_segmentFiles.front().c_str()) != 0)
+        acout() << "Can't delete " << m_segmentFiles.front() << "\n";
+    m_segmentFiles.pop_front();
+    metricDeleted->add(1);
+    return true;
+}
+
+void FileQueueManager::Checkpoint(){
+    if (m_fileType == Stream_FileType::WAV_TYPE && m_firstSectionWrite){
+        updateWavFile();
+    }
+    m_writer->checkpoint();
+    m_lastCheckpoint = m_hasWriteSize;
+}
+
+double FileQueueManager::GetWriteSpeed(){
+    double sec = m_writeTime.count();
+    if (sec <= 0)
+        return 0;
+    return m_writeBytes / sec;
 }
 
 void FileQueueManager::StartWrite(Stream_FileType _fileType){
@@ -155,12 +316,17 @@ void FileQueueManager::StartWrite(Stream_FileType _fileType){
     m_waitAllWrite = true;
     m_hasErrorWrite = false;
     
-    // Clean before start
-    auto bstream_clean = popQueue();
-    while(bstream_clean){
-        delete bstream_clean;
-        bstream_clean = popQueue();
-    }
+    // Clean before start. The whole queue is allocated here, so the producer never allocates:
+    // as many blocks as fit into the memory limit, but at least two to keep both threads busy.
+    size_t blockSize = m_blockSize + FILE_BLOCK_HEADER_SIZE;
+    size_t blocks = m_queueBlocks;
+    if (m_aviablePhyMemory / blockSize < blocks)
+        blocks = std::max<size_t>(m_aviablePhyMemory / blockSize, 2);
+    if (!m_ring.allocate(blocks, blockSize))
+        std::cerr << "Error: can't allocate " << blocks << " file queue blocks of " << blockSize << " bytes\n";
+    m_tdmsWriter->ResetLayout();
+    m_segmentProduced = 0;
+    m_rotatePending = false;
 
     th = new std::thread(&FileQueueManager::Task,this);
 }
@@ -188,45 +354,60 @@ void FileQueueManager::Task(){
     if (this->m_waitAllWrite) {
         while (WriteToFile() == 0);
     }else{
-        auto bstream = popQueue();
-        while(bstream){
-            delete bstream;
-            bstream = popQueue();
+        while(m_ring.peekRead()){
+            m_ring.releaseRead();
         }
     }
+    CloseFile();
     m_threadWork = false;
     m_waitLock.unlock();
 }
 
 
 int FileQueueManager::WriteToFile(){
-    auto bstream = popQueue();
+    auto block = m_ring.peekRead();
         
-    if (bstream == nullptr)
+    if (block == nullptr)
         return -1;
 
     if (m_hasErrorWrite) {
-        delete bstream;
+        m_ring.releaseRead();
         return 1;
     }
 
-    if (fs.good() && m_hasWriteSize < m_freeSize) {
-        
-        fs << bstream->rdbuf();
-        fs.flush();
-        bstream->seekg(0, std::ios::end);
-        auto Length = bstream->tellg();
+    if (block->flags & BLOCK_FLAG_NEW_FILE){
+        CloseWriter();
+        OpenSegment();
+    }
+
+    // The ring makes room by dropping old files. The current file is kept, the data on it
+    // is counted as used and the file may still take its preallocated space.
+    if (m_rotationActive && m_rotation.keepFiles > 0){
+        while (m_hasWriteSize >= m_freeSize && m_segmentFiles.size() > 1 && DeleteOldestSegment())
+            m_freeSize = m_hasWriteSize + GetFreeSpaceDisk(m_dirName);
+    }
+
+    if (m_writer != nullptr && m_writer->good() && m_hasWriteSize < m_freeSize) {
+        static CMetricHistogram *metricWrite = CMetricsRegistry::instance().histogram("file.write");
+        static CMetricCounter *metricBytes = CMetricsRegistry::instance().counter("file.bytes");
+
+        auto start = std::chrono::steady_clock::now();
+        m_writer->write(block->data, block->size);
+        auto Length = block->size;
         m_hasWriteSize += Length;
+        m_writeBytes += Length;
 
+        // The WAV header comes with the first block, sizes are updated at checkpoints
         if (m_fileType == Stream_FileType::WAV_TYPE){
-            if (m_firstSectionWrite){
-                updateWavFile(Length);
-            }
+            m_firstSectionWrite = true;
+        }
 
-            if (m_firstSectionWrite == false){
-                m_firstSectionWrite = true;
-            }
+        if (m_hasWriteSize - m_lastCheckpoint >= FILE_CHECKPOINT_SIZE){
+            Checkpoint();
         }
+        m_writeTime += std::chrono::steady_clock::now() - start;
+        metricWrite->recordSince(start);
+        metricBytes->add(Length);
 
     } else{
 
@@ -236,40 +417,51 @@ int FileQueueManager::WriteToFile(){
         }else {
             acout() << "Disk is full or error state\n";
         }
+        m_ring.releaseRead();
         return 1;
     }
-    delete bstream;
+    m_ring.releaseRead();
 
     return 0;    
 }
 
-void FileQueueManager::updateWavFile(int _size){
+void FileQueueManager::updateWavFile(){
     int offset1 = 4;
     int offset2 = 40;
-   
-    auto cur_p = fs.tellp();
-    auto cur_g = fs.tellg();
-
-    int32_t size1 = 0;
-    int32_t size2 = 0;
-    fs.seekg(offset1, fs.beg);
-    fs.read ((char*)&size1, sizeof(size1));
-    size1 += _size;
-    fs.seekp(offset1, fs.beg);
-    fs.write((char*)&size1, sizeof(size1));
-    fs.seekg(offset2, fs.beg);
-    fs.read ((char*)&size2, sizeof(size2));
-    size2 += _size;
-    fs.seekp(offset2, fs.beg);
-    fs.write((char*)&size2, sizeof(size2));
-
- 
-    fs.seekp(cur_p);
-    fs.seekg(cur_g);
+
+    // RIFF chunk size and data chunk size of a 44 byte header
+    int32_t size1 = m_hasWriteSize - 8;
+    int32_t size2 = m_hasWriteSize - 44;
+    m_writer->patch(offset1, &size1, sizeof(size1));
+    m_writer->patch(offset2, &size2, sizeof(size2));
 }
 
-std::iostream *FileQueueManager::BuildTDMSStream(uint8_t* buffer_ch1,size_t size_ch1,uint8_t* buffer_ch2,size_t size_ch2, unsigned short resolution){
-    TDMS::File outFile;
+// Sample interval in the waveform property names that TDMS readers know
+static void addWaveformProperties(TDMS::WriterSegment &_segment, shared_ptr<TDMS::Metadata> _channel, double _sampleRate){
+    if (_sampleRate <= 0)
+        return;
+    TDMS::DataType increment;
+    increment.InitDataType(TDMS::DataType::DoubleFloat, TDMS::DataType::MakeData<double>(1.0 / _sampleRate));
+    _segment.AddProperties(_channel, "wf_increment", increment);
+    TDMS::DataType offset;
+    offset.InitDataType(TDMS::DataType::DoubleFloat, TDMS::DataType::MakeData<double>(0.0));
+    _segment.AddProperties(_channel, "wf_start_offset", offset);
+}
+
+void FileQueueManager::BuildTDMSStream(std::iostream *memory,const uint8_t* buffer_ch1,size_t size_ch1,const uint8_t* buffer_ch2,size_t size_ch2, unsigned short resolution, double sampleRate){
+    auto type = (resolution == 8 ? TDMS::DataType::Integer8 : TDMS::DataType::Integer16);
+    auto sampleSize = (resolution == 16 ? 2 : 1);
+    TDMS::RawBlock raw[2];
+    size_t rawCount = 0;
+    if (size_ch1 != 0)
+        raw[rawCount++] = { type, size_ch1 / sampleSize, buffer_ch1 };
+    if (size_ch2 != 0)
+        raw[rawCount++] = { type, size_ch2 / sampleSize, buffer_ch2 };
+
+    m_tdmsWriter->SetStream(*memory);
+    if (m_tdmsWriter->WriteRaw(raw, rawCount))
+        return;
+
     TDMS::WriterSegment segment;
     vector<shared_ptr<TDMS::Metadata>> data;
 //    std::time_t tim_sec = std::time(0);
@@ -296,7 +488,11 @@ std::iostream *FileQueueManager::BuildTDMSStream(uint8_t* buffer_ch1,size_t size
             size_ch1 /= 2;
         auto channel = segment.GenerateChannel("Group", "ch1");
         data.push_back(channel);
-        segment.AddRaw(channel, (resolution == 8 ? TDMS::DataType::Integer8 : TDMS::DataType::Integer16), size_ch1 , buffer_ch1);
+        addWaveformProperties(segment, channel, sampleRate);
+        // Segment takes ownership of the raw buffer
+        auto buff = new uint8_t[size_ch1 * sampleSize];
+        memcpy(buff, buffer_ch1, size_ch1 * sampleSize);
+        segment.AddRaw(channel, type, size_ch1 , buff);
     }
 
     if (size_ch2 != 0)
@@ -305,63 +501,12 @@ std::iostream *FileQueueManager::BuildTDMSStream(uint8_t* buffer_ch1,size_t size
             size_ch2 /= 2;
         auto channel = segment.GenerateChannel("Group", "ch2");
         data.push_back(channel);
-        segment.AddRaw(channel, (resolution == 8 ? TDMS::DataType::Integer8 : TDMS::DataType::Integer16), size_ch2 , buffer_ch2);
+        addWaveformProperties(segment, channel, sampleRate);
+        auto buff = new uint8_t[size_ch2 * sampleSize];
+        memcpy(buff, buffer_ch2, size_ch2 * sampleSize);
+        segment.AddRaw(channel, type, size_ch2 , buff);
     }
 
     segment.LoadMetadata(data);
-    stringstream *memory = new stringstream(ios_base::in | ios_base::out | ios_base::binary);
-    outFile.WriteMemory(*memory,segment);
-    return memory;
+    m_tdmsWriter->Write(segment);
 }
-
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-
-Queue::Queue():
-m_useMemory(0)
-{
-
-}
-
-Queue::~Queue(){
-
-}
-
-
-
-
-void Queue::pushQueue(std::iostream* buffer){
-    mutex_.lock();
-    m_queue.push_back(buffer);
-    buffer->seekg(0, std::ios::end);
-    auto Length = buffer->tellg();
-    m_useMemory += Length;
-    mutex_.unlock();
-}
-
-
-
-std::iostream* Queue::popQueue(){
-    mutex_.lock();
-    std::iostream* buffer = m_queue.front();
-    if (buffer != nullptr){
-        m_queue.pop_front();
-        buffer->seekg(0, std::ios::end);
-        auto Length = buffer->tellg();
-        m_useMemory -= Length;
-        buffer->seekg(0, std::ios::beg);
-    }
-    mutex_.unlock();
-
-    return buffer;
-}
-
-long Queue::queueSize(){
-    mutex_.lock();
-    long size = m_queue.size();
-    mutex_.unlock();
-    return size;
-}
-
-
-
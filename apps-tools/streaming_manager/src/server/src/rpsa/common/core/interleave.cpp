@@ -0,0 +1,157 @@
+#include "rpsa/common/core/interleave.h"
+
+#ifdef ARCH_ARM
+#include <arm_neon.h>
+#endif
+
+#ifdef INTERLEAVE_X86
+#include <immintrin.h>
+#endif
+
+void interleave8_scalar(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t count){
+    for (size_t i = 0; i < count; i++){
+        dst[i * 2] = a[i];
+        dst[i * 2 + 1] = b[i];
+    }
+}
+
+void interleave16_scalar(uint16_t *dst, const uint16_t *a, const uint16_t *b, size_t count){
+    for (size_t i = 0; i < count; i++){
+        dst[i * 2] = a[i];
+        dst[i * 2 + 1] = b[i];
+    }
+}
+
+#ifdef ARCH_ARM
+
+void interleave8_neon(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t count){
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16){
+        uint8x16x2_t v;
+        v.val[0] = vld1q_u8(a + i);
+        v.val[1] = vld1q_u8(b + i);
+        vst2q_u8(dst + i * 2, v);
+    }
+    interleave8_scalar(dst + i * 2, a + i, b + i, count - i);
+}
+
+void interleave16_neon(uint16_t *dst, const uint16_t *a, const uint16_t *b, size_t count){
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8){
+        uint16x8x2_t v;
+        v.val[0] = vld1q_u16(a + i);
+        v.val[1] = vld1q_u16(b + i);
+        vst2q_u16(dst + i * 2, v);
+    }
+    interleave16_scalar(dst + i * 2, a + i, b + i, count - i);
+}
+
+#endif // ARCH_ARM
+
+#ifdef INTERLEAVE_X86
+
+__attribute__((target("sse2")))
+void interleave8_sse2(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t count){
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16){
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        _mm_storeu_si128((__m128i*)(dst + i * 2), _mm_unpacklo_epi8(va, vb));
+        _mm_storeu_si128((__m128i*)(dst + i * 2 + 16), _mm_unpackhi_epi8(va, vb));
+    }
+    interleave8_scalar(dst + i * 2, a + i, b + i, count - i);
+}
+
+__attribute__((target("sse2")))
+void interleave16_sse2(uint16_t *dst, const uint16_t *a, const uint16_t *b, size_t count){
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8){
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        _mm_storeu_si128((__m128i*)(dst + i * 2), _mm_unpacklo_epi16(va, vb));
+        _mm_storeu_si128((__m128i*)(dst + i * 2 + 8), _mm_unpackhi_epi16(va, vb));
+    }
+    interleave16_scalar(dst + i * 2, a + i, b + i, count - i);
+}
+
+// unpack works inside 128 bit lanes, the lane halves are put in order with permute2x128
+__attribute__((target("avx2")))
+void interleave8_avx2(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t count){
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32){
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+        __m256i lo = _mm256_unpacklo_epi8(va, vb);
+        __m256i hi = _mm256_unpackhi_epi8(va, vb);
+        _mm256_storeu_si256((__m256i*)(dst + i * 2), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + i * 2 + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    interleave8_scalar(dst + i * 2, a + i, b + i, count - i);
+}
+
+__attribute__((target("avx2")))
+void interleave16_avx2(uint16_t *dst, const uint16_t *a, const uint16_t *b, size_t count){
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16){
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+        __m256i lo = _mm256_unpacklo_epi16(va, vb);
+        __m256i hi = _mm256_unpackhi_epi16(va, vb);
+        _mm256_storeu_si256((__m256i*)(dst + i * 2), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + i * 2 + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    interleave16_scalar(dst + i * 2, a + i, b + i, count - i);
+}
+
+bool interleave_has_avx2(){
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+static bool interleave_has_sse2(){
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+#endif // INTERLEAVE_X86
+
+typedef void (*Interleave8Func)(uint8_t*, const uint8_t*, const uint8_t*, size_t);
+typedef void (*Interleave16Func)(uint16_t*, const uint16_t*, const uint16_t*, size_t);
+
+static Interleave8Func selectInterleave8(){
+#if defined(ARCH_ARM)
+    return interleave8_neon;
+#elif defined(INTERLEAVE_X86)
+    if (interleave_has_avx2())
+        return interleave8_avx2;
+    if (interleave_has_sse2())
+        return interleave8_sse2;
+    return interleave8_scalar;
+#else
+    return interleave8_scalar;
+#endif
+}
+
+static Interleave16Func selectInterleave16(){
+#if defined(ARCH_ARM)
+    return interleave16_neon;
+#elif defined(INTERLEAVE_X86)
+    if (interleave_has_avx2())
+        return interleave16_avx2;
+    if (interleave_has_sse2())
+        return interleave16_sse2;
+    return interleave16_scalar;
+#else
+    return interleave16_scalar;
+#endif
+}
+
+void interleave8(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t count){
+    static const Interleave8Func func = selectInterleave8();
+    func(dst, a, b, count);
+}
+
+void interleave16(uint16_t *dst, const uint16_t *a, const uint16_t *b, size_t count){
+    static const Interleave16Func func = selectInterleave16();
+    func(dst, a, b, count);
+}
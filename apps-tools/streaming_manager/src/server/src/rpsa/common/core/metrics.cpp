@@ -0,0 +1,300 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include "rpsa/common/core/metrics.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define METRICS_PAGE_ENTRIES ((METRICS_PAGE_SIZE - sizeof(MetricsPageHeader)) / sizeof(MetricSnapshot))
+
+static void storeMax(std::atomic<uint64_t> &_max, uint64_t _value){
+    uint64_t current = _max.load(std::memory_order_relaxed);
+    while (_value > current && !_max.compare_exchange_weak(current, _value, std::memory_order_relaxed)) {}
+}
+
+void CMetricGauge::set(uint64_t _value){
+    m_value.store(_value, std::memory_order_relaxed);
+    storeMax(m_max, _value);
+}
+
+uint64_t CMetricGauge::takeMax(){
+    // The level stays, so the next period starts from it
+    return m_max.exchange(m_value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+CMetricHistogram::CMetricHistogram():
+    m_max(0)
+{
+    for (auto &bucket : m_buckets)
+        bucket.store(0, std::memory_order_relaxed);
+}
+
+size_t CMetricHistogram::bucketOf(uint64_t _value){
+    const uint64_t sub = 1 << METRICS_SUB_BUCKET_BITS;
+    if (_value < sub)
+        return static_cast<size_t>(_value);
+    unsigned exp = 63 - __builtin_clzll(_value);
+    unsigned shift = exp - METRICS_SUB_BUCKET_BITS;
+    return static_cast<size_t>(sub + shift * sub + ((_value >> shift) & (sub - 1)));
+}
+
+uint64_t CMetricHistogram::bucketUpperBound(size_t _bucket){
+    const uint64_t sub = 1 << METRICS_SUB_BUCKET_BITS;
+    if (_bucket < sub)
+        return _bucket;
+    unsigned shift = static_cast<unsigned>((_bucket - sub) / sub);
+    uint64_t lower = (sub + (_bucket - sub) % sub) << shift;
+    return lower + ((uint64_t)1 << shift) - 1;
+}
+
+void CMetricHistogram::record(uint64_t _value){
+    m_buckets[bucketOf(_value)].fetch_add(1, std::memory_order_relaxed);
+    storeMax(m_max, _value);
+}
+
+void CMetricHistogram::recordSince(std::chrono::steady_clock::time_point _start){
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
+    record(ns > 0 ? static_cast<uint64_t>(ns) : 0);
+}
+
+void CMetricHistogram::collect(uint64_t *_buckets) const{
+    for (size_t i = 0; i < METRICS_BUCKETS; i++)
+        _buckets[i] += m_buckets[i].load(std::memory_order_relaxed);
+}
+
+uint64_t CMetricHistogram::takeMax(){
+    return m_max.exchange(0, std::memory_order_relaxed);
+}
+
+
+CMetricsRegistry& CMetricsRegistry::instance(){
+    static CMetricsRegistry registry;
+    return registry;
+}
+
+CMetricsRegistry::CMetricsRegistry():
+    m_mutex(),
+    m_entries(),
+    m_buckets(METRICS_BUCKETS),
+    m_lastRefresh(std::chrono::steady_clock::now()),
+    m_period(0),
+    m_page(nullptr),
+    m_pageName()
+{
+}
+
+CMetricsRegistry::~CMetricsRegistry(){
+    closeSharedPage();
+}
+
+CMetricsRegistry::Entry& CMetricsRegistry::find(const std::string &_name, MetricType _type){
+    for (auto &entry : m_entries){
+        if (entry.name == _name && entry.type == _type)
+            return entry;
+    }
+    m_entries.emplace_back();
+    Entry &entry = m_entries.back();
+    entry.name = _name;
+    entry.type = _type;
+    entry.lastValue = 0;
+    memset(&entry.snapshot, 0, sizeof(entry.snapshot));
+    strncpy(entry.snapshot.name, _name.c_str(), METRICS_NAME_SIZE - 1);
+    entry.snapshot.type = _type;
+    return entry;
+}
+
+CMetricCounter* CMetricsRegistry::counter(const std::string &_name){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Entry &entry = find(_name, METRIC_COUNTER);
+    if (!entry.counter)
+        entry.counter.reset(new CMetricCounter());
+    return entry.counter.get();
+}
+
+CMetricGauge* CMetricsRegistry::gauge(const std::string &_name){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Entry &entry = find(_name, METRIC_GAUGE);
+    if (!entry.gauge)
+        entry.gauge.reset(new CMetricGauge());
+    return entry.gauge.get();
+}
+
+CMetricHistogram* CMetricsRegistry::histogram(const std::string &_name){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Entry &entry = find(_name, METRIC_HISTOGRAM);
+    if (!entry.histogram){
+        entry.histogram.reset(new CMetricHistogram());
+        entry.lastBuckets.assign(METRICS_BUCKETS, 0);
+    }
+    return entry.histogram.get();
+}
+
+void CMetricsRegistry::refresh(){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - m_lastRefresh).count();
+    m_period = static_cast<uint64_t>(seconds * 1e6);
+    m_lastRefresh = now;
+    if (seconds <= 0)
+        seconds = 1;
+
+    for (auto &entry : m_entries){
+        MetricSnapshot &snap = entry.snapshot;
+        switch (entry.type){
+            case METRIC_COUNTER:{
+                uint64_t value = entry.counter->value();
+                snap.value = value;
+                snap.rate = (value - entry.lastValue) / seconds;
+                entry.lastValue = value;
+                break;
+            }
+            case METRIC_GAUGE:{
+                snap.max = entry.gauge->takeMax();
+                snap.value = entry.gauge->value();
+                break;
+            }
+            case METRIC_HISTOGRAM:{
+                // Percentiles of the last period only: difference of the cumulative buckets
+                std::fill(m_buckets.begin(), m_buckets.end(), 0);
+                entry.histogram->collect(m_buckets.data());
+                uint64_t total = 0;
+                uint64_t count = 0;
+                for (size_t i = 0; i < METRICS_BUCKETS; i++){
+                    uint64_t current = m_buckets[i];
+                    m_buckets[i] = current - entry.lastBuckets[i];
+                    entry.lastBuckets[i] = current;
+                    total += current;
+                    count += m_buckets[i];
+                }
+                snap.value = total;
+                snap.count = count;
+                snap.rate = count / seconds;
+                snap.max = entry.histogram->takeMax();
+
+                const double levels[3] = {0.5, 0.9, 0.99};
+                uint64_t *results[3] = {&snap.p50, &snap.p90, &snap.p99};
+                uint64_t seen = 0;
+                size_t level = 0;
+                for (size_t i = 0; i < METRICS_BUCKETS && level < 3 && count > 0; i++){
+                    seen += m_buckets[i];
+                    while (level < 3 && seen >= std::ceil(levels[level] * count)){
+                        *results[level] = std::min(CMetricHistogram::bucketUpperBound(i), snap.max);
+                        level++;
+                    }
+                }
+                for (; level < 3; level++)
+                    *results[level] = 0;
+                break;
+            }
+        }
+    }
+    publish();
+}
+
+std::vector<MetricSnapshot> CMetricsRegistry::snapshot(){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<MetricSnapshot> result;
+    result.reserve(m_entries.size());
+    for (auto &entry : m_entries)
+        result.push_back(entry.snapshot);
+    return result;
+}
+
+std::string CMetricsRegistry::report(){
+    auto metrics = snapshot();
+    std::string text;
+    char line[160];
+    for (auto &m : metrics){
+        switch (m.type){
+            case METRIC_COUNTER:
+                // Byte counters are easier to read as MB/s
+                if (strstr(m.name, "bytes") != nullptr){
+                    snprintf(line, sizeof(line), "%-28s total %14llu  %10.2f MB/s\n", m.name, (unsigned long long)m.value, m.rate / 1e6);
+                }else{
+                    snprintf(line, sizeof(line), "%-28s total %14llu  %10.1f /s\n", m.name, (unsigned long long)m.value, m.rate);
+                }
+                break;
+            case METRIC_GAUGE:
+                snprintf(line, sizeof(line), "%-28s now %8llu  max %8llu\n", m.name, (unsigned long long)m.value, (unsigned long long)m.max);
+                break;
+            default:
+                snprintf(line, sizeof(line), "%-28s %8.1f /s  p50 %9.1f  p90 %9.1f  p99 %9.1f  max %9.1f us\n",
+                         m.name, m.rate, m.p50 / 1e3, m.p90 / 1e3, m.p99 / 1e3, m.max / 1e3);
+                break;
+        }
+        text += line;
+    }
+    return text;
+}
+
+bool CMetricsRegistry::openSharedPage(const std::string &_name){
+#ifndef _WIN32
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_page != nullptr)
+        return true;
+    int fd = shm_open(_name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd == -1){
+        std::cerr << "Error: can't open shared memory " << _name << std::endl;
+        return false;
+    }
+    if (ftruncate(fd, METRICS_PAGE_SIZE) != 0){
+        std::cerr << "Error: can't resize shared memory " << _name << std::endl;
+        close(fd);
+        return false;
+    }
+    void *page = mmap(nullptr, METRICS_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED){
+        std::cerr << "Error: can't map shared memory " << _name << std::endl;
+        return false;
+    }
+    memset(page, 0, METRICS_PAGE_SIZE);
+    m_page = new (page) MetricsPageHeader();
+    m_page->magic = METRICS_PAGE_MAGIC;
+    m_page->version = METRICS_PAGE_VERSION;
+    m_page->entrySize = sizeof(MetricSnapshot);
+    m_page->sequence.store(0, std::memory_order_release);
+    m_pageName = _name;
+    return true;
+#else
+    (void)_name;
+    return false;
+#endif
+}
+
+void CMetricsRegistry::closeSharedPage(){
+#ifndef _WIN32
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_page == nullptr)
+        return;
+    munmap(m_page, METRICS_PAGE_SIZE);
+    shm_unlink(m_pageName.c_str());
+    m_page = nullptr;
+#endif
+}
+
+void CMetricsRegistry::publish(){
+    if (m_page == nullptr)
+        return;
+    uint32_t sequence = m_page->sequence.load(std::memory_order_relaxed);
+    m_page->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    auto entries = reinterpret_cast<MetricSnapshot*>(m_page + 1);
+    size_t count = std::min(m_entries.size(), (size_t)METRICS_PAGE_ENTRIES);
+    for (size_t i = 0; i < count; i++)
+        entries[i] = m_entries[i].snapshot;
+    m_page->count = static_cast<uint32_t>(count);
+    m_page->period = m_period;
+    m_page->timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::system_clock::now().time_since_epoch()).count();
+
+    m_page->sequence.store(sequence + 2, std::memory_order_release);
+}
@@ -0,0 +1,329 @@
+#include <algorithm>
+#include <cstddef>
+#include "rpsa/common/core/rice_codec.h"
+
+#ifdef ARCH_ARM
+#include <arm_neon.h>
+#endif
+
+#define RICE_ORDER_VERBATIM 3
+#define RICE_ORDER_BITS     2
+#define RICE_K_BITS         5
+
+static inline uint32_t zigzag(int32_t _value){
+    return ((uint32_t)_value << 1) ^ (uint32_t)(_value >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t _value){
+    return (int32_t)(_value >> 1) ^ -(int32_t)(_value & 1);
+}
+
+static inline int32_t predict(const int16_t *_x, ptrdiff_t _i, unsigned _order){
+    switch (_order){
+        case 1: return _x[_i - 1];
+        case 2: return 2 * _x[_i - 1] - _x[_i - 2];
+        default: return 0;
+    }
+}
+
+void rice_analyze_scalar(const int16_t *_x, size_t _count, uint64_t _sums[3]){
+    uint64_t s0 = 0, s1 = 0, s2 = 0;
+    for (size_t i = 0; i < _count; i++){
+        int32_t d1 = _x[i] - _x[(ptrdiff_t)i - 1];
+        int32_t d2 = d1 - (_x[(ptrdiff_t)i - 1] - _x[(ptrdiff_t)i - 2]);
+        s0 += zigzag(_x[i]);
+        s1 += zigzag(d1);
+        s2 += zigzag(d2);
+    }
+    _sums[0] = s0;
+    _sums[1] = s1;
+    _sums[2] = s2;
+}
+
+void rice_residuals_scalar(uint32_t *_u, const int16_t *_x, size_t _count, unsigned _order){
+    for (size_t i = 0; i < _count; i++)
+        _u[i] = zigzag(_x[i] - predict(_x, (ptrdiff_t)i, _order));
+}
+
+#ifdef ARCH_ARM
+
+static inline uint32x4_t zigzagNeon(int32x4_t _value){
+    return veorq_u32(vreinterpretq_u32_s32(vshlq_n_s32(_value, 1)), vreinterpretq_u32_s32(vshrq_n_s32(_value, 31)));
+}
+
+static inline uint64_t sumLanes(uint32x4_t _acc){
+    uint64x2_t wide = vpaddlq_u32(_acc);
+    return vgetq_lane_u64(wide, 0) + vgetq_lane_u64(wide, 1);
+}
+
+// A residual is below 2^18 and a lane adds _count / 4 of them, so 32 bit lanes are safe
+void rice_analyze_neon(const int16_t *_x, size_t _count, uint64_t _sums[3]){
+    uint32x4_t acc0 = vdupq_n_u32(0);
+    uint32x4_t acc1 = vdupq_n_u32(0);
+    uint32x4_t acc2 = vdupq_n_u32(0);
+    size_t i = 0;
+    for (; i + 8 <= _count; i += 8){
+        int16x8_t x0 = vld1q_s16(_x + i);
+        int16x8_t x1 = vld1q_s16(_x + i - 1);
+        int16x8_t x2 = vld1q_s16(_x + i - 2);
+        int32x4_t d1_lo = vsubl_s16(vget_low_s16(x0), vget_low_s16(x1));
+        int32x4_t d1_hi = vsubl_s16(vget_high_s16(x0), vget_high_s16(x1));
+        int32x4_t p1_lo = vsubl_s16(vget_low_s16(x1), vget_low_s16(x2));
+        int32x4_t p1_hi = vsubl_s16(vget_high_s16(x1), vget_high_s16(x2));
+        acc0 = vaddq_u32(acc0, zigzagNeon(vmovl_s16(vget_low_s16(x0))));
+        acc0 = vaddq_u32(acc0, zigzagNeon(vmovl_s16(vget_high_s16(x0))));
+        acc1 = vaddq_u32(acc1, zigzagNeon(d1_lo));
+        acc1 = vaddq_u32(acc1, zigzagNeon(d1_hi));
+        acc2 = vaddq_u32(acc2, zigzagNeon(vsubq_s32(d1_lo, p1_lo)));
+        acc2 = vaddq_u32(acc2, zigzagNeon(vsubq_s32(d1_hi, p1_hi)));
+    }
+    uint64_t tail[3];
+    rice_analyze_scalar(_x + i, _count - i, tail);
+    _sums[0] = sumLanes(acc0) + tail[0];
+    _sums[1] = sumLanes(acc1) + tail[1];
+    _sums[2] = sumLanes(acc2) + tail[2];
+}
+
+void rice_residuals_neon(uint32_t *_u, const int16_t *_x, size_t _count, unsigned _order){
+    size_t i = 0;
+    for (; i + 8 <= _count; i += 8){
+        int16x8_t x0 = vld1q_s16(_x + i);
+        int32x4_t lo, hi;
+        if (_order == 0){
+            lo = vmovl_s16(vget_low_s16(x0));
+            hi = vmovl_s16(vget_high_s16(x0));
+        }else{
+            int16x8_t x1 = vld1q_s16(_x + i - 1);
+            lo = vsubl_s16(vget_low_s16(x0), vget_low_s16(x1));
+            hi = vsubl_s16(vget_high_s16(x0), vget_high_s16(x1));
+            if (_order == 2){
+                int16x8_t x2 = vld1q_s16(_x + i - 2);
+                lo = vsubq_s32(lo, vsubl_s16(vget_low_s16(x1), vget_low_s16(x2)));
+                hi = vsubq_s32(hi, vsubl_s16(vget_high_s16(x1), vget_high_s16(x2)));
+            }
+        }
+        vst1q_u32(_u + i, zigzagNeon(lo));
+        vst1q_u32(_u + i + 4, zigzagNeon(hi));
+    }
+    rice_residuals_scalar(_u + i, _x + i, _count - i, _order);
+}
+
+#endif // ARCH_ARM
+
+static inline void riceAnalyze(const int16_t *_x, size_t _count, uint64_t _sums[3]){
+#ifdef ARCH_ARM
+    rice_analyze_neon(_x, _count, _sums);
+#else
+    rice_analyze_scalar(_x, _count, _sums);
+#endif
+}
+
+static inline void riceResiduals(uint32_t *_u, const int16_t *_x, size_t _count, unsigned _order){
+#ifdef ARCH_ARM
+    rice_residuals_neon(_u, _x, _count, _order);
+#else
+    rice_residuals_scalar(_u, _x, _count, _order);
+#endif
+}
+
+// Partition samples widened to 16 bit behind the two history samples
+static void loadPartition(int16_t *_x, const void *_src, size_t _offset, size_t _count, unsigned _bits){
+    if (_bits == 16){
+        std::copy((const int16_t*)_src + _offset, (const int16_t*)_src + _offset + _count, _x);
+    }else{
+        std::copy((const int8_t*)_src + _offset, (const int8_t*)_src + _offset + _count, _x);
+    }
+}
+
+namespace {
+
+// Whole 32 bit words are stored big endian, so the stream reads MSB first byte by byte
+struct BitWriter {
+    uint8_t *pos;
+    uint8_t *end;
+    uint64_t acc;
+    unsigned bits;
+    bool     overflow;
+
+    // _count <= 32, _value < 2^_count
+    inline void put(uint32_t _value, unsigned _count){
+        acc = (acc << _count) | _value;
+        bits += _count;
+        if (bits >= 32){
+            bits -= 32;
+            uint32_t word = (uint32_t)(acc >> bits);
+            if (end - pos < 4){
+                overflow = true;
+                return;
+            }
+            pos[0] = word >> 24;
+            pos[1] = word >> 16;
+            pos[2] = word >> 8;
+            pos[3] = word;
+            pos += 4;
+        }
+    }
+
+    void flush(){
+        if (bits == 0)
+            return;
+        uint32_t word = (uint32_t)(acc << (32 - bits));
+        size_t bytes = (bits + 7) / 8;
+        if ((size_t)(end - pos) < bytes){
+            overflow = true;
+            return;
+        }
+        for (size_t i = 0; i < bytes; i++)
+            pos[i] = word >> (24 - 8 * i);
+        pos += bytes;
+        bits = 0;
+    }
+};
+
+// Bits past the end read as zero, overrun() tells if any of them were used
+struct BitReader {
+    const uint8_t *begin;
+    const uint8_t *pos;
+    const uint8_t *end;
+    uint64_t acc;       // left aligned
+    unsigned bits;
+    size_t   padding;   // zero bytes loaded past the end
+
+    inline void refill(){
+        while (bits <= 56){
+            uint64_t byte = 0;
+            if (pos < end)
+                byte = *pos++;
+            else
+                padding++;
+            acc |= byte << (56 - bits);
+            bits += 8;
+        }
+    }
+
+    // _count <= 32
+    inline uint32_t get(unsigned _count){
+        if (_count == 0)
+            return 0;
+        if (bits < _count)
+            refill();
+        uint32_t value = (uint32_t)(acc >> (64 - _count));
+        acc <<= _count;
+        bits -= _count;
+        return value;
+    }
+
+    // Leading zero bits followed by a one, RICE_ESCAPE_ZEROS if the escape was read
+    inline unsigned unary(){
+        refill();
+        unsigned zeros = acc ? __builtin_clzll(acc) : 64;
+        if (zeros >= RICE_ESCAPE_ZEROS){
+            acc <<= RICE_ESCAPE_ZEROS;
+            bits -= RICE_ESCAPE_ZEROS;
+            return RICE_ESCAPE_ZEROS;
+        }
+        acc <<= zeros + 1;
+        bits -= zeros + 1;
+        return zeros;
+    }
+
+    bool overrun(){
+        size_t loaded = (pos - begin) + padding;
+        return loaded * 8 - bits > (size_t)(end - begin) * 8;
+    }
+};
+
+}
+
+size_t rice_encode(uint8_t *_dst, size_t _capacity, const void *_src, size_t _samples, unsigned _bits){
+    if (_bits != 8 && _bits != 16)
+        return 0;
+    BitWriter writer = {_dst, _dst + _capacity, 0, 0, false};
+    const uint32_t sampleMask = (uint32_t)((1u << _bits) - 1);
+    const unsigned escapeBits = _bits + 2;
+    int16_t x[RICE_PARTITION_SAMPLES + 2] = {0, 0};
+    uint32_t u[RICE_PARTITION_SAMPLES];
+
+    for (size_t start = 0; start < _samples && !writer.overflow; start += RICE_PARTITION_SAMPLES){
+        size_t n = std::min<size_t>(RICE_PARTITION_SAMPLES, _samples - start);
+        loadPartition(x + 2, _src, start, n, _bits);
+
+        uint64_t sums[3];
+        riceAnalyze(x + 2, n, sums);
+        unsigned order = 0;
+        for (unsigned i = 1; i < 3; i++){
+            if (sums[i] < sums[order])
+                order = i;
+        }
+        // k close to log2 of the mean residual
+        unsigned k = 0;
+        while (k < _bits + 1 && ((uint64_t)n << (k + 1)) <= sums[order])
+            k++;
+        uint64_t estimate = RICE_K_BITS + n * (k + 1) + (sums[order] >> k);
+
+        if (estimate >= (uint64_t)n * _bits){
+            writer.put(RICE_ORDER_VERBATIM, RICE_ORDER_BITS);
+            for (size_t i = 0; i < n; i++)
+                writer.put((uint16_t)x[i + 2] & sampleMask, _bits);
+        }else{
+            writer.put(order, RICE_ORDER_BITS);
+            writer.put(k, RICE_K_BITS);
+            riceResiduals(u, x + 2, n, order);
+            const uint32_t lowMask = (uint32_t)((1u << k) - 1);
+            for (size_t i = 0; i < n; i++){
+                uint32_t q = u[i] >> k;
+                if (q < RICE_ESCAPE_ZEROS){
+                    writer.put(1, q + 1);
+                    writer.put(u[i] & lowMask, k);
+                }else{
+                    writer.put(0, RICE_ESCAPE_ZEROS);
+                    writer.put(u[i], escapeBits);
+                }
+            }
+        }
+        x[0] = x[n];
+        x[1] = x[n + 1];
+    }
+    writer.flush();
+    if (writer.overflow)
+        return 0;
+    return writer.pos - _dst;
+}
+
+bool rice_decode(void *_dst, size_t _samples, const uint8_t *_src, size_t _size, unsigned _bits){
+    if (_bits != 8 && _bits != 16)
+        return false;
+    BitReader reader = {_src, _src, _src + _size, 0, 0, 0};
+    const unsigned escapeBits = _bits + 2;
+    const unsigned shift = 32 - _bits;
+    int16_t x[RICE_PARTITION_SAMPLES + 2] = {0, 0};
+
+    for (size_t start = 0; start < _samples; start += RICE_PARTITION_SAMPLES){
+        size_t n = std::min<size_t>(RICE_PARTITION_SAMPLES, _samples - start);
+        unsigned order = reader.get(RICE_ORDER_BITS);
+        int16_t *cur = x + 2;
+        if (order == RICE_ORDER_VERBATIM){
+            for (size_t i = 0; i < n; i++)
+                cur[i] = (int16_t)((int32_t)(reader.get(_bits) << shift) >> shift);
+        }else{
+            unsigned k = reader.get(RICE_K_BITS);
+            if (k > _bits + 1)
+                return false;
+            for (size_t i = 0; i < n; i++){
+                unsigned q = reader.unary();
+                uint32_t value = (q == RICE_ESCAPE_ZEROS) ? reader.get(escapeBits) : (q << k) | reader.get(k);
+                cur[i] = (int16_t)(unzigzag(value) + predict(cur, (ptrdiff_t)i, order));
+            }
+        }
+        if (reader.overrun())
+            return false;
+        if (_bits == 16){
+            std::copy(cur, cur + n, (int16_t*)_dst + start);
+        }else{
+            std::copy(cur, cur + n, (int8_t*)_dst + start);
+        }
+        x[0] = x[n];
+        x[1] = x[n + 1];
+    }
+    return true;
+}
@@ -1,8 +1,12 @@
+#include <cmath>
+#include <cstring>
 #include "rpsa/common/core/wavWriter.h"
+#include "rpsa/common/core/interleave.h"
 
 
 CWaveWriter::CWaveWriter(){
     resetHeaderInit();
+    m_sampleRate = 0;
     m_endianness = CWaveWriter::Endianness::LittleEndian;
 }
 
@@ -16,7 +20,7 @@ void CWaveWriter::resetHeaderInit(){
     m_headerInit = true;
 }
 
-std::iostream *CWaveWriter::BuildWAVStream(uint8_t* buffer_ch1,size_t size_ch1,uint8_t* buffer_ch2,size_t size_ch2,unsigned short resolution){
+void CWaveWriter::BuildWAVStream(CBlockStream *memory,const uint8_t* buffer_ch1,size_t size_ch1,const uint8_t* buffer_ch2,size_t size_ch2,unsigned short resolution,double sampleRate){
 
     if (size_ch1!=0 && size_ch2 != 0)
         assert(size_ch1 == size_ch2);
@@ -38,92 +42,41 @@ std::iostream *CWaveWriter::BuildWAVStream(uint8_t* buffer_ch1,size_t size_ch1,u
         m_samplesPerChannel = size_ch2 / (m_bitDepth==8 ? 1 : 2);
     //////////////////
 
-    std::stringstream *memory = new std::stringstream(std::ios_base::in | std::ios_base::out | std::ios_base::binary);
     if (m_headerInit)
     {
+        m_sampleRate = sampleRate > 0 ? static_cast<uint32_t>(std::lround(sampleRate)) : 44100;
         BuildHeader(memory);
         m_headerInit = false;
     }
 
     
 
-    if (m_bitDepth == 8)
-    {
-        if ((size_ch1 + size_ch2) > 0){
-        uint8_t* cross_buff = new uint8_t[size_ch1 + size_ch2];
-
-        if (size_ch2 > 0 && size_ch1 > 0){
-            for (int i = 0; i < m_samplesPerChannel; i++)
-            {
-                cross_buff[i*2] = buffer_ch1[i];
-            }
-
-            for (int i = 0; i < m_samplesPerChannel; i++)
-            {
-                cross_buff[i*2 + 1] = buffer_ch2[i];                            
-            }
-        }
-        else {
-            if (size_ch1 > 0){
-                for (int i = 0; i < m_samplesPerChannel; i++) {
-                    cross_buff[i] = buffer_ch1[i];
-                }
-            }
-
-            if (size_ch2 > 0) {
-                for (int i = 0; i < m_samplesPerChannel; i++) {
-                    cross_buff[i] = buffer_ch2[i];
-                }
-            }
-        }
-        memory->write((const char*)cross_buff, size_ch1 + size_ch2);
-        delete [] cross_buff;
-        }
-    }
+    if (m_bitDepth != 8 && m_bitDepth != 16)
+        return;
 
-    if (m_bitDepth == 16)
-    {
-        int Bufflen = (size_ch1 > 0 ? m_samplesPerChannel : 0) + (size_ch2 > 0 ? m_samplesPerChannel : 0);
-        if (Bufflen > 0){
-            uint16_t* cross_buff = new uint16_t[Bufflen];
-
-
-            if (size_ch2 > 0 && size_ch1 > 0){
-                for (int i = 0; i < m_samplesPerChannel; i++)
-                {
-                    cross_buff[i*2] = ((uint16_t*)buffer_ch1)[i];
-                }
-
-                for (int i = 0; i < m_samplesPerChannel; i++)
-                {
-                    cross_buff[i*2 + 1] = ((uint16_t*)buffer_ch2)[i];                            
-                }
-            }
-            else {
-                if (size_ch1 > 0){
-                    for (int i = 0; i < m_samplesPerChannel; i++)
-                    {
-                        cross_buff[i] = ((uint16_t *) buffer_ch1)[i];
-                    }
-                }
-
-                if (size_ch2 > 0) {
-                    for (int i = 0; i < m_samplesPerChannel; i++) {
-                        cross_buff[i] = ((uint16_t *) buffer_ch2)[i];
-                    }
-                }
-            }
-        memory->write((const char*)cross_buff, sizeof(uint16_t)* (Bufflen));
-        delete [] cross_buff;
-        }
-    }
+    size_t dataSize = size_ch1 + size_ch2;
+    if (dataSize == 0)
+        return;
 
-    return memory;
+    // Samples go straight to the block buffer
+    uint8_t *dst = memory->reserve(dataSize);
+    if (dst == nullptr)
+        return;
+
+    if (size_ch1 > 0 && size_ch2 > 0){
+        if (m_bitDepth == 8)
+            interleave8(dst, buffer_ch1, buffer_ch2, m_samplesPerChannel);
+        else
+            interleave16((uint16_t*)dst, (const uint16_t*)buffer_ch1, (const uint16_t*)buffer_ch2, m_samplesPerChannel);
+    }
+    else {
+        memcpy(dst, size_ch1 > 0 ? buffer_ch1 : buffer_ch2, dataSize);
+    }
 }
 
-void CWaveWriter::BuildHeader(std::stringstream *memory){
+void CWaveWriter::BuildHeader(std::iostream *memory){
 
-    int sampleRate = 44100;
+    uint32_t sampleRate = m_sampleRate;
     int32_t dataChunkSize = m_samplesPerChannel * m_numChannels * (m_bitDepth==8 ? 1 : 2);
    
     addStringToFileData(memory,"RIFF");
@@ -139,9 +92,9 @@ void CWaveWriter::BuildHeader(std::stringstream *memory){
     addInt32ToFileData (memory, 16); // format chunk size (16 for PCM)
     addInt16ToFileData (memory, 1); // audio format = 1
     addInt16ToFileData (memory, (int16_t)m_numChannels); // num channels
-    addInt32ToFileData (memory, (int32_t)m_samplesPerChannel); // sample rate
+    addInt32ToFileData (memory, (int32_t)sampleRate); // sample rate
     
-    int32_t numBytesPerSecond = (int32_t) ((m_numChannels * sampleRate * m_bitDepth) / 8);
+    int32_t numBytesPerSecond = (int32_t) (((uint64_t)m_numChannels * sampleRate * m_bitDepth) / 8);
     addInt32ToFileData (memory, numBytesPerSecond);
     
     int16_t numBytesPerBlock = m_numChannels * (m_bitDepth / 8);
@@ -156,13 +109,13 @@ void CWaveWriter::BuildHeader(std::stringstream *memory){
 }
 
 
-void CWaveWriter::addStringToFileData (std::stringstream *memory, std::string s)
+void CWaveWriter::addStringToFileData (std::iostream *memory, std::string s)
 {
     memory->write(s.data(),s.size());
 }
 
 
-void CWaveWriter::addInt32ToFileData (std::stringstream *memory, int32_t i)
+void CWaveWriter::addInt32ToFileData (std::iostream *memory, int32_t i)
 {
     char bytes[4];
     
@@ -184,7 +137,7 @@ void CWaveWriter::addInt32ToFileData (std::stringstream *memory, int32_t i)
     
 }
 
-void CWaveWriter::addInt16ToFileData (std::stringstream *memory, int16_t i)
+void CWaveWriter::addInt16ToFileData (std::iostream *memory, int16_t i)
 {
     char bytes[2];
     
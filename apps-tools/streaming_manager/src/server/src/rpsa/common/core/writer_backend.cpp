@@ -0,0 +1,283 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include "rpsa/common/core/writer_backend.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#define ALIGN_UP(X,A) (((X) + ((A) - 1)) & ~((size_t)(A) - 1))
+
+#ifndef _WIN32
+// fallocate() instead of posix_fallocate(): the latter falls back to writing zeros
+// over the whole size where the filesystem has no support, which costs more than it saves
+static bool allocateFile(int _fd, uint64_t _size){
+#ifdef __linux__
+    return _size == 0 || fallocate(_fd, 0, 0, _size) == 0;
+#else
+    (void)_fd;
+    (void)_size;
+    return false;
+#endif
+}
+#endif
+
+CWriterBackend::Ptr CWriterBackend::Create(CWriterBackend::Type _type){
+#ifndef _WIN32
+    if (_type == Type::DIRECT)
+        return std::make_shared<CDirectWriterBackend>();
+#endif
+    return std::make_shared<CStreamWriterBackend>();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+CStreamWriterBackend::CStreamWriterBackend():
+    m_preallocated(false)
+{
+}
+
+bool CStreamWriterBackend::open(std::string _fileName, bool _append){
+    m_fileName = _fileName;
+    m_preallocated = false;
+    m_fs.open(_fileName, std::ios::binary | std::ofstream::out| std::ofstream::in | (_append? std::ofstream::binary  : std::ofstream::trunc));
+    if (m_fs.fail()) {
+        m_fs.open(_fileName, std::ios::binary | std::ofstream::out| std::ofstream::in |  std::ofstream::trunc);
+        if (m_fs.fail()) {
+            std::cout << "File " << _fileName << " not exist" << std::endl;
+            return false;
+        }
+    }
+    if (_append)
+        m_fs.seekp(0, std::ios::end);
+    return true;
+}
+
+bool CStreamWriterBackend::preallocate(uint64_t _size){
+#ifndef _WIN32
+    // fstream gives no descriptor, the space is reserved through a second one
+    int fd = ::open(m_fileName.c_str(), O_WRONLY);
+    if (fd < 0)
+        return false;
+    m_preallocated = allocateFile(fd, _size);
+    ::close(fd);
+    return m_preallocated;
+#else
+    (void)_size;
+    return false;
+#endif
+}
+
+bool CStreamWriterBackend::write(const uint8_t *_data, size_t _size){
+    m_fs.write((const char*)_data, _size);
+    return m_fs.good();
+}
+
+bool CStreamWriterBackend::patch(uint64_t _offset, const void *_data, size_t _size){
+    auto cur_p = m_fs.tellp();
+    m_fs.seekp(_offset, std::ios::beg);
+    m_fs.write((const char*)_data, _size);
+    m_fs.seekp(cur_p);
+    return m_fs.good();
+}
+
+bool CStreamWriterBackend::checkpoint(){
+    m_fs.flush();
+    return m_fs.good();
+}
+
+void CStreamWriterBackend::close(){
+    if (!m_fs.is_open())
+        return;
+    std::streamoff end = m_fs.tellp();
+    m_fs.close();
+#ifndef _WIN32
+    if (m_preallocated && end >= 0 && truncate(m_fileName.c_str(), end) != 0)
+        std::cout << "File " << m_fileName << " can't be cut to " << end << " bytes" << std::endl;
+#endif
+    m_preallocated = false;
+}
+
+bool CStreamWriterBackend::good(){
+    return m_fs.good();
+}
+
+bool CStreamWriterBackend::isOpen(){
+    return m_fs.is_open();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _WIN32
+
+static uint8_t* allocAligned(size_t _size){
+    void *ptr = nullptr;
+    if (posix_memalign(&ptr, DIRECT_IO_ALIGN, _size) != 0)
+        return nullptr;
+    return static_cast<uint8_t*>(ptr);
+}
+
+CDirectWriterBackend::CDirectWriterBackend():
+    m_fd(-1),
+    m_batch(nullptr),
+    m_fill(0),
+    m_flushed(0),
+    m_headerPage(nullptr),
+    m_hasHeaderPage(false),
+    m_headerDirty(false),
+    m_good(false)
+{
+    m_batch = allocAligned(DIRECT_IO_BATCH);
+    m_headerPage = allocAligned(DIRECT_IO_ALIGN);
+}
+
+CDirectWriterBackend::~CDirectWriterBackend(){
+    close();
+    free(m_batch);
+    free(m_headerPage);
+}
+
+bool CDirectWriterBackend::open(std::string _fileName, bool _append){
+    close();
+    if (_append || m_batch == nullptr || m_headerPage == nullptr){
+        // Appending to a file with an unaligned size is not supported
+        std::cout << "Direct write is not available for " << _fileName << std::endl;
+        return false;
+    }
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+    m_fd = ::open(_fileName.c_str(), flags | O_DIRECT, 0644);
+    if (m_fd < 0 && errno == EINVAL){
+        // Filesystem without O_DIRECT support (tmpfs). Aligned batches are still used.
+        m_fd = ::open(_fileName.c_str(), flags, 0644);
+    }
+#else
+    m_fd = ::open(_fileName.c_str(), flags, 0644);
+#endif
+    if (m_fd < 0){
+        std::cout << "File " << _fileName << " not exist" << std::endl;
+        return false;
+    }
+    m_fill = 0;
+    m_flushed = 0;
+    m_hasHeaderPage = false;
+    m_headerDirty = false;
+    m_good = true;
+    return true;
+}
+
+bool CDirectWriterBackend::preallocate(uint64_t _size){
+    return m_fd >= 0 && allocateFile(m_fd, _size);
+}
+
+bool CDirectWriterBackend::writeAt(const uint8_t *_data, size_t _size, uint64_t _offset){
+    while (_size > 0){
+        auto res = ::pwrite(m_fd, _data, _size, _offset);
+        if (res < 0){
+            if (errno == EINTR)
+                continue;
+            m_good = false;
+            return false;
+        }
+        _data += res;
+        _size -= res;
+        _offset += res;
+    }
+    return true;
+}
+
+bool CDirectWriterBackend::writeBatch(size_t _size){
+    if (!m_hasHeaderPage && m_flushed == 0){
+        memcpy(m_headerPage, m_batch, DIRECT_IO_ALIGN);
+        m_hasHeaderPage = true;
+    }
+    if (!writeAt(m_batch, _size, m_flushed))
+        return false;
+    m_flushed += _size;
+    m_fill = 0;
+    return true;
+}
+
+bool CDirectWriterBackend::write(const uint8_t *_data, size_t _size){
+    if (!m_good)
+        return false;
+    while (_size > 0){
+        size_t n = DIRECT_IO_BATCH - m_fill;
+        if (n > _size)
+            n = _size;
+        memcpy(m_batch + m_fill, _data, n);
+        m_fill += n;
+        _data += n;
+        _size -= n;
+        if (m_fill == DIRECT_IO_BATCH && !writeBatch(DIRECT_IO_BATCH))
+            return false;
+    }
+    return true;
+}
+
+bool CDirectWriterBackend::patch(uint64_t _offset, const void *_data, size_t _size){
+    if (_offset >= m_flushed){
+        if (_offset + _size > m_flushed + m_fill)
+            return false;
+        memcpy(m_batch + (_offset - m_flushed), _data, _size);
+        return true;
+    }
+    if (m_hasHeaderPage && _offset + _size <= DIRECT_IO_ALIGN){
+        memcpy(m_headerPage + _offset, _data, _size);
+        m_headerDirty = true;
+        return true;
+    }
+    return false;
+}
+
+bool CDirectWriterBackend::checkpoint(){
+    if (!m_good)
+        return false;
+    // Whole pages of the batch go out first, only the unaligned tail stays in memory
+    size_t aligned = m_fill & ~size_t(DIRECT_IO_ALIGN - 1);
+    if (aligned > 0){
+        size_t tail = m_fill - aligned;
+        if (!writeBatch(aligned))
+            return false;
+        memmove(m_batch, m_batch + aligned, tail);
+        m_fill = tail;
+    }
+    if (m_headerDirty){
+        if (!writeAt(m_headerPage, DIRECT_IO_ALIGN, 0))
+            return false;
+        m_headerDirty = false;
+    }
+    return true;
+}
+
+void CDirectWriterBackend::close(){
+    if (m_fd < 0)
+        return;
+    if (m_good){
+        uint64_t total = m_flushed + m_fill;
+        if (m_fill > 0){
+            // Tail is padded to the page size and cut back with ftruncate
+            size_t aligned = ALIGN_UP(m_fill, DIRECT_IO_ALIGN);
+            memset(m_batch + m_fill, 0, aligned - m_fill);
+            writeBatch(aligned);
+        }
+        checkpoint();
+        if (m_good && ftruncate(m_fd, total) != 0)
+            m_good = false;
+    }
+    ::close(m_fd);
+    m_fd = -1;
+}
+
+bool CDirectWriterBackend::good(){
+    return m_good;
+}
+
+bool CDirectWriterBackend::isOpen(){
+    return m_fd >= 0;
+}
+
+#endif
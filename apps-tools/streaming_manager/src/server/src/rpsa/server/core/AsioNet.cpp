@@ -1,21 +1,87 @@
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
 #include <fstream>
 #include "asio.hpp"
 #include "rpsa/server/core/AsioNet.h"
+#include "rpsa/common/core/crc32c.h"
+#include "rpsa/common/core/metrics.h"
+#include "rpsa/common/core/neon_asm.h"
 
 #define ID_PACK "STREAMpackIDv1.0"
+#define MIN_SIZE(X,Y) ((X) < (Y) ? (X) : (Y))
 
 namespace  asionet {
 
-    uint8_t *CAsioNet::BuildPack(
+    template<typename T>
+    static T readField(const uint8_t *_buffer, size_t _offset){
+        T value;
+        memcpy(&value, _buffer + _offset, sizeof(T));
+        return value;
+    }
+
+    static bool isPackV1(const uint8_t *_buffer, size_t _size){
+        return _size >= PACK_HEADER_SIZE && memcmp(_buffer, ID_PACK, 16) == 0;
+    }
+
+    static bool isPackV2(const uint8_t *_buffer, size_t _size){
+        return _size >= offsetof(PackHeaderV2, flags) && readField<uint32_t>(_buffer, 0) == PACK_V2_MAGIC;
+    }
+
+    enum ProbeResult {
+        PROBE_PACK,
+        PROBE_NEED_MORE,
+        PROBE_NO_PACK
+    };
+
+    // Looks at the stream position without copying. A partial magic at the end of the
+    // data asks for more bytes, anything else that is not a sane header is no pack.
+    static ProbeResult probePack(const uint8_t *_buffer, size_t _size, size_t &_pack_size){
+        static const uint32_t v2_magic = PACK_V2_MAGIC;
+        if (memcmp(_buffer, &v2_magic, MIN_SIZE(_size, sizeof(v2_magic))) == 0){
+            if (_size < offsetof(PackHeaderV2, pack_size) + sizeof(uint32_t))
+                return PROBE_NEED_MORE;
+            _pack_size = readField<uint32_t>(_buffer, offsetof(PackHeaderV2, pack_size));
+            return _pack_size >= PACK_V2_HEADER_SIZE ? PROBE_PACK : PROBE_NO_PACK;
+        }
+        if (memcmp(_buffer, ID_PACK, MIN_SIZE(_size, 16)) == 0){
+            if (_size < 40)
+                return PROBE_NEED_MORE;
+            _pack_size = readField<uint32_t>(_buffer, 36);
+            return _pack_size >= PACK_HEADER_SIZE ? PROBE_PACK : PROBE_NO_PACK;
+        }
+        return PROBE_NO_PACK;
+    }
+
+    static size_t findMagic(const uint8_t *_buffer, size_t _size, const void *_magic, size_t _magic_size){
+        const uint8_t first = *(const uint8_t*)_magic;
+        const uint8_t *end = _buffer + _size;
+        const uint8_t *pos = _buffer;
+        while ((pos = (const uint8_t*)memchr(pos, first, end - pos)) != nullptr){
+            if (memcmp(pos, _magic, MIN_SIZE((size_t)(end - pos), _magic_size)) == 0)
+                return pos - _buffer;
+            ++pos;
+        }
+        return _size;
+    }
+
+    // Offset of the first possible pack start, a magic cut by the end of the data counts
+    static size_t findPackStart(const uint8_t *_buffer, size_t _size){
+        static const uint32_t v2_magic = PACK_V2_MAGIC;
+        size_t v1 = findMagic(_buffer, _size, ID_PACK, 16);
+        size_t v2 = findMagic(_buffer, MIN_SIZE(v1 + 1, _size), &v2_magic, sizeof(v2_magic));
+        return MIN_SIZE(v1, v2);
+    }
+
+    size_t CAsioNet::BuildPackHeader(
+            uint8_t *_header ,
             uint64_t _id ,
             uint64_t _lostRate ,
             uint32_t _oscRate  ,
             uint32_t _resolution ,
-            const void *_ch1 ,
             size_t _size_ch1 ,
-            const void *_ch2 ,
-            size_t _size_ch2 ,
-            size_t &_buffer_size ){
+            size_t _size_ch2){
 
         size_t  prefix_lenght = sizeof(int8_t) * 16; // ID of pack (16 byte)
         prefix_lenght += sizeof(uint64_t);    // Index (8 byte)
@@ -25,27 +91,110 @@ namespace  asionet {
         prefix_lenght += sizeof(int32_t) * 2; // size of channel1 and channel2 (8 byte)
         prefix_lenght += sizeof(int32_t);     // resolution (4 byte)
         size_t  buffer_size = prefix_lenght + _size_ch1 + _size_ch2;
-        auto buffer = new uint8_t[buffer_size];
-        memcpy(buffer,ID_PACK,16);
-        ((uint64_t*)buffer)[2] = _id;
-        ((uint64_t*)buffer)[3] = _lostRate;
-        ((uint32_t*)buffer)[8] = _oscRate;
-        ((uint32_t*)buffer)[9] = (uint32_t)buffer_size;
-        ((uint32_t*)buffer)[10] = (uint32_t)_size_ch1;
-        ((uint32_t*)buffer)[11] = (uint32_t)_size_ch2;
-        ((uint32_t*)buffer)[12] = _resolution;
-
-        if (_size_ch1>0){
+        memcpy(_header,ID_PACK,16);
+        ((uint64_t*)_header)[2] = _id;
+        ((uint64_t*)_header)[3] = _lostRate;
+        ((uint32_t*)_header)[8] = _oscRate;
+        ((uint32_t*)_header)[9] = (uint32_t)buffer_size;
+        ((uint32_t*)_header)[10] = (uint32_t)_size_ch1;
+        ((uint32_t*)_header)[11] = (uint32_t)_size_ch2;
+        ((uint32_t*)_header)[12] = _resolution;
+        return prefix_lenght;
+    }
 
-            memcpy_neon((&(*buffer)+prefix_lenght), _ch1, _size_ch1);
+    size_t CAsioNet::BuildPackHeaderV2(
+            uint8_t *_header ,
+            uint64_t _id ,
+            uint32_t _oscRate  ,
+            uint32_t _resolution ,
+            uint64_t _timestamp ,
+            uint32_t _flags ,
+            const BlockInfo &_info ,
+            const void *_ch1 ,
+            size_t _size_ch1 ,
+            const void *_ch2 ,
+            size_t _size_ch2 ,
+            size_t _raw_size){
+
+        PackHeaderV2 header;
+        memset(&header, 0, sizeof(header));
+        header.magic = PACK_V2_MAGIC;
+        header.version = PACK_VERSION_2;
+        header.header_size = sizeof(PackHeaderV2);
+        header.pack_size = (uint32_t)(sizeof(PackHeaderV2) + _size_ch1 + _size_ch2);
+        header.flags = _flags;
+        header.sequence = _id;
+        header.timestamp = _timestamp;
+        header.lost = _info.lostSamples;
+        header.dma_sequence = _info.dmaSequence;
+        header.sample_index = _info.sampleIndex;
+        header.osc_rate = _oscRate;
+        header.size_ch1 = (uint32_t)_size_ch1;
+        header.size_ch2 = (uint32_t)_size_ch2;
+        header.sample_format = (_resolution == 16 ? PACK_SAMPLE_INT16 : PACK_SAMPLE_INT8);
+        header.channel_mask = (_size_ch1 > 0 ? 0x1 : 0) | (_size_ch2 > 0 ? 0x2 : 0);
+        if (_flags & PACK_FLAG_RICE)
+            header.raw_size = (uint32_t)_raw_size;
+        if (_info.segment != 0){
+            header.flags |= PACK_FLAG_SEGMENT;
+            header.segment = _info.segment;
+            header.trigger_index = _info.triggerIndex;
         }
+        if (_flags & PACK_FLAG_CRC){
+            uint32_t crc = crc32c(0, &header, sizeof(header));
+            if (_size_ch1 > 0)
+                crc = crc32c(crc, _ch1, _size_ch1);
+            if (_size_ch2 > 0)
+                crc = crc32c(crc, _ch2, _size_ch2);
+            header.crc = crc;
+        }
+        memcpy(_header, &header, sizeof(header));
+        return sizeof(header);
+    }
 
-        if (_size_ch2>0){
+    PackFormat CAsioNet::GetPackFormat(uint16_t _version, uint32_t _flags){
+        if (_version < PACK_VERSION_2)
+            return PACK_FORMAT_V1;
+        if (_flags & PACK_FLAG_RICE)
+            return (_flags & PACK_FLAG_CRC) ? PACK_FORMAT_V2_RICE_CRC : PACK_FORMAT_V2_RICE;
+        return (_flags & PACK_FLAG_CRC) ? PACK_FORMAT_V2_CRC : PACK_FORMAT_V2;
+    }
 
-            memcpy_neon((&(*buffer)+prefix_lenght + _size_ch1), _ch2, _size_ch2);
+    // A peer that takes encoded data still gets a raw pack if the encoder left it raw
+    static bool usePacked(PackFormat _format, const PackSource &_pack){
+        return (_format == PACK_FORMAT_V2_RICE || _format == PACK_FORMAT_V2_RICE_CRC) &&
+               (_pack.packed_ch1 != nullptr || _pack.packed_ch2 != nullptr);
+    }
+
+    size_t CAsioNet::BuildPackHeader(uint8_t *_header, PackFormat _format, const PackSource &_pack){
+        if (_format == PACK_FORMAT_V1){
+            return BuildPackHeader(_header, _pack.id, _pack.lostRate, _pack.oscRate, _pack.resolution, _pack.size_ch1, _pack.size_ch2);
+        }
+        uint32_t flags = (_format == PACK_FORMAT_V2_CRC || _format == PACK_FORMAT_V2_RICE_CRC) ? PACK_FLAG_CRC : 0;
+        if (usePacked(_format, _pack)){
+            return BuildPackHeaderV2(_header, _pack.id, _pack.oscRate, _pack.resolution, _pack.timestamp,
+                                     flags | PACK_FLAG_RICE, _pack.info,
+                                     _pack.packed_ch1, _pack.packed_size_ch1, _pack.packed_ch2, _pack.packed_size_ch2,
+                                     std::max(_pack.size_ch1, _pack.size_ch2));
         }
+        return BuildPackHeaderV2(_header, _pack.id, _pack.oscRate, _pack.resolution, _pack.timestamp,
+                                 flags, _pack.info,
+                                 _pack.ch1, _pack.size_ch1, _pack.ch2, _pack.size_ch2);
+    }
 
-        _buffer_size = buffer_size;
+    uint8_t *CAsioNet::BuildPack(
+            uint64_t _id ,
+            uint64_t _lostRate ,
+            uint32_t _oscRate  ,
+            uint32_t _resolution ,
+            const void *_ch1 ,
+            size_t _size_ch1 ,
+            const void *_ch2 ,
+            size_t _size_ch2 ,
+            size_t &_buffer_size ){
+
+        auto buffer = new uint8_t[PACK_HEADER_SIZE + _size_ch1 + _size_ch2];
+        BuildPack(buffer, _id, _lostRate, _oscRate, _resolution, _ch1, _size_ch1, _ch2, _size_ch2, _buffer_size);
         return buffer;
     }
 
@@ -60,22 +209,8 @@ namespace  asionet {
             const void  *_ch2 ,
             size_t _size_ch2 ,
             size_t &_buffer_size){
-        size_t  prefix_lenght = sizeof(int8_t) * 16; // ID of pack (16 byte)
-        prefix_lenght += sizeof(uint64_t);    // Index (8 byte)
-        prefix_lenght += sizeof(uint64_t);    // lostRate  (8 byte)
-        prefix_lenght += sizeof(int32_t);     // _oscRate  (4 byte)
-        prefix_lenght += sizeof(int32_t);     // pack size (4 byte)
-        prefix_lenght += sizeof(int32_t) * 2; // size of channel1 and channel2 (8 byte)
-        prefix_lenght += sizeof(int32_t);     // resolution (4 byte)
-        size_t  buffer_size = prefix_lenght + _size_ch1 + _size_ch2;
-        memcpy(buffer,ID_PACK,16);
-        ((uint64_t*)buffer)[2] = _id;
-        ((uint64_t*)buffer)[3] = _lostRate;
-        ((uint32_t*)buffer)[8] = _oscRate;
-        ((uint32_t*)buffer)[9] = (uint32_t)buffer_size;
-        ((uint32_t*)buffer)[10] = (uint32_t)_size_ch1;
-        ((uint32_t*)buffer)[11] = (uint32_t)_size_ch2;
-        ((uint32_t*)buffer)[12] = _resolution;
+
+        size_t prefix_lenght = BuildPackHeader(buffer, _id, _lostRate, _oscRate, _resolution, _size_ch1, _size_ch2);
 
         if (_size_ch1>0){
 
@@ -87,8 +222,89 @@ namespace  asionet {
             memcpy_neon((&(*buffer)+prefix_lenght + _size_ch1), _ch2, _size_ch2);
         }
 
-        _buffer_size = buffer_size;
+        _buffer_size = prefix_lenght + _size_ch1 + _size_ch2;
+
+    }
+
+    size_t CAsioNet::PackSize(const uint8_t *_buffer, size_t _size){
+        if (isPackV2(_buffer, _size))
+            return readField<uint32_t>(_buffer, offsetof(PackHeaderV2, pack_size));
+        if (isPackV1(_buffer, _size))
+            return readField<uint32_t>(_buffer, 36);
+        return 0;
+    }
+
+    ExtractResult CAsioNet::ExtractPack(
+                    const uint8_t *_buffer ,
+                    size_t _size ,
+                    PackView &_view){
+        if (isPackV2(_buffer, _size)){
+            if (_size < PACK_V2_HEADER_SIZE)
+                return PACK_BAD_SIZE;
+            PackHeaderV2 header;
+            memcpy(&header, _buffer, sizeof(header));
+            // A newer peer may send a longer header, the known part is at the same offsets
+            if (header.version < PACK_VERSION_2 || header.header_size < sizeof(PackHeaderV2))
+                return PACK_BAD_HEADER;
+            if (header.pack_size != _size || (uint64_t)header.header_size + header.size_ch1 + header.size_ch2 != _size)
+                return PACK_BAD_SIZE;
+            // The decoded size sets the client's decode buffer, it can't be taken on trust
+            if ((header.flags & PACK_FLAG_RICE) &&
+                (header.raw_size > PACK_MAX_DATA_SIZE || header.raw_size % (header.sample_format == PACK_SAMPLE_INT16 ? 2 : 1) != 0))
+                return PACK_BAD_SIZE;
+            if (header.flags & PACK_FLAG_CRC){
+                uint32_t crc = header.crc;
+                header.crc = 0;
+                uint32_t calc = crc32c(0, &header, sizeof(header));
+                calc = crc32c(calc, _buffer + sizeof(header), _size - sizeof(header));
+                if (calc != crc)
+                    return PACK_BAD_CRC;
+            }
+            if (!(header.flags & PACK_FLAG_SEGMENT)){
+                header.segment = 0;
+                header.trigger_index = 0;
+            }
+            _view.version = header.version;
+            _view.flags = header.flags;
+            _view.id = header.sequence;
+            _view.timestamp = header.timestamp;
+            _view.lostRate = (header.lost > 0 ? 1 : 0);
+            _view.info.dmaSequence = header.dma_sequence;
+            _view.info.sampleIndex = header.sample_index;
+            _view.info.lostSamples = header.lost;
+            _view.info.segment = header.segment;
+            _view.info.triggerIndex = header.trigger_index;
+            _view.oscRate = header.osc_rate;
+            _view.resolution = (header.sample_format == PACK_SAMPLE_INT16 ? 16 : 8);
+            _view.size_ch1 = header.size_ch1;
+            _view.size_ch2 = header.size_ch2;
+            _view.raw_size = (header.flags & PACK_FLAG_RICE) ? header.raw_size : 0;
+            _view.ch1 = (header.size_ch1 > 0 ? _buffer + header.header_size : nullptr);
+            _view.ch2 = (header.size_ch2 > 0 ? _buffer + header.header_size + header.size_ch1 : nullptr);
+            return PACK_OK;
+        }
 
+        if (isPackV1(_buffer, _size)){
+            if (readField<uint32_t>(_buffer, 36) != _size)
+                return PACK_BAD_SIZE;
+            _view.version = PACK_VERSION_1;
+            _view.flags = 0;
+            _view.id = readField<uint64_t>(_buffer, 16);
+            _view.timestamp = 0;
+            _view.lostRate = readField<uint64_t>(_buffer, 24);
+            _view.info = BlockInfo();
+            _view.oscRate = readField<uint32_t>(_buffer, 32);
+            _view.size_ch1 = readField<uint32_t>(_buffer, 40);
+            _view.size_ch2 = readField<uint32_t>(_buffer, 44);
+            _view.resolution = readField<uint32_t>(_buffer, 48);
+            _view.raw_size = 0;
+            if (PACK_HEADER_SIZE + _view.size_ch1 + _view.size_ch2 != _size)
+                return PACK_BAD_SIZE;
+            _view.ch1 = (_view.size_ch1 > 0 ? _buffer + PACK_HEADER_SIZE : nullptr);
+            _view.ch2 = (_view.size_ch2 > 0 ? _buffer + PACK_HEADER_SIZE + _view.size_ch1 : nullptr);
+            return PACK_OK;
+        }
+        return PACK_BAD_HEADER;
     }
 
     bool CAsioNet::ExtractPack(
@@ -102,32 +318,31 @@ namespace  asionet {
                     size_t &_size_ch1 ,
                     CAsioSocket::send_buffer  &_ch2 ,
                     size_t &_size_ch2){
-        if (strncmp((const char*)_buffer,ID_PACK,16) == 0){
-            _id = ((uint64_t*)_buffer)[2];
-            _lostRate = ((uint64_t*)_buffer)[3];
-            _oscRate  = ((uint32_t*)_buffer)[8];
-            ASIO_ASSERT(_size == ((uint32_t*)_buffer)[9]);
-            _size_ch1 = ((uint32_t*)_buffer)[10];
-            _size_ch2 = ((uint32_t*)_buffer)[11];
-            _resolution = ((uint32_t*)_buffer)[12];
-            uint16_t prefix = 52;
-
-            if (_size_ch1 > 0) {
-                _ch1 = new uint8_t[_size_ch1];
-                memcpy_neon(_ch1,_buffer + prefix,_size_ch1);
-            }else{
-                _ch1 = nullptr;
-            }
+        PackView view;
+        // Encoded packs are left to CStreamingClient, this copy has no decoder
+        if (ExtractPack(_buffer, _size, view) != PACK_OK || (view.flags & PACK_FLAG_RICE))
+            return false;
+        _id = view.id;
+        _lostRate = view.lostRate;
+        _oscRate = view.oscRate;
+        _resolution = view.resolution;
+        _size_ch1 = view.size_ch1;
+        _size_ch2 = view.size_ch2;
+
+        if (_size_ch1 > 0) {
+            _ch1 = new uint8_t[_size_ch1];
+            memcpy_neon(_ch1,view.ch1,_size_ch1);
+        }else{
+            _ch1 = nullptr;
+        }
 
-            if (_size_ch2 > 0) {
-                _ch2 = new uint8_t[_size_ch2];
-                memcpy_neon(_ch2,_buffer + prefix + _size_ch1,_size_ch2);
-            }else{
-                _ch2 = nullptr;
-            }
-            return true;
+        if (_size_ch2 > 0) {
+            _ch2 = new uint8_t[_size_ch2];
+            memcpy_neon(_ch2,view.ch2,_size_ch2);
+        }else{
+            _ch2 = nullptr;
         }
-        return false;
+        return true;
     }
 
     CAsioNet::Ptr CAsioNet::Create(asionet::Mode _mode,asionet::Protocol _protocol,std::string _host , std::string _port) {
@@ -188,6 +403,26 @@ namespace  asionet {
         m_server->CloseSocket();
     }
 
+    void CAsioNet::SetRequestVersion(uint16_t _version, uint32_t _flags){
+        m_server->SetRequestVersion(_version, _flags);
+    }
+
+    void CAsioNet::SetMaxClients(size_t _count){
+        m_server->SetMaxClients(_count);
+    }
+
+    void CAsioNet::SetClientQueueDepth(size_t _depth){
+        m_server->SetClientQueueDepth(_depth);
+    }
+
+    std::vector<ClientStats> CAsioNet::GetClientStats(){
+        return m_server->GetClientStats();
+    }
+
+    uint32_t CAsioNet::GetClientFlags(){
+        return m_server->GetClientFlags();
+    }
+
     void CAsioNet::addCallServer_Connect(std::function<void(std::string host)> _func){
         if (m_server){
             m_server->addHandler(CAsioSocket::Events::CONNECT_SERVER, _func);
@@ -231,6 +466,11 @@ namespace  asionet {
             m_server->addHandler(CAsioSocket::Events::RECIVED_DATA_FROM_SERVER, _func);
     }
 
+    void CAsioNet::addCallReceivedError(std::function<void(std::error_code error)> _func){
+        if (m_server)
+            m_server->addHandler(CAsioSocket::Events::RECIVED_BROKEN_DATA, _func);
+    }
+
     bool CAsioNet::SendData(bool async,CAsioSocket::send_buffer _buffer,size_t _size){
         if (m_server){
             return m_server->SendBuffer(async,_buffer,_size);
@@ -238,6 +478,490 @@ namespace  asionet {
         return false;
     }
 
+    bool CAsioNet::SendPack(const PackSource &_pack){
+        if (m_server && m_IsRun){
+            return m_server->SendPack(_pack);
+        }
+        return false;
+    }
+
+    bool CAsioNet::SendPacks(const PackSource *_packs, size_t _count){
+        if (m_server && m_IsRun){
+            return m_server->SendPacks(_packs, _count);
+        }
+        return false;
+    }
+
+    CSharedPack::Ptr CSharedPack::Create(const PackSource &_source){
+        return std::make_shared<CSharedPack>(_source);
+    }
+
+    CSharedPack::CSharedPack(const PackSource &_source):
+            m_source(_source),
+            m_data()
+    {
+        for (size_t i = 0; i < PACK_FORMAT_COUNT; i++)
+            m_header_size[i] = 0;
+    }
+
+    const uint8_t *CSharedPack::Header(uint16_t _version, uint32_t _flags, size_t &_size){
+        PackFormat format = CAsioNet::GetPackFormat(_version, _flags);
+        if (m_header_size[format] == 0){
+            static CMetricHistogram *metricBuild = CMetricsRegistry::instance().histogram("net.pack_build");
+            CMetricTimer timer(metricBuild);
+            m_header_size[format] = CAsioNet::BuildPackHeader(m_header[format], format, m_source);
+        }
+        _size = m_header_size[format];
+        return m_header[format];
+    }
+
+    void CSharedPack::Detach(){
+        size_t raw = m_source.size_ch1 + m_source.size_ch2;
+        size_t packed = (m_source.packed_ch1 ? m_source.packed_size_ch1 : 0) + (m_source.packed_ch2 ? m_source.packed_size_ch2 : 0);
+        if (!m_data.empty() || raw + packed == 0)
+            return;
+        m_data.resize(raw + packed);
+        uint8_t *dst = m_data.data();
+        if (m_source.size_ch1 > 0){
+            memcpy_neon(dst, m_source.ch1, m_source.size_ch1);
+            m_source.ch1 = dst;
+            dst += m_source.size_ch1;
+        }
+        if (m_source.size_ch2 > 0){
+            memcpy_neon(dst, m_source.ch2, m_source.size_ch2);
+            m_source.ch2 = dst;
+            dst += m_source.size_ch2;
+        }
+        if (m_source.packed_ch1 != nullptr){
+            memcpy_neon(dst, m_source.packed_ch1, m_source.packed_size_ch1);
+            m_source.packed_ch1 = dst;
+            dst += m_source.packed_size_ch1;
+        }
+        if (m_source.packed_ch2 != nullptr){
+            memcpy_neon(dst, m_source.packed_ch2, m_source.packed_size_ch2);
+            m_source.packed_ch2 = dst;
+        }
+    }
+
+    std::array<asio::const_buffer, 3> CSharedPack::Buffers(uint16_t _version, uint32_t _flags, const uint8_t *_header, size_t _header_size){
+        if (usePacked(CAsioNet::GetPackFormat(_version, _flags), m_source)){
+            std::array<asio::const_buffer, 3> buffers = {{
+                asio::buffer(_header, _header_size),
+                asio::buffer(m_source.packed_ch1, m_source.packed_ch1 != nullptr ? m_source.packed_size_ch1 : 0),
+                asio::buffer(m_source.packed_ch2, m_source.packed_ch2 != nullptr ? m_source.packed_size_ch2 : 0)
+            }};
+            return buffers;
+        }
+        std::array<asio::const_buffer, 3> buffers = {{
+            asio::buffer(_header, _header_size),
+            asio::buffer(m_source.ch1, m_source.ch1 != nullptr ? m_source.size_ch1 : 0),
+            asio::buffer(m_source.ch2, m_source.ch2 != nullptr ? m_source.size_ch2 : 0)
+        }};
+        return buffers;
+    }
+
+    CUdpBatch::CUdpBatch():
+            m_packs(nullptr),
+            m_count(0)
+    {
+        for (size_t i = 0; i < PACK_FORMAT_COUNT; i++){
+            m_header_size[i] = 0;
+            m_built[i] = false;
+        }
+    }
+
+    void CUdpBatch::Reset(const PackSource *_packs, size_t _count){
+        m_packs = _packs;
+        m_count = _count;
+        for (size_t i = 0; i < PACK_FORMAT_COUNT; i++)
+            m_built[i] = false;
+    }
+
+    void CUdpBatch::BuildHeaders(PackFormat _format){
+        if (m_built[_format])
+            return;
+        static CMetricHistogram *metricBuild = CMetricsRegistry::instance().histogram("net.pack_build");
+        CMetricTimer timer(metricBuild);
+        // The arena only grows, after the first blocks there are no allocations
+        auto &headers = m_headers[_format];
+        if (headers.size() < m_count * PACK_V2_HEADER_SIZE)
+            headers.resize(m_count * PACK_V2_HEADER_SIZE);
+        for (size_t i = 0; i < m_count; i++){
+            m_header_size[_format] = CAsioNet::BuildPackHeader(headers.data() + i * PACK_V2_HEADER_SIZE, _format, m_packs[i]);
+        }
+        m_built[_format] = true;
+    }
+
+    size_t CUdpBatch::Send(asio::ip::udp::udp::socket &_socket, const asio::ip::udp::udp::endpoint &_endpoint,
+                           uint16_t _version, uint32_t _flags, size_t &_bytes, asio::error_code &_error){
+        PackFormat format = CAsioNet::GetPackFormat(_version, _flags);
+        BuildHeaders(format);
+        const uint8_t *headers = m_headers[format].data();
+        size_t header_size = m_header_size[format];
+        size_t sent = 0;
+        _bytes = 0;
+
+#ifdef __linux__
+        if (m_msgs.size() < m_count){
+            m_msgs.resize(m_count);
+            m_iov.resize(m_count * 3);
+        }
+        for (size_t i = 0; i < m_count; i++){
+            const PackSource &pack = m_packs[i];
+            bool packed = usePacked(format, pack);
+            const void *ch1 = packed ? pack.packed_ch1 : pack.ch1;
+            const void *ch2 = packed ? pack.packed_ch2 : pack.ch2;
+            struct iovec *iov = &m_iov[i * 3];
+            iov[0].iov_base = const_cast<uint8_t*>(headers + i * PACK_V2_HEADER_SIZE);
+            iov[0].iov_len = header_size;
+            iov[1].iov_base = const_cast<void*>(ch1);
+            iov[1].iov_len = ch1 != nullptr ? (packed ? pack.packed_size_ch1 : pack.size_ch1) : 0;
+            iov[2].iov_base = const_cast<void*>(ch2);
+            iov[2].iov_len = ch2 != nullptr ? (packed ? pack.packed_size_ch2 : pack.size_ch2) : 0;
+            memset(&m_msgs[i], 0, sizeof(m_msgs[i]));
+            m_msgs[i].msg_hdr.msg_name = const_cast<void*>(static_cast<const void*>(_endpoint.data()));
+            m_msgs[i].msg_hdr.msg_namelen = _endpoint.size();
+            m_msgs[i].msg_hdr.msg_iov = iov;
+            m_msgs[i].msg_hdr.msg_iovlen = 3;
+        }
+        while (sent < m_count){
+            int res = ::sendmmsg(_socket.native_handle(), &m_msgs[sent], m_count - sent, 0);
+            if (res < 0){
+                if (errno == EINTR)
+                    continue;
+                _error = asio::error_code(errno, asio::error::get_system_category());
+                break;
+            }
+            for (int i = 0; i < res; i++)
+                _bytes += m_msgs[sent + i].msg_len;
+            sent += res;
+        }
+#else
+        for (; sent < m_count; sent++){
+            const PackSource &pack = m_packs[sent];
+            bool packed = usePacked(format, pack);
+            const void *ch1 = packed ? pack.packed_ch1 : pack.ch1;
+            const void *ch2 = packed ? pack.packed_ch2 : pack.ch2;
+            std::array<asio::const_buffer, 3> buffers = {{
+                asio::buffer(headers + sent * PACK_V2_HEADER_SIZE, header_size),
+                asio::buffer(ch1, ch1 != nullptr ? (packed ? pack.packed_size_ch1 : pack.size_ch1) : 0),
+                asio::buffer(ch2, ch2 != nullptr ? (packed ? pack.packed_size_ch2 : pack.size_ch2) : 0)
+            }};
+            _bytes += _socket.send_to(buffers, _endpoint, 0, _error);
+            if (_error)
+                break;
+        }
+#endif
+        return sent;
+    }
+
+    CAsioClient::Ptr CAsioClient::Create(asio::io_service &io, shared_ptr<asio::ip::tcp::socket> _socket, size_t _queueDepth){
+        return std::make_shared<CAsioClient>(io, Protocol::TCP, _socket, nullptr, asio::ip::udp::udp::endpoint(), _queueDepth);
+    }
+
+    CAsioClient::Ptr CAsioClient::Create(asio::io_service &io, shared_ptr<asio::ip::udp::udp::socket> _socket, const asio::ip::udp::udp::endpoint &_endpoint){
+        return std::make_shared<CAsioClient>(io, Protocol::UDP, nullptr, _socket, _endpoint, 0);
+    }
+
+    CAsioClient::CAsioClient(asio::io_service &io, Protocol _protocol, shared_ptr<asio::ip::tcp::socket> _tcp_socket,
+                             shared_ptr<asio::ip::udp::udp::socket> _udp_socket, const asio::ip::udp::udp::endpoint &_endpoint, size_t _queueDepth):
+            m_io_service(io),
+            m_protocol(_protocol),
+            m_tcp_socket(_tcp_socket),
+            m_udp_socket(_udp_socket),
+            m_udp_endpoint(_endpoint),
+            m_host(),
+            m_version(PACK_VERSION_1),
+            m_flags(0),
+            m_queue(_queueDepth < 2 ? 2 : _queueDepth),
+            m_queue_head(0),
+            m_queue_count(0),
+            m_queue_depth(m_queue.size()),
+            m_queue_max(0),
+            m_current(),
+            m_sending(false),
+            m_in_flight(false),
+            m_closed(false),
+            m_onClose(nullptr),
+            m_onSend(nullptr),
+            m_packs(0),
+            m_bytes(0),
+            m_dropped(0)
+    {
+        asio::error_code error;
+        if (m_protocol == Protocol::TCP)
+            m_host = m_tcp_socket->remote_endpoint(error).address().to_string();
+        else
+            m_host = m_udp_endpoint.address().to_string() + ":" + std::to_string(m_udp_endpoint.port());
+    }
+
+    void CAsioClient::Start(CloseHandler _onClose, SendHandler _onSend){
+        m_onClose = _onClose;
+        m_onSend = _onSend;
+        if (m_protocol == Protocol::TCP) {
+            // The client stays on v1 until its hello arrives, v1 clients never send one
+            asio::async_read(*m_tcp_socket, asio::buffer(m_read_buffer, sizeof(m_read_buffer)),
+                             std::bind(&CAsioClient::HandlerReceiveHello, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+        }
+    }
+
+    void CAsioClient::Close(){
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_closed)
+                return;
+            m_closed = true;
+            // m_current is left to the io thread, it may still be written
+            for (auto &item : m_queue)
+                item.pack = nullptr;
+            m_queue_count = 0;
+        }
+        // The socket is only touched from the io thread
+        auto self = shared_from_this();
+        m_io_service.post([self](){
+            if (self->m_tcp_socket && self->m_tcp_socket->is_open()){
+                asio::error_code error;
+                self->m_tcp_socket->shutdown(asio::ip::tcp::socket::shutdown_both, error);
+                self->m_tcp_socket->close(error);
+            }
+            if (self->m_onClose)
+                self->m_onClose(self);
+        });
+    }
+
+    void CAsioClient::ParseHello(const uint8_t *_buffer, size_t _size){
+        PackHello hello;
+        if (_size < sizeof(hello)){
+            // Old client, only the connect byte
+            m_version = PACK_VERSION_1;
+            m_flags = 0;
+            return;
+        }
+        memcpy(&hello, _buffer, sizeof(hello));
+        if (hello.magic != PACK_HELLO_MAGIC || hello.version < PACK_VERSION_2){
+            m_version = PACK_VERSION_1;
+            m_flags = 0;
+            return;
+        }
+        m_version = PACK_VERSION_2;
+        m_flags = hello.flags & (PACK_FLAG_CRC | PACK_FLAG_RICE);
+    }
+
+    bool CAsioClient::IsEndpoint(const asio::ip::udp::udp::endpoint &_endpoint){
+        return m_protocol == Protocol::UDP && m_udp_endpoint == _endpoint;
+    }
+
+    void CAsioClient::HandlerReceiveHello(const asio::error_code &_error, size_t _bytesTransferred){
+        if (_error || m_read_buffer[0] == 0){
+            Close();
+            return;
+        }
+        ParseHello(m_read_buffer, _bytesTransferred);
+        m_tcp_socket->async_read_some(asio::buffer(m_read_buffer, sizeof(m_read_buffer)),
+                                      std::bind(&CAsioClient::HandlerReceive, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+    }
+
+    void CAsioClient::HandlerReceive(const asio::error_code &_error, size_t _bytesTransferred){
+        // After the hello the client only sends the zero byte on stop
+        if (_error || memchr(m_read_buffer, 0, _bytesTransferred) != nullptr){
+            Close();
+            return;
+        }
+        m_tcp_socket->async_read_some(asio::buffer(m_read_buffer, sizeof(m_read_buffer)),
+                                      std::bind(&CAsioClient::HandlerReceive, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+    }
+
+    // Time from handing a pack to the client until the socket took it
+    static CMetricHistogram* metricWrite(){
+        static CMetricHistogram *metric = CMetricsRegistry::instance().histogram("net.write");
+        return metric;
+    }
+
+    bool CAsioClient::Send(CUdpBatch &_batch){
+        if (m_protocol != Protocol::UDP)
+            return false;
+        size_t bytes = 0;
+        asio::error_code error;
+        auto start = std::chrono::steady_clock::now();
+        size_t sent = _batch.Send(*m_udp_socket, m_udp_endpoint, m_version, m_flags, bytes, error);
+        metricWrite()->recordSince(start);
+        static CMetricCounter *metricBytes = CMetricsRegistry::instance().counter("net.bytes");
+        metricBytes->add(bytes);
+        m_packs.fetch_add(sent, std::memory_order_relaxed);
+        m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        m_dropped.fetch_add(_batch.Count() - sent, std::memory_order_relaxed);
+        if (m_onSend)
+            m_onSend(error, bytes);
+        if (error)
+            Close();
+        return sent > 0;
+    }
+
+    bool CAsioClient::Send(const CSharedPack::Ptr &_pack, bool _direct){
+        auto start = std::chrono::steady_clock::now();
+        size_t header_size = 0;
+        const uint8_t *header = _pack->Header(m_version, m_flags, header_size);
+
+        if (m_protocol == Protocol::UDP){
+            asio::error_code error;
+            auto buffers = _pack->Buffers(m_version, m_flags, header, header_size);
+            size_t size = m_udp_socket->send_to(buffers, m_udp_endpoint, 0, error);
+            metricWrite()->recordSince(start);
+            Sent(error, size);
+            if (error)
+                Close();
+            return !error;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_closed)
+            return false;
+
+        size_t offset = 0;
+        if (!m_sending){
+            // Nothing queued, the pack goes out straight from the caller's buffers.
+            // The io thread doesn't touch the write side while m_sending is false.
+            asio::error_code error;
+            auto buffers = _pack->Buffers(m_version, m_flags, header, header_size);
+            offset = _direct ? asio::write(*m_tcp_socket, buffers, error) : TrySend(buffers, error);
+            if (error || offset == asio::buffer_size(buffers)){
+                lock.unlock();
+                metricWrite()->recordSince(start);
+                Sent(error, offset);
+                if (error)
+                    Close();
+                return !error;
+            }
+        }
+
+        // The client is behind, the pack has to outlive the caller's buffers
+        _pack->Detach();
+        if (offset > 0){
+            // The rest of a pack the socket took in part goes out before anything else
+            m_current = {_pack, header, header_size, offset, start};
+            m_in_flight = true;
+        }else{
+            if (m_queue_count + (m_in_flight ? 1 : 0) >= m_queue_depth){
+                // Drop the oldest pack, none in the ring is being written
+                m_queue[m_queue_head].pack = nullptr;
+                m_queue_head = (m_queue_head + 1) % m_queue_depth;
+                m_queue_count--;
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+            m_queue[(m_queue_head + m_queue_count) % m_queue_depth] = {_pack, header, header_size, 0, start};
+            m_queue_count++;
+        }
+        size_t queued = m_queue_count + (m_in_flight ? 1 : 0);
+        if (queued > m_queue_max)
+            m_queue_max = queued;
+        static CMetricGauge *metricQueue = CMetricsRegistry::instance().gauge("net.queue_depth");
+        metricQueue->set(queued);
+        if (!m_sending){
+            m_sending = true;
+            m_io_service.post(std::bind(&CAsioClient::WriteNext, shared_from_this()));
+        }
+        return true;
+    }
+
+    // Sends what the socket takes without waiting, 0 if it is full
+    size_t CAsioClient::TrySend(const std::array<asio::const_buffer, 3> &_buffers, asio::error_code &_error){
+#ifdef __linux__
+        struct iovec iov[3];
+        for (size_t i = 0; i < _buffers.size(); i++){
+            iov[i].iov_base = const_cast<void*>(_buffers[i].data());
+            iov[i].iov_len = _buffers[i].size();
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = _buffers.size();
+        while (true){
+            ssize_t res = ::sendmsg(m_tcp_socket->native_handle(), &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (res >= 0)
+                return res;
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                _error = asio::error_code(errno, asio::error::get_system_category());
+            return 0;
+        }
+#else
+        (void)_buffers;
+        (void)_error;
+        return 0;
+#endif
+    }
+
+    void CAsioClient::WriteNext(){
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_closed || (!m_in_flight && m_queue_count == 0)){
+            m_current.pack = nullptr;
+            m_in_flight = false;
+            m_sending = false;
+            return;
+        }
+        if (!m_in_flight){
+            m_current = std::move(m_queue[m_queue_head]);
+            m_queue_head = (m_queue_head + 1) % m_queue_depth;
+            m_queue_count--;
+            m_in_flight = true;
+        }
+        auto buffers = m_current.pack->Buffers(m_version, m_flags, m_current.header, m_current.header_size);
+        size_t offset = m_current.offset;
+        for (auto &buffer : buffers){
+            size_t skip = std::min(offset, buffer.size());
+            buffer = buffer + skip;
+            offset -= skip;
+        }
+        lock.unlock();
+        asio::async_write(*m_tcp_socket, buffers,
+                          std::bind(&CAsioClient::HandlerWrite, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+    }
+
+    void CAsioClient::HandlerWrite(const asio::error_code &_error, size_t _bytesTransferred){
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            metricWrite()->recordSince(m_current.queued);
+            _bytesTransferred += m_current.offset;
+            m_current.pack = nullptr;
+            m_in_flight = false;
+        }
+        Sent(_error, _bytesTransferred);
+        if (_error){
+            Close();
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_sending = false;
+            return;
+        }
+        WriteNext();
+    }
+
+    void CAsioClient::Sent(const asio::error_code &_error, size_t _bytesTransferred){
+        if (_error){
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+        }else{
+            static CMetricCounter *metricBytes = CMetricsRegistry::instance().counter("net.bytes");
+            m_packs.fetch_add(1, std::memory_order_relaxed);
+            m_bytes.fetch_add(_bytesTransferred, std::memory_order_relaxed);
+            metricBytes->add(_bytesTransferred);
+        }
+        if (m_onSend)
+            m_onSend(_error, _bytesTransferred);
+    }
+
+    ClientStats CAsioClient::GetStats(){
+        ClientStats stats;
+        stats.host = m_host;
+        stats.version = m_version;
+        stats.packs = m_packs.load(std::memory_order_relaxed);
+        stats.bytes = m_bytes.load(std::memory_order_relaxed);
+        stats.dropped = m_dropped.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        stats.queued = m_queue_count + (m_in_flight ? 1 : 0);
+        stats.queueMax = m_queue_max;
+        return stats;
+    }
+
 
     CAsioSocket::Ptr
     CAsioSocket::Create(asio::io_service &io, asionet::Protocol _protocol, std::string host, std::string port) {
@@ -256,7 +980,14 @@ namespace  asionet {
             m_tcp_socket(0),
             m_tcp_acceptor(0),
             m_udp_endpoint(),
-            m_last_pack_id(0)
+            m_fifo_begin(0),
+            m_fifo_end(0),
+            m_last_pack_id(0),
+            m_request_version(PACK_VERSION_1),
+            m_request_flags(0),
+            m_clients(),
+            m_max_clients(ASIO_MAX_CLIENTS),
+            m_client_queue_depth(ASIO_CLIENT_QUEUE_DEPTH)
     {
         m_SocketReadBuffer = new uint8_t[SOCKET_BUFFER_SIZE];
         m_tcp_fifo_buffer = new uint8_t[FIFO_BUFFER_SIZE];
@@ -292,13 +1023,31 @@ namespace  asionet {
             m_tcp_acceptor->set_option(asio::ip::tcp::acceptor::reuse_address(true));
             m_tcp_acceptor->bind(endpoint);
             m_tcp_acceptor->listen();
-            m_tcp_acceptor->async_accept(*m_tcp_socket,m_tcp_endpoint, std::bind(&CAsioSocket::HandlerAcceptFromClient, this, std::placeholders::_1));
+            AcceptClient();
         }
         m_mode = Mode::SERVER;
     }
 
     void CAsioSocket::CloseSocket(){
 
+        if (m_mode == Mode::SERVER){
+            std::vector<CAsioClient::Ptr> clients;
+            {
+                std::lock_guard<std::mutex> lock(m_clients_mutex);
+                clients.swap(m_clients);
+            }
+            for (auto &client : clients){
+                m_callback_Str.emitEvent(Events::DISCONNECT_SERVER, client->GetHost());
+                client->Close();
+            }
+            asio::error_code error;
+            if (m_tcp_acceptor && m_tcp_acceptor->is_open())
+                m_tcp_acceptor->close(error);
+            if (m_udp_socket && m_udp_socket->is_open())
+                m_udp_socket->close(error);
+            return;
+        }
+
         if (m_is_udp_connected)
             m_callback_Str.emitEvent(Events::DISCONNECT_SERVER, m_udp_endpoint.address().to_string());
         if (m_is_tcp_connected)
@@ -317,91 +1066,178 @@ namespace  asionet {
     void CAsioSocket::WaitClient() {
         if (m_protocol == asionet::Protocol::UDP) {
             m_udp_socket->async_receive_from(
-                    asio::buffer(m_udp_recv_server_buffer, 1), m_udp_endpoint,
+                    asio::buffer(m_udp_recv_server_buffer, sizeof(m_udp_recv_server_buffer)), m_udp_endpoint,
                     std::bind(&CAsioSocket::HandlerReceiveFromClient, this,
-                              std::placeholders::_1));
+                              std::placeholders::_1, std::placeholders::_2));
+        }
+    }
+
+    void CAsioSocket::SetRequestVersion(uint16_t _version, uint32_t _flags){
+        m_request_version = _version;
+        m_request_flags = _flags;
+    }
+
+    void CAsioSocket::SetMaxClients(size_t _count){
+        m_max_clients = (_count == 0 ? 1 : _count);
+    }
+
+    void CAsioSocket::SetClientQueueDepth(size_t _depth){
+        m_client_queue_depth = _depth;
+    }
+
+    std::vector<ClientStats> CAsioSocket::GetClientStats(){
+        std::vector<CAsioClient::Ptr> clients;
+        {
+            std::lock_guard<std::mutex> lock(m_clients_mutex);
+            clients = m_clients;
         }
+        std::vector<ClientStats> stats;
+        for (auto &client : clients)
+            stats.push_back(client->GetStats());
+        return stats;
+    }
+
+    uint32_t CAsioSocket::GetClientFlags(){
+        std::lock_guard<std::mutex> lock(m_clients_mutex);
+        uint32_t flags = 0;
+        for (auto &client : m_clients)
+            flags |= client->GetFlags();
+        return flags;
     }
 
-    void CAsioSocket::HandlerReceiveFromClient(const asio::error_code &error) {
-        if (!error) {
-            m_is_udp_connected = (bool) m_udp_recv_server_buffer[0];
-            if (m_is_udp_connected){
-                m_callback_Str.emitEvent(Events::CONNECT_SERVER,m_udp_endpoint.address().to_string());
+    void CAsioSocket::AddClient(CAsioClient::Ptr _client){
+        {
+            std::lock_guard<std::mutex> lock(m_clients_mutex);
+            m_clients.push_back(_client);
+        }
+        m_callback_Str.emitEvent(Events::CONNECT_SERVER, _client->GetHost());
+        _client->Start(std::bind(&CAsioSocket::RemoveClient, this, std::placeholders::_1),
+                       [this](std::error_code error, size_t size){
+                           m_callback_ErrorInt.emitEvent(Events::SEND_DATA, error, size);
+                       });
+    }
+
+    void CAsioSocket::RemoveClient(CAsioClient::Ptr _client){
+        bool found = false;
+        {
+            std::lock_guard<std::mutex> lock(m_clients_mutex);
+            auto it = std::find(m_clients.begin(), m_clients.end(), _client);
+            if (it != m_clients.end()){
+                m_clients.erase(it);
+                found = true;
             }
-            else {
-                m_callback_Str.emitEvent(Events::DISCONNECT_SERVER,m_udp_endpoint.address().to_string());
+        }
+        if (found)
+            m_callback_Str.emitEvent(Events::DISCONNECT_SERVER, _client->GetHost());
+    }
+
+    bool CAsioSocket::SendPack(const PackSource &_pack){
+        std::vector<CAsioClient::Ptr> clients;
+        {
+            std::lock_guard<std::mutex> lock(m_clients_mutex);
+            clients = m_clients;
+        }
+        if (clients.empty())
+            return false;
+
+        // A single TCP client is served straight from the caller's buffers while it keeps up.
+        // With more clients none may hold up the others, each gets what its socket takes at
+        // once and only the clients that are behind queue the pack, copied once for all of them.
+        bool direct = clients.size() == 1;
+        auto pack = CSharedPack::Create(_pack);
+        bool sent = false;
+        for (auto &client : clients){
+            sent |= client->Send(pack, direct);
+        }
+        return sent;
+    }
+
+    bool CAsioSocket::SendPacks(const PackSource *_packs, size_t _count){
+        if (m_protocol == Protocol::TCP){
+            bool sent = false;
+            for (size_t i = 0; i < _count; i++)
+                sent |= SendPack(_packs[i]);
+            return sent;
+        }
+
+        std::vector<CAsioClient::Ptr> clients;
+        {
+            std::lock_guard<std::mutex> lock(m_clients_mutex);
+            clients = m_clients;
+        }
+        if (clients.empty())
+            return false;
+
+        m_udp_batch.Reset(_packs, _count);
+        bool sent = false;
+        for (auto &client : clients){
+            sent |= client->Send(m_udp_batch);
+        }
+        return sent;
+    }
+
+    void CAsioSocket::BuildHello(PackHello &_hello){
+        memset(&_hello, 0, sizeof(_hello));
+        _hello.connect = 1;
+        _hello.version = m_request_version;
+        _hello.magic = PACK_HELLO_MAGIC;
+        _hello.flags = m_request_flags;
+    }
+
+    void CAsioSocket::HandlerReceiveFromClient(const asio::error_code &error, size_t bytes_transferred) {
+        if (error == asio::error::operation_aborted)
+            return;
+        if (!error && bytes_transferred > 0) {
+            CAsioClient::Ptr client = nullptr;
+            bool full = false;
+            {
+                std::lock_guard<std::mutex> lock(m_clients_mutex);
+                for (auto &c : m_clients) {
+                    if (c->IsEndpoint(m_udp_endpoint))
+                        client = c;
+                }
+                full = m_clients.size() >= m_max_clients;
+            }
+            if (m_udp_recv_server_buffer[0] != 0) {
+                if (client) {
+                    client->ParseHello(m_udp_recv_server_buffer, bytes_transferred);
+                } else if (!full) {
+                    client = CAsioClient::Create(m_io_service, m_udp_socket, m_udp_endpoint);
+                    client->ParseHello(m_udp_recv_server_buffer, bytes_transferred);
+                    AddClient(client);
+                } else {
+                    std::cerr << "Client limit reached, " << m_udp_endpoint.address().to_string() << " is ignored\n";
+                }
+            } else if (client) {
+                client->Close();
             }
-        } else {
-            m_callback_Str.emitEvent(Events::DISCONNECT_SERVER,m_udp_endpoint.address().to_string());
-            m_is_udp_connected = false;
         }
+        // Receive errors can't be matched to a client, the listener just goes on
         m_udp_socket->async_receive_from(
-                asio::buffer(m_udp_recv_server_buffer, 1), m_udp_endpoint,
+                asio::buffer(m_udp_recv_server_buffer, sizeof(m_udp_recv_server_buffer)), m_udp_endpoint,
                 std::bind(&CAsioSocket::HandlerReceiveFromClient, this,
-                          std::placeholders::_1));
+                          std::placeholders::_1, std::placeholders::_2));
     }
 
     void CAsioSocket::HandlerReceiveFromServer(const asio::error_code &ErrorCode, size_t bytes_transferred){
         if (!ErrorCode) {
         //    std::cout << "Byte received: " << bytes_transferred << "\n";
             if (m_protocol == Protocol::TCP) {
-
-                if (bytes_transferred + m_pos_last_in_fifo > FIFO_BUFFER_SIZE) {
-                    std::cerr  << "[rspa] TCP received buffer overflow\n";
-                    exit(5);
-                }
-
-                memcpy(m_tcp_fifo_buffer + m_pos_last_in_fifo,m_SocketReadBuffer,bytes_transferred);
-                m_pos_last_in_fifo += bytes_transferred;
-
-                char *id_str = ID_PACK;
-                uint8_t  size_id = sizeof(ID_PACK) - 1;
-                bool find_all_flag = false;
-//                cout << "Buff size " << m_pos_last_in_fifo << "\n";
-                do{
-
-                for (int i = 0; i < m_pos_last_in_fifo - size_id; ++i) {
-                    bool find_flag = false;
-                    for (int j = 0; j < size_id; ++j) {
-                        if (m_tcp_fifo_buffer[i + j] == id_str[j]) {
-                            find_flag = true;
-                        } else {
-                            find_flag = false;
-                            break;
-                        }
-                    }
- //                   std::cout << i << " pos " <<  m_pos_last_in_fifo << "\n";
-
-                    if (find_flag) {
-                        uint32_t pack_size = ((uint32_t *) (m_tcp_fifo_buffer + i))[9];
-                        if ((pack_size + i) <= m_pos_last_in_fifo) {
-                            m_callbackErrorUInt8Int.emitEvent(Events::RECIVED_DATA_FROM_SERVER, ErrorCode,
-                                                              m_tcp_fifo_buffer + i,
-                                                              (uint32_t) pack_size);
-
-                            memcpy(m_tcp_fifo_buffer, m_tcp_fifo_buffer + i + pack_size,
-                                   m_pos_last_in_fifo - pack_size - i);
-                            m_pos_last_in_fifo = m_pos_last_in_fifo - pack_size - i;
-                            find_all_flag = true;
-                        }
-                        else{
-                            find_all_flag = false;
-//                            std::cout << "Header persent " << i << " size " << m_pos_last_in_fifo <<" \n";
-                        }
-                        break;
-                    } else{
-                        find_all_flag = false;
-                    }
-                }
-                if (m_pos_last_in_fifo <= size_id)
-                    break;
-                } while (find_all_flag);
+                // Data was received straight into the stream buffer
+                m_fifo_end += bytes_transferred;
+                ParseStream();
             }
 
             if (m_protocol == Protocol::UDP) {
-                if (strncmp((const char*)m_SocketReadBuffer,ID_PACK,16) == 0) {
-                    uint64_t id_pack = ((uint64_t *) (m_SocketReadBuffer))[2];
+                uint64_t id_pack = 0;
+                bool is_pack = true;
+                if (isPackV2(m_SocketReadBuffer, bytes_transferred) && bytes_transferred >= PACK_V2_HEADER_SIZE)
+                    id_pack = readField<uint64_t>(m_SocketReadBuffer, offsetof(PackHeaderV2, sequence));
+                else if (isPackV1(m_SocketReadBuffer, bytes_transferred))
+                    id_pack = readField<uint64_t>(m_SocketReadBuffer, 16);
+                else
+                    is_pack = false;
+                if (is_pack) {
                     if (id_pack > m_last_pack_id)
                     {
                         m_callbackErrorUInt8Int.emitEvent(Events::RECIVED_DATA_FROM_SERVER, ErrorCode,
@@ -413,41 +1249,109 @@ namespace  asionet {
             }
 
 
-            if (m_protocol == Protocol::UDP) {
-                m_udp_socket->async_receive_from(
-                        asio::buffer(m_SocketReadBuffer, SOCKET_BUFFER_SIZE), m_udp_endpoint,
-                        std::bind(&CAsioSocket::HandlerReceiveFromServer, this,
-                                  std::placeholders::_1, std::placeholders::_2));
-            }
-            if (m_protocol == Protocol::TCP) {
-                m_tcp_socket->async_receive(asio::buffer(m_SocketReadBuffer, SOCKET_BUFFER_SIZE),
-                                            std::bind(&CAsioSocket::HandlerReceiveFromServer, this,
-                                                      std::placeholders::_1, std::placeholders::_2));
-            }
+            ReceiveFromServer();
         }else{
             m_callback_Error.emitEvent(Events::ERROR_CLIENT,ErrorCode);
             CloseSocket();
         }
     }
 
+    void CAsioSocket::ReceiveFromServer(){
+        if (m_protocol == Protocol::UDP) {
+            m_udp_socket->async_receive_from(
+                    asio::buffer(m_SocketReadBuffer, SOCKET_BUFFER_SIZE), m_udp_endpoint,
+                    std::bind(&CAsioSocket::HandlerReceiveFromServer, this,
+                              std::placeholders::_1, std::placeholders::_2));
+        }
+        if (m_protocol == Protocol::TCP) {
+            // Only the unfinished pack is moved to the front, and only when the tail is too short
+            if (m_fifo_begin == m_fifo_end) {
+                m_fifo_begin = m_fifo_end = 0;
+            } else if (FIFO_BUFFER_SIZE - m_fifo_end < SOCKET_BUFFER_SIZE && m_fifo_begin > 0) {
+                memmove(m_tcp_fifo_buffer, m_tcp_fifo_buffer + m_fifo_begin, m_fifo_end - m_fifo_begin);
+                m_fifo_end -= m_fifo_begin;
+                m_fifo_begin = 0;
+            }
+            m_tcp_socket->async_receive(asio::buffer(m_tcp_fifo_buffer + m_fifo_end, FIFO_BUFFER_SIZE - m_fifo_end),
+                                        std::bind(&CAsioSocket::HandlerReceiveFromServer, this,
+                                                  std::placeholders::_1, std::placeholders::_2));
+        }
+    }
+
+    void CAsioSocket::ParseStream(){
+        while (m_fifo_begin < m_fifo_end) {
+            uint8_t *pack = m_tcp_fifo_buffer + m_fifo_begin;
+            size_t size = m_fifo_end - m_fifo_begin;
+            size_t pack_size = 0;
+            auto probe = probePack(pack, size, pack_size);
+            if (probe == PROBE_NEED_MORE)
+                break;
+            if (probe == PROBE_NO_PACK) {
+                m_callback_Error.emitEvent(Events::RECIVED_BROKEN_DATA, asio::error::invalid_argument);
+                Resync(m_fifo_begin + 1);
+                continue;
+            }
+            if (pack_size > FIFO_BUFFER_SIZE) {
+                // Can never be received whole, it is skipped like garbage
+                m_callback_Error.emitEvent(Events::RECIVED_BROKEN_DATA, asio::error::message_size);
+                Resync(m_fifo_begin + 1);
+                continue;
+            }
+            if (pack_size > size)
+                break;
+            m_callbackErrorUInt8Int.emitEvent(Events::RECIVED_DATA_FROM_SERVER, asio::error_code(), pack, pack_size);
+            m_fifo_begin += pack_size;
+        }
+        if (m_fifo_end == FIFO_BUFFER_SIZE && m_fifo_begin == 0) {
+            // Full buffer without a complete pack, can only happen with a broken size field
+            m_callback_Error.emitEvent(Events::RECIVED_BROKEN_DATA, asio::error::message_size);
+            Resync(1);
+        }
+    }
+
+    void CAsioSocket::Resync(size_t _from){
+        // One memchr pass over the rest of the data, not a header check at every offset
+        m_fifo_begin = _from + findPackStart(m_tcp_fifo_buffer + _from, m_fifo_end - _from);
+    }
+
     bool CAsioSocket::IsConnected(){
+        if (m_mode == Mode::SERVER){
+            std::lock_guard<std::mutex> lock(m_clients_mutex);
+            return !m_clients.empty();
+        }
         return m_is_tcp_connected || m_is_udp_connected;
     }
 
+    void CAsioSocket::AcceptClient(){
+        m_tcp_socket = std::make_shared<asio::ip::tcp::socket>(m_io_service);
+        m_tcp_acceptor->async_accept(*m_tcp_socket, m_tcp_endpoint, std::bind(&CAsioSocket::HandlerAcceptFromClient, this, std::placeholders::_1));
+    }
+
     void CAsioSocket::HandlerAcceptFromClient(const asio::error_code &_error)
     {
+        if (_error == asio::error::operation_aborted)
+            return;
+
         if (!_error)
         {
-
-            m_callback_Str.emitEvent(Events::CONNECT_SERVER,m_tcp_endpoint.address().to_string());
-            m_is_tcp_connected = true;
+            bool full = false;
+            {
+                std::lock_guard<std::mutex> lock(m_clients_mutex);
+                full = m_clients.size() >= m_max_clients;
+            }
+            if (full) {
+                std::cerr << "Client limit reached, " << m_tcp_endpoint.address().to_string() << " is refused\n";
+                asio::error_code error;
+                m_tcp_socket->close(error);
+            } else {
+                AddClient(CAsioClient::Create(m_io_service, m_tcp_socket, m_client_queue_depth));
+            }
         }
-        else if (_error.value() != 1) // Already open connection
+        else
         {
             m_callback_Error.emitEvent(Events::ERROR_SERVER,_error);
-            m_tcp_acceptor->async_accept(*m_tcp_socket, m_tcp_endpoint, std::bind(&CAsioSocket::HandlerAcceptFromClient, this, std::placeholders::_1));
-            m_is_tcp_connected = false;
         }
+        AcceptClient();
     }
 
     void CAsioSocket::HandlerConnectToServer(const asio::error_code &_error, asio::ip::tcp::resolver::iterator endpoint_iterator)
@@ -457,9 +1361,13 @@ namespace  asionet {
 			{
 				m_callback_Str.emitEvent(Events::CONNECT_CLIENT, m_tcp_endpoint.address().to_string());
 				m_is_tcp_connected = true;
-				m_tcp_socket->async_receive(asio::buffer(m_SocketReadBuffer, SOCKET_BUFFER_SIZE),
-					std::bind(&CAsioSocket::HandlerReceiveFromServer, this,
-						std::placeholders::_1, std::placeholders::_2));
+				if (m_request_version >= PACK_VERSION_2) {
+					PackHello hello;
+					BuildHello(hello);
+					asio::error_code error;
+					asio::write(*m_tcp_socket, asio::buffer(&hello, sizeof(hello)), error);
+				}
+				ReceiveFromServer();
 			}
 			else if (endpoint_iterator != asio::ip::tcp::resolver::iterator()) {
 				m_tcp_socket->close();
@@ -484,14 +1392,23 @@ namespace  asionet {
     void CAsioSocket::InitClient(){
         m_is_udp_connected = false;
         m_is_tcp_connected = false;
-        m_pos_last_in_fifo = 0;
+        m_fifo_begin = 0;
+        m_fifo_end = 0;
         if (m_protocol == asionet::Protocol::UDP) {
             asio::ip::udp::udp::resolver resolver(m_io_service);
             asio::ip::udp::udp::resolver::query query(asio::ip::udp::udp::v4(), m_host, m_port);
             asio::ip::udp::udp::resolver::iterator iter = resolver.resolve(query);
             m_udp_socket = std::make_shared<asio::ip::udp::udp::socket>(m_io_service, asio::ip::udp::udp::endpoint(asio::ip::udp::udp::v4(), 0));
+            asio::error_code ignored;
+            m_udp_socket->set_option(asio::socket_base::receive_buffer_size(UDP_CLIENT_RECEIVE_BUFFER), ignored);
             m_udp_endpoint = *iter;
-            m_udp_socket->send_to(asio::buffer("\x01",1),m_udp_endpoint);
+            if (m_request_version >= PACK_VERSION_2) {
+                PackHello hello;
+                BuildHello(hello);
+                m_udp_socket->send_to(asio::buffer(&hello, sizeof(hello)),m_udp_endpoint);
+            } else {
+                m_udp_socket->send_to(asio::buffer("\x01",1),m_udp_endpoint);
+            }
             m_callback_Str.emitEvent(Events::CONNECT_CLIENT,m_udp_endpoint.address().to_string());
             m_udp_socket->async_receive_from(
                     asio::buffer(m_SocketReadBuffer, SOCKET_BUFFER_SIZE), m_udp_endpoint,
@@ -591,14 +1508,6 @@ namespace  asionet {
 
         } else if ((_error == asio::error::eof) || (_error == asio::error::connection_reset) ||
                 _error == asio::error::broken_pipe) {
-            if (m_mode == Mode::SERVER) {
-                if (m_is_udp_connected)
-                    m_callback_Str.emitEvent(Events::DISCONNECT_SERVER, m_udp_endpoint.address().to_string());
-                if (m_is_tcp_connected)
-                    m_callback_Str.emitEvent(Events::DISCONNECT_SERVER, m_tcp_endpoint.address().to_string());
-                InitServer();
-            }
-
             if (m_mode == Mode::CLIENT) {
                 if (m_is_udp_connected)
                     m_callback_Str.emitEvent(Events::DISCONNECT_SERVER, m_udp_endpoint.address().to_string());
@@ -16,10 +16,27 @@ m_oscLostRate(0),
 m_oscRate(0),
 m_udpLostRate(0),
 m_fileSystemLostRate(0),
+m_fileSystemQueueMax(0),
+m_fileSystemWriteSpeed(0),
 m_reciveData(0),
 m_reciveData_ch1(0),
 m_reciveData_ch2(0),
-m_old_id(0)
+m_compressionRaw(0),
+m_compressionPacked(0),
+m_compressionFallback(0),
+m_old_id(0),
+m_hasTimeline(false),
+m_firstDmaSequence(0),
+m_lastDmaSequence(0),
+m_firstSampleIndex(0),
+m_nextSampleIndex(0),
+m_adcLostSamples(0),
+m_timelineLostSamples(0),
+m_gapCount(0),
+m_gaps(),
+m_lastSegment(0),
+m_segmentCount(0),
+m_triggers()
 {
     ResetCounters();
 }
@@ -33,10 +50,27 @@ void CFileLogger::ResetCounters(){
     m_oscLostRate = 0;
     m_udpLostRate = 0;
     m_fileSystemLostRate = 0;
+    m_fileSystemQueueMax = 0;
+    m_fileSystemWriteSpeed = 0;
     m_reciveData = 0;
     m_reciveData_ch1 = 0;
     m_reciveData_ch2 = 0;
+    m_compressionRaw = 0;
+    m_compressionPacked = 0;
+    m_compressionFallback = 0;
     m_oscRate = 0;
+    m_hasTimeline = false;
+    m_firstDmaSequence = 0;
+    m_lastDmaSequence = 0;
+    m_firstSampleIndex = 0;
+    m_nextSampleIndex = 0;
+    m_adcLostSamples = 0;
+    m_timelineLostSamples = 0;
+    m_gapCount = 0;
+    m_gaps.clear();
+    m_lastSegment = 0;
+    m_segmentCount = 0;
+    m_triggers.clear();
 }
 
 void CFileLogger::AddMetric(CFileLogger::Metric _metric, uint64_t _value){
@@ -58,6 +92,15 @@ void CFileLogger::AddMetric(CFileLogger::Metric _metric, uint64_t _value){
             m_fileSystemLostRate += _value;
         break;
 
+        case Metric::FILESYSTEM_QUEUE_MAX:
+            if (_value > m_fileSystemQueueMax)
+                m_fileSystemQueueMax = _value;
+        break;
+
+        case Metric::FILESYSTEM_WRITE_SPEED:
+            m_fileSystemWriteSpeed = _value;
+        break;
+
         case Metric::RECIVE_DATE:
             m_reciveData += _value;
         break;
@@ -70,6 +113,18 @@ void CFileLogger::AddMetric(CFileLogger::Metric _metric, uint64_t _value){
             m_reciveData_ch2 += _value;
         break;
 
+        case Metric::COMPRESSION_RAW_BYTES:
+            m_compressionRaw += _value;
+        break;
+
+        case Metric::COMPRESSION_PACKED_BYTES:
+            m_compressionPacked += _value;
+        break;
+
+        case Metric::COMPRESSION_FALLBACK:
+            m_compressionFallback += _value;
+        break;
+
         default:
         break;
     }
@@ -84,6 +139,36 @@ void CFileLogger::AddMetricId(uint64_t _id){
     m_old_id = _id;
 }
 
+void CFileLogger::AddBlockInfo(const BlockInfo &_info, uint64_t _samples){
+    if (_info.dmaSequence == 0)
+        return; // Source without timeline
+
+    bool newSegment = _info.segment != 0 && _info.segment != m_lastSegment;
+    if (newSegment){
+        m_segmentCount++;
+        if (m_triggers.size() < LOG_MAX_TRIGGER_MARKERS)
+            m_triggers.push_back({_info.segment, _info.triggerIndex, _info.sampleIndex});
+    }
+    m_lastSegment = _info.segment;
+
+    if (!m_hasTimeline){
+        m_hasTimeline = true;
+        m_firstDmaSequence = _info.dmaSequence;
+        m_firstSampleIndex = _info.sampleIndex;
+    }else{
+        m_adcLostSamples += _info.lostSamples;
+        if (_info.sampleIndex != m_nextSampleIndex && !newSegment){
+            // Samples lost on the ADC side or packs lost on the way both show up as a jump of the index
+            uint64_t lost = _info.sampleIndex > m_nextSampleIndex ? _info.sampleIndex - m_nextSampleIndex : 0;
+            m_timelineLostSamples += lost;
+            m_gapCount++;
+            if (m_gaps.size() < LOG_MAX_GAP_MARKERS)
+                m_gaps.push_back({_info.sampleIndex, _info.dmaSequence, lost});
+        }
+    }
+    m_lastDmaSequence = _info.dmaSequence;
+    m_nextSampleIndex = _info.sampleIndex + _samples;
+}
 
 void CFileLogger::DumpToFile(){
     
@@ -104,6 +189,8 @@ void CFileLogger::DumpToFile(){
         log << "Missed data buffers when reading from ADC:\t" << m_oscLostRate << "\n";
         log << "Lost data during transfer by network:\t" << m_udpLostRate << "\n";
         log << "Lost data due to file write buffer overflow:\t" << m_fileSystemLostRate << "\n";
+        log << "Max blocks in file write buffer:\t" << m_fileSystemQueueMax << "\n";
+        log << "Disk write speed:\t" << m_fileSystemWriteSpeed / 1024 << "kb/s \n";
         log << "\n";
         log << "Total amount of data transferred:\n";
         log << "\t-" << m_reciveData << "b \n";
@@ -119,6 +206,45 @@ void CFileLogger::DumpToFile(){
         log << "\t-" << m_reciveData_ch2 << "b \n";
         log << "\t-" << m_reciveData_ch2 / 1024 << "kb \n";
         log << "\t-" << m_reciveData_ch2 / (1024 * 1024) << "Mb \n";
+        if (m_compressionRaw > 0 || m_compressionFallback > 0){
+            log << "\n";
+            log << "Compression:\n";
+            log << "\tChannel data:\t" << m_compressionRaw << "b \n";
+            log << "\tWritten:\t" << m_compressionPacked << "b \n";
+            if (m_compressionPacked > 0)
+                log << "\tRatio:\t" << (double)m_compressionRaw / m_compressionPacked << "\n";
+            log << "\tBlocks written raw because the encoder fell behind:\t" << m_compressionFallback << "\n";
+        }
+        if (m_hasTimeline){
+            log << "\n";
+            log << "Sample timeline (samples per channel):\n";
+            log << "\tFirst DMA buffer:\t" << m_firstDmaSequence << "\n";
+            log << "\tLast DMA buffer:\t" << m_lastDmaSequence << "\n";
+            log << "\tFirst sample index:\t" << m_firstSampleIndex << "\n";
+            log << "\tEnd sample index:\t" << m_nextSampleIndex << "\n";
+            log << "\tLost samples when reading from ADC:\t" << m_adcLostSamples << "\n";
+            log << "\tTotal lost samples:\t" << m_timelineLostSamples << "\n";
+            log << "\tGaps:\t" << m_gapCount << "\n";
+            if (m_gapCount > 0){
+                log << "\n";
+                log << "Gap markers (sample index after gap; DMA buffer; lost samples):\n";
+                for (const auto &gap : m_gaps){
+                    log << "\t" << gap.sampleIndex << ";\t" << gap.dmaSequence << ";\t" << gap.lostSamples << "\n";
+                }
+                if (m_gapCount > m_gaps.size())
+                    log << "\t... " << m_gapCount - m_gaps.size() << " more gaps not listed\n";
+            }
+            if (m_segmentCount > 0){
+                log << "\n";
+                log << "Triggered segments:\t" << m_segmentCount << "\n";
+                log << "Trigger markers (segment; trigger sample index; first sample index):\n";
+                for (const auto &trigger : m_triggers){
+                    log << "\t" << trigger.segment << ";\t" << trigger.triggerIndex << ";\t" << trigger.sampleIndex << "\n";
+                }
+                if (m_segmentCount > m_triggers.size())
+                    log << "\t... " << m_segmentCount - m_triggers.size() << " more segments not listed\n";
+            }
+        }
     }
     catch (std::exception& e)
 	{
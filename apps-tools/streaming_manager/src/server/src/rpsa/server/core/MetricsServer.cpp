@@ -0,0 +1,60 @@
+#include <functional>
+#include <iostream>
+#include "rpsa/server/core/MetricsServer.h"
+#include "rpsa/common/core/metrics.h"
+
+CMetricsServer::Ptr CMetricsServer::Create(asio::io_service &_io, unsigned short _port){
+    auto server = std::make_shared<CMetricsServer>(_io);
+    if (!server->listen(_port))
+        return nullptr;
+    server->accept();
+    return server;
+}
+
+CMetricsServer::CMetricsServer(asio::io_service &_io):
+    m_io(_io),
+    m_acceptor(_io)
+{
+}
+
+bool CMetricsServer::listen(unsigned short _port){
+    asio::error_code error;
+    asio::ip::tcp::endpoint endpoint(asio::ip::tcp::v4(), _port);
+    m_acceptor.open(endpoint.protocol(), error);
+    if (!error)
+        m_acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true), error);
+    if (!error)
+        m_acceptor.bind(endpoint, error);
+    if (!error)
+        m_acceptor.listen(asio::socket_base::max_connections, error);
+    if (error){
+        std::cerr << "Error: metrics endpoint on port " << _port << ": " << error.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void CMetricsServer::close(){
+    asio::error_code ignored;
+    m_acceptor.close(ignored);
+}
+
+void CMetricsServer::accept(){
+    auto socket = std::make_shared<asio::ip::tcp::socket>(m_io);
+    m_acceptor.async_accept(*socket, std::bind(&CMetricsServer::handlerAccept, shared_from_this(), socket, std::placeholders::_1));
+}
+
+void CMetricsServer::handlerAccept(std::shared_ptr<asio::ip::tcp::socket> _socket, const asio::error_code &_error){
+    if (_error == asio::error::operation_aborted || !m_acceptor.is_open())
+        return;
+    if (!_error){
+        auto text = std::make_shared<std::string>(CMetricsRegistry::instance().report());
+        // The socket and the text live until the write completes
+        asio::async_write(*_socket, asio::buffer(*text), [_socket, text](const asio::error_code &, size_t){
+            asio::error_code ignored;
+            _socket->shutdown(asio::ip::tcp::socket::shutdown_both, ignored);
+            _socket->close(ignored);
+        });
+    }
+    accept();
+}
@@ -1,10 +1,13 @@
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <fstream>
 #include <functional>
 #include <cstdlib>
+#include <cstring>
 #include "rpsa/server/core/StreamingApplication.h"
 #include "AsioNet.h"
+#include "rpsa/common/core/neon_asm.h"
 
 #define CH1 1
 #define CH2 2
@@ -29,29 +32,58 @@ void PrintDebugLogInFile(const char *message){
 }
 
 CStreamingApplication::CStreamingApplication(CStreamingManager::Ptr _StreamingManager,COscilloscope::Ptr _osc_ch, unsigned short _resolution,int _oscRate,int _channels) :
-    m_StreamingManager(_StreamingManager),
     m_Osc_ch(_osc_ch),
+    m_StreamingManager(_StreamingManager),
     m_OscThread(),
+    mtx(),
     m_ReadyToPass(0),
+    m_isRun(false),
     m_Ios(),
+    m_Resolution(_resolution),
     m_WriteBuffer_ch1(nullptr),
     m_WriteBuffer_ch2(nullptr),
-    m_Timer(m_Ios),
-    m_BytesCount(0),
-    m_Resolution(_resolution),
-    m_isRun(false),
+    m_PassBuffer_ch1(nullptr),
+    m_PassBuffer_ch2(nullptr),
+    m_ZeroCopy(false),
+    m_DmaBufferHeld(false),
     m_oscRate(_oscRate),
     m_channels(_channels),
-    mtx()
+    m_Timer(m_Ios),
+    m_OscThreadPriority(0),
+    m_OscThreadCpu(-1),
+    m_LastStatBlocks(0),
+    m_LastStatOverflows(0),
+    m_LastStatBytes(0),
+    m_MetricsTimer(m_Ios),
+    m_MetricsPort(0),
+    m_MetricsServer(nullptr),
+    m_MetricDmaWait(CMetricsRegistry::instance().histogram("acq.dma_wait")),
+    m_MetricCopy(CMetricsRegistry::instance().histogram("acq.copy")),
+    m_MetricPass(CMetricsRegistry::instance().histogram("acq.pass")),
+    m_MetricBytes(CMetricsRegistry::instance().counter("acq.bytes")),
+    m_MetricLostSamples(CMetricsRegistry::instance().counter("acq.lost_samples")),
+    m_Decimator_ch1(nullptr),
+    m_Decimator_ch2(nullptr),
+    m_DecimationFactor(1),
+    m_DecimatedIndex(0),
+    m_Segmenter(nullptr),
+    m_SegmentBuffer(),
+    m_MetricSegments(CMetricsRegistry::instance().counter("acq.segments"))
 {
     
     assert(this->m_Resolution == 8 || this->m_Resolution == 16);
 
     m_size_ch1 = 0;
     m_size_ch2 = 0;
+    m_BlockInfo = BlockInfo();
+    m_PassInfo = BlockInfo();
+    resetStats();
     
-    m_WriteBuffer_ch1 = aligned_alloc(64, osc_buf_size);
-    m_WriteBuffer_ch2 = aligned_alloc(64, osc_buf_size);
+    m_WriteBuffer_ch1 = aligned_alloc(64, m_Osc_ch->getBufferSize());
+    m_WriteBuffer_ch2 = aligned_alloc(64, m_Osc_ch->getBufferSize());
+    m_StreamingManager->setBlockSize(2 * m_Osc_ch->getBufferSize());
+
+    updateZeroCopy();
 
     m_OscThreadRun.test_and_set();
 }
@@ -73,6 +105,7 @@ void CStreamingApplication::run()
     m_size_ch2 = 0;
 
     m_isRun = true;
+    m_Osc_ch->clearInterrupt();
     m_OscThread = std::thread(&CStreamingApplication::oscWorker, this);
 
     try {
@@ -83,6 +116,12 @@ void CStreamingApplication::run()
         asio::signal_set signalSet(m_Ios, SIGINT, SIGTERM);
         signalSet.async_wait(std::bind(&CStreamingApplication::signalHandler, this, std::placeholders::_1, std::placeholders::_2));
 
+        startMetrics();
+
+        // Statistics are printed from here, the acquisition thread only updates counters
+        m_Timer.expires_from_now(std::chrono::seconds(m_PerformanceCounterPeriod));
+        m_Timer.async_wait(std::bind(&CStreamingApplication::performanceCounterHandler, this, std::placeholders::_1));
+
         asio::io_service::work idle(m_Ios);
         m_Ios.run();
         m_OscThread.join();
@@ -102,8 +141,16 @@ void CStreamingApplication::runNonBlock(){
     m_isRun = true;    
     try {
         m_StreamingManager->run(); // MUST BE INIT FIRST for thread logic
+        m_Osc_ch->clearInterrupt();
         m_OscThread = std::thread(&CStreamingApplication::oscWorker, this);
-        
+
+        // Only the metrics run on m_Ios here, the caller keeps its own thread
+        m_Ios.reset();
+        startMetrics();
+        m_SocketThread = std::thread([this](){
+            asio::io_service::work idle(m_Ios);
+            m_Ios.run();
+        });
     }
     catch (const asio::system_error &e)
     {
@@ -116,9 +163,16 @@ bool CStreamingApplication::stop(){
     
     if (m_isRun){
         m_OscThreadRun.clear();
+        m_Osc_ch->interrupt(); // Wake up the acquisition thread waiting for the DMA
         m_OscThread.join();
         m_StreamingManager->stop();
         m_Ios.stop();
+        if (m_SocketThread.joinable())
+            m_SocketThread.join();
+        if (m_MetricsServer){
+            m_MetricsServer->close();
+            m_MetricsServer = nullptr;
+        }
         m_Osc_ch->stop();
 
         m_isRun = false;
@@ -127,18 +181,95 @@ bool CStreamingApplication::stop(){
     return false;
 }
 
+void CStreamingApplication::setOscThreadOptions(int _priority, int _cpu){
+    m_OscThreadPriority = _priority;
+    m_OscThreadCpu = _cpu;
+    // The interrupt thread only moves DMA buffers around, it must preempt the worker
+    m_Osc_ch->setIrqThreadOptions(_priority > 0 ? _priority + 1 : 0, _cpu);
+}
+
+void CStreamingApplication::setMetricsPort(unsigned short _port){
+    m_MetricsPort = _port;
+}
+
+bool CStreamingApplication::setDecimation(DecimationFilter _filter, uint32_t _factor, uint32_t _taps, uint32_t _order){
+    CDecimator::Ptr ch1 = nullptr;
+    CDecimator::Ptr ch2 = nullptr;
+    if (_filter != DecimationFilter::NONE){
+        ch1 = CDecimator::Create(_filter, _factor, _taps, _order);
+        ch2 = CDecimator::Create(_filter, _factor, _taps, _order);
+        if (!ch1 || !ch2)
+            return false;
+    }
+    m_Decimator_ch1 = ch1;
+    m_Decimator_ch2 = ch2;
+    m_DecimationFactor = ch1 ? _factor : 1;
+    m_DecimatedIndex = 0;
+    updateZeroCopy();
+    return true;
+}
+
+bool CStreamingApplication::setTrigger(const TriggerSettings &_settings){
+    CTriggerSegmenter::Ptr segmenter = nullptr;
+    if (_settings.source != TriggerSource::NONE){
+        int channel = _settings.source == TriggerSource::CHANNEL1 ? CH1 : CH2;
+        segmenter = CTriggerSegmenter::Create(_settings);
+        if (!segmenter || !(m_channels & channel))
+            return false;
+    }
+    m_Segmenter = segmenter;
+    m_SegmentBuffer.resize(segmenter ? m_Osc_ch->getBufferSize() : 0);
+    updateZeroCopy();
+    return true;
+}
+
+// The network path sends synchronously, so 16 bit data can go from the DMA buffer straight to the socket.
+// 8 bit data still needs the stride copy, the software decimation and the segmenter write into the copy buffers.
+void CStreamingApplication::updateZeroCopy(){
+    m_ZeroCopy = !m_Decimator_ch1 && !m_Segmenter && !m_StreamingManager->isLocalFile() && m_Resolution == 16;
+}
+
+void CStreamingApplication::startMetrics(){
+    auto &registry = CMetricsRegistry::instance();
+    registry.openSharedPage();
+    if (m_MetricsPort != 0 && !m_MetricsServer)
+        m_MetricsServer = CMetricsServer::Create(m_Ios, m_MetricsPort);
+    registry.refresh();
+    m_MetricsTimer.expires_from_now(std::chrono::milliseconds(METRICS_REFRESH_PERIOD_MS));
+    m_MetricsTimer.async_wait(std::bind(&CStreamingApplication::metricsHandler, this, std::placeholders::_1));
+}
+
+void CStreamingApplication::metricsHandler(const asio::error_code &_error){
+    if (_error)
+        return;
+    CMetricsRegistry::instance().refresh();
+    m_MetricsTimer.expires_from_now(std::chrono::milliseconds(METRICS_REFRESH_PERIOD_MS));
+    m_MetricsTimer.async_wait(std::bind(&CStreamingApplication::metricsHandler, this, std::placeholders::_1));
+}
+
+void CStreamingApplication::resetStats(){
+    m_Stats.blocks = 0;
+    m_Stats.overflows = 0;
+    m_Stats.lostSamples = 0;
+    m_Stats.bytes = 0;
+    m_Stats.errors = 0;
+    m_Stats.segments = 0;
+    m_LastStatBlocks = 0;
+    m_LastStatOverflows = 0;
+    m_LastStatBytes = 0;
+}
+
+// Single writer: plain load and store are enough and avoid a locked read-modify-write
+static inline void statAdd(std::atomic<uint64_t> &_counter, uint64_t _value){
+    _counter.store(_counter.load(std::memory_order_relaxed) + _value, std::memory_order_relaxed);
+}
+
 void CStreamingApplication::oscWorker()
 {
+    COscilloscope::applyThreadOptions(m_OscThreadPriority, m_OscThreadCpu);
     sleep(1); // The delay is necessary for the web interface of the application to update
     m_Osc_ch->prepare();
-    auto timeNow = std::chrono::system_clock::now();
-    auto curTime = std::chrono::time_point_cast<std::chrono::milliseconds >(timeNow);
-    auto value = curTime.time_since_epoch();
-
-    long long int timeBegin = value.count();
-    uintmax_t counter = 0;
     m_lostRate = 0;
-    uintmax_t passCounter = 0;
     int dropFirstNBuffer = 2;
 try{
     while (m_OscThreadRun.test_and_set())
@@ -146,34 +277,41 @@ try{
 #ifndef DISABLE_OSC
         m_size_ch1 = 0;
         m_size_ch2 = 0;
-        bool overFlow = this->passCh(m_size_ch1,m_size_ch2);
+        bool overFlow = false;
+        if (!this->passCh(m_size_ch1,m_size_ch2,overFlow)){
+            if (m_Osc_ch->isInterrupted())
+                break;
+            statAdd(m_Stats.errors, 1);
+            continue;
+        }
         if (dropFirstNBuffer > 0 && (m_size_ch1 > 0 || m_size_ch2 > 0)) {
             m_size_ch1 = 0;
             m_size_ch2 = 0;
+            releaseBuffers();
             dropFirstNBuffer--;
             continue;
         }
         if (overFlow) {
             m_lostRate = 1;
-            ++passCounter;
+            statAdd(m_Stats.overflows, 1);
+            statAdd(m_Stats.lostSamples, m_BlockInfo.lostSamples);
+            m_MetricLostSamples->add(m_BlockInfo.lostSamples);
         }
 
 #endif
-        oscNotify(m_lostRate, m_oscRate, m_WriteBuffer_ch1, m_size_ch1, m_WriteBuffer_ch2, m_size_ch2);
-        m_lostRate = 0;
-        ++counter;
-
-        timeNow = std::chrono::system_clock::now();
-        curTime = std::chrono::time_point_cast<std::chrono::milliseconds >(timeNow);
-        value = curTime.time_since_epoch();
-
-          
-        if ((value.count() - timeBegin) >= 5000) {
-            std::cout << "Lost rate: " << passCounter << " / " << counter << " (" << (100. * static_cast<double>(passCounter) / counter) << " %)\n";
-            counter = 0;
-            passCounter = 0;
-            timeBegin = value.count();
+        size_t passed = m_size_ch1 + m_size_ch2;
+        {
+            CMetricTimer timer(m_MetricPass);
+            if (m_Segmenter)
+                passed = passSegments(m_size_ch1, m_size_ch2);
+            else
+                oscNotify(m_lostRate, m_oscRate * m_DecimationFactor, m_PassBuffer_ch1, m_size_ch1, m_PassBuffer_ch2, m_size_ch2, m_PassInfo);
         }
+        releaseBuffers();
+        m_lostRate = 0;
+        statAdd(m_Stats.blocks, 1);
+        statAdd(m_Stats.bytes, passed);
+        m_MetricBytes->add(passed);
 
         if (!m_StreamingManager->isFileThreadWork()){
             if (m_StreamingManager->notifyStop){
@@ -182,7 +320,9 @@ try{
             }
         }
 
+#ifdef DISABLE_OSC
         usleep(10);
+#endif
     }
     
 }catch (std::exception& e)
@@ -193,7 +333,7 @@ try{
 }
 
 
- bool CStreamingApplication::passCh(size_t &_size1, size_t &_size2){
+ bool CStreamingApplication::passCh(size_t &_size1, size_t &_size2, bool &_overFlow){
     
     uint8_t *buffer_ch1 = nullptr;
     uint8_t *buffer_ch2 = nullptr;
@@ -202,16 +342,55 @@ try{
     bool  overFlow1 = false;
     bool  overFlow2 = false;
     
-    success = m_Osc_ch->next(buffer_ch1, buffer_ch2, size , overFlow1 , overFlow2);
+    {
+        CMetricTimer timer(m_MetricDmaWait);
+        success = m_Osc_ch->next(buffer_ch1, buffer_ch2, size , overFlow1 , overFlow2, m_BlockInfo);
+    }
 
     if (!success) {
-        std::cerr << "Error: m_Osc->next()" << std::endl;
+        if (!m_Osc_ch->isInterrupted())
+            std::cerr << "Error: m_Osc->next()" << std::endl;
         return false;
     }
+    _overFlow = overFlow1 | overFlow2;
+    m_PassInfo = m_BlockInfo;
     // short *wb2 = (short*)buffer;
     // for(int i = 0 ;i < 40 /2 ;i ++)
     //     std::cout << std::hex <<  (static_cast<int>(wb2[i]) & 0xFFFF)  << " ";
     
+    if (m_ZeroCopy || (m_Segmenter && !m_Decimator_ch1)){
+        // The DMA buffer stays held until releaseBuffers() is called after the data was sent.
+        // The segmenter reads the 16 bit samples in place too.
+        _size1 = buffer_ch1 != nullptr ? size : 0;
+        _size2 = buffer_ch2 != nullptr ? size : 0;
+        m_PassBuffer_ch1 = buffer_ch1;
+        m_PassBuffer_ch2 = buffer_ch2;
+        m_DmaBufferHeld = true;
+        return true;
+    }
+
+    CMetricTimer timer(m_MetricCopy);
+    m_PassBuffer_ch1 = m_WriteBuffer_ch1;
+    m_PassBuffer_ch2 = m_WriteBuffer_ch2;
+
+    if (m_Decimator_ch1){
+        // The filter history is useless across a gap
+        if (m_BlockInfo.lostSamples > 0){
+            m_Decimator_ch1->reset();
+            m_Decimator_ch2->reset();
+        }
+        _size1 = buffer_ch1 != nullptr ? decimateCh(*m_Decimator_ch1, buffer_ch1, size, m_WriteBuffer_ch1) : 0;
+        _size2 = buffer_ch2 != nullptr ? decimateCh(*m_Decimator_ch2, buffer_ch2, size, m_WriteBuffer_ch2) : 0;
+
+        // Timeline in output samples, a partial gap counts as a whole lost sample
+        size_t samples = std::max(_size1, _size2) / (m_Segmenter ? 2 : m_Resolution / 8);
+        m_PassInfo.lostSamples = (m_BlockInfo.lostSamples + m_DecimationFactor - 1) / m_DecimationFactor;
+        m_PassInfo.sampleIndex = m_DecimatedIndex + m_PassInfo.lostSamples;
+        m_DecimatedIndex = m_PassInfo.sampleIndex + samples;
+        m_Osc_ch->changeBuffers();
+        return true;
+    }
+
     if (buffer_ch1 != nullptr){
         _size1 = size;
         switch (m_Resolution)
@@ -260,21 +439,96 @@ try{
     //      std::cout << (static_cast<int>(wb[_bufferIndex][i]) & 0xFF)  << " ";
     //   }
  	// exit(1);
-    return overFlow1 | overFlow2;
+    return true;
+}
+
+
+size_t CStreamingApplication::decimateCh(CDecimator &_decimator, const uint8_t *_buffer, size_t _size, void *_dst){
+    size_t samples = _decimator.process((const int16_t*)_buffer, _size / 2, (int16_t*)_dst);
+    // The segmenter takes 16 bit samples and narrows its output itself
+    if (m_Resolution == 8 && !m_Segmenter){
+        CDecimator::narrow8((int8_t*)_dst, (const int16_t*)_dst, samples);
+        return samples;
+    }
+    return samples * 2;
+}
+
+// Passes the segment parts of the 16 bit block to the streaming manager, in pieces of
+// at most one DMA buffer of samples. Returns the number of bytes passed.
+size_t CStreamingApplication::passSegments(size_t _size1, size_t _size2){
+    const size_t chunk = m_Osc_ch->getBufferSize() / 2;
+    const size_t sampleSize = m_Resolution / 8;
+    const uint32_t oscRate = m_oscRate * m_DecimationFactor;
+    const int16_t *ch1 = _size1 > 0 ? (const int16_t*)m_PassBuffer_ch1 : nullptr;
+    const int16_t *ch2 = _size2 > 0 ? (const int16_t*)m_PassBuffer_ch2 : nullptr;
+    uint64_t segments = m_Segmenter->getSegments();
+    size_t passed = 0;
+
+    m_Segmenter->process(ch1, ch2, std::max(_size1, _size2) / 2, m_PassInfo,
+                         [&](const int16_t *_ch1, const int16_t *_ch2, size_t _count, const BlockInfo &_info){
+        BlockInfo info = _info;
+        for (size_t offset = 0; offset < _count; offset += chunk){
+            size_t count = std::min(chunk, _count - offset);
+            const void *out1 = _ch1 ? _ch1 + offset : nullptr;
+            const void *out2 = _ch2 ? _ch2 + offset : nullptr;
+            if (m_Resolution == 8){
+                if (_ch1){
+                    CDecimator::narrow8(m_SegmentBuffer.data(), _ch1 + offset, count);
+                    out1 = m_SegmentBuffer.data();
+                }
+                if (_ch2){
+                    CDecimator::narrow8(m_SegmentBuffer.data() + chunk, _ch2 + offset, count);
+                    out2 = m_SegmentBuffer.data() + chunk;
+                }
+            }
+            size_t size1 = out1 ? count * sampleSize : 0;
+            size_t size2 = out2 ? count * sampleSize : 0;
+            oscNotify(info.lostSamples > 0 ? 1 : 0, oscRate, out1, size1, out2, size2, info);
+            passed += size1 + size2;
+            info.sampleIndex += count;
+            info.lostSamples = 0;
+        }
+    });
+
+    segments = m_Segmenter->getSegments() - segments;
+    statAdd(m_Stats.segments, segments);
+    m_MetricSegments->add(segments);
+    return passed;
 }
 
+void CStreamingApplication::releaseBuffers(){
+    if (m_DmaBufferHeld){
+        m_Osc_ch->changeBuffers();
+        m_DmaBufferHeld = false;
+    }
+}
 
-int CStreamingApplication::oscNotify(uint64_t _lostRate, uint32_t _oscRate,const void *_buffer_ch1, size_t _size_ch1,const void *_buffer_ch2, size_t _size_ch2)
+int CStreamingApplication::oscNotify(uint64_t _lostRate, uint32_t _oscRate,const void *_buffer_ch1, size_t _size_ch1,const void *_buffer_ch2, size_t _size_ch2, const BlockInfo &_info)
 {
-    return m_StreamingManager->passBuffers(_lostRate,_oscRate, _buffer_ch1,_size_ch1,_buffer_ch2,_size_ch2,m_Resolution, 0);
+    return m_StreamingManager->passBuffers(_lostRate,_oscRate, _buffer_ch1,_size_ch1,_buffer_ch2,_size_ch2,m_Resolution, 0, _info);
 }
 
 void CStreamingApplication::performanceCounterHandler(const asio::error_code &_error)
 {
     if (!_error)
     {
-        std::cout << "Bandwidth: " << m_BytesCount / (1024 * 1024 * m_PerformanceCounterPeriod) << " MiB/s\n";
-        m_BytesCount = 0;
+        uint64_t blocks = m_Stats.blocks.load(std::memory_order_relaxed);
+        uint64_t overflows = m_Stats.overflows.load(std::memory_order_relaxed);
+        uint64_t bytes = m_Stats.bytes.load(std::memory_order_relaxed);
+        uint64_t counter = blocks - m_LastStatBlocks;
+        uint64_t passCounter = overflows - m_LastStatOverflows;
+        std::cout << "Lost rate: " << passCounter << " / " << counter << " (" << (counter ? 100. * static_cast<double>(passCounter) / counter : 0.) << " %)\n";
+        std::cout << "Bandwidth: " << (bytes - m_LastStatBytes) / (1024 * 1024 * m_PerformanceCounterPeriod) << " MiB/s\n";
+        if (m_Segmenter)
+            std::cout << "Segments: " << m_Stats.segments.load(std::memory_order_relaxed) << "\n";
+        for (auto &client : m_StreamingManager->getClientStats()){
+            std::cout << "Client " << client.host << " v" << client.version << ": sent " << client.packs << " packs, "
+                      << client.bytes / (1024 * 1024) << " MiB, dropped " << client.dropped
+                      << ", queue " << client.queued << " (max " << client.queueMax << ")\n";
+        }
+        m_LastStatBlocks = blocks;
+        m_LastStatOverflows = overflows;
+        m_LastStatBytes = bytes;
 
         m_Timer.expires_from_now(std::chrono::seconds(m_PerformanceCounterPeriod));
         m_Timer.async_wait(std::bind(&CStreamingApplication::performanceCounterHandler, this, std::placeholders::_1));
@@ -5,6 +5,8 @@
 #include <functional>
 #include <cstdlib>
 #include "rpsa/server/core/StreamingManager.h"
+#include "rpsa/common/core/metrics.h"
+#include "rpsa/common/core/rice_codec.h"
 
 #ifdef _WIN32
 #include <dir.h>
@@ -52,7 +54,8 @@ std::string getNewFileName(Stream_FileType _fileType,string _filePath)
     time_t now = time(nullptr);
     timenow = gmtime(&now);
     strftime(time_str, sizeof(time_str), "%Y-%m-%d_%H-%M-%S", timenow);
-    std::string filename = _filePath  + "/" + std::string("data_file_") + time_str+"." + (_fileType == Stream_FileType::TDMS_TYPE ? "tdms":"wav");
+    const char *extension = _fileType == Stream_FileType::TDMS_TYPE ? "tdms" : (_fileType == Stream_FileType::BIN_TYPE ? "bin" : "wav");
+    std::string filename = _filePath  + "/" + std::string("data_file_") + time_str+"." + extension;
     return filename;
 }
 
@@ -75,7 +78,10 @@ CStreamingManager::CStreamingManager(Stream_FileType _fileType,std::string _file
     m_asionet(nullptr),
     m_filePath(_filePath),
     m_index_of_message(0),
-    notifyStop(nullptr)
+    notifyStop(nullptr),
+    m_udp_mtu(UDP_MTU_DEFAULT),
+    m_compression(StreamCompression::NONE),
+    m_compressionBackoff(0)
 {
     
     if (m_use_local_file){
@@ -100,7 +106,10 @@ CStreamingManager::CStreamingManager(string _host, string _port, asionet::Protoc
         m_asionet(nullptr),
         m_filePath(""),
         m_index_of_message(0),
-        notifyStop(nullptr)
+        notifyStop(nullptr),
+        m_udp_mtu(UDP_MTU_DEFAULT),
+        m_compression(StreamCompression::NONE),
+        m_compressionBackoff(0)
 {
 
 }
@@ -165,6 +174,35 @@ void CStreamingManager::stopServer(){
     }
 }
 
+void CStreamingManager::setUdpMtu(uint32_t _mtu){
+    m_udp_mtu = MIN(MAX(_mtu, UDP_MTU_MIN), UDP_MTU_MAX);
+}
+
+void CStreamingManager::setCompression(StreamCompression _mode){
+    m_compression = _mode;
+    m_compressionBackoff = 0;
+}
+
+void CStreamingManager::setFileRotation(const FileRotation &_rotation){
+    if (m_file_manager)
+        m_file_manager->SetRotation(_rotation);
+}
+
+void CStreamingManager::setBlockSize(size_t _size){
+    if (m_file_manager)
+        m_file_manager->SetBlockSize(_size);
+}
+
+std::vector<asionet::ClientStats> CStreamingManager::getClientStats(){
+    if (m_asionet)
+        return m_asionet->GetClientStats();
+    return std::vector<asionet::ClientStats>();
+}
+
+bool CStreamingManager::isLocalFile(){
+    return m_use_local_file;
+}
+
 bool CStreamingManager::isFileThreadWork(){
     if (m_use_local_file) {
         if (m_file_manager != nullptr) {
@@ -187,10 +225,12 @@ void CStreamingManager::run()
         this->startServer();
 }
 
-void CStreamingManager::stop(){
+void CStreamingManager::stop(bool _flush){
     if (m_use_local_file){
         if (m_file_manager != nullptr) {
-            m_file_manager->StopWrite(false);
+            m_file_manager->StopWrite(_flush);
+            if (m_fileLogger)
+                m_fileLogger->AddMetric(CFileLogger::Metric::FILESYSTEM_WRITE_SPEED,m_file_manager->GetWriteSpeed());
         }
     } else{
         this->stopServer();
@@ -198,42 +238,77 @@ void CStreamingManager::stop(){
 }
 
 
-int CStreamingManager::passBuffers(uint64_t _lostRate, uint32_t _oscRate, const void *_buffer_ch1, uint32_t _size_ch1,const void *_buffer_ch2, uint32_t _size_ch2, unsigned short _resolution, uint64_t _id){
+int CStreamingManager::passBuffers(uint64_t _lostRate, uint32_t _oscRate, const void *_buffer_ch1, uint32_t _size_ch1,const void *_buffer_ch2, uint32_t _size_ch2, unsigned short _resolution, uint64_t _id, const BlockInfo &_info){
 
     ASIO_ASSERT(!(_size_ch1 != _size_ch2 && _size_ch1 != 0 && _size_ch2 != 0));
     uint8_t *buff_ch1 = nullptr;
     uint8_t *buff_ch2 = nullptr;
 
     if (m_use_local_file){
-
-        if (_size_ch1>0){ 
-            buff_ch1 = new uint8_t[_size_ch1];
-            memcpy_neon(buff_ch1, _buffer_ch1, _size_ch1);
-        }
-
-        if (_size_ch2>0){ 
-            buff_ch2 = new uint8_t[_size_ch2];
-            memcpy_neon(buff_ch2, _buffer_ch2, _size_ch2);
-        }
+        static CMetricHistogram *metricBuild = CMetricsRegistry::instance().histogram("file.pack_build");
+        static CMetricGauge *metricQueue = CMetricsRegistry::instance().gauge("file.queue_depth");
+        static CMetricCounter *metricDropped = CMetricsRegistry::instance().counter("file.dropped_blocks");
 
         if (_size_ch1 + _size_ch2 > 0){
-            if (m_fileType == TDMS_TYPE){
-                auto stream_data = m_file_manager->BuildTDMSStream(buff_ch1, _size_ch1, buff_ch2, _size_ch2,_resolution);
-                if (!m_file_manager->AddBufferToWrite(stream_data))
-                {
-                    m_fileLogger->AddMetric(CFileLogger::Metric::FILESYSTEM_RATE,1);
+            // The block is taken from the writer queue before any copy, so a full queue costs nothing
+            bool newFile = false;
+            auto stream_data = m_file_manager->BeginBlock(&newFile);
+            if (stream_data == nullptr){
+                m_fileLogger->AddMetric(CFileLogger::Metric::FILESYSTEM_RATE,1);
+                metricDropped->add(1);
+            }else{
+                CMetricTimer timer(metricBuild);
+                double sampleRate = _oscRate > 0 ? (double)osc_adc_rate / _oscRate : 0;
+                // Every segment file gets its own header, the TDMS metadata is reset by the file manager
+                if (newFile)
+                    m_waveWriter->resetHeaderInit();
+                if (m_fileType == TDMS_TYPE){
+                    m_file_manager->BuildTDMSStream(stream_data, (const uint8_t*)_buffer_ch1, _size_ch1, (const uint8_t*)_buffer_ch2, _size_ch2,_resolution,sampleRate);
+                }
+
+                if (m_fileType == WAV_TYPE){
+                    m_waveWriter->BuildWAVStream(stream_data, (const uint8_t*)_buffer_ch1, _size_ch1, (const uint8_t*)_buffer_ch2, _size_ch2,_resolution,sampleRate);
                 }
-            }
 
+                if (m_fileType == BIN_TYPE){
+                    asionet::PackSource pack;
+                    pack.id = m_index_of_message++;
+                    pack.lostRate = _lostRate;
+                    pack.oscRate = _oscRate;
+                    pack.resolution = _resolution;
+                    pack.timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+                                         std::chrono::system_clock::now().time_since_epoch()).count();
+                    pack.info = _info;
+                    pack.ch1 = _buffer_ch1;
+                    pack.size_ch1 = _size_ch1;
+                    pack.ch2 = _buffer_ch2;
+                    pack.size_ch2 = _size_ch2;
+                    pack.packed_ch1 = nullptr;
+                    pack.packed_size_ch1 = 0;
+                    pack.packed_ch2 = nullptr;
+                    pack.packed_size_ch2 = 0;
+                    compressPacks(&pack, 1, _resolution, _oscRate, MAX(_size_ch1, _size_ch2) / (_resolution == 16 ? 2 : 1));
+
+                    uint8_t header[PACK_V2_HEADER_SIZE];
+                    bool packed = pack.packed_ch1 != nullptr || pack.packed_ch2 != nullptr;
+                    size_t header_size = asionet::CAsioNet::BuildPackHeader(header, packed ? asionet::PACK_FORMAT_V2_RICE : asionet::PACK_FORMAT_V2, pack);
+                    stream_data->write((const char*)header, header_size);
+                    if (packed){
+                        stream_data->write((const char*)pack.packed_ch1, pack.packed_ch1 ? pack.packed_size_ch1 : 0);
+                        stream_data->write((const char*)pack.packed_ch2, pack.packed_ch2 ? pack.packed_size_ch2 : 0);
+                    }else{
+                        stream_data->write((const char*)_buffer_ch1, _size_ch1);
+                        stream_data->write((const char*)_buffer_ch2, _size_ch2);
+                    }
+                }
 
-            if (m_fileType == WAV_TYPE){
-                auto stream_data = m_waveWriter->BuildWAVStream(buff_ch1, _size_ch1, buff_ch2, _size_ch2,_resolution);
-                if (!m_file_manager->AddBufferToWrite(stream_data))
+                if (!m_file_manager->CommitBlock())
                 {
                     m_fileLogger->AddMetric(CFileLogger::Metric::FILESYSTEM_RATE,1);
+                    metricDropped->add(1);
                 }
-                delete [] buff_ch1;
-                delete [] buff_ch2;
+                metricQueue->set(m_file_manager->queueSize());
+                m_fileLogger->AddMetric(CFileLogger::Metric::FILESYSTEM_QUEUE_MAX,m_file_manager->queueHighWaterMark());
             }
         
 
@@ -243,7 +318,8 @@ int CStreamingManager::passBuffers(uint64_t _lostRate, uint32_t _oscRate, const
             m_fileLogger->AddMetric(CFileLogger::Metric::RECIVE_DATA_CH2,_size_ch2);            
             m_fileLogger->AddMetric(CFileLogger::Metric::OSC_RATE_LOST,_lostRate);        
             m_fileLogger->AddMetric(CFileLogger::Metric::OSC_RATE,_oscRate);       
-            m_fileLogger->AddMetricId(_id);         
+            m_fileLogger->AddMetricId(_id);
+            m_fileLogger->AddBlockInfo(_info, MAX(_size_ch1, _size_ch2) / (_resolution == 16 ? 2 : 1));
         }
 
         if (notifyPassData)
@@ -252,44 +328,54 @@ int CStreamingManager::passBuffers(uint64_t _lostRate, uint32_t _oscRate, const
     }else{
         if (m_asionet){
             if (m_asionet->IsConnected()) {
-                int m_ReadyToPass = 0;
                 uint32_t frame_offset = 0;
                 uint32_t buffer_size = MAX(_size_ch1, _size_ch2);
-                uint32_t split_size = (m_asionet->GetProtocol() == asionet::Protocol::TCP ? TCP_BUFFER_LIMIT
-                                                                                          : UDP_BUFFER_LIMIT);
-                size_t full_send_size = 0;
+                uint32_t split_size = TCP_BUFFER_LIMIT;
+                if (m_asionet->GetProtocol() == asionet::Protocol::UDP) {
+                    // Header and the data of all channels have to fit into one datagram
+                    uint32_t channels = (_size_ch1 > 0 ? 1 : 0) + (_size_ch2 > 0 ? 1 : 0);
+                    split_size = ((m_udp_mtu - UDP_IP_HEADERS_SIZE - PACK_V2_HEADER_SIZE) / MAX(channels, 1u)) & ~7u;
+                }
                 buff_ch1 = (uint8_t *) _buffer_ch1;
                 buff_ch2 = (uint8_t *) _buffer_ch2;
-                uint32_t counter = 0;
-
-                while ((frame_offset + split_size) <= buffer_size) {
-                    if (frame_offset + split_size > buffer_size)
-                        split_size = buffer_size - frame_offset;
-
-                    size_t new_buff_size = 0;
-                    auto buffer = asionet::CAsioNet::BuildPack(m_index_of_message++, _lostRate, _oscRate,  _resolution,
-                                                               (&*buff_ch1 + frame_offset),
-                                                               (_size_ch1 == 0 ? 0 : split_size),
-                                                               (&*buff_ch2 + frame_offset),
-                                                               (_size_ch2 == 0 ? 0 : split_size),
-                                                               new_buff_size);
-
-                    ++m_ReadyToPass;
-                    if(m_ReadyToPass > 0)
-                        _lostRate = 0; // Send rate only first pack
-
-                    if (!m_asionet->SendData(false, buffer, new_buff_size)) {
-                        m_ReadyToPass--;
-                    }
-                    delete buffer;
-                    frame_offset += split_size;
-                    counter++;
+                uint64_t timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+                                         std::chrono::system_clock::now().time_since_epoch()).count();
+                BlockInfo info = _info;
+
+                m_packs.clear();
+                while (frame_offset < buffer_size) {
+                    uint32_t size = MIN(split_size, buffer_size - frame_offset);
+                    asionet::PackSource pack;
+                    pack.id = m_index_of_message++;
+                    pack.lostRate = (m_packs.empty() ? _lostRate : 0); // Send rate only first pack
+                    pack.oscRate = _oscRate;
+                    pack.resolution = _resolution;
+                    pack.timestamp = timestamp;
+                    pack.info = info;
+                    pack.size_ch1 = (_size_ch1 == 0 ? 0 : size);
+                    pack.size_ch2 = (_size_ch2 == 0 ? 0 : size);
+                    pack.ch1 = (pack.size_ch1 == 0 ? nullptr : buff_ch1 + frame_offset);
+                    pack.ch2 = (pack.size_ch2 == 0 ? nullptr : buff_ch2 + frame_offset);
+                    pack.packed_ch1 = nullptr;
+                    pack.packed_size_ch1 = 0;
+                    pack.packed_ch2 = nullptr;
+                    pack.packed_size_ch2 = 0;
+                    m_packs.push_back(pack);
+
+                    info.lostSamples = 0;
+                    info.sampleIndex += size / (_resolution == 16 ? 2 : 1);
+                    frame_offset += size;
                 }
 
-                if (m_ReadyToPass > 0)
-                    return 1;
-                else
-                    return 0;
+                // Encoding is skipped while no client can decode it
+                if (m_asionet->GetClientFlags() & PACK_FLAG_RICE)
+                    compressPacks(m_packs.data(), m_packs.size(), _resolution, _oscRate, buffer_size / (_resolution == 16 ? 2 : 1));
+
+                // Every client gets the packs in its own format. The data is copied only for TCP
+                // clients that can't take it at once, so the DMA buffer is free on return.
+                static CMetricHistogram *metricSend = CMetricsRegistry::instance().histogram("net.send");
+                CMetricTimer timer(metricSend);
+                return m_asionet->SendPacks(m_packs.data(), m_packs.size()) ? 1 : 0;
             }else{
                 return 0;
             }
@@ -302,3 +388,66 @@ int CStreamingManager::passBuffers(uint64_t _lostRate, uint32_t _oscRate, const
 
 
 
+
+// Encodes the channels of the packs into m_packed. A pack that doesn't get smaller stays raw.
+// The encoder runs on the acquisition thread, if it takes more than COMPRESSION_TIME_BUDGET
+// of the block duration the next COMPRESSION_BACKOFF_BLOCKS blocks go out raw, so a busy
+// CPU doesn't cost samples.
+void CStreamingManager::compressPacks(asionet::PackSource *_packs, size_t _count, unsigned short _resolution, uint32_t _oscRate, size_t _samples){
+    static CMetricHistogram *metricEncode = CMetricsRegistry::instance().histogram("compress.encode");
+    static CMetricCounter *metricRaw = CMetricsRegistry::instance().counter("compress.raw_bytes");
+    static CMetricCounter *metricPacked = CMetricsRegistry::instance().counter("compress.packed_bytes");
+    static CMetricCounter *metricFallback = CMetricsRegistry::instance().counter("compress.fallback_blocks");
+
+    if (m_compression == StreamCompression::NONE || _count == 0)
+        return;
+    if (m_compressionBackoff > 0){
+        m_compressionBackoff--;
+        metricFallback->add(1);
+        if (m_fileLogger)
+            m_fileLogger->AddMetric(CFileLogger::Metric::COMPRESSION_FALLBACK, 1);
+        return;
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < _count; i++)
+        total += _packs[i].size_ch1 + _packs[i].size_ch2;
+    // Resized before any pointer into it is taken
+    if (m_packed.size() < total)
+        m_packed.resize(total);
+
+    auto start = std::chrono::steady_clock::now();
+    const size_t sampleSize = _resolution == 16 ? 2 : 1;
+    uint8_t *dst = m_packed.data();
+    size_t packedBytes = 0;
+    for (size_t i = 0; i < _count; i++){
+        asionet::PackSource &pack = _packs[i];
+        size_t samples = MAX(pack.size_ch1, pack.size_ch2) / sampleSize;
+        size_t size_ch1 = pack.size_ch1 > 0 ? rice_encode(dst, pack.size_ch1, pack.ch1, samples, _resolution) : 0;
+        size_t size_ch2 = pack.size_ch2 > 0 ? rice_encode(dst + size_ch1, pack.size_ch2, pack.ch2, samples, _resolution) : 0;
+        if ((pack.size_ch1 > 0 && size_ch1 == 0) || (pack.size_ch2 > 0 && size_ch2 == 0)){
+            packedBytes += pack.size_ch1 + pack.size_ch2;
+            continue;
+        }
+        pack.packed_ch1 = size_ch1 > 0 ? dst : nullptr;
+        pack.packed_size_ch1 = size_ch1;
+        pack.packed_ch2 = size_ch2 > 0 ? dst + size_ch1 : nullptr;
+        pack.packed_size_ch2 = size_ch2;
+        dst += size_ch1 + size_ch2;
+        packedBytes += size_ch1 + size_ch2;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    metricEncode->recordSince(start);
+    metricRaw->add(total);
+    metricPacked->add(packedBytes);
+    if (m_fileLogger){
+        m_fileLogger->AddMetric(CFileLogger::Metric::COMPRESSION_RAW_BYTES, total);
+        m_fileLogger->AddMetric(CFileLogger::Metric::COMPRESSION_PACKED_BYTES, packedBytes);
+    }
+
+    if (_oscRate > 0){
+        double blockTime = (double)_samples * _oscRate / osc_adc_rate;
+        if (std::chrono::duration<double>(elapsed).count() > blockTime * COMPRESSION_TIME_BUDGET)
+            m_compressionBackoff = COMPRESSION_BACKOFF_BLOCKS;
+    }
+}
@@ -0,0 +1,262 @@
+#include <cmath>
+#include <iostream>
+#include "rpsa/server/core/SyntheticOscilloscope.h"
+
+#define SINE_TABLE_BITS 12
+#define SYNTHETIC_FREQUENCY 1000.0  // default signal frequency, Hz
+#define SYNTHETIC_AMPLITUDE 8000    // default amplitude, close to the 14 bit ADC full scale
+
+CSyntheticOscilloscope::Ptr CSyntheticOscilloscope::Create(bool _channel1Enable, bool _channel2Enable, double _sampleRate, SyntheticWaveform _waveform,
+                                                           uint32_t _dmaBufferSize, uint32_t _dmaBufferCount)
+{
+    if (_dmaBufferSize == 0 || (_dmaBufferSize % osc_buf_align) != 0)
+    {
+        std::cerr << "Error: DMA buffer size must be a multiple of " << osc_buf_align << "." << std::endl;
+        return Ptr();
+    }
+
+    if (_dmaBufferCount < osc_buf_min_count)
+    {
+        std::cerr << "Error: at least " << osc_buf_min_count << " DMA buffers are needed." << std::endl;
+        return Ptr();
+    }
+
+    if (_sampleRate < 0)
+    {
+        std::cerr << "Error: negative sample rate." << std::endl;
+        return Ptr();
+    }
+
+    return std::make_shared<CSyntheticOscilloscope>(_channel1Enable, _channel2Enable, _sampleRate, _waveform, _dmaBufferSize, _dmaBufferCount);
+}
+
+CSyntheticOscilloscope::CSyntheticOscilloscope(bool _channel1Enable, bool _channel2Enable, double _sampleRate, SyntheticWaveform _waveform,
+                                               uint32_t _dmaBufferSize, uint32_t _dmaBufferCount) :
+    m_Channel1(_channel1Enable),
+    m_Channel2(_channel2Enable),
+    m_SampleRate(_sampleRate),
+    m_Waveform(_waveform),
+    m_Frequency(SYNTHETIC_FREQUENCY),
+    m_Amplitude(SYNTHETIC_AMPLITUDE),
+    m_OverflowPeriod(0),
+    m_DmaBufferSize(_dmaBufferSize),
+    m_DmaBufferCount(_dmaBufferCount),
+    m_Buffer1(),
+    m_Buffer2(),
+    m_SineTable(),
+    m_DmaSequence(0),
+    m_Interrupted(false),
+    m_GeneratorRun(false),
+    m_GeneratorThread(),
+    m_IrqThreadPriority(0),
+    m_IrqThreadCpu(-1),
+    m_Current(),
+    m_HasCurrent(false)
+{
+    size_t samples = static_cast<size_t>(m_DmaBufferSize) / sizeof(int16_t) * m_DmaBufferCount;
+    if (m_Channel1)
+        m_Buffer1.resize(samples);
+    if (m_Channel2)
+        m_Buffer2.resize(samples);
+}
+
+CSyntheticOscilloscope::~CSyntheticOscilloscope()
+{
+    stop();
+}
+
+void CSyntheticOscilloscope::setSignal(double _frequency, int16_t _amplitude){
+    m_Frequency = _frequency;
+    m_Amplitude = _amplitude;
+}
+
+void CSyntheticOscilloscope::setOverflowPeriod(uint32_t _period){
+    m_OverflowPeriod = _period;
+}
+
+void CSyntheticOscilloscope::setIrqThreadOptions(int _priority, int _cpu){
+    m_IrqThreadPriority = _priority;
+    m_IrqThreadCpu = _cpu;
+}
+
+void CSyntheticOscilloscope::prepare()
+{
+    stop();
+
+    m_SineTable.resize(1 << SINE_TABLE_BITS);
+    for (size_t i = 0; i < m_SineTable.size(); i++){
+        m_SineTable[i] = static_cast<int16_t>(std::lround(m_Amplitude * std::sin(2 * M_PI * i / m_SineTable.size())));
+    }
+
+    m_Free.clear();
+    for (unsigned i = m_DmaBufferCount; i > 0; i--)
+        m_Free.push_back(i - 1);
+    m_Ready.clear();
+    m_HasCurrent = false;
+    m_DmaSequence = 0;
+
+    m_GeneratorRun = true;
+    m_GeneratorThread = std::thread(&CSyntheticOscilloscope::generatorWorker, this);
+}
+
+void CSyntheticOscilloscope::stop()
+{
+    if (!m_GeneratorThread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_RingMutex);
+        m_GeneratorRun = false;
+    }
+    m_RingCond.notify_all();
+    m_GeneratorThread.join();
+}
+
+bool CSyntheticOscilloscope::waitPeriod(std::chrono::steady_clock::time_point _time){
+    std::unique_lock<std::mutex> lock(m_RingMutex);
+    m_RingCond.wait_until(lock, _time, [this]{ return !m_GeneratorRun; });
+    return m_GeneratorRun;
+}
+
+void CSyntheticOscilloscope::fill(unsigned _index, uint64_t _sampleIndex){
+    size_t samples = m_DmaBufferSize / sizeof(int16_t);
+    int16_t *ch1 = m_Channel1 ? m_Buffer1.data() + samples * _index : nullptr;
+    int16_t *ch2 = m_Channel2 ? m_Buffer2.data() + samples * _index : nullptr;
+
+    if (m_Waveform == SyntheticWaveform::COUNTER){
+        for (size_t i = 0; i < samples; i++){
+            uint16_t value = static_cast<uint16_t>(_sampleIndex + i);
+            if (ch1) ch1[i] = static_cast<int16_t>(value);
+            if (ch2) ch2[i] = static_cast<int16_t>(~value);
+        }
+        return;
+    }
+
+    // Phase accumulator over 2^32, computed from the sample index so every block is reproducible
+    double rate = m_SampleRate > 0 ? m_SampleRate : osc_adc_rate;
+    uint32_t step = static_cast<uint32_t>(std::llround(m_Frequency / rate * 4294967296.0));
+    uint32_t phase = static_cast<uint32_t>(_sampleIndex * step);
+
+    if (m_Waveform == SyntheticWaveform::SINE){
+        for (size_t i = 0; i < samples; i++, phase += step){
+            if (ch1) ch1[i] = m_SineTable[phase >> (32 - SINE_TABLE_BITS)];
+            if (ch2) ch2[i] = m_SineTable[(phase + 0x40000000u) >> (32 - SINE_TABLE_BITS)];
+        }
+    }else{
+        for (size_t i = 0; i < samples; i++, phase += step){
+            if (ch1) ch1[i] = static_cast<int16_t>(((static_cast<int32_t>(phase >> 16) - 32768) * m_Amplitude) >> 15);
+            if (ch2) ch2[i] = static_cast<int16_t>(((static_cast<int32_t>((phase + 0x80000000u) >> 16) - 32768) * m_Amplitude) >> 15);
+        }
+    }
+}
+
+void CSyntheticOscilloscope::generatorWorker()
+{
+    applyThreadOptions(m_IrqThreadPriority, m_IrqThreadCpu);
+
+    uint64_t samples = m_DmaBufferSize / sizeof(int16_t);
+    uint64_t sampleIndex = 0;
+    uint64_t lostSamples = 0;
+    uint64_t period = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    while (m_GeneratorRun){
+        period++;
+        // The buffer is complete at the end of its period, like the DMA half-switch interrupt
+        if (m_SampleRate > 0){
+            auto due = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                   std::chrono::duration<double>(period * samples / m_SampleRate));
+            if (!waitPeriod(due))
+                break;
+        }
+
+        bool forced = m_OverflowPeriod > 0 && period % m_OverflowPeriod == 0;
+        unsigned index = 0;
+        {
+            std::unique_lock<std::mutex> lock(m_RingMutex);
+            if (m_SampleRate <= 0 && !forced){
+                m_RingCond.wait(lock, [this]{ return !m_Free.empty() || !m_GeneratorRun; });
+                if (!m_GeneratorRun)
+                    break;
+            }
+            if (forced || m_Free.empty()){
+                // Nowhere to write, the whole period is lost
+                m_DmaSequence++;
+                lostSamples += samples;
+                sampleIndex += samples;
+                continue;
+            }
+            index = m_Free.back();
+            m_Free.pop_back();
+        }
+
+        fill(index, sampleIndex);
+
+        DmaSlot slot;
+        slot.index = index;
+        slot.overFlow = lostSamples > 0;
+        slot.info = BlockInfo();
+        slot.info.dmaSequence = ++m_DmaSequence;
+        slot.info.sampleIndex = sampleIndex;
+        slot.info.lostSamples = lostSamples;
+        sampleIndex += samples;
+        lostSamples = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_RingMutex);
+            m_Ready.push_back(slot);
+        }
+        m_RingCond.notify_all();
+    }
+    m_RingCond.notify_all();
+}
+
+bool CSyntheticOscilloscope::next(uint8_t *&_buffer1,uint8_t *&_buffer2, size_t &_size,bool &_overFlow1 , bool &_overFlow2, BlockInfo &_info)
+{
+    std::unique_lock<std::mutex> lock(m_RingMutex);
+    m_RingCond.wait(lock, [this]{ return !m_Ready.empty() || m_Interrupted || !m_GeneratorRun; });
+
+    if (m_Interrupted || m_Ready.empty()){
+        _size = 0;
+        return false;
+    }
+
+    m_Current = m_Ready.front();
+    m_Ready.pop_front();
+    m_HasCurrent = true;
+
+    size_t offset = static_cast<size_t>(m_DmaBufferSize / sizeof(int16_t)) * m_Current.index;
+    _buffer1 = m_Channel1 ? reinterpret_cast<uint8_t*>(m_Buffer1.data() + offset) : nullptr;
+    _buffer2 = m_Channel2 ? reinterpret_cast<uint8_t*>(m_Buffer2.data() + offset) : nullptr;
+    _overFlow1 = m_Current.overFlow;
+    _overFlow2 = m_Current.overFlow;
+    _info = m_Current.info;
+    _size = (m_Channel1 || m_Channel2) ? m_DmaBufferSize : 0;
+    return true;
+}
+
+bool CSyntheticOscilloscope::changeBuffers(){
+    {
+        std::lock_guard<std::mutex> lock(m_RingMutex);
+        if (!m_HasCurrent)
+            return false;
+        m_HasCurrent = false;
+        m_Free.push_back(m_Current.index);
+    }
+    m_RingCond.notify_all();
+    return true;
+}
+
+void CSyntheticOscilloscope::interrupt(){
+    {
+        std::lock_guard<std::mutex> lock(m_RingMutex);
+        m_Interrupted = true;
+    }
+    m_RingCond.notify_all();
+}
+
+void CSyntheticOscilloscope::clearInterrupt(){
+    m_Interrupted = false;
+}
+
+bool CSyntheticOscilloscope::isInterrupted(){
+    return m_Interrupted;
+}
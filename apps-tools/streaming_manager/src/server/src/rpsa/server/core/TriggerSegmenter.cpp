@@ -0,0 +1,201 @@
+#include <algorithm>
+#include "rpsa/server/core/TriggerSegmenter.h"
+
+#ifdef ARCH_ARM
+#include <arm_neon.h>
+#endif
+
+size_t trigger_find_above_scalar(const int16_t *_x, size_t _count, int16_t _level){
+    for (size_t i = 0; i < _count; i++)
+        if (_x[i] >= _level)
+            return i;
+    return _count;
+}
+
+size_t trigger_find_below_scalar(const int16_t *_x, size_t _count, int16_t _level){
+    for (size_t i = 0; i < _count; i++)
+        if (_x[i] <= _level)
+            return i;
+    return _count;
+}
+
+#ifdef ARCH_ARM
+
+// 16 samples are compared per step, the exact index is then found by the scalar loop
+size_t trigger_find_above_neon(const int16_t *_x, size_t _count, int16_t _level){
+    const int16x8_t level = vdupq_n_s16(_level);
+    size_t i = 0;
+    for (; i + 16 <= _count; i += 16){
+        uint16x8_t a = vcgeq_s16(vld1q_s16(_x + i), level);
+        uint16x8_t b = vcgeq_s16(vld1q_s16(_x + i + 8), level);
+        uint8x8_t hit = vmovn_u16(vorrq_u16(a, b));
+        if (vget_lane_u64(vreinterpret_u64_u8(hit), 0) != 0)
+            break;
+    }
+    return i + trigger_find_above_scalar(_x + i, _count - i, _level);
+}
+
+size_t trigger_find_below_neon(const int16_t *_x, size_t _count, int16_t _level){
+    const int16x8_t level = vdupq_n_s16(_level);
+    size_t i = 0;
+    for (; i + 16 <= _count; i += 16){
+        uint16x8_t a = vcleq_s16(vld1q_s16(_x + i), level);
+        uint16x8_t b = vcleq_s16(vld1q_s16(_x + i + 8), level);
+        uint8x8_t hit = vmovn_u16(vorrq_u16(a, b));
+        if (vget_lane_u64(vreinterpret_u64_u8(hit), 0) != 0)
+            break;
+    }
+    return i + trigger_find_below_scalar(_x + i, _count - i, _level);
+}
+
+#endif // ARCH_ARM
+
+static inline size_t findAbove(const int16_t *_x, size_t _count, int16_t _level){
+#ifdef ARCH_ARM
+    return trigger_find_above_neon(_x, _count, _level);
+#else
+    return trigger_find_above_scalar(_x, _count, _level);
+#endif
+}
+
+static inline size_t findBelow(const int16_t *_x, size_t _count, int16_t _level){
+#ifdef ARCH_ARM
+    return trigger_find_below_neon(_x, _count, _level);
+#else
+    return trigger_find_below_scalar(_x, _count, _level);
+#endif
+}
+
+static inline int32_t armLevel(const TriggerSettings &_settings){
+    return _settings.edge == TriggerEdge::RISING ? (int32_t)_settings.level - _settings.hysteresis - 1
+                                                 : (int32_t)_settings.level + _settings.hysteresis + 1;
+}
+
+CTriggerSegmenter::Ptr CTriggerSegmenter::Create(const TriggerSettings &_settings){
+    if (_settings.source == TriggerSource::NONE)
+        return nullptr;
+    if (_settings.preSamples > TRIGGER_MAX_PRE_SAMPLES || _settings.postSamples < 1 || _settings.postSamples > TRIGGER_MAX_POST_SAMPLES)
+        return nullptr;
+    int32_t arm = armLevel(_settings);
+    if (arm < INT16_MIN || arm > INT16_MAX)
+        return nullptr;
+    return std::make_shared<CTriggerSegmenter>(_settings);
+}
+
+CTriggerSegmenter::CTriggerSegmenter(const TriggerSettings &_settings):
+    m_settings(_settings),
+    m_armLevel(static_cast<int16_t>(armLevel(_settings))),
+    m_armed(false),
+    m_historyCount(0),
+    m_historyDmaSequence(0),
+    m_open(false),
+    m_segment(0),
+    m_segmentStart(0),
+    m_segmentEnd(0),
+    m_triggerIndex(0),
+    m_passedEnd(0)
+{
+    m_history[0].assign(m_settings.preSamples, 0);
+    m_history[1].assign(m_settings.preSamples, 0);
+}
+
+void CTriggerSegmenter::reset(){
+    m_armed = false;
+    m_historyCount = 0;
+    m_historyDmaSequence = 0;
+    m_open = false;
+    m_segment = 0;
+    m_passedEnd = 0;
+}
+
+// Arming and firing are two threshold searches, so the whole scan runs in the vector kernels
+size_t CTriggerSegmenter::detect(const int16_t *_x, size_t _count){
+    const bool rising = m_settings.edge == TriggerEdge::RISING;
+    size_t pos = 0;
+    while (pos < _count){
+        if (!m_armed){
+            pos += rising ? findBelow(_x + pos, _count - pos, m_armLevel) : findAbove(_x + pos, _count - pos, m_armLevel);
+            if (pos >= _count)
+                break;
+            m_armed = true;
+        }
+        pos += rising ? findAbove(_x + pos, _count - pos, m_settings.level) : findBelow(_x + pos, _count - pos, m_settings.level);
+        if (pos < _count){
+            m_armed = false;
+            return pos;
+        }
+    }
+    return _count;
+}
+
+void CTriggerSegmenter::process(const int16_t *_ch1, const int16_t *_ch2, size_t _count, const BlockInfo &_info, const Callback &_callback){
+    const int16_t *source = m_settings.source == TriggerSource::CHANNEL1 ? _ch1 : _ch2;
+    const uint64_t start = _info.sampleIndex;
+    if (_info.lostSamples > 0){
+        // Neither the history nor the detector state reach across a gap
+        m_historyCount = 0;
+        m_armed = false;
+    }
+
+    size_t pos = 0;
+    while (pos < _count){
+        if (!m_open){
+            size_t trigger = source ? pos + detect(source + pos, _count - pos) : _count;
+            if (trigger >= _count)
+                break;
+            uint64_t index = start + trigger;
+            uint64_t first = index - std::min<uint64_t>(index, m_settings.preSamples);
+            first = std::max(first, std::max(m_passedEnd, start - m_historyCount));
+            m_segment++;
+            m_open = true;
+            m_segmentStart = first;
+            m_segmentEnd = index + m_settings.postSamples;
+            m_triggerIndex = index;
+            if (first < start){
+                size_t count = static_cast<size_t>(start - first);
+                size_t offset = m_historyCount - count;
+                BlockInfo info = {m_historyDmaSequence, first, 0, m_segment, index};
+                _callback(_ch1 ? m_history[0].data() + offset : nullptr, _ch2 ? m_history[1].data() + offset : nullptr, count, info);
+                m_passedEnd = start;
+            }
+            pos = static_cast<size_t>(std::max(first, start) - start);
+            continue;
+        }
+
+        // A gap may have gone past the end of the segment
+        if (m_segmentEnd <= start + pos){
+            m_open = false;
+            continue;
+        }
+        size_t end = static_cast<size_t>(std::min<uint64_t>(_count, m_segmentEnd - start));
+        BlockInfo info = {_info.dmaSequence, start + pos, 0, m_segment, m_triggerIndex};
+        if (pos == 0 && _info.lostSamples > 0)
+            info.lostSamples = start - std::max(start - _info.lostSamples, m_segmentStart);
+        _callback(_ch1 ? _ch1 + pos : nullptr, _ch2 ? _ch2 + pos : nullptr, end - pos, info);
+        m_passedEnd = start + end;
+        pos = end;
+        if (m_passedEnd >= m_segmentEnd)
+            m_open = false;
+    }
+
+    keepHistory(_ch1, _ch2, _count);
+    m_historyDmaSequence = _info.dmaSequence;
+}
+
+void CTriggerSegmenter::keepHistory(const int16_t *_ch1, const int16_t *_ch2, size_t _count){
+    const size_t pre = m_settings.preSamples;
+    if (pre == 0)
+        return;
+    size_t take = std::min(_count, pre);
+    size_t keep = std::min(m_historyCount, pre - take);
+    const int16_t *channels[2] = {_ch1, _ch2};
+    for (int c = 0; c < 2; c++){
+        if (channels[c] == nullptr)
+            continue;
+        auto &history = m_history[c];
+        // Moves to the front, so the overlapping copy is safe
+        std::copy(history.begin() + (m_historyCount - keep), history.begin() + m_historyCount, history.begin());
+        std::copy(channels[c] + _count - take, channels[c] + _count, history.begin() + keep);
+    }
+    m_historyCount = keep + take;
+}
@@ -0,0 +1,494 @@
+#include <iostream>
+#include <string>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "rpsa/server/core/UioOscilloscope.h"
+#include <stdio.h>
+#include <string.h>
+
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <cstdlib>
+
+namespace
+{
+//!
+//!@brief Map register using UIO.
+//!
+//!@param _fd File descriptor.
+//!@param _size The register map size.
+//!@param _number The register map number.
+//!@return The memory map pointer.
+//!
+void * MmapNumber(int _fd, size_t _size, size_t _number) {
+    const size_t offset = _number * getpagesize();
+    return mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, offset);
+}
+}
+
+COscilloscope::Ptr COscilloscope::Create(const UioT &_uio, bool _channel1Enable, bool _channel2Enable,uint32_t _dec_factor,uint32_t _dmaBufferSize,uint32_t _dmaBufferCount)
+{
+    return CUioOscilloscope::Create(_uio, _channel1Enable, _channel2Enable, _dec_factor, _dmaBufferSize, _dmaBufferCount);
+}
+
+CUioOscilloscope::Ptr CUioOscilloscope::Create(const UioT &_uio, bool _channel1Enable, bool _channel2Enable,uint32_t _dec_factor,uint32_t _dmaBufferSize,uint32_t _dmaBufferCount)
+{
+    // Validation
+    if (_uio.mapList.size() < 2)
+    {
+        // Error: validation.
+        std::cerr << "Error: UIO validation." << std::endl;
+        return Ptr();
+    }
+
+    if (_dmaBufferSize == 0 || (_dmaBufferSize % osc_buf_align) != 0)
+    {
+        // Error: buffer size.
+        std::cerr << "Error: DMA buffer size must be a multiple of " << osc_buf_align << "." << std::endl;
+        return Ptr();
+    }
+
+    // Both channels have their own set of buffers
+    uintptr_t maxCount = _uio.mapList[1].size / (static_cast<uintptr_t>(_dmaBufferSize) * 2);
+    if (_dmaBufferCount == 0)
+        _dmaBufferCount = static_cast<uint32_t>(maxCount);
+
+    if (_dmaBufferCount < osc_buf_min_count || _dmaBufferCount > maxCount)
+    {
+        // Error: buffer size.
+        std::cerr << "Error: buffer size. " << _dmaBufferCount << " DMA buffers of " << _dmaBufferSize
+                  << " bytes don't fit into " << _uio.mapList[1].size << " bytes." << std::endl;
+        return Ptr();
+    }
+
+    // Open file
+    std::string path("/dev/" + _uio.name);
+    int fd = open(path.c_str(), O_RDWR);
+
+    if (fd == -1)
+    {
+        // Error: open file.
+        std::cerr << "Error: open file." << std::endl;
+        return Ptr();
+    }
+
+    // Map
+    void *regset = MmapNumber(fd, _uio.mapList[0].size, 0);
+
+    if (regset == MAP_FAILED)
+    {
+        // Error: mmap
+        std::cerr << "Error: mmap regset." << std::endl;
+        close(fd);
+        return Ptr();
+    }
+
+    void *buffer = MmapNumber(fd, _uio.mapList[1].size, 1);
+
+    if (buffer == MAP_FAILED)
+    {
+        // Error: mmap
+        std::cerr << "Error: mmap buffer." << std::endl;
+        munmap(regset, _uio.mapList[0].size);
+        close(fd);
+        return Ptr();
+    }
+
+   
+    return std::make_shared<CUioOscilloscope>(_channel1Enable,_channel2Enable, fd, regset, _uio.mapList[0].size, buffer, _uio.mapList[1].size, _uio.mapList[1].addr,_dec_factor,_dmaBufferSize,_dmaBufferCount);
+}
+
+CUioOscilloscope::CUioOscilloscope(bool _channel1Enable, bool _channel2Enable, int _fd, void *_regset, size_t _regsetSize, void *_buffer, size_t _bufferSize, uintptr_t _bufferPhysAddr,uint32_t _dec_factor,uint32_t _dmaBufferSize,uint32_t _dmaBufferCount) :
+    m_Channel1(_channel1Enable),
+    m_Channel2(_channel2Enable),
+    m_Fd(_fd),
+    m_Regset(_regset),
+    m_RegsetSize(_regsetSize),
+    m_Buffer(_buffer),
+    m_BufferSize(_bufferSize),
+    m_BufferPhysAddr(_bufferPhysAddr),
+    m_OscMap1(nullptr),
+    m_OscMap2(nullptr),
+    m_OscBuffer1(nullptr),
+    m_OscBuffer2(nullptr),
+    m_dec_factor(_dec_factor),
+    m_DmaBufferSize(_dmaBufferSize),
+    m_DmaBufferCount(_dmaBufferCount < osc_buf_min_count ? osc_buf_min_count : _dmaBufferCount),
+    m_DmaSequence(0),
+    m_SampleCounter(0),
+    m_StopFd(-1),
+    m_Interrupted(false),
+    m_IrqThreadRun(false),
+    m_IrqThread(),
+    m_IrqThreadPriority(0),
+    m_IrqThreadCpu(-1),
+    m_Current(),
+    m_HasCurrent(false)
+{
+    m_HalfBuffer[0] = 0;
+    m_HalfBuffer[1] = 1;
+    m_StopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_StopFd == -1){
+        std::cerr << "Error: COscilloscope can't create eventfd, stop waits for the next interrupt" << std::endl;
+    }
+
+    uintptr_t oscMap = reinterpret_cast<uintptr_t>(m_Regset) +  osc0_baseaddr ;
+    m_OscMap1 = reinterpret_cast<OscilloscopeMapT *>(oscMap);
+    m_OscBuffer1 = static_cast<uint8_t *>(m_Buffer);
+    
+    oscMap = reinterpret_cast<uintptr_t>(m_Regset) + osc1_baseaddr;
+    m_OscMap2 = reinterpret_cast<OscilloscopeMapT *>(oscMap);
+    m_OscBuffer2 = static_cast<uint8_t *>(m_Buffer) + static_cast<size_t>(m_DmaBufferSize) * m_DmaBufferCount;
+    
+}
+
+CUioOscilloscope::~CUioOscilloscope()
+{
+    stopIrqThread();
+    munmap(m_Regset, m_RegsetSize);
+    munmap(m_Buffer, m_BufferSize);
+    close(m_Fd);
+    if (m_StopFd != -1)
+        close(m_StopFd);
+}
+
+void CUioOscilloscope::setReg(volatile OscilloscopeMapT *_OscMap,unsigned int _Channel){
+        // Buffer
+        _OscMap->dma_buf_size = m_DmaBufferSize;
+        _OscMap->dma_dst_addr1 = bufferPhysAddr(_Channel, m_HalfBuffer[0]);
+        _OscMap->dma_dst_addr2 = bufferPhysAddr(_Channel, m_HalfBuffer[1]);
+        // Filter bypass
+
+       // if (_Channel == 0) 
+        {
+            _OscMap->filt_bypass = UINT32_C(0x00000001);
+
+            
+            // Event
+            _OscMap->event_sel =  osc0_event_id ;
+
+            // Trigger mask
+            _OscMap->trig_mask = UINT32_C(0x00000004);
+
+            // Trigger low level
+            _OscMap->trig_low_level = -4;
+
+            // Trigger high level
+            _OscMap->trig_high_level = 4;
+
+            // Trigger edge
+            _OscMap->trig_edge = UINT32_C(0x00000000);
+
+            // Trigger pre samples
+            _OscMap->trig_pre_samp = m_DmaBufferSize / 4;
+
+            // Trigger post samples
+            _OscMap->trig_post_samp = (m_DmaBufferSize / 4) * 3;
+
+            // Decimate factor
+            _OscMap->dec_factor = m_dec_factor;
+
+            // DMA start
+            //_OscMap->dma_ctrl = (_Channel == 0) ? UINT32_C(0x00000211) : UINT32_C(0x00000200);
+
+        }
+
+        
+}
+
+uintptr_t CUioOscilloscope::bufferPhysAddr(unsigned _channel, unsigned _index){
+    return m_BufferPhysAddr + static_cast<uintptr_t>(m_DmaBufferSize) * (_channel * m_DmaBufferCount + _index);
+}
+
+void CUioOscilloscope::prepare()
+{
+    stop();
+
+    m_HalfBuffer[0] = 0;
+    m_HalfBuffer[1] = 1;
+    m_Free.clear();
+    for (unsigned i = m_DmaBufferCount - 1; i >= 2; i--)
+        m_Free.push_back(i);
+    m_Ready.clear();
+    m_HasCurrent = false;
+
+    // Second channel must init first if present. First channel start both channels synchronously
+
+    if (m_OscMap2 != nullptr){
+        setReg(m_OscMap2,1);
+    }else{
+        std::cerr << "Error: CUioOscilloscope::prepare() can't init second channel" << std::endl;
+        exit(-1);
+    }
+
+    if (m_OscMap1 != nullptr){
+        setReg(m_OscMap1,0);
+    }else{
+        std::cerr << "Error: CUioOscilloscope::prepare()  can't init first channel" << std::endl;
+        exit(-1);
+    }
+    
+    m_DmaSequence = 0;
+    m_SampleCounter = 0;
+    m_OscMap1->dma_ctrl  = 0xC;
+    m_OscMap2->dma_ctrl  = 0xC;
+    
+    m_OscMap1->dma_ctrl = UINT32_C(0x00000201);
+    m_OscMap2->dma_ctrl = UINT32_C(0x00000201);
+
+    m_OscMap1->event_sts = UINT32_C(0x00000001);
+    m_OscMap1->event_sts = UINT32_C(0x00000002);
+    m_OscMap2->event_sts = UINT32_C(0x00000001);
+    m_OscMap2->event_sts = UINT32_C(0x00000002);
+
+    m_IrqThreadRun = true;
+    m_IrqThread = std::thread(&CUioOscilloscope::irqWorker, this);
+}
+
+bool CUioOscilloscope::next(uint8_t *&_buffer1,uint8_t *&_buffer2, size_t &_size,bool &_overFlow1 , bool &_overFlow2, BlockInfo &_info)
+{
+    std::unique_lock<std::mutex> lock(m_RingMutex);
+    m_RingCond.wait(lock, [this]{ return !m_Ready.empty() || m_Interrupted || !m_IrqThreadRun; });
+
+    if (m_Interrupted || m_Ready.empty()){
+        _size = 0;
+        return false;
+    }
+
+    m_Current = m_Ready.front();
+    m_Ready.pop_front();
+    m_HasCurrent = true;
+
+    size_t offset = static_cast<size_t>(m_DmaBufferSize) * m_Current.index;
+    _buffer1 = m_Channel1 ? (m_OscBuffer1 + offset) : nullptr;
+    _buffer2 = m_Channel2 ? (m_OscBuffer2 + offset) : nullptr;
+    _overFlow1 = m_Current.overFlow1;
+    _overFlow2 = m_Current.overFlow2;
+    _info = m_Current.info;
+
+    if (m_Channel1 || m_Channel2){
+        _size = m_DmaBufferSize;
+    }else {
+        _size = 0;
+    }
+    return true;
+}
+
+bool CUioOscilloscope::serviceInterrupt()
+{
+    // Enable interrupt
+    int32_t cnt = 1;
+    constexpr size_t cnt_size = sizeof(cnt);
+    ssize_t bytes = write(m_Fd, &cnt, cnt_size);
+
+    if (bytes != cnt_size || !waitInterrupt())
+        return false;
+
+    bytes = read(m_Fd, &cnt, cnt_size);
+    if (bytes != cnt_size)
+        return false;
+
+    // Interrupt ACQ
+
+    if ((m_OscMap1->dma_sts_addr & 0x3) !=  (m_OscMap2->dma_sts_addr & 0x3)) {
+        std::cerr << "Error: CUioOscilloscope::next(): Buffers not synced" << std::endl;
+    } 
+
+    DmaSlot slot;
+    unsigned half = (m_OscMap1->dma_sts_addr & 0x1) ? 0 : 1;
+
+    slot.overFlow1 = m_OscMap1->dma_sts_addr & (half == 0 ? 0x4 : 0x8);
+    slot.overFlow2 = m_OscMap2->dma_sts_addr & (half == 0 ? 0x4 : 0x8);
+
+    // if (slot.overFlow1 ) printf("CH1  %x\n",slot.overFlow1);
+    // if (slot.overFlow2 ) printf("CH2  %x\n",slot.overFlow2);
+
+    // The overflow bit means the DMA had to drop one whole buffer because this one was still held.
+    // Both channels run from the same trigger, so one dropped buffer is lost on both of them.
+    uint64_t samples = m_DmaBufferSize / sizeof(int16_t); // DMA writes 16 bit samples
+    uint64_t lostBuffers = (slot.overFlow1 || slot.overFlow2) ? 1 : 0;
+    m_DmaSequence += lostBuffers + 1;
+    slot.info = BlockInfo();
+    slot.info.dmaSequence = m_DmaSequence;
+    slot.info.lostSamples = lostBuffers * samples;
+    slot.info.sampleIndex = m_SampleCounter + slot.info.lostSamples;
+    m_SampleCounter = slot.info.sampleIndex + samples;
+
+    {
+        std::lock_guard<std::mutex> lock(m_RingMutex);
+        slot.index = m_HalfBuffer[half];
+        if (!m_Free.empty()){
+            setHalfBuffer(half, m_Free.back());
+            m_Free.pop_back();
+            releaseHalf(half);
+            slot.heldHalf = -1;
+        }else{
+            slot.heldHalf = static_cast<int>(half);
+        }
+        m_Ready.push_back(slot);
+    }
+    m_RingCond.notify_one();
+    return true;
+}
+
+void CUioOscilloscope::irqWorker()
+{
+    applyThreadOptions(m_IrqThreadPriority, m_IrqThreadCpu);
+    while (m_IrqThreadRun && !m_Interrupted){
+        if (!serviceInterrupt() && m_IrqThreadRun && !m_Interrupted){
+            std::cerr << "Error: CUioOscilloscope::irqWorker() failed to wait for DMA interrupt" << std::endl;
+            usleep(1000);
+        }
+    }
+    m_RingCond.notify_all();
+}
+
+void CUioOscilloscope::stopIrqThread()
+{
+    if (!m_IrqThread.joinable())
+        return;
+    m_IrqThreadRun = false;
+    if (m_StopFd != -1){
+        uint64_t value = 1;
+        if (write(m_StopFd, &value, sizeof(value)) != sizeof(value)){
+            std::cerr << "Error: CUioOscilloscope::stopIrqThread()" << std::endl;
+        }
+    }
+    m_IrqThread.join();
+    m_RingCond.notify_all();
+    // Drop the wake up, unless interrupt() is pending too
+    if (!m_Interrupted)
+        clearInterrupt();
+}
+
+void CUioOscilloscope::setIrqThreadOptions(int _priority, int _cpu){
+    m_IrqThreadPriority = _priority;
+    m_IrqThreadCpu = _cpu;
+}
+
+bool CUioOscilloscope::waitInterrupt(){
+    // Wait for the DMA interrupt or for interrupt() from another thread
+    struct pollfd fds[2];
+    fds[0].fd = m_Fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = m_StopFd;
+    fds[1].events = POLLIN;
+    nfds_t count = m_StopFd != -1 ? 2 : 1;
+
+    while (true){
+        fds[0].revents = 0;
+        fds[1].revents = 0;
+        int ret = poll(fds, count, -1);
+        if (ret < 0){
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (m_Interrupted || !m_IrqThreadRun || (fds[1].revents & POLLIN))
+            return false;
+        if (fds[0].revents & POLLIN)
+            return true;
+        if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+            return false;
+    }
+}
+
+void CUioOscilloscope::interrupt(){
+    {
+        std::lock_guard<std::mutex> lock(m_RingMutex);
+        m_Interrupted = true;
+    }
+    m_RingCond.notify_all();
+    if (m_StopFd != -1){
+        uint64_t value = 1;
+        if (write(m_StopFd, &value, sizeof(value)) != sizeof(value)){
+            std::cerr << "Error: CUioOscilloscope::interrupt()" << std::endl;
+        }
+    }
+}
+
+void CUioOscilloscope::clearInterrupt(){
+    if (m_StopFd != -1){
+        uint64_t value;
+        while (read(m_StopFd, &value, sizeof(value)) > 0) {}
+    }
+    m_Interrupted = false;
+}
+
+bool CUioOscilloscope::isInterrupted(){
+    return m_Interrupted;
+}
+
+void CUioOscilloscope::setHalfBuffer(unsigned _half, unsigned _index){
+    m_HalfBuffer[_half] = _index;
+    if (_half == 0){
+        m_OscMap1->dma_dst_addr1 = bufferPhysAddr(0, _index);
+        m_OscMap2->dma_dst_addr1 = bufferPhysAddr(1, _index);
+    }else{
+        m_OscMap1->dma_dst_addr2 = bufferPhysAddr(0, _index);
+        m_OscMap2->dma_dst_addr2 = bufferPhysAddr(1, _index);
+    }
+}
+
+void CUioOscilloscope::releaseHalf(unsigned _half){
+
+    uint32_t clearFlag = (_half == 0 ? 0x00000004 : 0x00000008);
+    uint32_t resetFlag = 0x00000002;
+
+    m_OscMap1->dma_ctrl |= (resetFlag | clearFlag);
+    m_OscMap2->dma_ctrl |= (resetFlag | clearFlag);
+}
+
+bool CUioOscilloscope::changeBuffers(){
+
+    std::lock_guard<std::mutex> lock(m_RingMutex);
+    if (!m_HasCurrent)
+        return false;
+    m_HasCurrent = false;
+
+    if (m_Current.heldHalf >= 0){
+        // No spare buffer was free, the DMA half waits for this one
+        releaseHalf(static_cast<unsigned>(m_Current.heldHalf));
+        return true;
+    }
+
+    // A half held in the queue can be moved to the freed buffer right away
+    for (auto &slot : m_Ready){
+        if (slot.heldHalf >= 0){
+            unsigned half = static_cast<unsigned>(slot.heldHalf);
+            setHalfBuffer(half, m_Current.index);
+            releaseHalf(half);
+            slot.heldHalf = -1;
+            return true;
+        }
+    }
+    m_Free.push_back(m_Current.index);
+    return true;
+}
+
+void CUioOscilloscope::stop()
+{
+    stopIrqThread();
+
+    // Control stop
+    if (m_OscMap1 != nullptr){
+        m_OscMap1->event_sts = UINT32_C(0x00000004);
+    }else {
+        std::cerr << "Error: CUioOscilloscope::stop()" << std::endl;
+        exit(-1);
+    }
+    if (m_OscMap2 != nullptr){
+        m_OscMap2->event_sts = UINT32_C(0x00000004);
+    }else {
+        std::cerr << "Error: CUioOscilloscope::stop()" << std::endl;
+        exit(-1);
+    }
+}
@@ -0,0 +1,60 @@
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "rpsa/common/core/interleave.h"
+
+#define SAMPLES 65536   // One DMA buffer per channel
+#define REPEATS 2000
+
+template<typename T>
+using Kernel = void (*)(T*, const T*, const T*, size_t);
+
+template<typename T>
+static void bench(const char *_name, Kernel<T> _kernel, Kernel<T> _reference){
+    std::vector<T> a(SAMPLES), b(SAMPLES), dst(SAMPLES * 2), ref(SAMPLES * 2);
+    for (size_t i = 0; i < SAMPLES; i++){
+        a[i] = (T)(i * 7);
+        b[i] = (T)(i * 13 + 1);
+    }
+
+    // Odd count checks the scalar tail of the vector kernels
+    _reference(ref.data(), a.data(), b.data(), SAMPLES - 3);
+    _kernel(dst.data(), a.data(), b.data(), SAMPLES - 3);
+    bool valid = memcmp(ref.data(), dst.data(), (SAMPLES - 3) * 2 * sizeof(T)) == 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < REPEATS; i++){
+        _kernel(dst.data(), a.data(), b.data(), SAMPLES);
+    }
+    std::chrono::duration<double> sec = std::chrono::steady_clock::now() - start;
+
+    // Bytes read + bytes written
+    double bytes = 4.0 * SAMPLES * sizeof(T) * REPEATS;
+    std::cout << std::left << std::setw(22) << _name
+              << std::fixed << std::setprecision(2) << bytes / sec.count() / 1e9 << " GB/s"
+              << (valid ? "" : "  MISMATCH") << "\n";
+}
+
+int main()
+{
+    bench<uint8_t>("interleave8_scalar", interleave8_scalar, interleave8_scalar);
+    bench<uint16_t>("interleave16_scalar", interleave16_scalar, interleave16_scalar);
+#ifdef ARCH_ARM
+    bench<uint8_t>("interleave8_neon", interleave8_neon, interleave8_scalar);
+    bench<uint16_t>("interleave16_neon", interleave16_neon, interleave16_scalar);
+#endif
+#ifdef INTERLEAVE_X86
+    bench<uint8_t>("interleave8_sse2", interleave8_sse2, interleave8_scalar);
+    bench<uint16_t>("interleave16_sse2", interleave16_sse2, interleave16_scalar);
+    if (interleave_has_avx2()){
+        bench<uint8_t>("interleave8_avx2", interleave8_avx2, interleave8_scalar);
+        bench<uint16_t>("interleave16_avx2", interleave16_avx2, interleave16_scalar);
+    }
+#endif
+    bench<uint8_t>("interleave8", interleave8, interleave8_scalar);
+    bench<uint16_t>("interleave16", interleave16, interleave16_scalar);
+    return 0;
+}
@@ -0,0 +1,307 @@
+// Streams synthetic data from a server to the client library on the same host
+// and reports the throughput, latency and loss seen by the client.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "rpsa/server/core/StreamingManager.h"
+#include "rpsa/client/core/StreamingClient.h"
+#include "rpsa/common/core/metrics.h"
+
+#define BENCH_PORT      "18950"
+#define BENCH_SAMPLES   65536   // One DMA buffer per channel
+#define BENCH_SECONDS   5
+
+static char* getCmdOption(char **begin, char **end, const std::string &option){
+    char **itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+        return *itr;
+    return nullptr;
+}
+
+static bool cmdOptionExists(char **begin, char **end, const std::string &option){
+    return std::find(begin, end, option) != end;
+}
+
+static void usage(const char *_name){
+    std::cout << "Usage: " << _name << " [-p TCP|UDP] [-t seconds] [-r MB/s] [-b samples] [-m mtu] [-c] [-z]\n"
+              << "       [-raw file] [-npy file] [-wav dir] [-tdms dir] [-bin dir]\n"
+              << "  -r  limit of the generated data rate, 0 - as fast as possible (default)\n"
+              << "  -c  request CRC protected packs\n"
+              << "  -z  request encoded packs, the server compresses the blocks\n"
+              << "  -wav  also checks that a WAV sink closed with blocks queued writes all of them\n";
+}
+
+// Newest .wav file in _dir, empty if there is none
+static std::string newestWav(const std::string &_dir){
+    std::string newest;
+    time_t newest_time = 0;
+    DIR *dir = opendir(_dir.c_str());
+    if (!dir)
+        return newest;
+    while (dirent *entry = readdir(dir)){
+        std::string name = entry->d_name;
+        struct stat st;
+        if (name.size() < 4 || name.compare(name.size() - 4, 4, ".wav") != 0 || stat((_dir + "/" + name).c_str(), &st) != 0)
+            continue;
+        if (newest.empty() || st.st_mtime >= newest_time){
+            newest = _dir + "/" + name;
+            newest_time = st.st_mtime;
+        }
+    }
+    closedir(dir);
+    return newest;
+}
+
+// Samples of the data chunk, false if the header doesn't count the bytes that are in the file
+static bool readWavData(const std::string &_path, std::vector<uint16_t> &_data){
+    FILE *file = fopen(_path.c_str(), "rb");
+    if (!file)
+        return false;
+    bool valid = false;
+    uint8_t chunk[8];
+    fseek(file, 12, SEEK_SET);
+    while (fread(chunk, 1, sizeof(chunk), file) == sizeof(chunk)){
+        uint32_t size;
+        memcpy(&size, chunk + 4, sizeof(size));
+        if (memcmp(chunk, "data", 4) == 0){
+            _data.resize(size / 2 + 1);
+            valid = fread(_data.data(), 1, size + 2, file) == size;
+            _data.resize(size / 2);
+            break;
+        }
+        fseek(file, size, SEEK_CUR);
+    }
+    fclose(file);
+    return valid;
+}
+
+// Passes a burst of blocks to a WAV sink and closes it at once, while the writer still has
+// blocks queued. The file must hold exactly the samples that were passed in.
+static bool checkWavSink(const std::string &_dir){
+    const size_t blocks = 64;
+    const size_t samples = 16384;
+    std::vector<uint16_t> ch1(samples), ch2(samples);
+    auto sink = CStreamFileSink::Create(Stream_FileType::WAV_TYPE, _dir);
+    if (!sink->open()){
+        std::cerr << "Error: can't open a WAV file in " << _dir << "\n";
+        return false;
+    }
+    uint64_t dropped = CMetricsRegistry::instance().counter("file.dropped_blocks")->value();
+    for (size_t i = 0; i < blocks; i++){
+        for (size_t j = 0; j < samples; j++){
+            ch1[j] = (uint16_t)(i * samples + j);
+            ch2[j] = (uint16_t)~ch1[j];
+        }
+        SampleBlock block = SampleBlock();
+        block.id = i;
+        block.oscRate = 125000000;
+        block.resolution = 16;
+        block.info.dmaSequence = i + 1;
+        block.info.sampleIndex = i * samples;
+        block.ch1 = reinterpret_cast<const uint8_t*>(ch1.data());
+        block.size_ch1 = samples * 2;
+        block.ch2 = reinterpret_cast<const uint8_t*>(ch2.data());
+        block.size_ch2 = samples * 2;
+        sink->write(block);
+    }
+    sink->close();
+    dropped = CMetricsRegistry::instance().counter("file.dropped_blocks")->value() - dropped;
+
+    std::vector<uint16_t> data;
+    std::string path = newestWav(_dir);
+    if (path.empty() || !readWavData(path, data)){
+        std::cerr << "Error: no complete WAV file in " << _dir << "\n";
+        return false;
+    }
+    // Blocks the writer queue had no room for are left out of the file
+    size_t mismatches = 0;
+    size_t expected = (blocks - dropped) * samples * 2;
+    for (size_t i = 0; i < data.size() && dropped == 0; i++){
+        uint16_t value = (uint16_t)(i / 2);
+        if (data[i] != (i % 2 == 0 ? value : (uint16_t)~value))
+            mismatches++;
+    }
+    std::cout << "WAV sink:      " << data.size() / 2 << " of " << (blocks - dropped) * samples << " samples written, "
+              << dropped << " blocks dropped, " << mismatches << " mismatches\n";
+    return data.size() == expected && mismatches == 0;
+}
+
+static uint64_t nowUs(){
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t percentile(const std::vector<uint32_t> &_sorted, double _p){
+    if (_sorted.empty())
+        return 0;
+    size_t index = (size_t)(_p * (_sorted.size() - 1) + 0.5);
+    return _sorted[index];
+}
+
+int main(int argc, char **argv)
+{
+    if (cmdOptionExists(argv, argv + argc, "-h")){
+        usage(argv[0]);
+        return 0;
+    }
+
+    char *protocol = getCmdOption(argv, argv + argc, "-p");
+    char *seconds  = getCmdOption(argv, argv + argc, "-t");
+    char *rate     = getCmdOption(argv, argv + argc, "-r");
+    char *samples  = getCmdOption(argv, argv + argc, "-b");
+    char *mtu      = getCmdOption(argv, argv + argc, "-m");
+
+    asionet::Protocol protocol_val = asionet::Protocol::TCP;
+    if (protocol && strcmp(protocol, "UDP") == 0){
+        protocol_val = asionet::Protocol::UDP;
+    }else if (protocol && strcmp(protocol, "TCP") != 0){
+        usage(argv[0]);
+        return -1;
+    }
+    double duration = seconds ? atof(seconds) : BENCH_SECONDS;
+    double rate_limit = rate ? atof(rate) * 1e6 : 0;
+    size_t block_samples = samples ? strtoul(samples, nullptr, 10) : BENCH_SAMPLES;
+    if (block_samples == 0){
+        usage(argv[0]);
+        return -1;
+    }
+
+    auto server = CStreamingManager::Create("127.0.0.1", BENCH_PORT, protocol_val);
+    if (mtu)
+        server->setUdpMtu(strtoul(mtu, nullptr, 10));
+    bool compress = cmdOptionExists(argv, argv + argc, "-z");
+    if (compress)
+        server->setCompression(StreamCompression::RICE);
+    server->run();
+
+    auto client = CStreamingClient::Create("127.0.0.1", BENCH_PORT, protocol_val);
+    client->setRequestVersion(PACK_VERSION_2, (cmdOptionExists(argv, argv + argc, "-c") ? PACK_FLAG_CRC : 0) |
+                                              (compress ? PACK_FLAG_RICE : 0));
+
+    // Checks the ramp and collects the latency from the server timestamp to the sink
+    std::vector<uint32_t> latency;
+    latency.reserve(1 << 20);
+    uint64_t data_errors = 0;
+    client->addSink(CCallbackSink::Create([&](const SampleBlock &_block){
+        latency.push_back((uint32_t)MIN(nowUs() - _block.timestamp, (uint64_t)UINT32_MAX));
+        auto ch1 = reinterpret_cast<const uint16_t*>(_block.ch1);
+        auto ch2 = reinterpret_cast<const uint16_t*>(_block.ch2);
+        for (size_t i = 0; i < _block.size_ch1 / 2; i++){
+            uint16_t value = (uint16_t)(_block.info.sampleIndex + i);
+            if (ch1[i] != value || ch2[i] != (uint16_t)~value){
+                data_errors++;
+                break;
+            }
+        }
+    }));
+
+    char *raw_path = getCmdOption(argv, argv + argc, "-raw");
+    char *npy_path = getCmdOption(argv, argv + argc, "-npy");
+    char *wav_path = getCmdOption(argv, argv + argc, "-wav");
+    char *tdms_path = getCmdOption(argv, argv + argc, "-tdms");
+    char *bin_path = getCmdOption(argv, argv + argc, "-bin");
+    if (raw_path)
+        client->addSink(CRawFileSink::Create(raw_path));
+    if (npy_path)
+        client->addSink(CNpySink::Create(npy_path));
+    if (wav_path)
+        client->addSink(CStreamFileSink::Create(Stream_FileType::WAV_TYPE, wav_path));
+    if (tdms_path)
+        client->addSink(CStreamFileSink::Create(Stream_FileType::TDMS_TYPE, tdms_path));
+    if (bin_path)
+        client->addSink(CStreamFileSink::Create(Stream_FileType::BIN_TYPE, bin_path));
+
+    if (!client->start()){
+        std::cerr << "Error: can't open the sinks\n";
+        return -1;
+    }
+
+    // UDP has no connection, the server learns the client from its first datagram.
+    // A TCP client counts as v1 until its hello is read, those packs carry no sample index.
+    auto wait_start = std::chrono::steady_clock::now();
+    while (server->getClientStats().empty() || server->getClientStats()[0].version != PACK_VERSION_2){
+        if (std::chrono::steady_clock::now() - wait_start > std::chrono::seconds(5)){
+            std::cerr << "Error: client did not connect\n";
+            return -1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    std::vector<uint16_t> ch1(block_samples), ch2(block_samples);
+    uint64_t sample_index = 0;
+    uint64_t sent_blocks = 0;
+    double block_bytes = block_samples * 2 * sizeof(uint16_t);
+
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::microseconds((uint64_t)(duration * 1e6));
+    auto next = start;
+    while (std::chrono::steady_clock::now() < end){
+        for (size_t i = 0; i < block_samples; i++){
+            uint16_t value = (uint16_t)(sample_index + i);
+            ch1[i] = value;
+            ch2[i] = (uint16_t)~value;
+        }
+        BlockInfo info = BlockInfo();
+        info.dmaSequence = sent_blocks + 1;
+        info.sampleIndex = sample_index;
+        server->passBuffers(0, 125000000, ch1.data(), block_samples * 2, ch2.data(), block_samples * 2, 16, sent_blocks, info);
+        sample_index += block_samples;
+        sent_blocks++;
+
+        if (rate_limit > 0){
+            next += std::chrono::microseconds((uint64_t)(block_bytes / rate_limit * 1e6));
+            std::this_thread::sleep_until(next);
+        }
+    }
+    std::chrono::duration<double> send_time = std::chrono::steady_clock::now() - start;
+
+    // Let the queues drain: stop once nothing arrived for a while
+    uint64_t last_packs = client->getCounters().packs;
+    for (int idle = 0; idle < 5;){
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        uint64_t packs = client->getCounters().packs;
+        idle = packs == last_packs ? idle + 1 : 0;
+        last_packs = packs;
+    }
+    std::chrono::duration<double> total_time = std::chrono::steady_clock::now() - start;
+
+    auto server_stats = server->getClientStats();
+    client->stop();
+    server->stop();
+
+    auto counters = client->getCounters();
+    std::sort(latency.begin(), latency.end());
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "Protocol:      " << (protocol_val == asionet::Protocol::TCP ? "TCP" : "UDP")
+              << ", " << block_samples << " samples x 2 channels per block\n"
+              << "Sent:          " << sent_blocks << " blocks, " << sent_blocks * block_bytes / 1e6 << " MB, "
+              << sent_blocks * block_bytes / send_time.count() / 1e6 << " MB/s\n"
+              << "Received:      " << counters.packs << " packs, " << counters.bytes / 1e6 << " MB, "
+              << counters.bytes / total_time.count() / 1e6 << " MB/s\n"
+              << "On the wire:   " << counters.wireBytes / 1e6 << " MB, ratio " << std::setprecision(2)
+              << (counters.wireBytes > 0 ? (double)counters.bytes / counters.wireBytes : 0) << std::setprecision(1) << "\n"
+              << "Latency us:    p50 " << percentile(latency, 0.5)
+              << "  p90 " << percentile(latency, 0.9)
+              << "  p99 " << percentile(latency, 0.99)
+              << "  max " << (latency.empty() ? 0 : latency.back()) << "\n"
+              << "Loss:          " << counters.lostPacks << " packs lost, "
+              << (sent_blocks * block_bytes > counters.bytes ? sent_blocks * block_bytes - counters.bytes : 0) / 1e6 << " MB missing\n"
+              << "Server queue:  " << (server_stats.empty() ? 0 : server_stats[0].dropped) << " dropped\n"
+              << "Client queue:  " << counters.queueDrops << " dropped, max " << counters.queueMax << " packs\n"
+              << "Errors:        " << counters.badPacks << " bad packs, " << data_errors << " data mismatches\n";
+
+    if (wav_path && !checkWavSink(std::string(wav_path) + "/sink_check"))
+        return -1;
+    return 0;
+}
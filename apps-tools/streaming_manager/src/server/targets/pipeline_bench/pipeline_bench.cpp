@@ -0,0 +1,234 @@
+// Runs CStreamingApplication on a synthetic oscilloscope, so the acquisition, file writer and
+// network paths can be measured at target data rates without the FPGA.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#include "rpsa/server/core/SyntheticOscilloscope.h"
+#include "rpsa/server/core/StreamingApplication.h"
+#include "rpsa/server/core/StreamingManager.h"
+#include "rpsa/client/core/StreamingClient.h"
+#include "rpsa/common/core/metrics.h"
+
+#define BENCH_PORT      "18951"
+#define BENCH_SECONDS   5
+#define BENCH_WARMUP_MS 1500    // the acquisition thread waits a second before it starts
+
+static char* getCmdOption(char **begin, char **end, const std::string &option){
+    char **itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+        return *itr;
+    return nullptr;
+}
+
+static bool cmdOptionExists(char **begin, char **end, const std::string &option){
+    return std::find(begin, end, option) != end;
+}
+
+static void usage(const char *_name){
+    std::cout << "Usage: " << _name << " [-m TCP|UDP|wav|tdms|bin] [-t seconds] [-d decimation] [-r 8|16] [-c 1|2|3]\n"
+              << "       [-w sine|ramp|counter] [-b buffer bytes] [-n buffers] [-o overflow period] [-f dir] [-q port]\n"
+              << "       [-s avg|cic|fir] [-k factor] [-T taps] [-z] [-g level] [-pre samples] [-post samples]\n"
+              << "       [-seg bytes] [-segt seconds] [-keep files]\n"
+              << "  -d  sample rate is " << osc_adc_rate << " / decimation, 0 - as fast as the pipeline takes it\n"
+              << "  -f  directory for the wav, tdms and bin modes (default /tmp/pipeline_bench)\n"
+              << "  -q  also serve the metrics report on this TCP port\n"
+              << "  -s  software decimation by -k after the FPGA decimation, -T FIR taps or CIC order\n"
+              << "  -z  lossless compression, the client asks for encoded packs\n"
+              << "  -g  triggered segments on the first channel at this level, the counter crosses it once per period\n"
+              << "  -seg, -segt  file modes: a new file every that many bytes or seconds, -keep only the last files\n";
+}
+
+int main(int argc, char **argv)
+{
+    if (cmdOptionExists(argv, argv + argc, "-h")){
+        usage(argv[0]);
+        return 0;
+    }
+
+    char *mode      = getCmdOption(argv, argv + argc, "-m");
+    char *seconds   = getCmdOption(argv, argv + argc, "-t");
+    char *decimation = getCmdOption(argv, argv + argc, "-d");
+    char *resolution = getCmdOption(argv, argv + argc, "-r");
+    char *channels  = getCmdOption(argv, argv + argc, "-c");
+    char *waveform  = getCmdOption(argv, argv + argc, "-w");
+    char *buf_size  = getCmdOption(argv, argv + argc, "-b");
+    char *buf_count = getCmdOption(argv, argv + argc, "-n");
+    char *overflow  = getCmdOption(argv, argv + argc, "-o");
+    char *dir       = getCmdOption(argv, argv + argc, "-f");
+    char *metrics   = getCmdOption(argv, argv + argc, "-q");
+    char *filter    = getCmdOption(argv, argv + argc, "-s");
+    char *factor    = getCmdOption(argv, argv + argc, "-k");
+    char *taps      = getCmdOption(argv, argv + argc, "-T");
+    char *level     = getCmdOption(argv, argv + argc, "-g");
+    char *pre       = getCmdOption(argv, argv + argc, "-pre");
+    char *post      = getCmdOption(argv, argv + argc, "-post");
+    char *seg_bytes = getCmdOption(argv, argv + argc, "-seg");
+    char *seg_time  = getCmdOption(argv, argv + argc, "-segt");
+    char *keep      = getCmdOption(argv, argv + argc, "-keep");
+
+    std::string mode_val = mode ? mode : "TCP";
+    double duration = seconds ? atof(seconds) : BENCH_SECONDS;
+    uint32_t dec = decimation ? strtoul(decimation, nullptr, 10) : 8;
+    unsigned short res = resolution ? atoi(resolution) : 16;
+    int channel = channels ? atoi(channels) : 3;
+    SyntheticWaveform wave = SyntheticWaveform::COUNTER;
+    if (waveform && strcmp(waveform, "sine") == 0)
+        wave = SyntheticWaveform::SINE;
+    else if (waveform && strcmp(waveform, "ramp") == 0)
+        wave = SyntheticWaveform::RAMP;
+    DecimationFilter filter_val = DecimationFilter::NONE;
+    if (filter && strcmp(filter, "avg") == 0)
+        filter_val = DecimationFilter::AVERAGE;
+    else if (filter && strcmp(filter, "cic") == 0)
+        filter_val = DecimationFilter::CIC;
+    else if (filter && strcmp(filter, "fir") == 0)
+        filter_val = DecimationFilter::FIR;
+    uint32_t factor_val = factor ? strtoul(factor, nullptr, 10) : 1;
+    bool compress = cmdOptionExists(argv, argv + argc, "-z");
+    if ((res != 8 && res != 16) || channel < 1 || channel > 3){
+        usage(argv[0]);
+        return -1;
+    }
+
+    double rate = dec > 0 ? (double)osc_adc_rate / dec : 0;
+    auto osc = CSyntheticOscilloscope::Create(channel & 1, channel & 2, rate, wave,
+                                              buf_size ? strtoul(buf_size, nullptr, 10) : osc_buf_size,
+                                              buf_count ? strtoul(buf_count, nullptr, 10) : osc_buf_min_count);
+    if (!osc)
+        return -1;
+    if (overflow)
+        osc->setOverflowPeriod(strtoul(overflow, nullptr, 10));
+
+    CStreamingManager::Ptr manager;
+    CStreamingClient::Ptr client;
+    std::atomic<uint64_t> counter_errors(0);
+    std::atomic<uint64_t> trigger_errors(0);
+    int16_t level_val = level ? atoi(level) : 0;
+    if (mode_val == "TCP" || mode_val == "UDP"){
+        auto protocol = mode_val == "TCP" ? asionet::Protocol::TCP : asionet::Protocol::UDP;
+        manager = CStreamingManager::Create("127.0.0.1", BENCH_PORT, protocol);
+        client = CStreamingClient::Create("127.0.0.1", BENCH_PORT, protocol);
+        if (compress)
+            client->setRequestVersion(PACK_VERSION_2, PACK_FLAG_RICE);
+        if (wave == SyntheticWaveform::COUNTER && res == 16 && filter_val == DecimationFilter::NONE){
+            client->addSink(CCallbackSink::Create([&](const SampleBlock &_block){
+                auto ch = reinterpret_cast<const uint16_t*>(_block.ch1 ? _block.ch1 : _block.ch2);
+                uint16_t mask = _block.ch1 ? 0 : 0xFFFF;
+                size_t size = _block.ch1 ? _block.size_ch1 : _block.size_ch2;
+                for (size_t i = 0; i < size / 2; i++){
+                    if ((ch[i] ^ mask) != (uint16_t)(_block.info.sampleIndex + i)){
+                        counter_errors++;
+                        break;
+                    }
+                }
+                // The counter reaches the level exactly once per period
+                if (_block.info.segment != 0 && (int16_t)((uint16_t)_block.info.triggerIndex ^ mask) != level_val)
+                    trigger_errors++;
+            }));
+        }
+    }else if (mode_val == "wav" || mode_val == "tdms" || mode_val == "bin"){
+        Stream_FileType type = mode_val == "wav" ? Stream_FileType::WAV_TYPE :
+                               (mode_val == "tdms" ? Stream_FileType::TDMS_TYPE : Stream_FileType::BIN_TYPE);
+        manager = CStreamingManager::Create(type, dir ? dir : "/tmp/pipeline_bench");
+        FileRotation rotation;
+        rotation.segmentBytes = seg_bytes ? strtoull(seg_bytes, nullptr, 10) : 0;
+        rotation.segmentSeconds = seg_time ? strtoul(seg_time, nullptr, 10) : 0;
+        rotation.keepFiles = keep ? strtoul(keep, nullptr, 10) : 0;
+        manager->setFileRotation(rotation);
+    }else{
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (compress)
+        manager->setCompression(StreamCompression::RICE);
+
+    CStreamingApplication app(manager, osc, res, dec, channel);
+    if (metrics)
+        app.setMetricsPort(atoi(metrics));
+    if (filter_val != DecimationFilter::NONE){
+        uint32_t taps_val = taps ? strtoul(taps, nullptr, 10) : (filter_val == DecimationFilter::CIC ? DECIMATION_CIC_DEFAULT_ORDER : DECIMATION_FIR_DEFAULT_TAPS);
+        if (!app.setDecimation(filter_val, factor_val, taps_val, taps_val)){
+            std::cerr << "Error: unsupported decimation settings" << std::endl;
+            return -1;
+        }
+    }
+    if (level){
+        TriggerSettings trigger;
+        trigger.source = (channel & 1) ? TriggerSource::CHANNEL1 : TriggerSource::CHANNEL2;
+        // The second channel of the counter counts down
+        trigger.edge = (channel & 1) ? TriggerEdge::RISING : TriggerEdge::FALLING;
+        trigger.level = level_val;
+        trigger.hysteresis = 64;
+        trigger.preSamples = pre ? strtoul(pre, nullptr, 10) : 1024;
+        trigger.postSamples = post ? strtoul(post, nullptr, 10) : 3072;
+        if (!app.setTrigger(trigger)){
+            std::cerr << "Error: unsupported trigger settings" << std::endl;
+            return -1;
+        }
+    }
+    app.runNonBlock();
+    if (client)
+        client->start();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(BENCH_WARMUP_MS));
+    const OscWorkerStats &stats = app.getStats();
+    uint64_t start_blocks = stats.blocks;
+    uint64_t start_bytes = stats.bytes;
+    uint64_t start_lost = stats.lostSamples;
+    uint64_t start_overflows = stats.overflows;
+    uint64_t start_segments = stats.segments;
+    uint64_t start_client = client ? client->getCounters().bytes : 0;
+    uint64_t start_wire = client ? client->getCounters().wireBytes : 0;
+    auto start = std::chrono::steady_clock::now();
+
+    std::this_thread::sleep_for(std::chrono::microseconds((uint64_t)(duration * 1e6)));
+
+    std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    uint64_t blocks = stats.blocks - start_blocks;
+    uint64_t bytes = stats.bytes - start_bytes;
+    uint64_t lost = stats.lostSamples - start_lost;
+    uint64_t overflows = stats.overflows - start_overflows;
+    uint64_t segments = stats.segments - start_segments;
+    uint64_t client_bytes = client ? client->getCounters().bytes - start_client : 0;
+    uint64_t wire_bytes = client ? client->getCounters().wireBytes - start_wire : 0;
+    // Last full refresh period, before stop() drains the pipeline
+    std::string report = CMetricsRegistry::instance().report();
+
+    app.stop();
+    ClientCounters counters = {};
+    if (client){
+        client->stop();
+        counters = client->getCounters();
+    }
+
+    double samples = bytes / (res / 8) / (channel == 3 ? 2 : 1);
+    std::cout << std::fixed << std::setprecision(1)
+              << "Mode:          " << mode_val << ", " << res << " bit, channels " << channel
+              << ", decimation " << dec << " (" << rate / 1e6 << " MS/s)\n";
+    if (filter_val != DecimationFilter::NONE)
+        std::cout << "Software:      " << filter << " decimation by " << factor_val << " (" << rate / factor_val / 1e6 << " MS/s out)\n";
+    std::cout << "Acquisition:   " << blocks << " blocks, " << bytes / time.count() / 1e6 << " MB/s, "
+              << samples / time.count() / 1e6 << " MS/s per channel\n"
+              << "DMA overflow:  " << overflows << " blocks, " << lost << " samples lost\n";
+    if (level)
+        std::cout << "Segments:      " << segments << " triggered, " << segments / time.count() << " per second\n";
+    if (client){
+        std::cout << "Client:        " << client_bytes / time.count() / 1e6 << " MB/s, "
+                  << counters.lostPacks << " packs lost, " << counters.badPacks << " bad packs, "
+                  << counter_errors << " data mismatches\n";
+        if (level)
+            std::cout << "Client:        " << counters.segments << " segments, " << trigger_errors << " trigger mismatches\n";
+        if (compress)
+            std::cout << "Compression:   " << wire_bytes / time.count() / 1e6 << " MB/s on the wire, ratio "
+                      << std::setprecision(2) << (wire_bytes > 0 ? (double)client_bytes / wire_bytes : 0) << std::setprecision(1) << "\n";
+    }
+    std::cout << "Metrics:\n" << report;
+    return 0;
+}
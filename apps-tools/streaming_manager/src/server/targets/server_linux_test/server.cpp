@@ -3,6 +3,7 @@
 
 #include "rpsa/server/core/UioParser.h"
 #include "rpsa/server/core/Oscilloscope.h"
+#include "rpsa/server/core/SyntheticOscilloscope.h"
 #include "rpsa/server/core/StreamingApplication.h"
 #include "rpsa/server/core/StreamingManager.h"
 
@@ -50,11 +51,12 @@ int main()
         }
     }
 
-    // if (!osc0)
-    // {
-    //     std::cerr << "Error: create osc0" << std::endl;
-    //     return 1;
-    // }
+    // Without the FPGA the pipeline runs on generated data
+    if (!osc0)
+    {
+        std::cout << "No rp_oscilloscope, using synthetic data" << std::endl;
+        osc0 = CSyntheticOscilloscope::Create(true, true, osc_adc_rate / Decimation, SyntheticWaveform::SINE);
+    }
 
     // if (!osc1)
     // {